@@ -0,0 +1,282 @@
+#!/usr/bin/env bash
+# Time the kernels in this directory with different compiler flags.
+#
+# Usage: bench/run.sh <path to moj> <suite>
+#
+# Suites:
+#   fastmath   strict IEEE floats vs. -ffp-contract=on vs. -ffast-math
+#   bounds     unchecked array accesses vs. -fbounds-check=trap/diagnose
+#   mir        code generated from the AST vs. through MIR (-mir), with
+#              bounds checks
+#   startup    compiling the whole program before main (the default) vs.
+#              compiling each function when it's first called (-jit-lazy),
+#              for programs that call 2 and all of their 400 functions
+#   tiered     the default JIT vs. compiling everything without
+#              optimization and optimizing hot functions in the background,
+#              without and with on-stack replacement of hot loops
+#              (-jit-tiered), for programs with small hot functions, with
+#              long loops in main and with 400 functions
+#   pgo        static heuristics vs. -fprofile-use with a profile of a
+#              training run of the same kernel
+#   interp     the JIT vs. the bytecode interpreter (--interp), end to end
+#              for each example program
+#   jitcache   compiling the whole program before main vs. loading it from
+#              a warm -cache-dir, which is filled before timing
+#   aotcache   compiling an object file (-o) vs. copying it from a warm
+#              -cache-dir
+#   incremental
+#              a generated program with 5000 functions: compiling it with
+#              -jit-incremental into an empty cache, then running it after
+#              an edit of one function, which is all that is compiled again
+#   server     compiling each example program to an object file (-o) and
+#              running it with the interpreter, with moj vs. with mojc and
+#              a compile server (moj --server) that is already running
+#   batch      compiling 8 copies of each example program to object files
+#              with one moj per file vs. one moj for all of them (-j1) vs.
+#              one moj with a thread per CPU
+#
+# Each cell is the best wall time (in milliseconds) of $RUNS runs, followed
+# by the difference to the first column.
+
+set -euo pipefail
+
+MOJ=$(realpath "${1:?path to moj}")
+SUITE=${2:?suite}
+BENCH_DIR=$(dirname "$(realpath "$0")")
+RUNS=${RUNS:-3}
+
+# Print the best wall time in milliseconds of RUNS executions of a command.
+best_time() {
+  local best=0
+  for _ in $(seq "$RUNS"); do
+    local start elapsed
+    start=$(date +%s%N)
+    DUMP=0 "$@" >/dev/null
+    elapsed=$((($(date +%s%N) - start) / 1000000))
+    if [ "$best" = 0 ] || [ "$elapsed" -lt "$best" ]; then
+      best=$elapsed
+    fi
+  done
+  echo "$best"
+}
+
+# Time every kernel in KERNELS with every set of flags in CONFIGS, where %k
+# stands for the name of the kernel.  Flags that start with "mojc" are run
+# by the mojc next to moj, on the server at $MOJ_SERVER.
+compare() {
+  printf "%-24s" "kernel"
+  for config in "${CONFIGS[@]}"; do printf "%24s" "${config:-default}"; done
+  echo
+  for kernel in "${KERNELS[@]}"; do
+    printf "%-24s" "$(basename "$kernel")"
+    local base=""
+    for config in "${CONFIGS[@]}"; do
+      local time cell flags=${config//%k/$(basename "$kernel")} moj=$MOJ
+      if [[ $flags == "mojc "* ]]; then
+        moj=$(dirname "$MOJ")/mojc
+        flags=${flags#mojc }
+      fi
+      # Flags are for the JIT unless they pick the interpreter or AOT.
+      case " $flags " in
+      *" --interp "* | *" -o "*) ;;
+      *) flags="--run $flags" ;;
+      esac
+      # shellcheck disable=SC2086
+      time=$(best_time "$moj" "$kernel" $flags)
+      cell=$time
+      if [ -z "$base" ]; then
+        base=$time
+      elif [ "$base" -gt 0 ]; then
+        cell="$time ($(((time - base) * 100 / base))%)"
+      fi
+      printf "%24s" "$cell"
+    done
+    echo
+  done
+}
+
+# Print a program with 400 functions like those of a large application,
+# of which main calls the given number, each with a loop of a few hundred
+# iterations.
+many_functions() {
+  awk -v calls="$1" 'BEGIN {
+    for (k = 0; k < 400; k++) {
+      printf "int kernel%d(int n){\n    int a[64];\n    float f = 0.5;\n", k
+      printf "    int s = %d;\n", k
+      printf "    for (int i = 0; i < 64; i = i + 1){\n"
+      printf "        a[i] = i * %d + n;\n    }\n", k % 7 + 1
+      printf "    for (int i = 1; i < n; i = i + 1){\n"
+      printf "        if (a[i %% 64] > a[i %% 63]){\n"
+      printf "            s = s + a[i %% 64] %% %d;\n", k % 5 + 2
+      printf "        } else {\n"
+      printf "            s = s - a[i %% 63] / %d;\n        }\n", k % 3 + 1
+      printf "        a[i %% 61] = s %% 1000;\n        f = f * 0.5 + 1;\n    }\n"
+      printf "    while (s > 1000){\n        s = s - %d;\n    }\n", k + 3
+      printf "    return s + int(f);\n}\n\n"
+    }
+    printf "int main(int mode){\n"
+    for (k = 0; k < calls; k++)
+      printf "    print(kernel%d(%d));\n", k, k == 1 ? 500 : 300
+    printf "    if (mode > 0){\n"
+    for (k = 0; k < 400; k++)
+      printf "        print(kernel%d(mode));\n", k
+    printf "    }\n    return 0;\n}\n"
+  }'
+}
+
+case "$SUITE" in
+fastmath)
+  KERNELS=("$BENCH_DIR/floatDot.in" "$BENCH_DIR/floatSortBig.in")
+  CONFIGS=("" "-ffp-contract=on" "-ffast-math")
+  compare
+  ;;
+bounds)
+  KERNELS=("$BENCH_DIR/../example/testSortBig.in"
+    "$BENCH_DIR/floatSortBig.in" "$BENCH_DIR/arrayCopy.in"
+    "$BENCH_DIR/histogram.in")
+  CONFIGS=("" "-fbounds-check=trap" "-fbounds-check=diagnose")
+  compare
+  ;;
+mir)
+  KERNELS=("$BENCH_DIR/../example/testSortBig.in"
+    "$BENCH_DIR/floatSortBig.in" "$BENCH_DIR/arrayCopy.in"
+    "$BENCH_DIR/histogram.in")
+  CONFIGS=("-fbounds-check=trap" "-fbounds-check=trap -mir")
+  compare
+  ;;
+startup)
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "$WORK_DIR"' EXIT
+  many_functions 2 >"$WORK_DIR/manyFunctions.in"
+  many_functions 400 >"$WORK_DIR/manyCalls.in"
+  KERNELS=("$WORK_DIR/manyFunctions.in" "$WORK_DIR/manyCalls.in"
+    "$BENCH_DIR/../example/add.in")
+  CONFIGS=("" "-jit-lazy")
+  compare
+  ;;
+tiered)
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "$WORK_DIR"' EXIT
+  many_functions 2 >"$WORK_DIR/manyFunctions.in"
+  KERNELS=("$BENCH_DIR/callHeavy.in" "$BENCH_DIR/../example/testSortBig.in"
+    "$BENCH_DIR/histogram.in" "$WORK_DIR/manyFunctions.in")
+  CONFIGS=("" "-jit-tiered -jit-osr-threshold=0" "-jit-tiered")
+  compare
+  ;;
+pgo)
+  KERNELS=("$BENCH_DIR/../example/testSortBig.in"
+    "$BENCH_DIR/floatSortBig.in" "$BENCH_DIR/histogram.in")
+  PROFILE_DIR=$(mktemp -d)
+  trap 'rm -rf "$PROFILE_DIR"' EXIT
+  for kernel in "${KERNELS[@]}"; do
+    DUMP=0 "$MOJ" "$kernel" --run \
+      -fprofile-generate="$PROFILE_DIR/$(basename "$kernel").mojprof" >/dev/null
+  done
+  CONFIGS=("" "-fprofile-use=$PROFILE_DIR/%k.mojprof")
+  compare
+  ;;
+interp)
+  KERNELS=("$BENCH_DIR"/../example/*.in)
+  CONFIGS=("" "--interp")
+  compare
+  ;;
+jitcache)
+  WORK_DIR=$(mktemp -d)
+  CACHE_DIR=$(mktemp -d)
+  trap 'rm -rf "$WORK_DIR" "$CACHE_DIR"' EXIT
+  many_functions 2 >"$WORK_DIR/manyFunctions.in"
+  KERNELS=("$WORK_DIR/manyFunctions.in" "$BENCH_DIR/callHeavy.in"
+    "$BENCH_DIR/../example/testSortBig.in" "$BENCH_DIR/../example/add.in")
+  for kernel in "${KERNELS[@]}"; do
+    DUMP=0 "$MOJ" "$kernel" --run -cache-dir="$CACHE_DIR" >/dev/null
+  done
+  CONFIGS=("-jit-lazy=false" "-cache-dir=$CACHE_DIR")
+  compare
+  ;;
+aotcache)
+  WORK_DIR=$(mktemp -d)
+  CACHE_DIR=$(mktemp -d)
+  trap 'rm -rf "$WORK_DIR" "$CACHE_DIR"' EXIT
+  many_functions 2 >"$WORK_DIR/manyFunctions.in"
+  KERNELS=("$WORK_DIR/manyFunctions.in" "$BENCH_DIR/callHeavy.in"
+    "$BENCH_DIR/../example/testSortBig.in" "$BENCH_DIR/../example/add.in")
+  for kernel in "${KERNELS[@]}"; do
+    DUMP=0 "$MOJ" "$kernel" -o "$CACHE_DIR/out.o" -cache-dir="$CACHE_DIR"
+  done
+  CONFIGS=("-o $CACHE_DIR/out.o" "-o $CACHE_DIR/out.o -cache-dir=$CACHE_DIR")
+  compare
+  ;;
+incremental)
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "$WORK_DIR"' EXIT
+  # Print a program with 5000 small functions, which main calls through 50
+  # others.  The argument is the constant in the body of f2500.
+  generate() {
+    awk -v constant="$1" 'BEGIN {
+      for (k = 0; k < 5000; k++) {
+        printf "int f%d(int x) {\n  int s = 0;\n", k
+        printf "  for (int i = 0; i < x; i = i + 1) {\n"
+        printf "    s = s + i * %d;\n  }\n  return s;\n}\n", k == 2500 ? constant : k
+      }
+      for (j = 0; j < 50; j++) {
+        printf "int g%d(int x) {\n  int s = 0;\n", j
+        for (k = 0; k < 100; k++)
+          printf "  s = s + f%d(x);\n", j * 100 + k
+        printf "  return s;\n}\n"
+      }
+      printf "int main() {\n  int s = 0;\n"
+      for (j = 0; j < 50; j++)
+        printf "  s = s + g%d(10);\n", j
+      printf "  print(s);\n  return 0;\n}\n"
+    }' >"$WORK_DIR/program.in"
+  }
+  FLAGS=(--run -cache-dir="$WORK_DIR/cache" -jit-incremental)
+  generate 2500
+  RUNS=1
+  printf "%-32s%8s\n" "cold cache" \
+    "$(best_time "$MOJ" "$WORK_DIR/program.in" "${FLAGS[@]}")"
+  # Every run compiles a different version of f2500.
+  best=0
+  for run in $(seq 3); do
+    generate "$((100000 + run))"
+    time=$(best_time "$MOJ" "$WORK_DIR/program.in" "${FLAGS[@]}")
+    if [ "$best" = 0 ] || [ "$time" -lt "$best" ]; then best=$time; fi
+  done
+  printf "%-32s%8s\n" "after an edit of one function" "$best"
+  ;;
+server)
+  KERNELS=("$BENCH_DIR"/../example/*.in)
+  WORK_DIR=$(mktemp -d)
+  export MOJ_SERVER=$WORK_DIR/moj.sock
+  DUMP=0 "$MOJ" --server="$MOJ_SERVER" &
+  SERVER=$!
+  trap 'kill "$SERVER"; wait "$SERVER"; rm -rf "$WORK_DIR"' EXIT
+  while [ ! -S "$MOJ_SERVER" ]; do sleep 0.1; done
+  CONFIGS=("-o /dev/null" "mojc -o /dev/null")
+  compare
+  CONFIGS=("--interp" "mojc --interp")
+  compare
+  ;;
+batch)
+  WORK_DIR=$(mktemp -d)
+  trap 'rm -rf "$WORK_DIR"' EXIT
+  for copy in $(seq 8); do
+    for program in "$BENCH_DIR"/../example/*.in; do
+      cp "$program" "$WORK_DIR/$(basename "$program" .in)_$copy.in"
+    done
+  done
+  FILES=("$WORK_DIR"/*.in)
+  # shellcheck disable=SC2016
+  printf "%-32s%8s\n" "one moj per file" \
+    "$(best_time bash -c 'for f in "${@:2}"; do "$1" "$f" -o /dev/null; done' \
+      bash "$MOJ" "${FILES[@]}")"
+  printf "%-32s%8s\n" "moj -j1" \
+    "$(best_time "$MOJ" -j1 "${FILES[@]}" -o "$WORK_DIR/out/")"
+  printf "%-32s%8s\n" "moj -j$(nproc)" \
+    "$(best_time "$MOJ" -j"$(nproc)" "${FILES[@]}" -o "$WORK_DIR/out/")"
+  ;;
+*)
+  echo "Unknown suite: $SUITE" >&2
+  exit 1
+  ;;
+esac
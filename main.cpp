@@ -1,77 +1,194 @@
 ﻿#include "src/Builtins.h"
+#include "src/Bytecode.h"
+#include "src/Cache.h"
 #include "src/Codegen.h"
+#include "src/Export.h"
+#include "src/Import.h"
+#include "src/Jit.h"
+#include "src/JitCache.h"
+#include "src/Link.h"
+#include "src/Mir.h"
+#include "src/MirPasses.h"
+#include "src/Optimize.h"
 #include "src/Parser.h"
 #include "src/Printer.h"
+#include "src/Profile.h"
 #include "src/Program.h"
+#include "src/Repl.h"
+#include "src/Server.h"
+#include "src/Session.h"
 #include "src/TokenStream.h"
 #include "src/Typechecker.h"
+#include "src/Watch.h"
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FileUtilities.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
 #include <llvm/Support/raw_os_ostream.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
 #include <optional>
 
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/Support/TargetSelect.h>
 
-#include <llvm/ExecutionEngine/GenericValue.h>
-
 #include <llvm/MC/TargetRegistry.h>
 
 #include <llvm/LinkAllPasses.h>
 #include <llvm/TargetParser/Host.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
-#include <llvm/Passes/PassBuilder.h>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
 #include <utility>
 
-int dumpIt = 1;
-
 namespace {
 using namespace llvm;
 
-int runViaJIT(std::unique_ptr<llvm::Module> module);
-void emitObjectFile(llvm::Module *module, const std::string &filename);
-void optimize(llvm::Module *module, int optLevel);
+// The value that main returned, for exitRequest.
+std::optional<int> mainStatus;
+
+// The flags that the generated code depends on, and where it goes.
+struct BuildSettings {
+  int optLevel = 2;
+  bool useMir = false;
+  // Object files and bitcode only: emit bitcode.
+  bool emitBitcode = false;
+  // Object files only: export functions to C, with a header next to the
+  // output (see Export.h), all of them if there are no names.
+  bool exportFunctions = false;
+  std::vector<std::string> exports;
+  // Object files only: link a shared library.
+  bool shared = false;
+  // Object files only: link a static executable with the runtime.
+  bool executable = false;
+  CodegenOptions codegenOptions;
+  llvm::TargetOptions targetOptions;
+  // The file an instrumented build writes its profile to, empty for the
+  // default.
+  std::optional<std::string> profileGenerate;
+  std::string profileUse;
+  // Write the syntax tree, MIR and IR next to the input file.
+  bool dump = true;
+};
+
+int compile(int argc, const char *const *argv);
+mir::ModulePtr lowerToMir(const Program &program, const std::string &filename,
+                          const BuildSettings &settings);
+std::unique_ptr<llvm::Module>
+generateModule(llvm::LLVMContext *context, const Program &program,
+               const std::string &filename, const BuildSettings &settings,
+               llvm::TargetMachine *targetMachine, llvm::raw_ostream &errors);
+int compileToFile(const std::string &filename, const std::string &outputFile,
+                  const BuildSettings &settings, Cache *cache,
+                  ProgramPtr *builtins, std::ostream &errors);
+int compileBatch(const std::vector<std::string> &inputFiles,
+                 const std::string &outputDirectory,
+                 const BuildSettings &settings, const Cache *cache,
+                 unsigned jobs);
+int watchProgram(const std::string &filename, const BuildSettings &settings,
+                 Cache *cache);
+int buildModules(const std::string &filename, const std::string &outputFile,
+                 const BuildSettings &settings, Cache *cache, unsigned jobs,
+                 bool emitIR, bool run);
+int compileModule(const std::vector<ModuleFile> &modules, size_t position,
+                  const BuildSettings &settings, const std::string &flags,
+                  Cache *cache, std::string *bitcode, std::ostream &errors);
+void exitRequest();
+void emitObject(llvm::Module *module, llvm::TargetMachine *targetMachine,
+                llvm::raw_pwrite_stream &out);
+int writeOutput(const std::string &filename, llvm::StringRef contents,
+                llvm::raw_ostream &errors);
+int linkSharedLibrary(llvm::StringRef object, const std::string &outputFile,
+                      llvm::raw_ostream &errors);
+int linkExecutable(llvm::StringRef object, const std::string &outputFile,
+                   llvm::raw_ostream &errors);
+int writeTemporaryObject(llvm::StringRef object,
+                         llvm::SmallVectorImpl<char> *objectFile,
+                         llvm::FileRemover *remover, llvm::raw_ostream &errors);
+std::unique_ptr<llvm::TargetMachine>
+createTargetMachine(const llvm::TargetOptions &targetOptions);
 int readFile(const char *filename, std::vector<char> *buffer);
-void dumpSyntax(const Program &program, const std::string &srcFilename);
-void dumpIR(llvm::Module &module, const std::string &srcFilename,
-            const char *what);
+bool describeCodegen(const BuildSettings &settings, std::string *description,
+                     std::ostream &errors);
+bool readDumpSetting();
+void dumpSyntax(const BuildSettings &settings, const Program &program,
+                const std::string &srcFilename);
+void dumpIR(const BuildSettings &settings, llvm::Module &module,
+            const std::string &srcFilename, const char *what);
+void dumpMir(const BuildSettings &settings, const mir::Module &module,
+             const std::string &srcFilename, const char *what);
 
 // Parse and typecheck the given source code, adding definitions to the given
-// program. First for builtins then for user code.
-int ParseAndTypecheck(const char *source, Program *program) {
+// program. First for builtins then for user code.  Errors are reported to
+// the given stream.
+int ParseAndTypecheck(const char *source, Program *program,
+                      std::ostream &errors) {
   // Construct token stream, which encapsulates the lexer.
   TokenStream tokens(source);
 
   // Parse the token stream into a program.
-  int status = ParseProgram(tokens, program);
-  dumpSyntax(*program, "test123");
+  int status = ParseProgram(tokens, program, errors);
   // If the parser succeeded, typecheck the program.
   if (status == 0)
-    status = Typecheck(*program);
+    status = Typecheck(*program, errors);
   return status;
 }
 
+// Parse and typecheck the builtin functions into a new program.
+ProgramPtr parseBuiltins() {
+  ProgramPtr program(new Program);
+  int status = ParseAndTypecheck(GetBuiltins(), program.get(), std::cerr);
+  assert(status == 0);
+  (void)status;
+  return program;
+}
+
 } // namespace
 
 int main(int argc, const char *const *argv) {
+  int status = compile(argc, argv);
+  mainStatus = status;
+  return status;
+}
+
+namespace {
+
+int compile(int argc, const char *const *argv) {
   InitializeNativeTarget();
   InitializeNativeTargetAsmPrinter();
   InitializeNativeTargetAsmParser();
 
-  llvm::cl::opt<std::string> filename(
-      llvm::cl::Positional, llvm::cl::desc("<input file>"), llvm::cl::Required);
+  llvm::cl::list<std::string> inputFiles(
+      llvm::cl::Positional, llvm::cl::desc("<input files>"));
 
   llvm::cl::opt<std::string> outputFile(
-      "o", llvm::cl::desc("Specify output filename"),
+      "o",
+      llvm::cl::desc("Specify output filename, or the output directory when "
+                     "there are several input files"),
       llvm::cl::value_desc("filename"));
+  llvm::cl::opt<unsigned> jobs(
+      "j",
+      llvm::cl::desc("Number of input files compiled at the same time "
+                     "(default: one per CPU)"),
+      llvm::cl::value_desc("count"), llvm::cl::Prefix);
 
   llvm::cl::opt<int> optimizationLevel(
       "O", llvm::cl::desc("Optimization level (0-3)"),
@@ -80,70 +197,462 @@ int main(int argc, const char *const *argv) {
 
   llvm::cl::opt<bool> run_mode("run",
                                llvm::cl::desc("JIT and run the program"));
+  llvm::cl::opt<bool> repl(
+      "repl", llvm::cl::desc("Read functions and statements from stdin and "
+                             "compile and run each one right away"));
+  llvm::cl::opt<bool> watch(
+      "watch",
+      llvm::cl::desc("Run the program again each time its file is saved, "
+                     "compiling only the functions that changed (with --run)"));
+  llvm::cl::opt<bool> jit_lazy(
+      "jit-lazy",
+      llvm::cl::desc("Compile functions when they are first called (default: "
+                     "false)"),
+      llvm::cl::init(false));
+  llvm::cl::opt<bool> jit_tiered(
+      "jit-tiered",
+      llvm::cl::desc("Compile quickly without optimization first, then "
+                     "optimize functions that are called often in the "
+                     "background"));
+  llvm::cl::opt<unsigned> jit_tier_threshold(
+      "jit-tier-threshold",
+      llvm::cl::desc("Calls after which the tiered JIT optimizes a function "
+                     "(default: 1000)"),
+      llvm::cl::value_desc("calls"), llvm::cl::init(1000));
+  llvm::cl::opt<unsigned> jit_osr_threshold(
+      "jit-osr-threshold",
+      llvm::cl::desc("Loop iterations after which the tiered JIT moves the "
+                     "running function into optimized code, 0 to disable "
+                     "(default: 10000)"),
+      llvm::cl::value_desc("iterations"), llvm::cl::init(10000));
+  llvm::cl::opt<bool> jit_incremental(
+      "jit-incremental",
+      llvm::cl::desc("Compile each function on its own and keep it in the "
+                     "-cache-dir, so that only the functions that changed "
+                     "are compiled again"));
+  llvm::cl::opt<bool> interp_mode(
+      "interp",
+      llvm::cl::desc("Run the program with the bytecode interpreter, without "
+                     "compiling it to machine code"));
+  llvm::cl::opt<bool> emit_bytecode(
+      "emit-bytecode", llvm::cl::desc("Emit the interpreter's bytecode only"));
   llvm::cl::opt<bool> emit_ir("emit-ir", llvm::cl::desc("Emit LLVM IR only"));
+  llvm::cl::opt<bool> shared(
+      "shared", llvm::cl::desc("Link the -o file as a shared library, which "
+                               "exports the functions to C (see -export)"));
+  llvm::cl::list<std::string> exports(
+      "export", llvm::cl::CommaSeparated,
+      llvm::cl::desc("Export these functions of the -o file to C, declared "
+                     "in a header next to it (with -shared, all of them by "
+                     "default)"),
+      llvm::cl::value_desc("functions"));
+  llvm::cl::opt<bool> executable(
+      "exe", llvm::cl::desc("Link the -o file as a static executable, which "
+                            "needs no C library"));
+  llvm::cl::opt<bool> emit_bc(
+      "emit-bc",
+      llvm::cl::desc("Emit LLVM bitcode (to the -o file or stdout) instead "
+                     "of an object file"));
+  llvm::cl::opt<bool> use_mir(
+      "mir", llvm::cl::desc("Generate code through the mid-level IR (MIR)"));
+  llvm::cl::opt<bool> emit_mir("emit-mir",
+                               llvm::cl::desc("Emit the optimized MIR only"));
   llvm::cl::opt<bool> dump_tokens("dump-tokens",
                                   llvm::cl::desc("Dump tokens and exit"));
 
+  // Floating point options, named after their clang equivalents.  The
+  // Hexagon backend of LLVM already registers -ffast-math, in which case we
+  // share its option.
+  std::optional<llvm::cl::opt<bool>> fast_math_option;
+  if (!llvm::cl::getRegisteredOptions().count("ffast-math"))
+    fast_math_option.emplace(
+        "ffast-math",
+        llvm::cl::desc("Enable all unsafe floating point optimizations"));
+  llvm::cl::opt<bool> associative_math(
+      "fassociative-math",
+      llvm::cl::desc("Allow reassociation of floating point operations"));
+  llvm::cl::opt<bool> no_honor_nans(
+      "fno-honor-nans",
+      llvm::cl::desc("Assume floating point values are never NaN"));
+  llvm::cl::opt<bool> no_honor_infinities(
+      "fno-honor-infinities",
+      llvm::cl::desc("Assume floating point values are never infinite"));
+  llvm::cl::opt<bool> no_signed_zeros(
+      "fno-signed-zeros",
+      llvm::cl::desc("Ignore the sign of floating point zeros"));
+  llvm::cl::opt<bool> reciprocal_math(
+      "freciprocal-math",
+      llvm::cl::desc("Allow division to use an approximate reciprocal"));
+  llvm::cl::opt<FPContract> fp_contract(
+      "ffp-contract",
+      llvm::cl::desc("Fuse floating point multiply and add (default: off)"),
+      llvm::cl::values(
+          clEnumValN(kFPContractOff, "off", "Never fuse"),
+          clEnumValN(kFPContractOn, "on", "Fuse within an expression"),
+          clEnumValN(kFPContractFast, "fast", "Fuse across expressions")),
+      llvm::cl::init(kFPContractOff));
+
+  // Integer overflow is undefined unless one of these is given.
+  llvm::cl::opt<bool> wrapv(
+      "fwrapv", llvm::cl::desc("Signed integer overflow wraps around"));
+  llvm::cl::opt<bool> trapv(
+      "ftrapv", llvm::cl::desc("Trap on signed integer overflow"));
+
+  llvm::cl::opt<BoundsCheck> bounds_check(
+      "fbounds-check",
+      llvm::cl::desc("Check array indices at runtime (default: off)"),
+      llvm::cl::values(
+          clEnumValN(kBoundsCheckOff, "off", "Don't check"),
+          clEnumValN(kBoundsCheckTrap, "trap", "Trap on a bad index"),
+          clEnumValN(kBoundsCheckDiagnose, "diagnose",
+                     "Print the bad index and exit")),
+      llvm::cl::init(kBoundsCheckOff));
+
+  // Profile-guided optimization: an instrumented build writes the counts of
+  // its runs, which a later build uses in place of static guesses.
+  llvm::cl::opt<std::string> profile_generate(
+      "fprofile-generate",
+      llvm::cl::desc("Instrument the program to write a profile at exit "
+                     "(default file: default.mojprof)"),
+      llvm::cl::value_desc("file"), llvm::cl::ValueOptional);
+  llvm::cl::opt<std::string> profile_use(
+      "fprofile-use",
+      llvm::cl::desc("Optimize with a profile written by -fprofile-generate"),
+      llvm::cl::value_desc("file"));
+
+  // Compiled programs are kept in a directory, keyed by their source and
+  // flags, and reused when they are compiled again.
+  llvm::cl::opt<std::string> cache_dir(
+      "cache-dir",
+      llvm::cl::desc("Reuse the object files, bitcode and JIT code of "
+                     "programs compiled before with the same flags, kept in "
+                     "this directory"),
+      llvm::cl::value_desc("directory"));
+  llvm::cl::opt<unsigned> cache_max_size(
+      "cache-max-size",
+      llvm::cl::desc("Remove the least recently used programs from the "
+                     "cache when it grows over this size (default: 1024)"),
+      llvm::cl::value_desc("MB"), llvm::cl::init(1024));
+  llvm::cl::opt<bool> cache_stats(
+      "cache-stats",
+      llvm::cl::desc("Print the hits, misses and size of the cache and exit"));
+
+  // A daemon that compiles for mojc, for CI jobs that compile many small
+  // programs (see Server.h).
+  llvm::cl::opt<std::string> server(
+      "server",
+      llvm::cl::desc("Serve the compilations that mojc requests on this Unix "
+                     "domain socket"),
+      llvm::cl::value_desc("socket"));
+  llvm::cl::opt<unsigned> server_workers(
+      "server-workers",
+      llvm::cl::desc("Number of requests the server runs at the same time "
+                     "(default: one per CPU)"),
+      llvm::cl::value_desc("count"));
+
   llvm::cl::ParseCommandLineOptions(argc, argv, "My Compiler\n");
 
+  // The server parses the builtins and creates the context before it forks
+  // its workers, so that requests start with them.  Each request then runs
+  // in a process of its own, as if moj had been started with its arguments.
+  ProgramPtr program;
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::vector<std::string> request;
+  if (!server.empty()) {
+    // Options that aren't reset by a request would carry over into it.
+    bool otherOptions = inputFiles.getNumOccurrences() != 0;
+    for (const auto &entry : llvm::cl::getRegisteredOptions()) {
+      llvm::cl::Option *option = entry.second;
+      if (option != &server && option != &server_workers &&
+          option->getNumOccurrences())
+        otherOptions = true;
+    }
+    if (otherOptions) {
+      std::cerr << "-server only takes -server-workers; requests give their "
+                   "own options\n";
+      return 1;
+    }
+    program = parseBuiltins();
+    context = std::make_unique<llvm::LLVMContext>();
+    request = RunServer(server, server_workers);
+    std::vector<const char *> requestArgv;
+    for (const std::string &argument : request)
+      requestArgv.push_back(argument.c_str());
+    // The process is a copy of a worker, in which all other options are
+    // still at their defaults.  Resetting all options would copy the memory
+    // of each one.
+    server.reset();
+    server_workers.reset();
+    llvm::cl::ParseCommandLineOptions(requestArgv.size(), requestArgv.data(),
+                                      "My Compiler\n");
+    if (server.getNumOccurrences()) {
+      std::cerr << "-server can't be used through mojc\n";
+      return 1;
+    }
+    std::atexit(exitRequest);
+  }
+
+  std::unique_ptr<Cache> cache;
+  if (!cache_dir.empty())
+    cache = std::make_unique<Cache>(cache_dir,
+                                    uint64_t(cache_max_size) * 1024 * 1024);
+  if (cache_stats) {
+    if (!cache) {
+      std::cerr << "-cache-stats needs -cache-dir\n";
+      return 1;
+    }
+    cache->PrintStats(llvm::outs());
+    return 0;
+  }
+  if (inputFiles.empty() && !repl) {
+    std::cerr << "No input file\n";
+    return 1;
+  }
+  if (jit_incremental && !cache) {
+    std::cerr << "-jit-incremental needs -cache-dir\n";
+    return 1;
+  }
+
+  bool fast_math = static_cast<llvm::cl::opt<bool> *>(
+                       llvm::cl::getRegisteredOptions()["ffast-math"])
+                       ->getValue();
+  CodegenOptions codegenOptions;
+  codegenOptions.fpReassociate = fast_math || associative_math;
+  codegenOptions.fpNoNaNs = fast_math || no_honor_nans;
+  codegenOptions.fpNoInfs = fast_math || no_honor_infinities;
+  codegenOptions.fpNoSignedZeros = fast_math || no_signed_zeros;
+  codegenOptions.fpReciprocal = fast_math || reciprocal_math;
+  codegenOptions.fpContract =
+      fast_math && fp_contract.getNumOccurrences() == 0 ? kFPContractFast
+                                                        : fp_contract;
+  codegenOptions.intOverflow = trapv   ? kIntOverflowTrap
+                               : wrapv ? kIntOverflowWrap
+                                       : kIntOverflowUndefined;
+  codegenOptions.boundsCheck = bounds_check;
+  llvm::TargetOptions targetOptions = GetTargetOptions(codegenOptions);
+  if (profile_generate.getNumOccurrences() && !profile_use.empty()) {
+    std::cerr << "-fprofile-generate and -fprofile-use can't be combined\n";
+    return 1;
+  }
+  // With a profile, cold blocks are moved out of hot functions.
+  targetOptions.EnableMachineFunctionSplitter = !profile_use.empty();
+
+  BuildSettings settings;
+  settings.optLevel = optimizationLevel;
+  settings.useMir = use_mir;
+  settings.emitBitcode = emit_bc;
+  settings.exportFunctions = shared || !exports.empty();
+  settings.exports = exports;
+  settings.shared = shared;
+  settings.executable = executable;
+  settings.codegenOptions = codegenOptions;
+  settings.targetOptions = targetOptions;
+  if (profile_generate.getNumOccurrences())
+    settings.profileGenerate = profile_generate;
+  settings.profileUse = profile_use;
+  settings.dump = readDumpSetting();
+
+  if (repl) {
+    if (!inputFiles.empty()) {
+      std::cerr << "-repl doesn't take input files\n";
+      return 1;
+    }
+    SessionOptions sessionOptions;
+    sessionOptions.optLevel = optimizationLevel;
+    sessionOptions.useMir = use_mir;
+    sessionOptions.codegenOptions = codegenOptions;
+    return RunRepl(sessionOptions);
+  }
+
+  // Object files and bitcode, of one file or of several independent ones.
+  bool aot = !outputFile.empty() || emit_bc;
+  if (settings.exportFunctions &&
+      (outputFile.empty() || emit_bc || inputFiles.size() > 1)) {
+    std::cerr << "-shared and -export need a single input file and -o, and "
+                 "can't be combined with -emit-bc\n";
+    return 1;
+  }
+  if (executable) {
+    if (outputFile.empty() || emit_bc || inputFiles.size() > 1 ||
+        settings.exportFunctions) {
+      std::cerr << "-exe needs a single input file and -o, and can't be "
+                   "combined with -emit-bc, -shared or -export\n";
+      return 1;
+    }
+    // The instrumentation writes the profile with the C library.
+    if (profile_generate.getNumOccurrences()) {
+      std::cerr << "-exe can't be combined with -fprofile-generate\n";
+      return 1;
+    }
+    llvm::Triple triple(llvm::sys::getDefaultTargetTriple());
+    if (triple.getArch() != llvm::Triple::x86_64 || !triple.isOSLinux()) {
+      std::cerr << "-exe only supports x86-64 Linux\n";
+      return 1;
+    }
+  }
+  if (inputFiles.size() > 1) {
+    if (outputFile.empty()) {
+      std::cerr << "Several input files need -o <directory>\n";
+      return 1;
+    }
+    if (dump_tokens || run_mode || interp_mode || emit_bytecode || emit_ir ||
+        emit_mir) {
+      std::cerr << "Several input files can only be compiled to object files "
+                   "or bitcode\n";
+      return 1;
+    }
+    // A profile belongs to one program.
+    if (profile_generate.getNumOccurrences() || !profile_use.empty()) {
+      std::cerr << "-fprofile-generate and -fprofile-use take a single input "
+                   "file\n";
+      return 1;
+    }
+    return compileBatch(inputFiles, outputFile, settings, cache.get(), jobs);
+  }
+  const std::string &filename = inputFiles.front();
   std::vector<char> source;
-  int status = readFile(argv[1], &source);
+  int status = readFile(filename.c_str(), &source);
   if (status != 0) {
-    std::cerr << "Unable to open input file: " << argv[1] << '\n';
+    std::cerr << "Unable to open input file: " << filename << '\n';
     return status;
   }
 
+  // A file with imports is built together with its modules (see Import.h).
+  if (!dump_tokens && HasImports(source.data())) {
+    if (watch || interp_mode || emit_bytecode || use_mir || emit_mir ||
+        settings.exportFunctions) {
+      std::cerr << "A file with imports can't be compiled with -watch, "
+                   "--interp, -emit-bytecode, -mir, -emit-mir, -shared or "
+                   "-export\n";
+      return 1;
+    }
+    if (jit_tiered || jit_incremental ||
+        profile_generate.getNumOccurrences() || !profile_use.empty()) {
+      std::cerr << "A file with imports can't be run with the tiered or "
+                   "incremental JIT, or use profiles\n";
+      return 1;
+    }
+    return buildModules(filename, outputFile, settings, cache.get(), jobs,
+                        emit_ir, run_mode);
+  }
+
+  if (watch) {
+    if (!run_mode || aot || dump_tokens || interp_mode || emit_bytecode ||
+        emit_ir || emit_mir) {
+      std::cerr << "-watch only works with --run\n";
+      return 1;
+    }
+    if (profile_generate.getNumOccurrences()) {
+      std::cerr << "-watch can't be combined with -fprofile-generate\n";
+      return 1;
+    }
+    return watchProgram(filename, settings, cache.get());
+  }
+  if (aot && !dump_tokens && !interp_mode && !emit_bytecode && !emit_mir)
+    return compileToFile(filename, outputFile, settings, cache.get(), &program,
+                         std::cerr);
+
   if (dump_tokens) {
     TokenStream tokens((source.data()));
     tokens.printAllTokens();
     return 0;
   }
 
-  const char *envVarValue = std::getenv("DUMP");
-  if (envVarValue != nullptr) {
-    dumpIt = std::atoi(envVarValue);
+  // A program that was run before with the same flags is taken from the
+  // cache without parsing it.  The JIT doesn't cache instrumented code,
+  // which registers its profile writer in a constructor that the JIT only
+  // runs for modules it compiles itself.  With -jit-incremental, the
+  // program is parsed and only its functions are taken from the cache.
+  bool jit = !emit_ir && run_mode && !profile_generate.getNumOccurrences();
+  std::unique_ptr<JitCache> jitCache;
+  std::string jitCacheName;
+  if (cache && jit && !interp_mode && !emit_bytecode && !emit_mir) {
+    std::string flags;
+    if (!describeCodegen(settings, &flags, std::cerr))
+      return 1;
+    jitCache = std::make_unique<JitCache>(*cache, flags);
+    if (!jit_incremental) {
+      jitCacheName = jitCache->GetProgramName(
+          llvm::StringRef(source.data(), source.size() - 1));
+      if (std::unique_ptr<llvm::MemoryBuffer> object =
+              jitCache->Lookup(jitCacheName))
+        return RunJIT(std::move(object), targetOptions);
+    }
   }
 
-  // Parse and typecheck builtin functions.
-  ProgramPtr program(new Program);
-  status = ParseAndTypecheck(GetBuiltins(), program.get());
-  assert(status == 0);
+  // Parse and typecheck builtin functions, unless the server did.
+  if (!program)
+    program = parseBuiltins();
 
   // Parse and typecheck user source code.
-  status = ParseAndTypecheck(source.data(), program.get());
+  status = ParseAndTypecheck(source.data(), program.get(), std::cerr);
   if (status)
     return status;
-  dumpSyntax(*program, filename);
+  dumpSyntax(settings, *program, filename);
 
-  // Generate LLVM IR.
-  llvm::LLVMContext context;
-  std::unique_ptr<llvm::Module> module(Codegen(&context, *program));
-  dumpIR(*module, filename, "initial");
-
-  // Verify the module, which catches malformed instructions and type errors.
-  assert(!verifyModule(*module, &llvm::errs()));
+  // The interpreter starts right away, without LLVM.
+  if (interp_mode || emit_bytecode) {
+    bytecode::ModulePtr bytecodeModule;
+    try {
+      bytecodeModule = bytecode::Compile(*program, codegenOptions);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    }
+    if (emit_bytecode) {
+      bytecode::Print(std::cout, *bytecodeModule);
+      return 0;
+    }
+    return bytecode::Run(*bytecodeModule);
+  }
 
-  if (module.get() == nullptr) {
-    std::cout << "module je null exit";
-    exit(0);
+  if (emit_mir) {
+    mir::Print(std::cout, *lowerToMir(*program, filename, settings));
+    return 0;
   }
 
-  optimize(module.get(), optimizationLevel.getValue());
-  dumpIR(*module, filename, "optimized");
+  if (!context)
+    context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::TargetMachine> targetMachine =
+      createTargetMachine(targetOptions);
+  std::unique_ptr<llvm::Module> module =
+      generateModule(context.get(), *program, filename, settings,
+                     targetMachine.get(), llvm::errs());
+  if (!module)
+    return 1;
+
+  // The lazy and the tiered JIT optimize each function when they compile it.
+  // A cached program is compiled as a whole, unless its functions are
+  // cached one by one.
+  bool jitOptimizes = !emit_ir && run_mode &&
+                      (jitCache ? jit_incremental : jit_lazy || jit_tiered);
+  if (!jitOptimizes) {
+    Optimize(module.get(), optimizationLevel.getValue(), targetMachine.get());
+    dumpIR(settings, *module, filename, "optimized");
+  }
 
-  if (!outputFile.empty()) {
-    // AOT mode: emit object file
-    emitObjectFile(module.get(), outputFile);
-    return 0;
-  } else if (emit_ir) {
+  if (emit_ir) {
     // Emit IR to stdout
     llvm::outs() << *module;
     return 0;
   } else if (run_mode) {
-    // JIT mode: run via ExecutionEngine
-    return runViaJIT(std::move(module));
+    // JIT mode: compile with ORC and call main
+    JitOptions jitOptions;
+    jitOptions.lazy = jit_lazy;
+    jitOptions.optLevel = optimizationLevel;
+    jitOptions.tiered = jit_tiered;
+    jitOptions.tierUpThreshold = jit_tier_threshold;
+    jitOptions.osrThreshold = jit_osr_threshold;
+    jitOptions.cache = jitCache.get();
+    jitOptions.incremental = jitCache && jit_incremental;
+    if (jitCache && !jit_incremental)
+      jitCache->Add(module.get(), jitCacheName);
+    return RunJIT(std::move(context), std::move(module), targetOptions,
+                  jitOptions);
   } else {
-    std::cerr << "No action specified. Use --run, -emit-ir, or -o <file>\n";
+    std::cerr
+        << "No action specified. Use --run, --interp, -emit-ir, -emit-bc, or "
+           "-o <file>\n";
     return 1;
   }
 
@@ -158,49 +667,523 @@ int main(int argc, const char *const *argv) {
   return 0;
 }
 
-namespace {
+// Lower the program to MIR and run the MIR passes on it.
+mir::ModulePtr lowerToMir(const Program &program, const std::string &filename,
+                          const BuildSettings &settings) {
+  const CodegenOptions &options = settings.codegenOptions;
+  mir::ModulePtr mirModule = mir::LowerProgram(program, options);
+  dumpMir(settings, *mirModule, filename, "initial");
 
-// Optimize the module using the given optimization level (0 -  3).
-void optimize(Module *module, int optLevel) {
-  llvm::PassBuilder passBuilder;
-
-  llvm::LoopAnalysisManager loopAnalysisManager;
-  llvm::FunctionAnalysisManager functionAnalysisManager;
-  llvm::CGSCCAnalysisManager cGSCCAnalysisManager;
-  llvm::ModuleAnalysisManager moduleAnalysisManager;
-
-  passBuilder.registerModuleAnalyses(moduleAnalysisManager);
-  passBuilder.registerCGSCCAnalyses(cGSCCAnalysisManager);
-  passBuilder.registerFunctionAnalyses(functionAnalysisManager);
-  passBuilder.registerLoopAnalyses(loopAnalysisManager);
-
-  passBuilder.crossRegisterProxies(loopAnalysisManager, functionAnalysisManager,
-                                   cGSCCAnalysisManager, moduleAnalysisManager);
-
-  llvm::ModulePassManager modulePassManager;
-
-  llvm::OptimizationLevel level;
-  switch (optLevel) {
-  case 0:
-    level = llvm::OptimizationLevel::O0;
-    break;
-  case 1:
-    level = llvm::OptimizationLevel::O1;
-    break;
-  case 2:
-    level = llvm::OptimizationLevel::O2;
-    break;
-  case 3:
-    level = llvm::OptimizationLevel::O3;
-    break;
-  default:
-    level = llvm::OptimizationLevel::O2;
-  }
-
-  modulePassManager = passBuilder.buildPerModuleDefaultPipeline(level);
-
-  // Run the optimizations on the module.
-  modulePassManager.run(*module, moduleAnalysisManager);
+  mir::PassManager passManager;
+  mir::AddDefaultPasses(&passManager, options);
+  passManager.Run(mirModule.get());
+  dumpMir(settings, *mirModule, filename, "optimized");
+  return mirModule;
+}
+
+// Generate the unoptimized LLVM IR of the program for the given target,
+// either straight from the AST or through MIR, which has its own
+// optimization passes.  Returns null, with an error message, if the profile
+// can't be applied.
+std::unique_ptr<llvm::Module>
+generateModule(llvm::LLVMContext *context, const Program &program,
+               const std::string &filename, const BuildSettings &settings,
+               llvm::TargetMachine *targetMachine, llvm::raw_ostream &errors) {
+  std::unique_ptr<llvm::Module> module;
+  if (settings.useMir) {
+    mir::ModulePtr mirModule = lowerToMir(program, filename, settings);
+    module = Codegen(context, program, *mirModule, settings.codegenOptions);
+  } else {
+    module = Codegen(context, program, settings.codegenOptions);
+  }
+  dumpIR(settings, *module, filename, "initial");
+
+  // Verify the module, which catches malformed instructions and type errors.
+  assert(!verifyModule(*module, &llvm::errs()));
+
+  // The optimizer needs to know the target, e.g. to pick vector widths.
+  module->setTargetTriple(targetMachine->getTargetTriple().str());
+  module->setDataLayout(targetMachine->createDataLayout());
+
+  // Profiles are collected and applied on the unoptimized IR, where a
+  // function's control flow is the same in both builds.
+  if (settings.profileGenerate) {
+    InstrumentForProfiling(module.get(), settings.profileGenerate->empty()
+                                             ? "default.mojprof"
+                                             : *settings.profileGenerate);
+  } else if (!settings.profileUse.empty()) {
+    if (!ApplyProfile(module.get(), settings.profileUse, errors))
+      return nullptr;
+  }
+  return module;
+}
+
+// Parse, typecheck and compile the source into an object file, or bitcode,
+// adding its functions to the program and those it exports to *exported.
+// Returns zero for success.
+int buildOutput(const std::string &filename, const char *source,
+                const BuildSettings &settings, Program *program,
+                std::ostream &errors, llvm::SmallVectorImpl<char> *output,
+                std::vector<const FuncDef *> *exported) {
+  int status = ParseAndTypecheck(source, program, errors);
+  if (status)
+    return status;
+  dumpSyntax(settings, *program, filename);
+
+  // Each file has its own context, so that files can be compiled at the
+  // same time.
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::TargetMachine> targetMachine =
+      createTargetMachine(settings.targetOptions);
+  llvm::raw_os_ostream profileErrors(errors);
+  std::unique_ptr<llvm::Module> module =
+      generateModule(&context, *program, filename, settings,
+                     targetMachine.get(), profileErrors);
+  if (!module)
+    return 1;
+  if (settings.exportFunctions &&
+      !ExportFunctions(*module, *program, settings.exports, exported, errors))
+    return 1;
+  Optimize(module.get(), settings.optLevel, targetMachine.get());
+  dumpIR(settings, *module, filename, "optimized");
+
+  llvm::raw_svector_ostream stream(*output);
+  if (settings.emitBitcode)
+    llvm::WriteBitcodeToFile(*module, stream);
+  else
+    emitObject(module.get(), targetMachine.get(), stream);
+  return 0;
+}
+
+// Compile a file to an object file, or bitcode, through the cache if there
+// is one, and link the object file if the settings ask for it.  The
+// builtins are parsed into *builtins unless it has them already; the
+// functions of the file are removed from it again afterwards, so that it
+// can be used for the next file.  Errors go to the given stream.  Returns
+// zero for success.
+int compileToFile(const std::string &filename, const std::string &outputFile,
+                  const BuildSettings &settings, Cache *cache,
+                  ProgramPtr *builtins, std::ostream &errors) {
+  std::vector<char> source;
+  int status = readFile(filename.c_str(), &source);
+  if (status != 0) {
+    errors << "Unable to open input file: " << filename << '\n';
+    return status;
+  }
+  llvm::raw_os_ostream outputErrors(errors);
+
+  // A program that was compiled before with the same flags is taken from
+  // the cache without parsing it.  Object files are compiled for a generic
+  // CPU of the default target.  The header of exported functions is
+  // generated from the parsed program, so such builds skip the cache.
+  std::string cacheName;
+  if (cache && !settings.exportFunctions) {
+    std::string flags;
+    if (!describeCodegen(settings, &flags, errors))
+      return 1;
+    const char *extension = settings.emitBitcode ? "bc" : "o";
+    if (settings.profileGenerate)
+      flags += " -fprofile-generate=" + *settings.profileGenerate;
+    std::string description = std::string("aot ") + extension + " " +
+                              llvm::sys::getDefaultTargetTriple() + " " +
+                              flags;
+    cacheName = Cache::ComputeKey(
+                    llvm::StringRef(source.data(), source.size() - 1),
+                    description) +
+                "." + extension;
+    if (std::unique_ptr<llvm::MemoryBuffer> output =
+            cache->Lookup(cacheName)) {
+      if (settings.executable)
+        return linkExecutable(output->getBuffer(), outputFile, outputErrors);
+      return writeOutput(outputFile, output->getBuffer(), outputErrors);
+    }
+  }
+
+  if (!*builtins)
+    *builtins = parseBuiltins();
+  std::vector<FuncDefPtr> &functions = (*builtins)->GetFunctions();
+  size_t numBuiltins = functions.size();
+  llvm::SmallVector<char, 0> output;
+  std::vector<const FuncDef *> exported;
+  status = buildOutput(filename, source.data(), settings, builtins->get(),
+                       errors, &output, &exported);
+  std::string header;
+  llvm::SmallString<128> headerFile(outputFile);
+  if (status == 0 && settings.exportFunctions) {
+    llvm::sys::path::replace_extension(headerFile, "h");
+    header = GenerateHeader(exported, std::string(headerFile), filename);
+  }
+  functions.erase(functions.begin() + numBuiltins, functions.end());
+  if (status)
+    return status;
+
+  llvm::StringRef contents(output.data(), output.size());
+  if (cache && !settings.exportFunctions)
+    cache->Store(cacheName, contents);
+  if (settings.exportFunctions &&
+      writeOutput(std::string(headerFile), header, outputErrors) != 0)
+    return 1;
+  if (settings.shared)
+    return linkSharedLibrary(contents, outputFile, outputErrors);
+  if (settings.executable)
+    return linkExecutable(contents, outputFile, outputErrors);
+  return writeOutput(outputFile, contents, outputErrors);
+}
+
+// Link an object file into a shared library with the C compiler, which
+// knows where the C library is.
+int linkSharedLibrary(llvm::StringRef object, const std::string &outputFile,
+                      llvm::raw_ostream &errors) {
+  llvm::ErrorOr<std::string> compiler = llvm::sys::findProgramByName("cc");
+  if (!compiler) {
+    errors << "Error: -shared needs a C compiler (cc) to link " << outputFile
+           << "\n";
+    return 1;
+  }
+  llvm::SmallString<128> objectFile;
+  llvm::FileRemover remover;
+  if (writeTemporaryObject(object, &objectFile, &remover, errors) != 0)
+    return 1;
+  std::string message;
+  int status = llvm::sys::ExecuteAndWait(
+      *compiler, {*compiler, "-shared", "-o", outputFile, objectFile},
+      std::nullopt, {}, 0, 0, &message);
+  if (status != 0) {
+    errors << "Error: Could not link " << outputFile;
+    if (!message.empty())
+      errors << ": " << message;
+    errors << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// Link an object file into a static executable with the runtime, which is
+// installed next to moj.
+int linkExecutable(llvm::StringRef object, const std::string &outputFile,
+                   llvm::raw_ostream &errors) {
+  llvm::SmallString<128> runtime(
+      llvm::sys::path::parent_path(llvm::sys::fs::getMainExecutable(
+          nullptr, reinterpret_cast<void *>(&linkExecutable))));
+  llvm::sys::path::append(runtime, kRuntimeName);
+  if (!llvm::sys::fs::exists(runtime)) {
+    errors << "Error: The runtime " << runtime << " is missing\n";
+    return 1;
+  }
+  llvm::SmallString<128> objectFile;
+  llvm::FileRemover remover;
+  if (writeTemporaryObject(object, &objectFile, &remover, errors) != 0)
+    return 1;
+  return LinkExecutable(objectFile, runtime, outputFile, errors) ? 0 : 1;
+}
+
+// Write an object file to a temporary file for the linker, which *remover
+// deletes again.
+int writeTemporaryObject(llvm::StringRef object,
+                         llvm::SmallVectorImpl<char> *objectFile,
+                         llvm::FileRemover *remover,
+                         llvm::raw_ostream &errors) {
+  if (std::error_code ec =
+          llvm::sys::fs::createTemporaryFile("moj", "o", *objectFile)) {
+    errors << "Error: Could not create a temporary file: " << ec.message()
+           << "\n";
+    return 1;
+  }
+  remover->setFile(*objectFile);
+  return writeOutput(std::string(objectFile->begin(), objectFile->end()),
+                     object, errors);
+}
+
+// Run the program each time its file is saved (--watch).  The builtins,
+// the target machine and the objects of the functions stay in this process
+// between runs, so a save only costs parsing the program and compiling the
+// functions whose IR changed (see Incremental.h), or nothing if the file
+// didn't change.  Only the objects that the last run used stay in memory;
+// they are also kept in the cache if there is one.  The program runs in a
+// child process, so that the watch goes on if it crashes.
+int watchProgram(const std::string &filename, const BuildSettings &settings,
+                 Cache *cache) {
+  std::string flags;
+  if (!describeCodegen(settings, &flags, std::cerr))
+    return 1;
+  std::unique_ptr<JitCache> jitCache =
+      cache ? std::make_unique<JitCache>(*cache, flags)
+            : std::make_unique<JitCache>(flags);
+  JitOptions jitOptions;
+  jitOptions.optLevel = settings.optLevel;
+  jitOptions.cache = jitCache.get();
+  jitOptions.incremental = true;
+  jitOptions.isolate = true;
+
+  ProgramPtr program = parseBuiltins();
+  size_t numBuiltins = program->GetFunctions().size();
+  std::unique_ptr<llvm::TargetMachine> targetMachine =
+      createTargetMachine(settings.targetOptions);
+  std::vector<char> lastSource;
+  return WatchFile(filename, [&] {
+    std::vector<char> source;
+    if (readFile(filename.c_str(), &source) != 0) {
+      std::cerr << "Unable to open input file: " << filename << '\n';
+      return;
+    }
+    if (source == lastSource)
+      return;
+    lastSource = source;
+
+    auto start = std::chrono::steady_clock::now();
+    if (ParseAndTypecheck(source.data(), program.get(), std::cerr) == 0) {
+      dumpSyntax(settings, *program, filename);
+      auto context = std::make_unique<llvm::LLVMContext>();
+      std::unique_ptr<llvm::Module> module =
+          generateModule(context.get(), *program, filename, settings,
+                         targetMachine.get(), llvm::errs());
+      if (module) {
+        jitCache->BeginRun();
+        RunJIT(std::move(context), std::move(module), settings.targetOptions,
+               jitOptions);
+      }
+    }
+    std::vector<FuncDefPtr> &functions = program->GetFunctions();
+    functions.erase(functions.begin() + numBuiltins, functions.end());
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    std::cerr << "-- " << filename << ": done in " << elapsed.count()
+              << " ms, waiting for changes\n";
+  });
+}
+
+// Build a file with imports (see Import.h): compile it and its modules to
+// bitcode on the given number of threads, or one per CPU if it's zero, then
+// link them into one module, which is optimized again, so that calls across
+// modules are inlined, and compiled to the output, printed or run.  With a
+// cache, only the modules whose source or imported interfaces changed are
+// compiled again.  Returns zero for success.
+int buildModules(const std::string &filename, const std::string &outputFile,
+                 const BuildSettings &settings, Cache *cache, unsigned jobs,
+                 bool emitIR, bool run) {
+  bool aot = !outputFile.empty() || settings.emitBitcode;
+  if (!aot && !emitIR && !run) {
+    std::cerr << "No action specified. Use --run, -emit-ir, -emit-bc, or -o "
+                 "<file>\n";
+    return 1;
+  }
+  std::vector<ModuleFile> modules;
+  if (!LoadModules(filename, cache, &modules, std::cerr))
+    return 1;
+  std::string flags;
+  if (!describeCodegen(settings, &flags, std::cerr))
+    return 1;
+
+  if (jobs == 0)
+    jobs = std::thread::hardware_concurrency();
+  jobs = std::max(1u, std::min<unsigned>(jobs, modules.size()));
+  std::vector<std::string> bitcode(modules.size());
+  std::atomic<size_t> next(0);
+  std::atomic<unsigned> failures(0);
+  std::mutex errorsMutex;
+  auto compileModules = [&]() {
+    std::optional<Cache> threadCache;
+    if (cache)
+      threadCache.emplace(*cache);
+    for (size_t i = next++; i < modules.size(); i = next++) {
+      std::ostringstream errors;
+      if (compileModule(modules, i, settings, flags,
+                        threadCache ? &*threadCache : nullptr, &bitcode[i],
+                        errors) != 0)
+        ++failures;
+      std::lock_guard<std::mutex> lock(errorsMutex);
+      std::cerr << errors.str();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < jobs; ++i)
+    threads.emplace_back(compileModules);
+  compileModules();
+  for (std::thread &thread : threads)
+    thread.join();
+  if (failures)
+    return 1;
+
+  auto context = std::make_unique<llvm::LLVMContext>();
+  std::unique_ptr<llvm::Module> program;
+  for (size_t i = 0; i < modules.size(); ++i) {
+    llvm::Expected<std::unique_ptr<llvm::Module>> module =
+        llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(bitcode[i], modules[i].path), *context);
+    if (!module) {
+      llvm::errs() << "Error: Could not read the bitcode of "
+                   << modules[i].path << ": "
+                   << llvm::toString(module.takeError()) << "\n";
+      return 1;
+    }
+    if (!program)
+      program = std::move(*module);
+    else if (llvm::Linker::linkModules(*program, std::move(*module))) {
+      llvm::errs() << "Error: Could not link " << modules[i].path << "\n";
+      return 1;
+    }
+  }
+  // Only main is called from outside the program, so the functions that
+  // modules export can be inlined into their callers and dropped.
+  for (llvm::Function &function : *program) {
+    if (!function.isDeclaration() && function.getName() != "main")
+      function.setLinkage(llvm::GlobalValue::InternalLinkage);
+  }
+  std::unique_ptr<llvm::TargetMachine> targetMachine =
+      createTargetMachine(settings.targetOptions);
+  Optimize(program.get(), settings.optLevel, targetMachine.get());
+  dumpIR(settings, *program, filename, "linked");
+
+  if (aot) {
+    llvm::SmallVector<char, 0> output;
+    llvm::raw_svector_ostream stream(output);
+    if (settings.emitBitcode)
+      llvm::WriteBitcodeToFile(*program, stream);
+    else
+      emitObject(program.get(), targetMachine.get(), stream);
+    llvm::StringRef contents(output.data(), output.size());
+    if (settings.executable)
+      return linkExecutable(contents, outputFile, llvm::errs());
+    return writeOutput(outputFile, contents, llvm::errs());
+  }
+  if (emitIR) {
+    llvm::outs() << *program;
+    return 0;
+  }
+  // The program is optimized as a whole, so the JIT compiles it as one.
+  JitOptions jitOptions;
+  jitOptions.lazy = false;
+  jitOptions.optLevel = settings.optLevel;
+  return RunJIT(std::move(context), std::move(program), settings.targetOptions,
+                jitOptions);
+}
+
+// Compile a file of a program to optimized bitcode, in which the functions
+// that other modules call keep their symbols, through the cache if there is
+// one.  Errors go to the given stream.  Returns zero for success.
+int compileModule(const std::vector<ModuleFile> &modules, size_t position,
+                  const BuildSettings &settings, const std::string &flags,
+                  Cache *cache, std::string *bitcode, std::ostream &errors) {
+  const ModuleFile &module = modules[position];
+  bool isModule = position + 1 < modules.size();
+
+  // The bitcode only depends on the interfaces of the imports, not on their
+  // sources.
+  std::string cacheName;
+  if (cache) {
+    std::string key = module.source;
+    for (size_t import : module.imports)
+      key += modules[import].interface;
+    std::string description = "module bc " +
+                              (isModule ? module.name : std::string("main")) +
+                              " " + llvm::sys::getDefaultTargetTriple() + " " +
+                              flags;
+    cacheName = Cache::ComputeKey(key, description) + ".bc";
+    if (std::unique_ptr<llvm::MemoryBuffer> cached = cache->Lookup(cacheName)) {
+      *bitcode = std::string(cached->getBuffer());
+      return 0;
+    }
+  }
+
+  ProgramPtr program = parseBuiltins();
+  if (ParseModule(module, modules, isModule, program.get(), errors) != 0)
+    return 1;
+  dumpSyntax(settings, *program, module.path);
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::TargetMachine> targetMachine =
+      createTargetMachine(settings.targetOptions);
+  llvm::raw_os_ostream profileErrors(errors);
+  std::unique_ptr<llvm::Module> llvmModule =
+      generateModule(&context, *program, module.path, settings,
+                     targetMachine.get(), profileErrors);
+  if (!llvmModule)
+    return 1;
+  Optimize(llvmModule.get(), settings.optLevel, targetMachine.get());
+  dumpIR(settings, *llvmModule, module.path, "optimized");
+
+  llvm::raw_string_ostream stream(*bitcode);
+  llvm::WriteBitcodeToFile(*llvmModule, stream);
+  stream.flush();
+  if (cache)
+    cache->Store(cacheName, *bitcode);
+  return 0;
+}
+
+// Compile several independent files into object files, or bitcode, named
+// after them in the given directory, on the given number of threads, or one
+// per CPU if it's zero.  Each thread parses the builtins once for the files
+// it takes.  The errors of a file are printed together once it's done, each
+// line prefixed with its name.  Returns zero if all files compiled.
+int compileBatch(const std::vector<std::string> &inputFiles,
+                 const std::string &outputDirectory,
+                 const BuildSettings &settings, const Cache *cache,
+                 unsigned jobs) {
+  // The directory is created if its name ends in a slash.
+  if (!llvm::sys::fs::is_directory(outputDirectory) &&
+      !llvm::sys::path::is_separator(outputDirectory.back())) {
+    std::cerr << "-o must name a directory when there are several input "
+                 "files\n";
+    return 1;
+  }
+  if (std::error_code ec =
+          llvm::sys::fs::create_directories(outputDirectory)) {
+    llvm::errs() << "Error: Could not create directory " << outputDirectory
+                 << ": " << ec.message() << "\n";
+    return 1;
+  }
+  const char *extension = settings.emitBitcode ? ".bc" : ".o";
+  std::vector<std::string> outputFiles;
+  std::set<std::string> seen;
+  for (const std::string &inputFile : inputFiles) {
+    llvm::SmallString<128> outputFile(outputDirectory);
+    llvm::sys::path::append(outputFile,
+                            llvm::sys::path::stem(inputFile) + extension);
+    if (!seen.insert(std::string(outputFile)).second) {
+      std::cerr << "Several input files would be compiled to "
+                << std::string(outputFile) << '\n';
+      return 1;
+    }
+    outputFiles.push_back(std::string(outputFile));
+  }
+
+  if (jobs == 0)
+    jobs = std::thread::hardware_concurrency();
+  jobs = std::max(1u, std::min<unsigned>(jobs, inputFiles.size()));
+  std::atomic<size_t> next(0);
+  std::atomic<unsigned> failures(0);
+  std::mutex errorsMutex;
+  auto compileFiles = [&]() {
+    // Lookups and stores count the size of the cache, which the threads
+    // don't share.
+    std::optional<Cache> threadCache;
+    if (cache)
+      threadCache.emplace(*cache);
+    ProgramPtr builtins;
+    for (size_t i = next++; i < inputFiles.size(); i = next++) {
+      std::ostringstream errors;
+      if (compileToFile(inputFiles[i], outputFiles[i], settings,
+                        threadCache ? &*threadCache : nullptr, &builtins,
+                        errors) != 0)
+        ++failures;
+      std::istringstream lines(errors.str());
+      std::lock_guard<std::mutex> lock(errorsMutex);
+      for (std::string line; std::getline(lines, line);)
+        std::cerr << inputFiles[i] << ": " << line << '\n';
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < jobs; ++i)
+    threads.emplace_back(compileFiles);
+  compileFiles();
+  for (std::thread &thread : threads)
+    thread.join();
+
+  if (failures) {
+    std::cerr << failures << " of " << inputFiles.size()
+              << " files failed to compile\n";
+    return 1;
+  }
+  return 0;
 }
 
 // Read file into the given buffer.  Returns zero for success.
@@ -221,8 +1204,54 @@ int readFile(const char *filename, std::vector<char> *buffer) {
   return 0;
 }
 
-void dumpSyntax(const Program &program, const std::string &srcFilename) {
-  if (dumpIt == 0)
+// Describe the flags that the generated code depends on, for the key of a
+// cached program.  With -fprofile-use, the profile is part of it.  Returns
+// false if the profile can't be read.
+bool describeCodegen(const BuildSettings &settings, std::string *description,
+                     std::ostream &errors) {
+  std::vector<char> profile;
+  if (!settings.profileUse.empty() &&
+      readFile(settings.profileUse.c_str(), &profile) != 0) {
+    errors << "Unable to open profile: " << settings.profileUse << '\n';
+    return false;
+  }
+  const CodegenOptions &options = settings.codegenOptions;
+  *description = llvm::formatv(
+      "-O{0} mir={1} fp={2}{3}{4}{5}{6} contract={7} overflow={8} bounds={9} "
+      "profile=",
+      settings.optLevel, settings.useMir, options.fpReassociate,
+      options.fpNoNaNs, options.fpNoInfs, options.fpNoSignedZeros,
+      options.fpReciprocal, static_cast<int>(options.fpContract),
+      static_cast<int>(options.intOverflow),
+      static_cast<int>(options.boundsCheck));
+  description->append(profile.begin(), profile.end());
+  return true;
+}
+
+// A request of the server skips the destructors of LLVM's statics when main
+// returns: they would write to, and so copy, much of the memory that it
+// shares with its worker.  Functions that the program registered with
+// atexit, like the profile writer, run before this.  When exit is called
+// before main returns, the status is unknown, and the process exits as
+// usual.
+void exitRequest() {
+  if (!mainStatus)
+    return;
+  std::cout.flush();
+  llvm::outs().flush();
+  std::fflush(nullptr);
+  std::_Exit(*mainStatus);
+}
+
+// Dumps of the syntax tree and IR are on unless DUMP is set to 0.
+bool readDumpSetting() {
+  const char *envVarValue = std::getenv("DUMP");
+  return envVarValue == nullptr || std::atoi(envVarValue) != 0;
+}
+
+void dumpSyntax(const BuildSettings &settings, const Program &program,
+                const std::string &srcFilename) {
+  if (!settings.dump)
     return;
   // std::string filename(srcFilename + ".syn");
   // std::ofstream out(filename);
@@ -231,9 +1260,9 @@ void dumpSyntax(const Program &program, const std::string &srcFilename) {
   std::ofstream astOut(astFilename);
   printAST(astOut, program);
 }
-void dumpIR(llvm::Module &module, const std::string &srcFilename,
-            const char *what) {
-  if (dumpIt == 0) {
+void dumpIR(const BuildSettings &settings, llvm::Module &module,
+            const std::string &srcFilename, const char *what) {
+  if (!settings.dump) {
     return;
   }
   const std::string filename(srcFilename + "." + what + ".ll");
@@ -242,10 +1271,20 @@ void dumpIR(llvm::Module &module, const std::string &srcFilename,
   out << module;
 }
 
-void emitObjectFile(llvm::Module *module, const std::string &filename) {
+void dumpMir(const BuildSettings &settings, const mir::Module &module,
+             const std::string &srcFilename, const char *what) {
+  if (!settings.dump)
+    return;
+  std::ofstream out(srcFilename + "." + what + ".mir");
+  mir::Print(out, module);
+}
+
+// Create a target machine for the host, with a generic CPU so that object
+// files run on any machine of the same architecture.
+std::unique_ptr<llvm::TargetMachine>
+createTargetMachine(const llvm::TargetOptions &targetOptions) {
   // Initialize target information
   std::string targetTriple = llvm::sys::getDefaultTargetTriple();
-  module->setTargetTriple(targetTriple);
 
   // Look up the target
   std::string error;
@@ -260,10 +1299,7 @@ void emitObjectFile(llvm::Module *module, const std::string &filename) {
   std::string cpu = "generic";
   std::string features = "";
 
-  TargetOptions opt;
-  auto TheTargetMachine = target->createTargetMachine(
-      targetTriple, cpu, features, opt, Reloc::PIC_);
-
+  TargetOptions opt = targetOptions;
   std::unique_ptr<llvm::TargetMachine> targetMachine(
       target->createTargetMachine(targetTriple, cpu, features, opt, Reloc::PIC_,
                                   std::nullopt,
@@ -272,19 +1308,14 @@ void emitObjectFile(llvm::Module *module, const std::string &filename) {
     llvm::errs() << "Error: Could not create target machine\n";
     exit(1);
   }
+  return targetMachine;
+}
 
-  // Open the output file
-  std::error_code ec;
-  llvm::raw_fd_ostream dest(filename, ec, llvm::sys::fs::OF_None);
-  if (ec) {
-    llvm::errs() << "Error: Could not open file " << filename << ": "
-                 << ec.message() << "\n";
-    exit(1);
-  }
-
+void emitObject(llvm::Module *module, llvm::TargetMachine *targetMachine,
+                llvm::raw_pwrite_stream &out) {
   // Set up the pass manager to emit object code
   llvm::legacy::PassManager passManager;
-  if (targetMachine->addPassesToEmitFile(passManager, dest, nullptr,
+  if (targetMachine->addPassesToEmitFile(passManager, out, nullptr,
                                          llvm::CGFT_ObjectFile)) {
     llvm::errs() << "Error: Target machine cannot emit an object file\n";
     exit(1);
@@ -292,37 +1323,28 @@ void emitObjectFile(llvm::Module *module, const std::string &filename) {
 
   // Run the passes to emit the object file
   passManager.run(*module);
-  dest.flush();
-
-  // Close the file
-  dest.close();
 }
 
-int runViaJIT(std::unique_ptr<llvm::Module> module) {
-  std::string errStr;
-  auto *engine = llvm::EngineBuilder(std::move(module))
-                     .setErrorStr(&errStr)
-                     .setEngineKind(llvm::EngineKind::JIT)
-                     .create();
-
-  if (!engine) {
-    llvm::errs() << "JIT init failed: " << errStr << "\n";
+// Write the output to the given file, or to stdout if there is none.
+// Returns zero for success.
+int writeOutput(const std::string &filename, llvm::StringRef contents,
+                llvm::raw_ostream &errors) {
+  std::error_code ec;
+  llvm::raw_fd_ostream dest(filename.empty() ? "-" : filename, ec,
+                            llvm::sys::fs::OF_None);
+  if (ec) {
+    errors << "Error: Could not open file " << filename << ": "
+           << ec.message() << "\n";
     return 1;
   }
-
-  auto *mainFunc = engine->FindFunctionNamed("main");
-  if (!mainFunc) {
-    llvm::errs() << "Function 'main' not found\n";
+  dest << contents;
+  dest.close();
+  if (dest.has_error()) {
+    errors << "Error: Could not write file " << filename << ": "
+           << dest.error().message() << "\n";
+    dest.clear_error();
     return 1;
   }
-
-  engine->getTargetMachine()->setOptLevel(static_cast<CodeGenOpt::Level>(2));
-  // If we want to pass the arguments from the command line to the function we
-  // can do it here
-  // std::vector<GenericValue> args(1);
-  // args[0].IntVal = APInt(32, 5);
-  std::vector<llvm::GenericValue> noargs;
-  llvm::GenericValue result = engine->runFunction(mainFunc, noargs);
   return 0;
 }
 
@@ -0,0 +1,307 @@
+// The runtime of the executables that moj links itself (-exe): the entry
+// point and the few C library functions that the generated code calls, on
+// top of Linux system calls, so that the executables need no C library.
+//
+// printf only knows the conversions that codegen emits (%d, %f and %s),
+// and prints them like the C library does.  Output is buffered, and
+// flushed at each newline if it goes to a terminal.  x86-64 only.
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "The moj runtime supports x86-64 Linux only"
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+int main(int argc);
+void exit(int status);
+
+// System calls.
+
+static long syscall3(long number, long a, long b, long c) {
+  long result;
+  __asm__ volatile("syscall"
+                   : "=a"(result)
+                   : "a"(number), "D"(a), "S"(b), "d"(c)
+                   : "rcx", "r11", "memory");
+  return result;
+}
+
+enum { kSysWrite = 1, kSysIoctl = 16, kSysExitGroup = 231 };
+enum { kTCGETS = 0x5401 };
+
+// Entry point.
+
+__asm__(".text\n"
+        ".global _start\n"
+        "_start:\n"
+        "  xor %ebp, %ebp\n"
+        "  mov %rsp, %rdi\n"
+        "  and $-16, %rsp\n"
+        "  call __moj_start\n"
+        "  hlt\n");
+
+// The stack that the kernel sets up starts with argc.
+void __moj_start(long *stack) { exit(main((int)stack[0])); }
+
+// Output.
+
+static char buffer[4096];
+static size_t bufferSize;
+// Whether stdout is a terminal, once it's known: -1 for not yet.
+static int isTerminal = -1;
+
+static void flush(void) {
+  const char *data = buffer;
+  while (bufferSize > 0) {
+    long written = syscall3(kSysWrite, 1, (long)data, (long)bufferSize);
+    // An interrupted write is retried; any other error drops the output,
+    // like it does for a C library.
+    if (written == -4)
+      continue;
+    if (written < 0)
+      break;
+    data += written;
+    bufferSize -= (size_t)written;
+  }
+  bufferSize = 0;
+}
+
+static void put(char c) {
+  if (bufferSize == sizeof(buffer))
+    flush();
+  buffer[bufferSize++] = c;
+}
+
+static size_t putString(const char *s) {
+  size_t length = 0;
+  for (; s[length]; ++length)
+    put(s[length]);
+  return length;
+}
+
+static size_t putInt(int value) {
+  char digits[11];
+  size_t numDigits = 0;
+  // Negated as unsigned, so that INT_MIN works.
+  unsigned magnitude = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+  do {
+    digits[numDigits++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  size_t length = numDigits;
+  if (value < 0) {
+    put('-');
+    ++length;
+  }
+  while (numDigits)
+    put(digits[--numDigits]);
+  return length;
+}
+
+// Doubles are printed exactly, rounded to six decimals, half to even.  The
+// integer part is a big number in base 10^9, with the least significant
+// limb first, and the fraction a string of decimal digits.
+
+enum { kNumLimbs = 36, kMaxFractionDigits = 1075 };
+
+static void addOne(uint32_t *limbs, int *numLimbs) {
+  for (int i = 0; i < *numLimbs; ++i) {
+    if (++limbs[i] < 1000000000u)
+      return;
+    limbs[i] = 0;
+  }
+  limbs[(*numLimbs)++] = 1;
+}
+
+static size_t putDouble(double value) {
+  union {
+    double d;
+    uint64_t bits;
+  } u = {value};
+  size_t length = 0;
+  if (u.bits >> 63) {
+    put('-');
+    ++length;
+  }
+  int exponent = (int)(u.bits >> 52 & 0x7ff);
+  uint64_t mantissa = u.bits & (((uint64_t)1 << 52) - 1);
+  if (exponent == 0x7ff)
+    return length + putString(mantissa ? "nan" : "inf");
+  if (exponent)
+    mantissa |= (uint64_t)1 << 52;
+  else
+    exponent = 1;
+  // value = mantissa * 2^shift
+  int shift = exponent - 1075;
+
+  uint32_t limbs[kNumLimbs];
+  int numLimbs = 0;
+  static char fraction[kMaxFractionDigits + 1];
+  int numFractionDigits = 0;
+  if (shift >= 0) {
+    limbs[numLimbs++] = (uint32_t)(mantissa % 1000000000u);
+    limbs[numLimbs++] = (uint32_t)(mantissa / 1000000000u % 1000000000u);
+    limbs[numLimbs++] = (uint32_t)(mantissa / 1000000000u / 1000000000u);
+    for (; shift > 0; --shift) {
+      uint32_t carry = 0;
+      for (int i = 0; i < numLimbs; ++i) {
+        uint32_t doubled = limbs[i] * 2 + carry;
+        carry = doubled >= 1000000000u;
+        limbs[i] = doubled - carry * 1000000000u;
+      }
+      if (carry)
+        limbs[numLimbs++] = 1;
+    }
+  } else {
+    int numBits = -shift;
+    uint64_t integer = numBits < 64 ? mantissa >> numBits : 0;
+    limbs[numLimbs++] = (uint32_t)(integer % 1000000000u);
+    limbs[numLimbs++] = (uint32_t)(integer / 1000000000u % 1000000000u);
+    // The fraction is built from its lowest bit up: each bit is added in
+    // front of it and the whole halved.
+    for (int bit = 0; bit < numBits; ++bit) {
+      int carry = bit < 64 && (mantissa >> bit & 1) ? 10 : 0;
+      for (int i = 0; i < numFractionDigits; ++i) {
+        int digit = carry + fraction[i];
+        fraction[i] = (char)(digit / 2);
+        carry = digit % 2 * 10;
+      }
+      if (carry)
+        fraction[numFractionDigits++] = 5;
+    }
+  }
+  while (numLimbs > 1 && limbs[numLimbs - 1] == 0)
+    --numLimbs;
+  for (int i = numFractionDigits; i < 7; ++i)
+    fraction[i] = 0;
+
+  // Round to six decimals.
+  int roundUp = fraction[6] > 5;
+  if (fraction[6] == 5) {
+    int exact = 1;
+    for (int i = 7; i < numFractionDigits; ++i)
+      exact &= fraction[i] == 0;
+    roundUp = !exact || fraction[5] % 2;
+  }
+  if (roundUp) {
+    int i = 5;
+    for (; i >= 0 && fraction[i] == 9; --i)
+      fraction[i] = 0;
+    if (i >= 0)
+      ++fraction[i];
+    else
+      addOne(limbs, &numLimbs);
+  }
+
+  length += putInt((int)limbs[numLimbs - 1]);
+  for (int i = numLimbs - 2; i >= 0; --i) {
+    for (uint32_t scale = 100000000u; scale; scale /= 10)
+      put((char)('0' + limbs[i] / scale % 10));
+    length += 9;
+  }
+  put('.');
+  for (int i = 0; i < 6; ++i)
+    put((char)('0' + fraction[i]));
+  return length + 7;
+}
+
+int printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t length = 0;
+  int newline = 0;
+  for (const char *p = format; *p; ++p) {
+    if (*p != '%') {
+      put(*p);
+      newline |= *p == '\n';
+      ++length;
+      continue;
+    }
+    switch (*++p) {
+    case 'd':
+      length += putInt(va_arg(args, int));
+      break;
+    case 'f':
+      length += putDouble(va_arg(args, double));
+      break;
+    case 's':
+      length += putString(va_arg(args, const char *));
+      break;
+    default:
+      put('%');
+      ++length;
+      if (!*p)
+        --p;
+      else if (*p != '%') {
+        put(*p);
+        ++length;
+      }
+      break;
+    }
+  }
+  va_end(args);
+
+  if (newline) {
+    if (isTerminal < 0) {
+      char termios[64];
+      isTerminal = syscall3(kSysIoctl, 1, kTCGETS, (long)termios) == 0;
+    }
+    if (isTerminal)
+      flush();
+  }
+  return (int)length;
+}
+
+// The optimizer turns calls of printf with constant strings into these.
+
+int puts(const char *s) {
+  size_t length = putString(s);
+  return printf("\n") + (int)length;
+}
+
+int putchar(int c) {
+  if (c == '\n')
+    return printf("\n") ? c : -1;
+  put((char)c);
+  return c;
+}
+
+void exit(int status) {
+  flush();
+  syscall3(kSysExitGroup, status, 0, 0);
+  __builtin_unreachable();
+}
+
+// Functions that the optimizer may call.
+
+void *memset(void *destination, int c, size_t size) {
+  void *d = destination;
+  __asm__ volatile("rep stosb" : "+D"(d), "+c"(size) : "a"(c) : "memory");
+  return destination;
+}
+
+void *memcpy(void *destination, const void *source, size_t size) {
+  void *d = destination;
+  __asm__ volatile("rep movsb"
+                   : "+D"(d), "+S"(source), "+c"(size)
+                   :
+                   : "memory");
+  return destination;
+}
+
+void *memmove(void *destination, const void *source, size_t size) {
+  if ((uintptr_t)destination - (uintptr_t)source >= size)
+    return memcpy(destination, source, size);
+  // Overlapping with the source before the destination: copy backwards.
+  void *d = (char *)destination + size - 1;
+  source = (const char *)source + size - 1;
+  __asm__ volatile("std\n"
+                   "rep movsb\n"
+                   "cld"
+                   : "+D"(d), "+S"(source), "+c"(size)
+                   :
+                   : "memory");
+  return destination;
+}
@@ -0,0 +1,959 @@
+#include "Analysis.h"
+#include "Exp.h"
+#include "FuncDef.h"
+#include "Program.h"
+#include "Stmt.h"
+#include "Visitor.h"
+
+#include <vector>
+
+namespace {
+
+// Check whether the expression only consists of literals and builtin
+// operators, in which case Codegen folds it into a constant.
+bool isConstantExp(const Exp &exp) {
+  if (dynamic_cast<const IntExp *>(&exp) ||
+      dynamic_cast<const BoolExp *>(&exp) ||
+      dynamic_cast<const FloatExp *>(&exp))
+    return true;
+
+  const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+  if (!callExp || callExp->getFuncDef() == nullptr ||
+      !callExp->getFuncDef()->isBuiltin() || callExp->getFuncName() == "print")
+    return false;
+
+  for (const ExpPtr &arg : callExp->getArgs()) {
+    if (!isConstantExp(*arg))
+      return false;
+  }
+  return true;
+}
+
+// Check whether the expression is an integer operation that traps on
+// overflow when arithmetic is checked.
+bool isCheckedArithmetic(const CallExp &exp) {
+  const std::string &funcName = exp.getFuncName();
+  return exp.getType() == kTypeInt &&
+         (funcName == "+" || funcName == "-" || funcName == "*");
+}
+
+// Collects the local facts of a single function body: direct callees, side
+// effects and loops. The visitors operate on non-const nodes, so we must
+// const_cast when dispatching.
+class FuncScanner : public ExpVisitor, public StmtVisitor {
+public:
+  FuncScanner(const AnalysisOptions *options, FuncInfo *info)
+      : m_options(options), m_info(info) {}
+
+  void Scan(const Exp &exp) { const_cast<Exp &>(exp).Dispatch(*this); }
+
+  void Scan(const Stmt &stmt) { const_cast<Stmt &>(stmt).Dispatch(*this); }
+
+  void *Visit(BoolExp &exp) override { return nullptr; }
+
+  void *Visit(IntExp &exp) override { return nullptr; }
+
+  void *Visit(FloatExp &exp) override { return nullptr; }
+
+  void *Visit(VarExp &exp) override { return nullptr; }
+
+  void *Visit(ArrayAccessExp &exp) override {
+    Scan(*exp.getIndexExp());
+    checkedArrayAccess();
+    return nullptr;
+  }
+
+  void *Visit(CallExp &exp) override {
+    for (const ExpPtr &arg : exp.getArgs())
+      Scan(*arg);
+
+    const FuncDef *funcDef = exp.getFuncDef();
+    assert(funcDef && "Expected typechecked call");
+    if (!funcDef->isBuiltin())
+      m_info->callees.insert(funcDef);
+    else if (exp.getFuncName() == "print")
+      m_info->hasSideEffects = true;
+    else if (m_options->trapOnOverflow && isCheckedArithmetic(exp))
+      m_info->mayNotReturn = true;
+    return nullptr;
+  }
+
+  void Visit(CallStmt &stmt) override { Scan(stmt.GetCallExp()); }
+
+  void Visit(AssignStmt &stmt) override { Scan(stmt.GetRvalue()); }
+
+  void Visit(ArrayAssignStmt &stmt) override {
+    Scan(*stmt.getIndexExp());
+    Scan(stmt.GetRvalue());
+    checkedArrayAccess();
+  }
+
+  void Visit(DeclStmt &stmt) override {
+    const VarDecl *varDecl = stmt.GetVarDecl();
+    if (varDecl->GetIsArray()) {
+      m_info->declaresArrays = true;
+      const Exp &sizeExp = varDecl->getVariable().getArraySizeExp();
+      Scan(sizeExp);
+      // A non-constant array size is checked at runtime, and a bad size
+      // terminates the program.
+      if (!isConstantExp(sizeExp)) {
+        m_info->hasSideEffects = true;
+        m_info->mayNotReturn = true;
+      }
+    }
+    if (stmt.HasInitExp())
+      Scan(stmt.GetInitExp());
+  }
+
+  void Visit(ReturnStmt &stmt) override {
+    m_info->returns.insert(&stmt);
+    Scan(stmt.GetExp());
+  }
+
+  void Visit(SeqStmt &seq) override {
+    for (const StmtPtr &stmt : seq.Get())
+      Scan(*stmt);
+  }
+
+  void Visit(IfStmt &stmt) override {
+    Scan(stmt.getCondExp());
+    Scan(stmt.getThenStmt());
+    if (stmt.hasElseStmt())
+      Scan(stmt.getElseStmt());
+  }
+
+  void Visit(WhileStmt &stmt) override {
+    m_info->mayNotReturn = true;
+    Scan(stmt.GetCondExp());
+    Scan(stmt.GetBodyStmt());
+  }
+
+  void Visit(ForStmt &stmt) override {
+    m_info->mayNotReturn = true;
+    if (stmt.HasInitStmt())
+      Scan(stmt.GetInitStmt());
+    if (stmt.HasCondExp())
+      Scan(stmt.GetCondExp());
+    if (stmt.HasUpdateStmt())
+      Scan(stmt.GetUpdateStmt());
+    if (stmt.HasBodyStmt())
+      Scan(stmt.GetBodyStmt());
+  }
+
+private:
+  const AnalysisOptions *m_options;
+  FuncInfo *m_info;
+
+  // A failed bounds check terminates the program, and it may print.
+  void checkedArrayAccess() {
+    if (m_options->checkArrayBounds)
+      m_info->mayNotReturn = true;
+    if (m_options->diagnoseArrayBounds)
+      m_info->hasSideEffects = true;
+  }
+};
+
+// Check whether evaluating the expression might print or terminate the
+// program, which means it can't be reordered with other calls.
+bool hasSideEffects(const Exp &exp, const FuncInfoTable &table) {
+  if (const auto *arrayExp = dynamic_cast<const ArrayAccessExp *>(&exp))
+    return hasSideEffects(*arrayExp->getIndexExp(), table);
+
+  const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+  if (!callExp)
+    return false;
+
+  const FuncDef *funcDef = callExp->getFuncDef();
+  if (!funcDef->isBuiltin() ? table.at(funcDef).hasSideEffects
+                            : callExp->getFuncName() == "print")
+    return true;
+
+  for (const ExpPtr &arg : callExp->getArgs()) {
+    if (hasSideEffects(*arg, table))
+      return true;
+  }
+  return false;
+}
+
+// Get the call if the expression is a direct call to the given function.
+const CallExp *asCallTo(const Exp &exp, const FuncDef *funcDef) {
+  const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+  return callExp && callExp->getFuncDef() == funcDef ? callExp : nullptr;
+}
+
+// Check whether a return statement of the given function is tail recursive,
+// filling in the details if it is.  An operand may only be combined with the
+// recursive call through integer "+" or "*", which are associative and
+// commutative (integer arithmetic wraps), and it must be free of side effects
+// when it follows the call, since it will be evaluated first.
+bool classifyReturn(const ReturnStmt &stmt, const FuncDef *funcDef,
+                    const FuncInfoTable &table, TailRecursiveReturn *result,
+                    std::string *op) {
+  const Exp &exp = stmt.GetExp();
+  if ((result->call = asCallTo(exp, funcDef)))
+    return true;
+
+  const auto *opExp = dynamic_cast<const CallExp *>(&exp);
+  if (!opExp || opExp->getType() != kTypeInt || opExp->getArgs().size() != 2 ||
+      (opExp->getFuncName() != "+" && opExp->getFuncName() != "*"))
+    return false;
+
+  const Exp &lhs = *opExp->getArgs()[0];
+  const Exp &rhs = *opExp->getArgs()[1];
+  if (lhs.getType() != kTypeInt || rhs.getType() != kTypeInt)
+    return false;
+
+  if ((result->call = asCallTo(rhs, funcDef))) {
+    result->operand = &lhs;
+    result->operandFirst = true;
+  } else if ((result->call = asCallTo(lhs, funcDef)) &&
+             !hasSideEffects(rhs, table)) {
+    result->operand = &rhs;
+    result->operandFirst = false;
+  } else {
+    return false;
+  }
+  *op = opExp->getFuncName();
+  return true;
+}
+
+// Select the tail recursive returns of a function that Codegen lowers to a
+// loop.  Arrays are allocated where they are declared, so a loop would grow
+// the stack just like the recursion, and accumulating returns can only be
+// lowered if they all use the same operator (and reassociation is allowed).
+void findTailRecursion(const FuncDef *funcDef, const FuncInfoTable &table,
+                       bool reassociateIntegers, FuncInfo *info) {
+  if (info->declaresArrays)
+    return;
+
+  std::set<std::string> ops;
+  for (const ReturnStmt *stmt : info->returns) {
+    TailRecursiveReturn tailReturn;
+    std::string op;
+    if (classifyReturn(*stmt, funcDef, table, &tailReturn, &op)) {
+      info->tailRecursiveReturns[stmt] = tailReturn;
+      if (!op.empty())
+        ops.insert(op);
+    }
+  }
+
+  if (ops.size() == 1 && reassociateIntegers) {
+    info->accumulatorOp = *ops.begin();
+    return;
+  }
+
+  // Without a common operator only the plain calls are lowered.
+  for (auto it = info->tailRecursiveReturns.begin();
+       it != info->tailRecursiveReturns.end();) {
+    if (it->second.operand)
+      it = info->tailRecursiveReturns.erase(it);
+    else
+      ++it;
+  }
+}
+
+// Check whether the target function is reachable from the callees of the
+// given function.
+bool reaches(const FuncInfoTable &table, const FuncDef *from,
+             const FuncDef *target) {
+  std::set<const FuncDef *> visited;
+  std::vector<const FuncDef *> worklist(table.at(from).callees.begin(),
+                                        table.at(from).callees.end());
+  while (!worklist.empty()) {
+    const FuncDef *funcDef = worklist.back();
+    worklist.pop_back();
+    if (funcDef == target)
+      return true;
+    if (!visited.insert(funcDef).second)
+      continue;
+    auto it = table.find(funcDef);
+    if (it != table.end())
+      worklist.insert(worklist.end(), it->second.callees.begin(),
+                      it->second.callees.end());
+  }
+  return false;
+}
+
+// The bounds check analysis matches expressions structurally.  A VarExp
+// must be told apart from an ArrayAccessExp, which derives from it.
+const VarDecl *asVariable(const Exp &exp) {
+  if (dynamic_cast<const ArrayAccessExp *>(&exp))
+    return nullptr;
+  const auto *varExp = dynamic_cast<const VarExp *>(&exp);
+  return varExp ? varExp->getVarDecl() : nullptr;
+}
+
+// Check whether the expression is an integer literal, getting its value.
+bool asIntLiteral(const Exp &exp, int64_t *value) {
+  const auto *intExp = dynamic_cast<const IntExp *>(&exp);
+  if (intExp)
+    *value = intExp->getValue();
+  return intExp != nullptr;
+}
+
+// Get the call if the expression is a call to a builtin operator with the
+// given name.
+const CallExp *asBuiltin(const Exp &exp, const std::string &funcName) {
+  const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+  return callExp && callExp->getFuncName() == funcName &&
+                 callExp->getFuncDef()->isBuiltin()
+             ? callExp
+             : nullptr;
+}
+
+// Get the call if the expression adds or subtracts two integers.
+const CallExp *asIntAddSub(const Exp &exp) {
+  const CallExp *callExp = asBuiltin(exp, "+");
+  if (!callExp)
+    callExp = asBuiltin(exp, "-");
+  if (!callExp || callExp->getArgs().size() != 2 ||
+      callExp->getArgs()[0]->getType() != kTypeInt ||
+      callExp->getArgs()[1]->getType() != kTypeInt)
+    return nullptr;
+  return callExp;
+}
+
+// Get the statement if it assigns a scalar variable.
+const AssignStmt *asScalarAssign(const Stmt &stmt) {
+  if (dynamic_cast<const ArrayAssignStmt *>(&stmt))
+    return nullptr;
+  return dynamic_cast<const AssignStmt *>(&stmt);
+}
+
+// A loop "for (i = start; i < bound; i = i + 1)" (or "i <= bound") with a
+// constant start >= 0, whose body doesn't assign the induction variable.
+// Inside the body, i is in [start, bound - 1] (or [start, bound]).
+struct CanonicalLoop {
+  const ForStmt *stmt = nullptr;
+  const VarDecl *var = nullptr;
+  int64_t start = 0;
+  const Exp *bound = nullptr;
+  bool inclusive = false;
+
+  // The body may print, return or not terminate.
+  bool hasEffects = false;
+};
+
+bool matchCanonicalLoop(const ForStmt &stmt, const FuncInfoTable *table,
+                        CanonicalLoop *loop);
+
+// Collects the variables a statement assigns and initializes, and whether
+// it does anything besides computing values in local variables and arrays.
+// A check can't be moved in front of such a statement.
+class BodyScanner : public ExpVisitor, public StmtVisitor {
+public:
+  explicit BodyScanner(const FuncInfoTable *table) : m_table(table) {}
+
+  void Scan(const Exp &exp) { const_cast<Exp &>(exp).Dispatch(*this); }
+
+  void Scan(const Stmt &stmt) { const_cast<Stmt &>(stmt).Dispatch(*this); }
+
+  std::set<const VarDecl *> assigned;
+  std::map<const VarDecl *, const Exp *> initializers;
+  bool hasEffects = false;
+
+  void *Visit(BoolExp &exp) override { return nullptr; }
+
+  void *Visit(IntExp &exp) override { return nullptr; }
+
+  void *Visit(FloatExp &exp) override { return nullptr; }
+
+  void *Visit(VarExp &exp) override { return nullptr; }
+
+  void *Visit(ArrayAccessExp &exp) override {
+    Scan(*exp.getIndexExp());
+    return nullptr;
+  }
+
+  void *Visit(CallExp &exp) override {
+    for (const ExpPtr &arg : exp.getArgs())
+      Scan(*arg);
+
+    const FuncDef *funcDef = exp.getFuncDef();
+    if (!funcDef->isBuiltin()) {
+      const FuncInfo &info = m_table->at(funcDef);
+      if (info.hasSideEffects || info.mayNotReturn)
+        hasEffects = true;
+    } else if (exp.getFuncName() == "print") {
+      hasEffects = true;
+    }
+    return nullptr;
+  }
+
+  void Visit(CallStmt &stmt) override { Scan(stmt.GetCallExp()); }
+
+  void Visit(AssignStmt &stmt) override {
+    assigned.insert(stmt.GetVarDecl());
+    Scan(stmt.GetRvalue());
+  }
+
+  void Visit(ArrayAssignStmt &stmt) override {
+    Scan(*stmt.getIndexExp());
+    Scan(stmt.GetRvalue());
+  }
+
+  void Visit(DeclStmt &stmt) override {
+    const VarDecl *varDecl = stmt.GetVarDecl();
+    if (varDecl->GetIsArray()) {
+      const Exp &sizeExp = varDecl->getVariable().getArraySizeExp();
+      Scan(sizeExp);
+      if (!isConstantExp(sizeExp))
+        hasEffects = true;
+    }
+    if (stmt.HasInitExp()) {
+      initializers[varDecl] = &stmt.GetInitExp();
+      Scan(stmt.GetInitExp());
+    }
+  }
+
+  void Visit(ReturnStmt &stmt) override {
+    hasEffects = true;
+    Scan(stmt.GetExp());
+  }
+
+  void Visit(SeqStmt &seq) override {
+    for (const StmtPtr &stmt : seq.Get())
+      Scan(*stmt);
+  }
+
+  void Visit(IfStmt &stmt) override {
+    Scan(stmt.getCondExp());
+    Scan(stmt.getThenStmt());
+    if (stmt.hasElseStmt())
+      Scan(stmt.getElseStmt());
+  }
+
+  void Visit(WhileStmt &stmt) override {
+    hasEffects = true;
+    Scan(stmt.GetCondExp());
+    Scan(stmt.GetBodyStmt());
+  }
+
+  void Visit(ForStmt &stmt) override {
+    // Only canonical loops are known to terminate.
+    CanonicalLoop loop;
+    if (!matchCanonicalLoop(stmt, m_table, &loop))
+      hasEffects = true;
+    if (stmt.HasInitStmt())
+      Scan(stmt.GetInitStmt());
+    if (stmt.HasCondExp())
+      Scan(stmt.GetCondExp());
+    if (stmt.HasUpdateStmt())
+      Scan(stmt.GetUpdateStmt());
+    if (stmt.HasBodyStmt())
+      Scan(stmt.GetBodyStmt());
+  }
+
+private:
+  const FuncInfoTable *m_table;
+};
+
+bool matchCanonicalLoop(const ForStmt &stmt, const FuncInfoTable *table,
+                        CanonicalLoop *loop) {
+  if (!stmt.HasInitStmt() || !stmt.HasCondExp() || !stmt.HasUpdateStmt() ||
+      !stmt.HasBodyStmt())
+    return false;
+
+  // int i = start, or i = start
+  const Exp *startExp = nullptr;
+  if (const auto *declStmt = dynamic_cast<const DeclStmt *>(
+          &stmt.GetInitStmt())) {
+    if (declStmt->HasInitExp()) {
+      loop->var = declStmt->GetVarDecl();
+      startExp = &declStmt->GetInitExp();
+    }
+  } else if (const AssignStmt *assignStmt =
+                 asScalarAssign(stmt.GetInitStmt())) {
+    loop->var = assignStmt->GetVarDecl();
+    startExp = &assignStmt->GetRvalue();
+  }
+  if (!loop->var || loop->var->GetType() != kTypeInt ||
+      loop->var->GetIsArray() || !asIntLiteral(*startExp, &loop->start) ||
+      loop->start < 0)
+    return false;
+
+  // i < bound, or i <= bound
+  const CallExp *condExp = asBuiltin(stmt.GetCondExp(), "<");
+  loop->inclusive = !condExp;
+  if (!condExp)
+    condExp = asBuiltin(stmt.GetCondExp(), "<=");
+  if (!condExp || asVariable(*condExp->getArgs()[0]) != loop->var ||
+      condExp->getArgs()[1]->getType() != kTypeInt)
+    return false;
+  loop->bound = condExp->getArgs()[1].get();
+
+  // i = i + 1, or i = 1 + i
+  const AssignStmt *updateStmt = asScalarAssign(stmt.GetUpdateStmt());
+  if (!updateStmt || updateStmt->GetVarDecl() != loop->var)
+    return false;
+  const CallExp *addExp = asIntAddSub(updateStmt->GetRvalue());
+  if (!addExp || addExp->getFuncName() != "+")
+    return false;
+  const Exp &lhs = *addExp->getArgs()[0];
+  const Exp &rhs = *addExp->getArgs()[1];
+  int64_t step = 0;
+  if (!(asVariable(lhs) == loop->var && asIntLiteral(rhs, &step)) &&
+      !(asVariable(rhs) == loop->var && asIntLiteral(lhs, &step)))
+    return false;
+  if (step != 1)
+    return false;
+
+  BodyScanner body(table);
+  body.Scan(stmt.GetBodyStmt());
+  loop->stmt = &stmt;
+  loop->hasEffects = body.hasEffects;
+  return body.assigned.count(loop->var) == 0;
+}
+
+// A symbolic integer value base + offset, where the base is a variable that
+// holds a single value, or null for a constant.
+struct Bound {
+  const VarDecl *base = nullptr;
+  int64_t offset = 0;
+};
+
+// Add or subtract two bounds, which is only possible if at most one of them
+// has a base and the subtracted one doesn't.
+bool combineBounds(const Bound &lhs, const Bound &rhs, bool subtract,
+                   Bound *result) {
+  if (rhs.base && (lhs.base || subtract))
+    return false;
+  result->base = lhs.base ? lhs.base : rhs.base;
+  result->offset = subtract ? lhs.offset - rhs.offset : lhs.offset + rhs.offset;
+  return true;
+}
+
+// Decides how each array access of a function is checked: not at all if its
+// index is provably in bounds, once before the innermost enclosing loop if
+// that doesn't change what the program does, or in place otherwise.
+//
+// An index is in bounds if its lower bound is >= 0 and its upper bound is
+// below the size of the array, where both the upper bound and the size are
+// expressed in terms of the same variable.  Induction variables of canonical
+// loops are bounded by their loop conditions.
+class ArrayCheckScanner : public ExpVisitor, public StmtVisitor {
+public:
+  ArrayCheckScanner(const FuncDef &funcDef, const FuncInfoTable *table,
+                    bool diagnose, FuncInfo *info)
+      : m_table(table), m_diagnose(diagnose), m_info(info) {
+    // Parameters are never assigned, and locals that are initialized but
+    // never assigned keep their value for as long as they are in scope.
+    BodyScanner body(table);
+    body.Scan(funcDef.GetBody());
+    for (const VarDeclPtr &param : funcDef.getParams())
+      m_constants.insert(param.get());
+    for (const auto &entry : body.initializers) {
+      if (!body.assigned.count(entry.first)) {
+        m_constants.insert(entry.first);
+        m_initializers.insert(entry);
+      }
+    }
+  }
+
+  void Scan(const Exp &exp) { const_cast<Exp &>(exp).Dispatch(*this); }
+
+  void Scan(const Stmt &stmt) { const_cast<Stmt &>(stmt).Dispatch(*this); }
+
+  void *Visit(BoolExp &exp) override { return nullptr; }
+
+  void *Visit(IntExp &exp) override { return nullptr; }
+
+  void *Visit(FloatExp &exp) override { return nullptr; }
+
+  void *Visit(VarExp &exp) override { return nullptr; }
+
+  void *Visit(ArrayAccessExp &exp) override {
+    Scan(*exp.getIndexExp());
+    checkAccess(exp.getVarDecl(), *exp.getIndexExp());
+    return nullptr;
+  }
+
+  void *Visit(CallExp &exp) override {
+    const std::vector<ExpPtr> &args = exp.getArgs();
+    if (asBuiltin(exp, "&&") || asBuiltin(exp, "||")) {
+      // The right operand is only evaluated conditionally.
+      Scan(*args[0]);
+      ++m_conditional;
+      Scan(*args[1]);
+      --m_conditional;
+    } else {
+      for (const ExpPtr &arg : args)
+        Scan(*arg);
+    }
+    return nullptr;
+  }
+
+  void Visit(CallStmt &stmt) override { Scan(stmt.GetCallExp()); }
+
+  void Visit(AssignStmt &stmt) override { Scan(stmt.GetRvalue()); }
+
+  void Visit(ArrayAssignStmt &stmt) override {
+    Scan(*stmt.getIndexExp());
+    Scan(stmt.GetRvalue());
+    checkAccess(stmt.GetVarDecl(), *stmt.getIndexExp());
+  }
+
+  void Visit(DeclStmt &stmt) override {
+    const VarDecl *varDecl = stmt.GetVarDecl();
+    if (varDecl->GetIsArray()) {
+      // The array doesn't exist before the loops it is declared in.
+      for (ActiveLoop &loop : m_loops)
+        loop.arrays.insert(varDecl);
+      Scan(varDecl->getVariable().getArraySizeExp());
+    }
+    if (stmt.HasInitExp())
+      Scan(stmt.GetInitExp());
+  }
+
+  void Visit(ReturnStmt &stmt) override { Scan(stmt.GetExp()); }
+
+  void Visit(SeqStmt &seq) override {
+    for (const StmtPtr &stmt : seq.Get())
+      Scan(*stmt);
+  }
+
+  void Visit(IfStmt &stmt) override {
+    Scan(stmt.getCondExp());
+    ++m_conditional;
+    Scan(stmt.getThenStmt());
+    if (stmt.hasElseStmt())
+      Scan(stmt.getElseStmt());
+    --m_conditional;
+  }
+
+  void Visit(WhileStmt &stmt) override {
+    ++m_conditional;
+    Scan(stmt.GetCondExp());
+    Scan(stmt.GetBodyStmt());
+    --m_conditional;
+  }
+
+  void Visit(ForStmt &stmt) override {
+    if (stmt.HasInitStmt())
+      Scan(stmt.GetInitStmt());
+    if (stmt.HasCondExp())
+      Scan(stmt.GetCondExp());
+
+    ActiveLoop loop;
+    if (!matchCanonicalLoop(stmt, m_table, &loop)) {
+      ++m_conditional;
+      if (stmt.HasBodyStmt())
+        Scan(stmt.GetBodyStmt());
+      if (stmt.HasUpdateStmt())
+        Scan(stmt.GetUpdateStmt());
+      --m_conditional;
+      return;
+    }
+
+    // Accesses are unconditional if they happen in every iteration.
+    int conditional = m_conditional;
+    m_conditional = 0;
+    m_loops.push_back(loop);
+    Scan(stmt.GetBodyStmt());
+    loop = std::move(m_loops.back());
+    m_loops.pop_back();
+    m_conditional = conditional;
+
+    finishLoop(loop);
+    Scan(stmt.GetUpdateStmt());
+  }
+
+private:
+  // A canonical loop whose body is being scanned.
+  struct ActiveLoop : CanonicalLoop {
+    // Checks that can be hoisted in front of the loop, and their accesses.
+    std::vector<HoistedCheck> checks;
+    std::vector<const Exp *> accesses;
+
+    // Arrays declared in the body.
+    std::set<const VarDecl *> arrays;
+
+    // The body contains checks that aren't hoisted in front of this loop.
+    bool hasOtherChecks = false;
+  };
+
+  const FuncInfoTable *m_table;
+  bool m_diagnose;
+  FuncInfo *m_info;
+  std::set<const VarDecl *> m_constants;
+  std::map<const VarDecl *, const Exp *> m_initializers;
+  std::vector<ActiveLoop> m_loops;
+
+  // Number of enclosing conditions within the innermost loop.
+  int m_conditional = 0;
+
+  // Find the active loop with the given induction variable among the
+  // outermost ones, or return -1.
+  int findLoop(const VarDecl *varDecl, size_t depth) const {
+    for (size_t i = 0; i < depth; ++i) {
+      if (m_loops[i].var == varDecl)
+        return static_cast<int>(i);
+    }
+    return -1;
+  }
+
+  bool isConstantInt(const VarDecl *varDecl) const {
+    return varDecl->GetType() == kTypeInt && !varDecl->GetIsArray() &&
+           m_constants.count(varDecl);
+  }
+
+  // Get the value of a variable that holds a single value, in terms of the
+  // variables its initializer uses if possible.
+  void variableValue(const VarDecl *varDecl, Bound *result) const {
+    auto it = m_initializers.find(varDecl);
+    if (it == m_initializers.end() || !exactValue(*it->second, result))
+      *result = {varDecl, 0};
+  }
+
+  // Get the exact value of an integer expression.
+  bool exactValue(const Exp &exp, Bound *result) const {
+    if (asIntLiteral(exp, &result->offset)) {
+      result->base = nullptr;
+      return true;
+    }
+    if (const VarDecl *varDecl = asVariable(exp)) {
+      if (!isConstantInt(varDecl))
+        return false;
+      variableValue(varDecl, result);
+      return true;
+    }
+    const CallExp *callExp = asIntAddSub(exp);
+    Bound lhs, rhs;
+    return callExp && exactValue(*callExp->getArgs()[0], &lhs) &&
+           exactValue(*callExp->getArgs()[1], &rhs) &&
+           combineBounds(lhs, rhs, callExp->getFuncName() == "-", result);
+  }
+
+  // Get an upper bound of an integer expression inside the given number of
+  // outermost loops.
+  bool upperBound(const Exp &exp, size_t depth, Bound *result) const {
+    if (asIntLiteral(exp, &result->offset)) {
+      result->base = nullptr;
+      return true;
+    }
+    if (const VarDecl *varDecl = asVariable(exp)) {
+      int loopIndex = findLoop(varDecl, depth);
+      if (loopIndex < 0) {
+        if (!isConstantInt(varDecl))
+          return false;
+        variableValue(varDecl, result);
+        return true;
+      }
+      const ActiveLoop &loop = m_loops[loopIndex];
+      if (!upperBound(*loop.bound, loopIndex, result))
+        return false;
+      if (!loop.inclusive)
+        result->offset -= 1;
+      return true;
+    }
+
+    const CallExp *callExp = asIntAddSub(exp);
+    if (!callExp)
+      return false;
+    Bound lhs;
+    if (!upperBound(*callExp->getArgs()[0], depth, &lhs))
+      return false;
+    if (callExp->getFuncName() == "+") {
+      Bound rhs;
+      return upperBound(*callExp->getArgs()[1], depth, &rhs) &&
+             combineBounds(lhs, rhs, false, result);
+    }
+    Bound rhs;
+    return lowerBound(*callExp->getArgs()[1], depth, &rhs) &&
+           combineBounds(lhs, rhs, true, result);
+  }
+
+  // Get a lower bound of an integer expression inside the given number of
+  // outermost loops.
+  bool lowerBound(const Exp &exp, size_t depth, Bound *result) const {
+    if (asIntLiteral(exp, &result->offset)) {
+      result->base = nullptr;
+      return true;
+    }
+    if (const VarDecl *varDecl = asVariable(exp)) {
+      int loopIndex = findLoop(varDecl, depth);
+      if (loopIndex >= 0) {
+        *result = {nullptr, m_loops[loopIndex].start};
+        return true;
+      }
+      if (!isConstantInt(varDecl))
+        return false;
+      variableValue(varDecl, result);
+      return true;
+    }
+
+    const CallExp *callExp = asIntAddSub(exp);
+    Bound lhs, rhs;
+    if (!callExp || !lowerBound(*callExp->getArgs()[0], depth, &lhs))
+      return false;
+    if (callExp->getFuncName() == "+")
+      return lowerBound(*callExp->getArgs()[1], depth, &rhs) &&
+             combineBounds(lhs, rhs, false, result);
+    return upperBound(*callExp->getArgs()[1], depth, &rhs) &&
+           combineBounds(lhs, rhs, true, result);
+  }
+
+  // Check whether an expression has the same value in every iteration of the
+  // loop at the given depth (and can be evaluated in front of it).
+  bool isInvariant(const Exp &exp, size_t depth) const {
+    if (isConstantExp(exp))
+      return true;
+    if (const VarDecl *varDecl = asVariable(exp))
+      return m_constants.count(varDecl) || findLoop(varDecl, depth) >= 0;
+
+    const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+    if (!callExp || !callExp->getFuncDef()->isBuiltin() ||
+        callExp->getFuncName() == "print")
+      return false;
+    for (const ExpPtr &arg : callExp->getArgs()) {
+      if (!isInvariant(*arg, depth))
+        return false;
+    }
+    return true;
+  }
+
+  // Check whether the index is "i" or "i + offset" for the given variable.
+  static bool matchLoopIndex(const Exp &exp, const VarDecl *var,
+                             int64_t *offset) {
+    if (asVariable(exp) == var) {
+      *offset = 0;
+      return true;
+    }
+    const CallExp *callExp = asIntAddSub(exp);
+    if (!callExp || callExp->getFuncName() != "+")
+      return false;
+    const Exp &lhs = *callExp->getArgs()[0];
+    const Exp &rhs = *callExp->getArgs()[1];
+    return (asVariable(lhs) == var && asIntLiteral(rhs, offset)) ||
+           (asVariable(rhs) == var && asIntLiteral(lhs, offset));
+  }
+
+  // Check whether an index is in bounds of an array of the given size.  The
+  // size of an array is at least one, or the program exits where the array
+  // is declared.
+  bool isInBounds(const Exp &index, const Bound &size) const {
+    size_t depth = m_loops.size();
+    Bound low, high;
+    if (!lowerBound(index, depth, &low) || !upperBound(index, depth, &high))
+      return false;
+    bool lowInBounds =
+        low.base ? low.base == size.base && low.offset >= size.offset - 1
+                 : low.offset >= 0;
+    bool highInBounds =
+        high.base ? high.base == size.base && high.offset < size.offset
+                  : high.offset < (size.base ? 1 : size.offset);
+    return lowInBounds && highInBounds;
+  }
+
+  void checkAccess(const VarDecl *array, const Exp &index) {
+    Bound size;
+    if (exactValue(array->getVariable().getArraySizeExp(), &size) &&
+        isInBounds(index, size)) {
+      m_info->inBoundsAccesses.insert(&index);
+      return;
+    }
+    size_t depth = m_loops.size();
+    if (depth == 0)
+      return;
+
+    // The check can move in front of the loop if the access happens in every
+    // iteration, and nothing else in the loop can be observed before it.
+    ActiveLoop &loop = m_loops.back();
+    HoistedCheck check;
+    if (m_conditional == 0 && !loop.hasEffects && !loop.arrays.count(array) &&
+        matchLoopIndex(index, loop.var, &check.offset) && check.offset >= 0 &&
+        isInvariant(*loop.bound, depth - 1)) {
+      check.array = array;
+      check.bound = loop.bound;
+      check.inclusive = loop.inclusive;
+      check.start = loop.start;
+      loop.checks.push_back(check);
+      loop.accesses.push_back(&index);
+    } else {
+      loop.hasOtherChecks = true;
+    }
+  }
+
+  // Commit the hoisted checks of a loop.  A diagnostic names the first bad
+  // index, which is only known before the loop if no other check in it can
+  // fail first.
+  void finishLoop(const ActiveLoop &loop) {
+    bool hoist = !loop.checks.empty() &&
+                 (!m_diagnose || (loop.checks.size() == 1 &&
+                                  !loop.hasOtherChecks));
+    if (hoist) {
+      m_info->hoistedChecks[loop.stmt] = loop.checks;
+      m_info->hoistedAccesses.insert(loop.accesses.begin(),
+                                     loop.accesses.end());
+    }
+    // Either way, the checks are in the body of the enclosing loop.
+    if (!m_loops.empty() && (!loop.checks.empty() || loop.hasOtherChecks))
+      m_loops.back().hasOtherChecks = true;
+  }
+};
+
+} // namespace
+
+FuncInfoTable AnalyzeProgram(const Program &program,
+                             const AnalysisOptions &options) {
+  FuncInfoTable table;
+
+  // Collect the local facts of every function.  Nothing is known about the
+  // functions imported from other files.
+  for (const FuncDefPtr &funcDef : program.GetFunctions()) {
+    if (funcDef->isImported()) {
+      FuncInfo &info = table[funcDef.get()];
+      info.hasSideEffects = info.mayNotReturn = info.isRecursive = true;
+    }
+    if (!funcDef->hasBody())
+      continue;
+    FuncInfo &info = table[funcDef.get()];
+    FuncScanner(&options, &info).Scan(funcDef->GetBody());
+  }
+
+  for (auto &entry : table) {
+    if (!entry.first->hasBody())
+      continue;
+    entry.second.isRecursive = reaches(table, entry.first, entry.first);
+    if (entry.second.isRecursive)
+      entry.second.mayNotReturn = true;
+  }
+
+  // Propagate side effects and non-termination from callees to callers until
+  // nothing changes.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &entry : table) {
+      FuncInfo &info = entry.second;
+      for (const FuncDef *callee : info.callees) {
+        const FuncInfo &calleeInfo = table.at(callee);
+        if (calleeInfo.hasSideEffects && !info.hasSideEffects) {
+          info.hasSideEffects = true;
+          changed = true;
+        }
+        if (calleeInfo.mayNotReturn && !info.mayNotReturn) {
+          info.mayNotReturn = true;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  for (auto &entry : table) {
+    if (entry.second.isRecursive && entry.first->hasBody())
+      findTailRecursion(entry.first, table, !options.trapOnOverflow,
+                        &entry.second);
+  }
+
+  if (options.checkArrayBounds) {
+    for (auto &entry : table) {
+      if (!entry.first->hasBody())
+        continue;
+      ArrayCheckScanner(*entry.first, &table, options.diagnoseArrayBounds,
+                        &entry.second)
+          .Scan(entry.first->GetBody());
+    }
+  }
+  return table;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class CallExp;
+class Exp;
+class ForStmt;
+class FuncDef;
+class Program;
+class ReturnStmt;
+class VarDecl;
+
+// A return statement whose value is a call to the enclosing function, either
+// on its own ("return f(x - 1);") or combined with an operand through an
+// associative integer operator ("return x * f(x - 1);").
+struct TailRecursiveReturn {
+  const CallExp *call = nullptr;
+
+  // Operand combined with the result of the call (null for a plain call).
+  const Exp *operand = nullptr;
+
+  // Whether the operand comes before the call in the source.
+  bool operandFirst = false;
+};
+
+// A bounds check that Codegen emits before a loop
+// "for (i = start; i < bound; i = i + 1)" instead of checking the access
+// "array[i + offset]" in every iteration.  It checks the last index of the
+// loop, which covers all the others.
+struct HoistedCheck {
+  const VarDecl *array = nullptr;
+  const Exp *bound = nullptr;
+  bool inclusive = false; // the condition is "i <= bound"
+  int64_t start = 0;
+  int64_t offset = 0;
+};
+
+// Interprocedural facts about a user-defined function, computed from the
+// typechecked AST. Codegen turns them into LLVM function attributes.
+struct FuncInfo {
+  // Functions called directly from the body (builtins excluded).
+  std::set<const FuncDef *> callees;
+
+  // The function (or something it calls) prints or may terminate the program.
+  bool hasSideEffects = false;
+
+  // The function contains a loop, may recurse or may terminate the program,
+  // so we can't prove that it always returns to the caller.
+  bool mayNotReturn = false;
+
+  // The function can reach itself through the call graph.
+  bool isRecursive = false;
+
+  // Self-recursive returns that Codegen turns into jumps back to the start
+  // of the function. Empty if the function can't be lowered to a loop.
+  std::map<const ReturnStmt *, TailRecursiveReturn> tailRecursiveReturns;
+
+  // Operator ("+" or "*") that accumulates the operands of the tail recursive
+  // returns, or empty if all of them are plain calls.
+  std::string accumulatorOp;
+
+  // Array accesses (identified by their index expression) that are proven to
+  // be in bounds, so they aren't checked.
+  std::set<const Exp *> inBoundsAccesses;
+
+  // Array accesses that are covered by a check before the enclosing loop,
+  // and the checks of each loop.
+  std::set<const Exp *> hoistedAccesses;
+  std::map<const ForStmt *, std::vector<HoistedCheck>> hoistedChecks;
+
+  // Internal bookkeeping for the analysis.
+  std::set<const ReturnStmt *> returns;
+  bool declaresArrays = false;
+};
+
+// Maps function definitions (with a body) and imported functions to the
+// facts about them
+using FuncInfoTable = std::map<const FuncDef *, FuncInfo>;
+
+// The runtime checks that Codegen emits, which the analysis must respect.
+struct AnalysisOptions {
+  // Integer arithmetic traps on overflow.  Checked operations must stay in
+  // source order, so integer operands aren't accumulated out of order in
+  // tail recursive returns.
+  bool trapOnOverflow = false;
+
+  // Array indices are checked, and a bad one terminates the program.
+  bool checkArrayBounds = false;
+
+  // A failed bounds check prints a message before terminating.
+  bool diagnoseArrayBounds = false;
+};
+
+// Analyze every function definition in the given (typechecked) program.
+FuncInfoTable
+AnalyzeProgram(const Program &program,
+               const AnalysisOptions &options = AnalysisOptions());
@@ -0,0 +1,217 @@
+#include "Bytecode.h"
+
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+namespace bytecode {
+namespace {
+
+// The kinds of the operands of an opcode, one letter each: a register (r),
+// a code offset (t), a function (f) or an array name (n).
+const char *getOperandKinds(Opcode opcode) {
+  switch (opcode) {
+  case kJump:
+    return "t";
+  case kRet:
+    return "r";
+  case kJumpIf:
+  case kJumpIfNot:
+    return "rt";
+  case kJumpEqI:
+  case kJumpNeI:
+  case kJumpLtI:
+  case kJumpLeI:
+  case kJumpGtI:
+  case kJumpGeI:
+    return "rrt";
+  case kCheckDiagnose:
+    return "rrn";
+  case kCall:
+    return "rfr";
+  case kTailCall:
+    return "fr";
+  case kMov:
+  case kNegI:
+  case kNegIChecked:
+  case kNegF:
+  case kNot:
+  case kIntToFloat:
+  case kFloatToInt:
+  case kIntToBool:
+  case kFloatToBool:
+  case kNewArray:
+  case kCheck:
+  case kPrintI:
+  case kPrintF:
+  case kPrintB:
+    return "rr";
+  default:
+    return "rrr";
+  }
+}
+
+} // namespace
+
+const char *toString(Opcode opcode) {
+  switch (opcode) {
+  case kMov:
+    return "mov";
+  case kAddI:
+    return "add.i";
+  case kSubI:
+    return "sub.i";
+  case kMulI:
+    return "mul.i";
+  case kDivI:
+    return "div.i";
+  case kRemI:
+    return "rem.i";
+  case kNegI:
+    return "neg.i";
+  case kAddIChecked:
+    return "add.i.checked";
+  case kSubIChecked:
+    return "sub.i.checked";
+  case kMulIChecked:
+    return "mul.i.checked";
+  case kNegIChecked:
+    return "neg.i.checked";
+  case kAddF:
+    return "add.f";
+  case kSubF:
+    return "sub.f";
+  case kMulF:
+    return "mul.f";
+  case kDivF:
+    return "div.f";
+  case kNegF:
+    return "neg.f";
+  case kEqI:
+    return "eq.i";
+  case kNeI:
+    return "ne.i";
+  case kLtI:
+    return "lt.i";
+  case kLeI:
+    return "le.i";
+  case kGtI:
+    return "gt.i";
+  case kGeI:
+    return "ge.i";
+  case kEqF:
+    return "eq.f";
+  case kNeF:
+    return "ne.f";
+  case kLtF:
+    return "lt.f";
+  case kLeF:
+    return "le.f";
+  case kGtF:
+    return "gt.f";
+  case kGeF:
+    return "ge.f";
+  case kNot:
+    return "not";
+  case kIntToFloat:
+    return "itof";
+  case kFloatToInt:
+    return "ftoi";
+  case kIntToBool:
+    return "itob";
+  case kFloatToBool:
+    return "ftob";
+  case kJump:
+    return "jump";
+  case kJumpIf:
+    return "jump.if";
+  case kJumpIfNot:
+    return "jump.ifnot";
+  case kJumpEqI:
+    return "jump.eq.i";
+  case kJumpNeI:
+    return "jump.ne.i";
+  case kJumpLtI:
+    return "jump.lt.i";
+  case kJumpLeI:
+    return "jump.le.i";
+  case kJumpGtI:
+    return "jump.gt.i";
+  case kJumpGeI:
+    return "jump.ge.i";
+  case kNewArray:
+    return "newarray";
+  case kLoad:
+    return "load";
+  case kStore:
+    return "store";
+  case kCheck:
+    return "check";
+  case kCheckDiagnose:
+    return "check.diagnose";
+  case kCall:
+    return "call";
+  case kTailCall:
+    return "tailcall";
+  case kRet:
+    return "ret";
+  case kPrintI:
+    return "print.i";
+  case kPrintF:
+    return "print.f";
+  case kPrintB:
+    return "print.b";
+  }
+  return "?";
+}
+
+unsigned getNumOperands(Opcode opcode) {
+  return std::strlen(getOperandKinds(opcode));
+}
+
+void Print(std::ostream &out, const Module &module) {
+  for (const Function &function : module.functions) {
+    out << "func @" << function.name << " (params " << function.numParams
+        << ", registers " << function.numRegisters << ")\n";
+    for (size_t i = 0; i < function.constants.size(); ++i) {
+      out << "  r" << function.numRegisters + i << " = ";
+      if (function.constantTypes[i] == kTypeFloat)
+        out << "float " << function.constants[i].f << "\n";
+      else
+        out << toString(function.constantTypes[i]) << " "
+            << function.constants[i].i << "\n";
+    }
+
+    const std::vector<uint32_t> &code = function.code;
+    for (size_t pc = 0; pc < code.size();) {
+      auto opcode = static_cast<Opcode>(code[pc]);
+      out << "  " << std::setw(4) << std::setfill('0') << pc
+          << std::setfill(' ') << ": " << toString(opcode);
+      const char *kinds = getOperandKinds(opcode);
+      for (size_t i = 0; kinds[i]; ++i) {
+        uint32_t operand = code[pc + 1 + i];
+        out << (i ? ", " : " ");
+        switch (kinds[i]) {
+        case 'r':
+          out << "r" << operand;
+          break;
+        case 't':
+          out << std::setw(4) << std::setfill('0') << operand
+              << std::setfill(' ');
+          break;
+        case 'f':
+          out << "@" << module.functions.at(operand).name;
+          break;
+        case 'n':
+          out << '"' << module.arrayNames.at(operand) << '"';
+          break;
+        }
+      }
+      out << "\n";
+      pc += 1 + std::strlen(kinds);
+    }
+    out << "\n";
+  }
+}
+
+} // namespace bytecode
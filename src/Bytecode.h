@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Codegen.h"
+#include "Type.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Program;
+
+// A compact register bytecode that --interp runs without LLVM, so a program
+// starts as soon as it's typechecked.  The bytecode is compiled straight
+// from the AST in one pass.
+//
+// Every call gets a window of 32-bit registers: the parameters first, then
+// the local variables and the temporaries of the expressions, and the
+// constants of the function at the end, which are copied in when it's
+// called.  Bools are ints that are 0 or 1.  An array is a pair of registers
+// that hold its offset in the array heap and its size; its elements live
+// until the function returns.
+//
+// An instruction is an opcode followed by its operands, each one 32-bit
+// word: registers, code offsets, function indices or array names.  The
+// operands are listed with each opcode, the result first.
+namespace bytecode {
+
+enum Opcode : uint32_t {
+  kMov, // dst, src
+
+  // Int arithmetic on two registers (dst, lhs, rhs), which wraps around.
+  kAddI,
+  kSubI,
+  kMulI,
+  kDivI,
+  kRemI,
+  kNegI, // dst, src
+
+  // Int arithmetic that traps on overflow, for -ftrapv.
+  kAddIChecked,
+  kSubIChecked,
+  kMulIChecked,
+  kNegIChecked, // dst, src
+
+  // Float arithmetic (dst, lhs, rhs).
+  kAddF,
+  kSubF,
+  kMulF,
+  kDivF,
+  kNegF, // dst, src
+
+  // Comparisons (dst, lhs, rhs), which produce a bool.  Float comparisons
+  // other than "<" are true for NaN operands, like in the generated code.
+  kEqI,
+  kNeI,
+  kLtI,
+  kLeI,
+  kGtI,
+  kGeI,
+  kEqF,
+  kNeF,
+  kLtF,
+  kLeF,
+  kGtF,
+  kGeF,
+
+  kNot, // dst, src
+
+  // Conversions (dst, src).  A bool converts to an int or float as 0 or 1.
+  kIntToFloat,
+  kFloatToInt,
+  kIntToBool,
+  kFloatToBool,
+
+  // Jumps to a code offset.  The int comparisons are fused with the jump
+  // (lhs, rhs, target), which is what most loop conditions turn into.
+  kJump,      // target
+  kJumpIf,    // condition, target
+  kJumpIfNot, // condition, target
+  kJumpEqI,
+  kJumpNeI,
+  kJumpLtI,
+  kJumpLeI,
+  kJumpGtI,
+  kJumpGeI,
+
+  // Arrays.  An array operand is the first of its pair of registers.
+  kNewArray,      // array, size
+  kLoad,          // dst, array, index
+  kStore,         // array, index, value
+  kCheck,         // array, index: trap if the index is out of bounds
+  kCheckDiagnose, // array, index, name: print an error and exit instead
+
+  // Calls.  The arguments are in consecutive registers of the caller.
+  kCall,     // dst, function, first argument
+  kTailCall, // function, first argument: replace the current call
+  kRet,      // src
+
+  // Print an int, float or bool and return the result of printf.
+  kPrintI, // dst, src
+  kPrintF,
+  kPrintB
+};
+
+// Get the name of an opcode as printed in the bytecode dump.
+const char *toString(Opcode opcode);
+
+// Get the number of operands that follow an opcode.
+unsigned getNumOperands(Opcode opcode);
+
+// The value of a register.
+union Slot {
+  int32_t i;
+  float f;
+};
+
+struct Function {
+  std::string name;
+  unsigned numParams = 0;
+
+  // Registers for the parameters, locals and temporaries, which are followed
+  // by the constants.
+  unsigned numRegisters = 0;
+  std::vector<Slot> constants;
+  std::vector<::Type> constantTypes;
+
+  std::vector<uint32_t> code;
+
+  // Total size of the register window of a call.
+  unsigned getFrameSize() const { return numRegisters + constants.size(); }
+};
+
+struct Module {
+  std::vector<Function> functions;
+
+  // Index of the main function.
+  unsigned main = 0;
+
+  // Names of the arrays in diagnostics of bounds checks.
+  std::vector<std::string> arrayNames;
+};
+
+using ModulePtr = std::unique_ptr<Module>;
+
+// Compile the (typechecked) program to bytecode.  Bounds checks and integer
+// overflow follow the given options; the floating point options don't apply,
+// so float arithmetic is always strict IEEE.  Throws std::runtime_error if
+// main is missing or has the wrong signature.
+ModulePtr Compile(const Program &program, const CodegenOptions &options);
+
+// Call main with the interpreter and return zero, like the JIT.
+int Run(const Module &module);
+
+// Print the module in a readable text form.
+void Print(std::ostream &out, const Module &module);
+
+} // namespace bytecode
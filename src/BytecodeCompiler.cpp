@@ -0,0 +1,649 @@
+#include "Bytecode.h"
+#include "Exp.h"
+#include "FuncDef.h"
+#include "Program.h"
+#include "Stmt.h"
+#include "Visitor.h"
+
+#include <cassert>
+#include <map>
+#include <stdexcept>
+
+namespace bytecode {
+namespace {
+
+using FunctionTable = std::map<const FuncDef *, unsigned>;
+
+// Registers of constants are numbered from here until the function is
+// finished, when they are moved behind the other registers.
+const uint32_t kConstantRegister = 1u << 31;
+
+// Passed as the target of an expression that can go in any register.
+const uint32_t kAnyRegister = ~0u;
+
+// Emits the code of a function and allocates its registers.  Registers are
+// allocated like a stack: a variable keeps its registers until the end of
+// its scope, and the temporaries of a statement are released after it.
+class FuncBuilder {
+public:
+  FuncBuilder(Module *module, Function *function, const CodegenOptions *options)
+      : m_module(module), m_function(function), m_options(options) {}
+
+  Module *getModule() const { return m_module; }
+
+  const CodegenOptions *getOptions() const { return m_options; }
+
+  // Whether the code emitted next can be reached.  After a return, the rest
+  // of the enclosing statements can't, and the language has no labels to
+  // jump to them.
+  bool isReachable() const { return m_reachable; }
+
+  // Allocate consecutive registers, returning the first one.
+  uint32_t allocate(unsigned count = 1) {
+    uint32_t first = m_nextRegister;
+    m_nextRegister += count;
+    if (m_nextRegister > m_function->numRegisters)
+      m_function->numRegisters = m_nextRegister;
+    return first;
+  }
+
+  // Get the first register that isn't allocated, to release the ones that
+  // are allocated after it.
+  uint32_t getMark() const { return m_nextRegister; }
+  void release(uint32_t mark) { m_nextRegister = mark; }
+
+  // Get the register of a constant, which is shared by all its uses.
+  uint32_t getInt(int value) { return getConstant(kTypeInt, {value}); }
+  uint32_t getBool(bool value) { return getConstant(kTypeBool, {value}); }
+  uint32_t getFloat(float value) {
+    Slot slot;
+    slot.f = value;
+    return getConstant(kTypeFloat, slot);
+  }
+  uint32_t getZero(::Type type) {
+    return type == kTypeFloat ? getFloat(0) : getConstant(type, {0});
+  }
+
+  // Emit an instruction whose operands are all registers.
+  void emit(Opcode opcode, std::initializer_list<uint32_t> registers) {
+    assert(registers.size() == getNumOperands(opcode));
+    emitOpcode(opcode);
+    for (uint32_t reg : registers)
+      emitRegister(reg);
+  }
+
+  void emitOpcode(Opcode opcode) {
+    m_function->code.push_back(opcode);
+    if (opcode == kJump || opcode == kTailCall || opcode == kRet)
+      m_reachable = false;
+  }
+
+  void emitRegister(uint32_t reg) {
+    assert(reg != kAnyRegister);
+    if (reg & kConstantRegister)
+      m_constantUses.push_back(m_function->code.size());
+    m_function->code.push_back(reg);
+  }
+
+  void emitOperand(uint32_t operand) { m_function->code.push_back(operand); }
+
+  // Code offsets that are jumped to before they are known.
+  unsigned createLabel() {
+    m_labels.emplace_back();
+    return m_labels.size() - 1;
+  }
+
+  void emitTarget(unsigned label) {
+    m_labels[label].uses.push_back(m_function->code.size());
+    m_function->code.push_back(0);
+  }
+
+  void placeLabel(unsigned label) {
+    m_labels[label].offset = m_function->code.size();
+    m_reachable = true;
+  }
+
+  // Resolve the labels and move the constants behind the other registers.
+  void finish() {
+    for (const Label &label : m_labels) {
+      for (size_t use : label.uses)
+        m_function->code[use] = label.offset;
+    }
+    for (size_t use : m_constantUses)
+      m_function->code[use] += m_function->numRegisters - kConstantRegister;
+  }
+
+private:
+  struct Label {
+    uint32_t offset = 0;
+    std::vector<size_t> uses;
+  };
+
+  Module *m_module;
+  Function *m_function;
+  const CodegenOptions *m_options;
+  uint32_t m_nextRegister = 0;
+  bool m_reachable = true;
+  std::map<std::pair<::Type, int32_t>, uint32_t> m_constants;
+  std::vector<size_t> m_constantUses;
+  std::vector<Label> m_labels;
+
+  uint32_t getConstant(::Type type, Slot value) {
+    auto it = m_constants.find({type, value.i});
+    if (it != m_constants.end())
+      return it->second;
+    uint32_t reg = kConstantRegister | m_function->constants.size();
+    m_function->constants.push_back(value);
+    m_function->constantTypes.push_back(type);
+    m_constants[{type, value.i}] = reg;
+    return reg;
+  }
+};
+
+// The registers of the variables in scope.  An array has two: its offset in
+// the array heap and its size.
+struct Variables {
+  std::map<const VarDecl *, uint32_t> registers;
+  std::map<const VarDecl *, uint32_t> arrayNames;
+};
+
+// Compiles expressions to instructions that compute their values.  A
+// variable or a constant is used in its own register, other values go in a
+// temporary or in the target register that the caller asks for.
+class ExpCompiler : public ExpVisitor {
+public:
+  ExpCompiler(FuncBuilder *builder, const FunctionTable *functions,
+              Variables *variables)
+      : m_builder(builder), m_functions(functions), m_variables(variables) {}
+
+  // Compile an expression, returning the register that holds its value,
+  // which is the target if there is one.
+  uint32_t Compile(const Exp &exp, uint32_t target = kAnyRegister) {
+    uint32_t saved = m_target;
+    m_target = target;
+    const_cast<Exp &>(exp).Dispatch(*this);
+    m_target = saved;
+    uint32_t result = m_result;
+    if (target != kAnyRegister && result != target) {
+      m_builder->emit(kMov, {target, result});
+      result = target;
+    }
+    return result;
+  }
+
+  // Compile a condition to a jump to the given label if it's equal to
+  // jumpIf, falling through otherwise.  "&&", "||" and "!" short-circuit
+  // straight to the targets, and int comparisons are fused with the jump.
+  void CompileJump(const Exp &exp, bool jumpIf, unsigned label) {
+    if (const auto *boolExp = dynamic_cast<const BoolExp *>(&exp)) {
+      if (boolExp->getValue() == jumpIf) {
+        m_builder->emitOpcode(kJump);
+        m_builder->emitTarget(label);
+      }
+      return;
+    }
+
+    const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+    const std::string funcName = callExp ? callExp->getFuncName() : "";
+    if (funcName == "&&" || funcName == "||") {
+      // The jump is taken once an operand decides the value; the right
+      // operand is skipped if the left one decides it the other way.
+      bool decidesOnFalse = funcName == "&&";
+      const Exp &lhs = *callExp->getArgs().at(0);
+      const Exp &rhs = *callExp->getArgs().at(1);
+      if (jumpIf != decidesOnFalse) {
+        CompileJump(lhs, jumpIf, label);
+        CompileJump(rhs, jumpIf, label);
+      } else {
+        unsigned skip = m_builder->createLabel();
+        CompileJump(lhs, !jumpIf, skip);
+        CompileJump(rhs, jumpIf, label);
+        m_builder->placeLabel(skip);
+      }
+      return;
+    }
+    if (funcName == "!") {
+      CompileJump(*callExp->getArgs().at(0), !jumpIf, label);
+      return;
+    }
+
+    static const std::map<std::string, Opcode> jumps = {
+        {"==", kJumpEqI}, {"!=", kJumpNeI}, {"<", kJumpLtI},
+        {"<=", kJumpLeI}, {">", kJumpGtI},  {">=", kJumpGeI}};
+    static const std::map<std::string, Opcode> inverseJumps = {
+        {"==", kJumpNeI}, {"!=", kJumpEqI}, {"<", kJumpGeI},
+        {"<=", kJumpGtI}, {">", kJumpLeI},  {">=", kJumpLtI}};
+    auto it = jumps.find(funcName);
+    if (it != jumps.end() && callExp->getArgs()[0]->getType() == kTypeInt &&
+        callExp->getArgs()[1]->getType() == kTypeInt) {
+      uint32_t mark = m_builder->getMark();
+      uint32_t lhs = Compile(*callExp->getArgs()[0]);
+      uint32_t rhs = Compile(*callExp->getArgs()[1]);
+      m_builder->release(mark);
+      m_builder->emitOpcode(jumpIf ? it->second : inverseJumps.at(funcName));
+      m_builder->emitRegister(lhs);
+      m_builder->emitRegister(rhs);
+      m_builder->emitTarget(label);
+      return;
+    }
+
+    // Other values are compared against zero.
+    uint32_t mark = m_builder->getMark();
+    uint32_t condition = Compile(exp);
+    if (exp.getType() == kTypeFloat) {
+      m_builder->release(mark);
+      uint32_t converted = m_builder->allocate();
+      m_builder->emit(kFloatToBool, {converted, condition});
+      condition = converted;
+    }
+    m_builder->release(mark);
+    m_builder->emitOpcode(jumpIf ? kJumpIf : kJumpIfNot);
+    m_builder->emitRegister(condition);
+    m_builder->emitTarget(label);
+  }
+
+  // Get the first register of an array.
+  uint32_t GetArray(const VarDecl *varDecl) const {
+    auto it = m_variables->registers.find(varDecl);
+    assert(it != m_variables->registers.end() && "Array wasn't declared");
+    return it->second;
+  }
+
+  // Check an index into an array if bounds are checked.
+  void CheckIndex(const VarDecl *varDecl, uint32_t index) {
+    switch (m_builder->getOptions()->boundsCheck) {
+    case kBoundsCheckOff:
+      break;
+    case kBoundsCheckTrap:
+      m_builder->emit(kCheck, {GetArray(varDecl), index});
+      break;
+    case kBoundsCheckDiagnose:
+      m_builder->emitOpcode(kCheckDiagnose);
+      m_builder->emitRegister(GetArray(varDecl));
+      m_builder->emitRegister(index);
+      m_builder->emitOperand(m_variables->arrayNames.at(varDecl));
+      break;
+    }
+  }
+
+  void *Visit(BoolExp &exp) override {
+    m_result = m_builder->getBool(exp.getValue());
+    return nullptr;
+  }
+
+  void *Visit(IntExp &exp) override {
+    m_result = m_builder->getInt(exp.getValue());
+    return nullptr;
+  }
+
+  void *Visit(FloatExp &exp) override {
+    m_result = m_builder->getFloat(exp.getValue());
+    return nullptr;
+  }
+
+  void *Visit(VarExp &exp) override {
+    const VarDecl *varDecl = exp.getVarDecl();
+    assert(varDecl && !varDecl->GetIsArray());
+    m_result = m_variables->registers.at(varDecl);
+    return nullptr;
+  }
+
+  void *Visit(ArrayAccessExp &exp) override {
+    uint32_t mark = m_builder->getMark();
+    uint32_t array = GetArray(exp.getVarDecl());
+    uint32_t index = Compile(*exp.getIndexExp());
+    CheckIndex(exp.getVarDecl(), index);
+    m_builder->release(mark);
+    uint32_t result = getResultRegister();
+    m_builder->emit(kLoad, {result, array, index});
+    m_result = result;
+    return nullptr;
+  }
+
+  void *Visit(CallExp &exp) override {
+    const std::string &funcName = exp.getFuncName();
+    if (funcName == "&&" || funcName == "||") {
+      m_result = compileLogicalValue(exp);
+      return nullptr;
+    }
+
+    const FuncDef *funcDef = exp.getFuncDef();
+    assert(funcDef);
+    if (funcDef->hasBody()) {
+      uint32_t mark = m_builder->getMark();
+      uint32_t args = CompileArgs(exp);
+      m_builder->release(mark);
+      uint32_t result = getResultRegister();
+      m_builder->emitOpcode(kCall);
+      m_builder->emitRegister(result);
+      m_builder->emitOperand(m_functions->at(funcDef));
+      m_builder->emitRegister(args);
+      m_result = result;
+      return nullptr;
+    }
+
+    // Builtins take their operands from any registers.  Mixed int and float
+    // operands are computed as floats.
+    uint32_t mark = m_builder->getMark();
+    std::vector<uint32_t> args;
+    bool isFloat = false;
+    for (const ExpPtr &arg : exp.getArgs()) {
+      args.push_back(Compile(*arg));
+      isFloat = isFloat || arg->getType() == kTypeFloat;
+    }
+    if (isFloat && args.size() == 2) {
+      for (size_t i = 0; i < 2; ++i) {
+        if (exp.getArgs()[i]->getType() == kTypeInt) {
+          uint32_t converted = m_builder->allocate();
+          m_builder->emit(kIntToFloat, {converted, args[i]});
+          args[i] = converted;
+        }
+      }
+    }
+    m_builder->release(mark);
+
+    Opcode opcode = getBuiltinOpcode(exp, isFloat);
+    if (opcode == kMov) {
+      m_result = args[0];
+      return nullptr;
+    }
+    uint32_t result = getResultRegister();
+    args.insert(args.begin(), result);
+    m_builder->emitOpcode(opcode);
+    for (uint32_t reg : args)
+      m_builder->emitRegister(reg);
+    m_result = result;
+    return nullptr;
+  }
+
+  // Compile the arguments of a call into consecutive registers, returning
+  // the first one.
+  uint32_t CompileArgs(const CallExp &exp) {
+    uint32_t args = m_builder->allocate(exp.getArgs().size());
+    for (size_t i = 0; i < exp.getArgs().size(); ++i) {
+      uint32_t mark = m_builder->getMark();
+      Compile(*exp.getArgs()[i], args + i);
+      m_builder->release(mark);
+    }
+    return args;
+  }
+
+private:
+  FuncBuilder *m_builder;
+  const FunctionTable *m_functions;
+  Variables *m_variables;
+  uint32_t m_target = kAnyRegister;
+  uint32_t m_result = kAnyRegister;
+
+  // Get the register for the value of the current expression, after its
+  // operands are computed.
+  uint32_t getResultRegister() {
+    return m_target != kAnyRegister ? m_target : m_builder->allocate();
+  }
+
+  Opcode getBuiltinOpcode(const CallExp &exp, bool isFloat) {
+    const std::string &funcName = exp.getFuncName();
+    bool checked = m_builder->getOptions()->intOverflow == kIntOverflowTrap;
+    ::Type argType = exp.getArgs()[0]->getType();
+    if (funcName == "print")
+      return argType == kTypeFloat ? kPrintF
+             : argType == kTypeBool ? kPrintB
+                                    : kPrintI;
+    if (funcName == "!")
+      return kNot;
+    if (funcName == "-" && exp.getArgs().size() == 1)
+      return isFloat ? kNegF : checked ? kNegIChecked : kNegI;
+
+    // Conversions; an int that is a bool already is 0 or 1.
+    if (funcName == "float")
+      return kIntToFloat;
+    if (funcName == "int")
+      return argType == kTypeFloat ? kFloatToInt : kMov;
+    if (funcName == "bool")
+      return argType == kTypeFloat ? kFloatToBool : kIntToBool;
+
+    static const std::map<std::string, Opcode> intOps = {
+        {"+", kAddI}, {"-", kSubI}, {"*", kMulI}, {"/", kDivI}, {"%", kRemI},
+        {"==", kEqI}, {"!=", kNeI}, {"<", kLtI},  {"<=", kLeI}, {">", kGtI},
+        {">=", kGeI}};
+    static const std::map<std::string, Opcode> checkedOps = {
+        {"+", kAddIChecked}, {"-", kSubIChecked}, {"*", kMulIChecked}};
+    static const std::map<std::string, Opcode> floatOps = {
+        {"+", kAddF}, {"-", kSubF}, {"*", kMulF}, {"/", kDivF},
+        {"==", kEqF}, {"!=", kNeF}, {"<", kLtF},  {"<=", kLeF},
+        {">", kGtF},  {">=", kGeF}};
+    if (isFloat)
+      return floatOps.at(funcName);
+    if (checked && checkedOps.count(funcName))
+      return checkedOps.at(funcName);
+    return intOps.at(funcName);
+  }
+
+  // Materialize the value of "&&" or "||" by jumping to code that produces
+  // true or false.
+  uint32_t compileLogicalValue(const CallExp &exp) {
+    uint32_t result = getResultRegister();
+    unsigned falseLabel = m_builder->createLabel();
+    unsigned endLabel = m_builder->createLabel();
+    CompileJump(exp, false, falseLabel);
+    m_builder->emit(kMov, {result, m_builder->getBool(true)});
+    m_builder->emitOpcode(kJump);
+    m_builder->emitTarget(endLabel);
+    m_builder->placeLabel(falseLabel);
+    m_builder->emit(kMov, {result, m_builder->getBool(false)});
+    m_builder->placeLabel(endLabel);
+    return result;
+  }
+};
+
+// Compiles statements.  Loops are laid out with the condition at the bottom,
+// so an iteration takes one jump.
+class StmtCompiler : public StmtVisitor {
+public:
+  StmtCompiler(FuncBuilder *builder, const FunctionTable *functions)
+      : m_builder(builder), m_functions(functions),
+        m_exp(builder, functions, &m_variables) {}
+
+  void Compile(const Stmt &stmt) { const_cast<Stmt &>(stmt).Dispatch(*this); }
+
+  // Map the parameters to the first registers.
+  void AddParams(const FuncDef &funcDef) {
+    for (const VarDeclPtr &param : funcDef.getParams())
+      m_variables.registers[param.get()] = m_builder->allocate();
+  }
+
+  void Visit(CallStmt &stmt) override {
+    uint32_t mark = m_builder->getMark();
+    m_exp.Compile(stmt.GetCallExp());
+    m_builder->release(mark);
+  }
+
+  void Visit(AssignStmt &stmt) override {
+    uint32_t mark = m_builder->getMark();
+    m_exp.Compile(stmt.GetRvalue(),
+                  m_variables.registers.at(stmt.GetVarDecl()));
+    m_builder->release(mark);
+  }
+
+  void Visit(ArrayAssignStmt &stmt) override {
+    uint32_t mark = m_builder->getMark();
+    uint32_t array = m_exp.GetArray(stmt.GetVarDecl());
+    uint32_t value = m_exp.Compile(stmt.GetRvalue());
+    uint32_t index = m_exp.Compile(*stmt.getIndexExp());
+    m_exp.CheckIndex(stmt.GetVarDecl(), index);
+    m_builder->emit(kStore, {array, index, value});
+    m_builder->release(mark);
+  }
+
+  void Visit(DeclStmt &stmt) override {
+    const VarDecl *varDecl = stmt.GetVarDecl();
+    if (varDecl->GetIsArray()) {
+      const Exp &sizeExp = varDecl->getVariable().getArraySizeExp();
+      const auto *constant = dynamic_cast<const IntExp *>(&sizeExp);
+      if (constant && constant->getValue() <= 0)
+        throw std::runtime_error("Array size must be > 0");
+
+      uint32_t array = m_builder->allocate(2);
+      m_variables.registers[varDecl] = array;
+      std::vector<std::string> &names = m_builder->getModule()->arrayNames;
+      m_variables.arrayNames[varDecl] = names.size();
+      names.push_back(varDecl->GetName());
+
+      uint32_t mark = m_builder->getMark();
+      m_builder->emit(kNewArray, {array, m_exp.Compile(sizeExp)});
+      m_builder->release(mark);
+      return;
+    }
+
+    // A variable without initializer is zero, though it's undefined in the
+    // language.
+    uint32_t reg = m_builder->allocate();
+    m_variables.registers[varDecl] = reg;
+    uint32_t mark = m_builder->getMark();
+    if (stmt.HasInitExp())
+      m_exp.Compile(stmt.GetInitExp(), reg);
+    else
+      m_builder->emit(kMov, {reg, m_builder->getZero(varDecl->GetType())});
+    m_builder->release(mark);
+  }
+
+  // A call in tail position replaces the current one, so tail recursion
+  // runs in constant space.
+  void Visit(ReturnStmt &stmt) override {
+    uint32_t mark = m_builder->getMark();
+    const auto *callExp = dynamic_cast<const CallExp *>(&stmt.GetExp());
+    if (callExp && callExp->getFuncDef()->hasBody()) {
+      uint32_t args = m_exp.CompileArgs(*callExp);
+      m_builder->emitOpcode(kTailCall);
+      m_builder->emitOperand(m_functions->at(callExp->getFuncDef()));
+      m_builder->emitRegister(args);
+    } else {
+      m_builder->emit(kRet, {m_exp.Compile(stmt.GetExp())});
+    }
+    m_builder->release(mark);
+  }
+
+  // The variables declared in a sequence go out of scope at its end.
+  void Visit(SeqStmt &seq) override {
+    uint32_t mark = m_builder->getMark();
+    for (const StmtPtr &stmt : seq.Get()) {
+      if (!m_builder->isReachable())
+        break;
+      Compile(*stmt);
+    }
+    m_builder->release(mark);
+  }
+
+  void Visit(IfStmt &stmt) override {
+    unsigned elseLabel = m_builder->createLabel();
+    m_exp.CompileJump(stmt.getCondExp(), false, elseLabel);
+    Compile(stmt.getThenStmt());
+    if (!stmt.hasElseStmt()) {
+      m_builder->placeLabel(elseLabel);
+      return;
+    }
+
+    unsigned joinLabel = m_builder->createLabel();
+    if (m_builder->isReachable()) {
+      m_builder->emitOpcode(kJump);
+      m_builder->emitTarget(joinLabel);
+    }
+    m_builder->placeLabel(elseLabel);
+    Compile(stmt.getElseStmt());
+    m_builder->placeLabel(joinLabel);
+  }
+
+  void Visit(WhileStmt &stmt) override {
+    compileLoop(&stmt.GetCondExp(), stmt.GetBodyStmt(), nullptr);
+  }
+
+  void Visit(ForStmt &stmt) override {
+    uint32_t mark = m_builder->getMark();
+    if (stmt.HasInitStmt())
+      Compile(stmt.GetInitStmt());
+    compileLoop(stmt.HasCondExp() ? &stmt.GetCondExp() : nullptr,
+                stmt.GetBodyStmt(),
+                stmt.HasUpdateStmt() ? &stmt.GetUpdateStmt() : nullptr);
+    m_builder->release(mark);
+  }
+
+private:
+  FuncBuilder *m_builder;
+  const FunctionTable *m_functions;
+  Variables m_variables;
+  ExpCompiler m_exp;
+
+  // Jump to the condition, which jumps back to the body while it holds.
+  void compileLoop(const Exp *condExp, const Stmt &bodyStmt,
+                   const Stmt *updateStmt) {
+    unsigned bodyLabel = m_builder->createLabel();
+    unsigned condLabel = m_builder->createLabel();
+    if (condExp) {
+      m_builder->emitOpcode(kJump);
+      m_builder->emitTarget(condLabel);
+    }
+
+    m_builder->placeLabel(bodyLabel);
+    Compile(bodyStmt);
+    if (updateStmt && m_builder->isReachable())
+      Compile(*updateStmt);
+
+    m_builder->placeLabel(condLabel);
+    if (condExp) {
+      m_exp.CompileJump(*condExp, true, bodyLabel);
+    } else {
+      m_builder->emitOpcode(kJump);
+      m_builder->emitTarget(bodyLabel);
+    }
+  }
+};
+
+} // namespace
+
+ModulePtr Compile(const Program &program, const CodegenOptions &options) {
+  ModulePtr module(new Module);
+
+  // Number every function first, so calls can refer to later ones.
+  FunctionTable functions;
+  std::vector<const FuncDef *> funcDefs;
+  for (const FuncDefPtr &funcDef : program.GetFunctions()) {
+    if (!funcDef->hasBody())
+      continue;
+    functions[funcDef.get()] = funcDefs.size();
+    funcDefs.push_back(funcDef.get());
+  }
+  module->functions.resize(funcDefs.size());
+
+  const FuncDef *mainDef = nullptr;
+  for (size_t i = 0; i < funcDefs.size(); ++i) {
+    const FuncDef &funcDef = *funcDefs[i];
+    Function &function = module->functions[i];
+    function.name = funcDef.getName();
+    function.numParams = funcDef.getParams().size();
+    if (function.name == "main") {
+      mainDef = &funcDef;
+      module->main = i;
+    }
+
+    FuncBuilder builder(module.get(), &function, &options);
+    StmtCompiler compiler(&builder, &functions);
+    compiler.AddParams(funcDef);
+    compiler.Compile(funcDef.GetBody());
+
+    // Add a return instruction if the user neglected to do so.
+    if (builder.isReachable())
+      builder.emit(kRet, {builder.getZero(funcDef.getReturnType())});
+    builder.finish();
+  }
+
+  if (!mainDef)
+    throw std::runtime_error("Function 'main' not found");
+  const std::vector<VarDeclPtr> &params = mainDef->getParams();
+  if (mainDef->getReturnType() != kTypeInt || params.size() > 1 ||
+      (params.size() == 1 && params[0]->GetType() != kTypeInt))
+    throw std::runtime_error(
+        "Function 'main' must be 'int main()' or 'int main(int)'");
+  return module;
+}
+
+} // namespace bytecode
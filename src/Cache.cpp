@@ -0,0 +1,288 @@
+#include "Cache.h"
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+// Bump when the way outputs are compiled or stored changes without a change
+// of the executable's identity.
+const char *const kFormatVersion = "moj-cache-2";
+
+// The log of lookups: 'h' for a hit and 'm' for a miss, after a line with
+// the numbers of hits and misses that were compacted.
+const char *const kStatsFile = "stats";
+
+// The log is compacted when it grows over this many bytes.
+const uint64_t kMaxStatsSize = 4096;
+
+// Temporary files older than this were left by a writer that crashed.
+const std::chrono::hours kStaleAge(1);
+
+// Add a string to the hash, followed by a separator so that adjacent strings
+// can't run into each other.
+void addToHash(SHA256 &hash, StringRef value) {
+  hash.update(value);
+  hash.update(StringRef("\0", 1));
+}
+
+bool isTemporary(StringRef filename) { return filename.endswith(".tmp"); }
+
+bool isEntry(StringRef filename) {
+  return filename != kStatsFile && !isTemporary(filename);
+}
+
+// Add up the hits and misses in a log of lookups.
+void countLookups(StringRef log, uint64_t *hits, uint64_t *misses) {
+  *hits = *misses = 0;
+  size_t newline = log.find('\n');
+  if (newline != StringRef::npos) {
+    std::pair<StringRef, StringRef> counts =
+        log.take_front(newline).split(' ');
+    counts.first.getAsInteger(10, *hits);
+    counts.second.getAsInteger(10, *misses);
+    log = log.drop_front(newline + 1);
+  }
+  *hits += log.count('h');
+  *misses += log.count('m');
+}
+
+sys::TimePoint<> now() {
+  return std::chrono::time_point_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now());
+}
+
+} // namespace
+
+Cache::Cache(std::string directory, uint64_t maxSize)
+    : m_directory(std::move(directory)), m_maxSize(maxSize) {}
+
+std::string Cache::ComputeKey(StringRef source, StringRef description) {
+  SHA256 hash;
+  addToHash(hash, kFormatVersion);
+  addToHash(hash, LLVM_VERSION_STRING);
+
+  std::string executable = sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void *>(&Cache::ComputeKey));
+  sys::fs::file_status status;
+  addToHash(hash, executable);
+  if (!sys::fs::status(executable, status)) {
+    addToHash(hash, std::to_string(status.getSize()));
+    addToHash(hash,
+              std::to_string(
+                  status.getLastModificationTime().time_since_epoch().count()));
+  }
+
+  addToHash(hash, description);
+  addToHash(hash, source);
+  return toHex(hash.final(), /*LowerCase=*/true);
+}
+
+std::unique_ptr<MemoryBuffer> Cache::Lookup(StringRef name) {
+  std::string path = getPath(name);
+  int fd;
+  sys::fs::file_status status;
+  if (sys::fs::openFileForRead(path, fd)) {
+    recordLookup(false);
+    return nullptr;
+  }
+  std::unique_ptr<MemoryBuffer> contents;
+  if (!sys::fs::status(fd, status)) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> read =
+        MemoryBuffer::getOpenFile(fd, path, status.getSize(),
+                                  /*RequiresNullTerminator=*/false);
+    if (read) {
+      contents = std::move(*read);
+      // Mark the entry as recently used.
+      sys::fs::setLastAccessAndModificationTime(fd, now());
+    }
+  }
+  sys::fs::closeFile(fd);
+  recordLookup(contents != nullptr);
+  return contents;
+}
+
+void Cache::Store(StringRef name, StringRef contents) {
+  if (std::error_code ec = sys::fs::create_directories(m_directory)) {
+    errs() << "Warning: Could not create cache directory " << m_directory
+           << ": " << ec.message() << "\n";
+    return;
+  }
+
+  // The temporary file is in the same directory, so that renaming it doesn't
+  // move it to another file system.
+  SmallString<128> model(m_directory);
+  sys::path::append(model, name + "-%%%%%%%%.tmp");
+  int fd;
+  SmallString<128> temporary;
+  if (std::error_code ec = sys::fs::createUniqueFile(model, fd, temporary)) {
+    errs() << "Warning: Could not create a file in " << m_directory << ": "
+           << ec.message() << "\n";
+    return;
+  }
+  raw_fd_ostream out(fd, /*shouldClose=*/true);
+  out << contents;
+  out.close();
+
+  std::error_code ec = out.error();
+  if (!ec)
+    ec = sys::fs::rename(temporary, getPath(name));
+  if (ec) {
+    out.clear_error();
+    sys::fs::remove(temporary);
+    errs() << "Warning: Could not store " << name << " in " << m_directory
+           << ": " << ec.message() << "\n";
+    return;
+  }
+  if (m_size != uint64_t(-1))
+    m_size += contents.size();
+  if (m_size == uint64_t(-1) || m_size > m_maxSize)
+    evict();
+}
+
+Cache::Stats Cache::GetStats() const {
+  Stats stats;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> log =
+      MemoryBuffer::getFile(getPath(kStatsFile), /*IsText=*/false,
+                            /*RequiresNullTerminator=*/false);
+  if (log)
+    countLookups((*log)->getBuffer(), &stats.hits, &stats.misses);
+
+  std::error_code ec;
+  for (sys::fs::directory_iterator it(m_directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    if (!isEntry(sys::path::filename(it->path())))
+      continue;
+    ErrorOr<sys::fs::basic_file_status> status = it->status();
+    if (!status)
+      continue;
+    ++stats.entries;
+    stats.size += status->getSize();
+  }
+  return stats;
+}
+
+void Cache::PrintStats(raw_ostream &out) const {
+  Stats stats = GetStats();
+  uint64_t lookups = stats.hits + stats.misses;
+  out << "cache directory  " << m_directory << "\n";
+  out << "hits             " << stats.hits;
+  if (lookups)
+    out << format(" (%.1f%%)", 100.0 * stats.hits / lookups);
+  out << "\n";
+  out << "misses           " << stats.misses << "\n";
+  out << "entries          " << stats.entries << "\n";
+  const double megabyte = 1024 * 1024;
+  out << format("size             %.2f MB of %.2f MB\n",
+                stats.size / megabyte, m_maxSize / megabyte);
+}
+
+std::string Cache::getPath(StringRef name) const {
+  SmallString<128> path(m_directory);
+  sys::path::append(path, name);
+  return std::string(path);
+}
+
+// Appends of a single byte are never interleaved, so concurrent processes
+// don't lose each other's counts.
+void Cache::recordLookup(bool hit) {
+  if (sys::fs::create_directories(m_directory))
+    return;
+  int fd;
+  if (sys::fs::openFileForWrite(getPath(kStatsFile), fd,
+                                sys::fs::CD_OpenAlways, sys::fs::OF_Append))
+    return;
+  uint64_t size = 0;
+  {
+    raw_fd_ostream out(fd, /*shouldClose=*/false);
+    out << (hit ? 'h' : 'm');
+    out.flush();
+    sys::fs::file_status status;
+    if (!sys::fs::status(fd, status))
+      size = status.getSize();
+  }
+  sys::fs::closeFile(fd);
+  if (size > kMaxStatsSize)
+    compactStats();
+}
+
+// The counts are written to a temporary file that replaces the log, like an
+// entry.  A lookup that is appended to the old log in between is lost.
+void Cache::compactStats() {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> log =
+      MemoryBuffer::getFile(getPath(kStatsFile), /*IsText=*/false,
+                            /*RequiresNullTerminator=*/false);
+  if (!log)
+    return;
+  uint64_t hits, misses;
+  countLookups((*log)->getBuffer(), &hits, &misses);
+
+  SmallString<128> model(m_directory);
+  sys::path::append(model, Twine(kStatsFile) + "-%%%%%%%%.tmp");
+  int fd;
+  SmallString<128> temporary;
+  if (sys::fs::createUniqueFile(model, fd, temporary))
+    return;
+  raw_fd_ostream out(fd, /*shouldClose=*/true);
+  out << hits << ' ' << misses << '\n';
+  out.close();
+  if (out.has_error() || sys::fs::rename(temporary, getPath(kStatsFile))) {
+    out.clear_error();
+    sys::fs::remove(temporary);
+  }
+}
+
+// Other processes may evict at the same time, so files that are already
+// gone are skipped.
+void Cache::evict() {
+  struct Entry {
+    std::string path;
+    sys::TimePoint<> used;
+    uint64_t size;
+  };
+  std::vector<Entry> entries;
+  uint64_t size = 0;
+  sys::TimePoint<> staleBefore = now() - kStaleAge;
+
+  std::error_code ec;
+  for (sys::fs::directory_iterator it(m_directory, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    StringRef filename = sys::path::filename(it->path());
+    ErrorOr<sys::fs::basic_file_status> status = it->status();
+    if (!status || filename == kStatsFile)
+      continue;
+    if (isTemporary(filename)) {
+      if (status->getLastModificationTime() < staleBefore)
+        sys::fs::remove(it->path());
+      continue;
+    }
+    entries.push_back(
+        {it->path(), status->getLastModificationTime(), status->getSize()});
+    size += status->getSize();
+  }
+  m_size = size;
+  compactStats();
+  if (size <= m_maxSize)
+    return;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  for (const Entry &entry : entries) {
+    if (size <= m_maxSize)
+      break;
+    sys::fs::remove(entry.path);
+    size -= entry.size;
+  }
+  m_size = size;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+// A content-addressed cache of compiled programs in a directory, like
+// ccache: object files and bitcode of AOT builds, and the objects that
+// --run compiles (see JitCache.h).
+//
+// Each entry is a file named after a hash of everything its contents depend
+// on, so entries are never updated, only added and removed.  An entry is
+// written to a temporary file that is then renamed, which is atomic, so any
+// number of processes can share the directory without locks: a reader sees
+// either a complete entry or none, and writers of the same entry race
+// harmlessly.  Reading an entry touches its modification time, and when
+// the entries grow over the size limit, the ones that were used least
+// recently are removed.  An entry that is removed while it's being read
+// stays readable until it's closed.
+//
+// Lookups are counted for statistics by appending one byte to a log, which
+// is atomic as well.  When the log grows over a few kilobytes, and when
+// entries are evicted, it is replaced by the counts it adds up to, so it
+// stays small; lookups that other processes log at that moment may be lost.
+class Cache {
+public:
+  // Use the given directory, which is created when the first entry is
+  // stored, and keep its entries within the given number of bytes.
+  explicit Cache(std::string directory,
+                 uint64_t maxSize = uint64_t(1024) * 1024 * 1024);
+
+  // Hash the source and a description of everything else that the output
+  // depends on (the flags, the target, the kind of output), with the
+  // compiler, into a key.  The compiler is identified by the LLVM version
+  // and the moj executable itself, which contains the builtins, so a
+  // rebuilt compiler doesn't reuse old entries.
+  static std::string ComputeKey(llvm::StringRef source,
+                                llvm::StringRef description);
+
+  // Get the entry with the given name (a key and an extension), or null if
+  // there is none.
+  std::unique_ptr<llvm::MemoryBuffer> Lookup(llvm::StringRef name);
+
+  // Add an entry, then remove the least recently used ones if the cache is
+  // too big.  The directory is scanned by the first store of a process, and
+  // again only when the entries it added since then take it over the limit.
+  // A failure only makes later builds slower, so it's reported as a
+  // warning.
+  void Store(llvm::StringRef name, llvm::StringRef contents);
+
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t entries = 0;
+    uint64_t size = 0; // bytes
+  };
+
+  Stats GetStats() const;
+
+  // Print the statistics in a readable form.
+  void PrintStats(llvm::raw_ostream &out) const;
+
+private:
+  std::string m_directory;
+  uint64_t m_maxSize;
+
+  // Size of the entries when the directory was last scanned, plus the ones
+  // added since then, or -1 before the first scan.
+  uint64_t m_size = uint64_t(-1);
+
+  std::string getPath(llvm::StringRef name) const;
+  void recordLookup(bool hit);
+  void compactStats();
+  void evict();
+};
@@ -1,4 +1,6 @@
 #include "Codegen.h"
+#include "Analysis.h"
+#include "CodegenUtil.h"
 #include "Exp.h"
 #include "FuncDef.h"
 #include "Program.h"
@@ -8,9 +10,13 @@
 #include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/Argument.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
 #include <map>
 
 using namespace llvm;
@@ -24,12 +30,24 @@ using FunctionTable = std::map<const FuncDef *, Function *>;
 
 namespace {
 
+// Tail recursive returns are lowered to jumps to a loop header at the start
+// of the function, where PHI nodes take the place of the parameters and
+// (optionally) accumulate the operands combined with the recursive calls.
+struct TailRecursionLoop {
+  BasicBlock *header = nullptr;
+  std::vector<PHINode *> params;
+  PHINode *accumulator = nullptr;
+  std::string accumulatorOp;
+};
+
 // Class that holds llvm objects, and also helper functions that will help us in
 // the Codegen phase
 class CodegenBase {
 public:
-  CodegenBase(LLVMContext *context, Module *module, IRBuilder<> *builder)
+  CodegenBase(LLVMContext *context, Module *module, IRBuilder<> *builder,
+              const CodegenOptions *options)
       : m_context(context), m_module(module), m_builder(builder),
+        m_options(options),
         m_boolType(IntegerType::get(*m_context, 1)),
         m_intType(IntegerType::get(*m_context, 32)),
         m_floatType(llvm::Type::getFloatTy(*m_context)) {
@@ -156,10 +174,23 @@ public:
     return ConstantInt::get(GetIntType(), i, true);
   }
 
+  // Print an error message with printf and exit the program, which ends the
+  // current block.
+  void emitRuntimeError(const std::string &format,
+                        llvm::ArrayRef<Value *> args) {
+    std::vector<Value *> printfArgs{
+        getBuilder()->CreateGlobalStringPtr(format)};
+    printfArgs.insert(printfArgs.end(), args.begin(), args.end());
+    getBuilder()->CreateCall(m_module->getFunction("printf"), printfArgs);
+    getBuilder()->CreateCall(m_module->getFunction("exit"), GetInt(-1));
+    getBuilder()->CreateUnreachable();
+  }
+
 protected:
   LLVMContext *m_context;
   Module *m_module;
   IRBuilder<> *m_builder;
+  const CodegenOptions *m_options;
   llvm::Type *m_boolType;
   llvm::Type *m_intType;
   llvm::Type *m_floatType;
@@ -168,14 +199,98 @@ protected:
 class CodegenExp : public ExpVisitor, CodegenBase {
 public:
   CodegenExp(LLVMContext *context, Module *module, IRBuilder<> *builder,
-             SymbolTable *symbols, FunctionTable *functions)
-      : CodegenBase(context, module, builder), m_symbols(symbols),
-        m_functions(functions) {}
+             const CodegenOptions *options, SymbolTable *symbols,
+             FunctionTable *functions, const FuncInfo *funcInfo)
+      : CodegenBase(context, module, builder, options), m_symbols(symbols),
+        m_functions(functions), m_funcInfo(funcInfo) {}
 
   Value *Codegen(const Exp &exp) {
     return reinterpret_cast<Value *>(const_cast<Exp &>(exp).Dispatch(*this));
   }
 
+  // Generate code that evaluates a condition and jumps to one of the given
+  // blocks, without materializing its value.  "&&", "||" and "!" short-circuit
+  // straight to the targets; any other expression is compared against zero.
+  void CodegenBranch(const Exp &exp, BasicBlock *trueBlock,
+                     BasicBlock *falseBlock) {
+    if (const auto *boolExp = dynamic_cast<const BoolExp *>(&exp)) {
+      getBuilder()->CreateBr(boolExp->getValue() ? trueBlock : falseBlock);
+      return;
+    }
+
+    const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+    const std::string funcName = callExp ? callExp->getFuncName() : "";
+    if (funcName == "&&" || funcName == "||") {
+      bool isAnd = funcName == "&&";
+      llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
+      BasicBlock *rhsBlock = BasicBlock::Create(
+          *getContext(), isAnd ? "and.rhs" : "or.rhs", func);
+      CodegenBranch(*callExp->getArgs().at(0), isAnd ? rhsBlock : trueBlock,
+                    isAnd ? falseBlock : rhsBlock);
+      getBuilder()->SetInsertPoint(rhsBlock);
+      CodegenBranch(*callExp->getArgs().at(1), trueBlock, falseBlock);
+      return;
+    }
+    if (funcName == "!") {
+      CodegenBranch(*callExp->getArgs().at(0), falseBlock, trueBlock);
+      return;
+    }
+
+    // Comparisons already produce an i1, other values are converted.
+    Value *condition = Codegen(exp);
+    if (exp.getType() == kTypeInt)
+      condition = getBuilder()->CreateICmpNE(condition, GetInt(0));
+    else if (exp.getType() == kTypeFloat)
+      condition = getBuilder()->CreateFCmpUNE(
+          condition, llvm::ConstantFP::get(GetFloatType(), 0.0), "tobool");
+    getBuilder()->CreateCondBr(condition, trueBlock, falseBlock);
+  }
+
+  // Check that an array index is in bounds, unless checks are off, the
+  // analysis proved it, or the check was hoisted in front of a loop.
+  void CheckArrayIndex(const VarDecl *varDecl, const Exp &indexExp,
+                       Value *index) {
+    if (m_options->boundsCheck == kBoundsCheckOff ||
+        m_funcInfo->inBoundsAccesses.count(&indexExp) ||
+        m_funcInfo->hoistedAccesses.count(&indexExp))
+      return;
+
+    // A negative index is a large unsigned one.
+    Value *size = getArraySize(varDecl);
+    emitBoundsCheck(getBuilder()->CreateICmpULT(index, size), varDecl, index,
+                    size);
+  }
+
+  // Check in front of a loop that the last index it accesses is in bounds,
+  // which covers the accesses of all the iterations.
+  void CheckHoistedArrayIndex(const HoistedCheck &check) {
+    llvm::Type *int64Type = getBuilder()->getInt64Ty();
+    Value *size = getArraySize(check.array);
+    Value *last = getBuilder()->CreateSExt(Codegen(*check.bound), int64Type);
+    if (!check.inclusive)
+      last = getBuilder()->CreateSub(last, ConstantInt::get(int64Type, 1));
+
+    // Nothing is accessed unless the loop runs.
+    Value *runs = getBuilder()->CreateICmpSGE(
+        last, ConstantInt::get(int64Type, check.start));
+    last = getBuilder()->CreateAdd(
+        last, ConstantInt::get(int64Type, check.offset), "last");
+    Value *inBounds = getBuilder()->CreateOr(
+        getBuilder()->CreateNot(runs),
+        getBuilder()->CreateICmpULT(
+            last, getBuilder()->CreateZExt(size, int64Type)));
+
+    // The loop fails at the first index past the end of the array, unless
+    // its first index is already past it.
+    Value *badIndex = nullptr;
+    if (m_options->boundsCheck == kBoundsCheckDiagnose) {
+      Value *first = GetInt(static_cast<int>(check.start + check.offset));
+      badIndex = getBuilder()->CreateSelect(
+          getBuilder()->CreateICmpSLT(first, size), size, first);
+    }
+    emitBoundsCheck(inBounds, check.array, badIndex, size);
+  }
+
   void *Visit(BoolExp &exp) override { return GetBool(exp.getValue()); }
 
   void *Visit(IntExp &exp) override { return GetInt(exp.getValue()); }
@@ -195,6 +310,7 @@ public:
     // auto var3 = allocInst->getArraySize();
 
     Value *index = Codegen(*exp.getIndexExp());
+    CheckArrayIndex(varDecl, *exp.getIndexExp(), index);
     if (allocInst->getAllocatedType()->isArrayTy()) {
       std::vector<Value *> indices;
       Value *zero = GetInt(0);
@@ -242,59 +358,13 @@ public:
   void *Visit(CallExp &exp) override {
 
     const std::string &funcName = exp.getFuncName();
-    if (funcName == "&&") {
-
-      llvm::Value *lhs = Codegen(*exp.getArgs().at(0));
-      llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
-      llvm::BasicBlock *rhsBlock =
-          llvm::BasicBlock::Create(getBuilder()->getContext(), "and.rhs", func);
-      llvm::BasicBlock *endBlock =
-          llvm::BasicBlock::Create(getBuilder()->getContext(), "and.end");
-
-      getBuilder()->CreateCondBr(lhs, rhsBlock, endBlock);
-
-      getBuilder()->SetInsertPoint(rhsBlock);
-      llvm::Value *rhs = Codegen(*exp.getArgs().at(1));
-      getBuilder()->CreateBr(endBlock);
-
-      rhsBlock = getBuilder()->GetInsertBlock();
-      func->insert(func->end(), endBlock);
-      getBuilder()->SetInsertPoint(endBlock);
-      llvm::PHINode *phi =
-          getBuilder()->CreatePHI(getBuilder()->getInt1Ty(), 2);
-      phi->addIncoming(
-          getBuilder()->getFalse(),
-          getBuilder()->GetInsertBlock()->getPrevNode()->getPrevNode());
-      phi->addIncoming(rhs, rhsBlock);
-
-      return phi;
-    } else if (funcName == "||") {
-
-      llvm::Value *lhs = Codegen(*exp.getArgs().at(0));
-      llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
-      llvm::BasicBlock *rhsBlock =
-          llvm::BasicBlock::Create(getBuilder()->getContext(), "or.rhs", func);
-      llvm::BasicBlock *endBlock =
-          llvm::BasicBlock::Create(getBuilder()->getContext(), "or.end");
-
-      getBuilder()->CreateCondBr(lhs, endBlock, rhsBlock);
+    if (funcName == "&&" || funcName == "||")
+      return codegenLogicalValue(exp);
 
-      getBuilder()->SetInsertPoint(rhsBlock);
-      llvm::Value *rhs = Codegen(*exp.getArgs().at(1));
-      ; // Evaluate RHS here
-      getBuilder()->CreateBr(endBlock);
-
-      rhsBlock = getBuilder()->GetInsertBlock();
-      func->insert(func->end(), endBlock);
-      getBuilder()->SetInsertPoint(endBlock);
-      llvm::PHINode *phi =
-          getBuilder()->CreatePHI(getBuilder()->getInt1Ty(), 2);
-      phi->addIncoming(
-          getBuilder()->getTrue(),
-          getBuilder()->GetInsertBlock()->getPrevNode()->getPrevNode());
-      phi->addIncoming(rhs, rhsBlock);
-
-      return phi;
+    if (m_options->fpContract == kFPContractOn && exp.getType() == kTypeFloat &&
+        (funcName == "+" || funcName == "-") && exp.getArgs().size() == 2) {
+      if (Value *result = codegenFMulAdd(exp))
+        return result;
     }
 
     std::vector<Value *> args;
@@ -314,20 +384,21 @@ public:
     if (funcName == "+") {
       return returnType->isFloatTy()
                  ? getBuilder()->CreateFAdd(args[0], args[1])
-                 : getBuilder()->CreateAdd(args[0], args[1]);
+                 : createIntArith(Instruction::Add, args[0], args[1]);
     } else if (funcName == "-") {
       if (args.size() == 1) {
-        return returnType->isFloatTy() ? getBuilder()->CreateFNeg(args[0])
-                                       : getBuilder()->CreateNeg(args[0]);
+        return returnType->isFloatTy()
+                   ? getBuilder()->CreateFNeg(args[0])
+                   : createIntArith(Instruction::Sub, GetInt(0), args[0]);
       } else {
         return returnType->isFloatTy()
                    ? getBuilder()->CreateFSub(args[0], args[1])
-                   : getBuilder()->CreateSub(args[0], args[1]);
+                   : createIntArith(Instruction::Sub, args[0], args[1]);
       }
     } else if (funcName == "*") {
       return returnType->isFloatTy()
                  ? getBuilder()->CreateFMul(args[0], args[1])
-                 : getBuilder()->CreateMul(args[0], args[1]);
+                 : createIntArith(Instruction::Mul, args[0], args[1]);
     } else if (funcName == "/") {
       if (returnType->isFloatTy()) {
 
@@ -438,24 +509,199 @@ public:
     assert(it != m_functions->end());
     Function *function = it->second;
 
-    // Generate LLVM function call.
-    return getBuilder()->CreateCall(function, args, funcDef->getName());
+    // Generate LLVM function call.  The call site carries the same calling
+    // convention and attributes as the callee.
+    CallInst *call =
+        getBuilder()->CreateCall(function, args, funcDef->getName());
+    call->setCallingConv(function->getCallingConv());
+    if (function->doesNotThrow())
+      call->setDoesNotThrow();
+    if (function->doesNotRecurse())
+      call->addFnAttr(Attribute::NoRecurse);
+    if (function->willReturn())
+      call->addFnAttr(Attribute::WillReturn);
+    if (function->doesNotAccessMemory())
+      call->setDoesNotAccessMemory();
+    return call;
   }
 
 private:
   SymbolTable *m_symbols;
   FunctionTable *m_functions;
+  const FuncInfo *m_funcInfo;
+  BasicBlock *m_trapBlock = nullptr;
+
+  // Get the number of elements of a local array.
+  Value *getArraySize(const VarDecl *varDecl) {
+    auto it = m_symbols->find(varDecl);
+    assert(it != m_symbols->end() && "Array wasn't mapped to a pointer");
+    auto *array = llvm::cast<AllocaInst>(it->second);
+    if (auto *arrayType =
+            llvm::dyn_cast<llvm::ArrayType>(array->getAllocatedType()))
+      return GetInt(arrayType->getNumElements());
+    return array->getArraySize();
+  }
+
+  // Branch on a bounds check, continuing where it holds.  A failed check
+  // either traps or reports the index and the array, then exits.
+  void emitBoundsCheck(Value *inBounds, const VarDecl *varDecl, Value *index,
+                       Value *size) {
+    llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
+    BasicBlock *continueBlock =
+        BasicBlock::Create(*getContext(), "inbounds", func);
+    bool diagnose = m_options->boundsCheck == kBoundsCheckDiagnose;
+    BasicBlock *failBlock =
+        diagnose ? BasicBlock::Create(*getContext(), "outofbounds", func)
+                 : getTrapBlock();
+    getBuilder()->CreateCondBr(
+        inBounds, continueBlock, failBlock,
+        MDBuilder(*getContext()).createBranchWeights((1U << 20) - 1, 1));
+
+    if (diagnose) {
+      getBuilder()->SetInsertPoint(failBlock);
+      emitRuntimeError("Error: Index %d is out of bounds for array " +
+                           varDecl->GetName() + " of size %d\n",
+                       {index, size});
+    }
+    getBuilder()->SetInsertPoint(continueBlock);
+  }
+
+  // Generate integer addition, subtraction or multiplication with the
+  // overflow semantics selected by the options.
+  Value *createIntArith(Instruction::BinaryOps opcode, Value *lhs,
+                        Value *rhs) {
+    switch (m_options->intOverflow) {
+    case kIntOverflowUndefined: {
+      // Like signed arithmetic in C, which tells the optimizer that e.g. an
+      // induction variable doesn't wrap around.
+      Value *result = getBuilder()->CreateBinOp(opcode, lhs, rhs);
+      if (auto *inst = llvm::dyn_cast<BinaryOperator>(result))
+        inst->setHasNoSignedWrap();
+      return result;
+    }
+    case kIntOverflowWrap:
+      return getBuilder()->CreateBinOp(opcode, lhs, rhs);
+    case kIntOverflowTrap:
+      break;
+    }
+
+    Intrinsic::ID id = opcode == Instruction::Add
+                           ? Intrinsic::sadd_with_overflow
+                       : opcode == Instruction::Sub
+                           ? Intrinsic::ssub_with_overflow
+                           : Intrinsic::smul_with_overflow;
+    Value *resultAndOverflow =
+        getBuilder()->CreateBinaryIntrinsic(id, lhs, rhs);
+    Value *overflow = getBuilder()->CreateExtractValue(resultAndOverflow, 1);
+
+    llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
+    BasicBlock *continueBlock =
+        BasicBlock::Create(*getContext(), "nooverflow", func);
+    getBuilder()->CreateCondBr(
+        overflow, getTrapBlock(), continueBlock,
+        MDBuilder(*getContext()).createBranchWeights(1, (1U << 20) - 1));
+
+    getBuilder()->SetInsertPoint(continueBlock);
+    return getBuilder()->CreateExtractValue(resultAndOverflow, 0);
+  }
+
+  // Get the block that traps when checked integer arithmetic overflows or
+  // an array index is out of bounds, which is shared by all the checks in
+  // the current function.
+  BasicBlock *getTrapBlock() {
+    if (!m_trapBlock) {
+      llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
+      m_trapBlock = BasicBlock::Create(*getContext(), "trap", func);
+      IRBuilder<> builder(m_trapBlock);
+      builder.CreateIntrinsic(Intrinsic::trap, {}, {});
+      builder.CreateUnreachable();
+    }
+    return m_trapBlock;
+  }
+
+  // Materialize the value of "&&" or "||" by branching to blocks that
+  // produce true and false, which join in a PHI node.
+  Value *codegenLogicalValue(const CallExp &exp) {
+    llvm::Function *func = getBuilder()->GetInsertBlock()->getParent();
+    BasicBlock *trueBlock = BasicBlock::Create(*getContext(), "bool.true");
+    BasicBlock *falseBlock = BasicBlock::Create(*getContext(), "bool.false");
+    BasicBlock *endBlock = BasicBlock::Create(*getContext(), "bool.end");
+
+    CodegenBranch(exp, trueBlock, falseBlock);
+
+    func->insert(func->end(), trueBlock);
+    getBuilder()->SetInsertPoint(trueBlock);
+    getBuilder()->CreateBr(endBlock);
+
+    func->insert(func->end(), falseBlock);
+    getBuilder()->SetInsertPoint(falseBlock);
+    getBuilder()->CreateBr(endBlock);
+
+    func->insert(func->end(), endBlock);
+    getBuilder()->SetInsertPoint(endBlock);
+    PHINode *phi = getBuilder()->CreatePHI(GetBoolType(), 2);
+    phi->addIncoming(GetBool(true), trueBlock);
+    phi->addIncoming(GetBool(false), falseBlock);
+    return phi;
+  }
+
+  // Get the expression if it's a float multiplication.
+  static const CallExp *asFloatMul(const Exp &exp) {
+    const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+    return callExp && callExp->getFuncName() == "*" &&
+                   callExp->getType() == kTypeFloat
+               ? callExp
+               : nullptr;
+  }
+
+  Value *codegenFloat(const Exp &exp) {
+    return convertToTargetType(Codegen(exp), GetFloatType());
+  }
+
+  // Contract a float addition or subtraction with a multiplication operand
+  // into llvm.fmuladd, which the backend turns into an FMA instruction where
+  // that's profitable.  Operands are evaluated in source order.  Returns null
+  // if neither operand is a multiplication.
+  Value *codegenFMulAdd(const CallExp &exp) {
+    const Exp &lhs = *exp.getArgs()[0];
+    const Exp &rhs = *exp.getArgs()[1];
+    bool isSub = exp.getFuncName() == "-";
+
+    Value *mulLhs, *mulRhs, *addend;
+    if (const CallExp *mul = asFloatMul(lhs)) {
+      // a*b + c, a*b - c
+      mulLhs = codegenFloat(*mul->getArgs()[0]);
+      mulRhs = codegenFloat(*mul->getArgs()[1]);
+      addend = codegenFloat(rhs);
+      if (isSub)
+        addend = getBuilder()->CreateFNeg(addend);
+    } else if (const CallExp *mul = asFloatMul(rhs)) {
+      // c + a*b, c - a*b
+      addend = codegenFloat(lhs);
+      mulLhs = codegenFloat(*mul->getArgs()[0]);
+      mulRhs = codegenFloat(*mul->getArgs()[1]);
+      if (isSub)
+        mulLhs = getBuilder()->CreateFNeg(mulLhs);
+    } else {
+      return nullptr;
+    }
+    return getBuilder()->CreateIntrinsic(Intrinsic::fmuladd, {GetFloatType()},
+                                         {mulLhs, mulRhs, addend});
+  }
 };
 
 // Statement code generator.
 class CodegenStmt : public StmtVisitor, CodegenBase {
 public:
   CodegenStmt(LLVMContext *context, Module *module, IRBuilder<> *builder,
-              SymbolTable *symbols, FunctionTable *functions,
-              Function *currentFunction)
-      : CodegenBase(context, module, builder), m_symbols(symbols),
+              const CodegenOptions *options, SymbolTable *symbols,
+              FunctionTable *functions, Function *currentFunction,
+              const FuncInfo *funcInfo, TailRecursionLoop *loop)
+      : CodegenBase(context, module, builder, options), m_symbols(symbols),
         m_functions(functions), m_currentFunction(currentFunction),
-        m_codegenExp(context, module, builder, symbols, functions) {}
+        m_funcInfo(funcInfo), m_loop(loop),
+        m_codegenExp(context, module, builder, options, symbols, functions,
+                     funcInfo) {}
 
   void Codegen(const Stmt &stmt) { const_cast<Stmt &>(stmt).Dispatch(*this); }
 
@@ -479,6 +725,7 @@ public:
     // create an index value for the element you want to assign
     Value *rvalue = m_codegenExp.Codegen(stmt.GetRvalue());
     Value *index = m_codegenExp.Codegen(*stmt.getIndexExp());
+    m_codegenExp.CheckArrayIndex(varDecl, *stmt.getIndexExp(), index);
 
     rvalue = convertToTargetType(rvalue, allocInst->getAllocatedType());
     if (allocInst->getAllocatedType()->isArrayTy()) {
@@ -565,15 +812,7 @@ public:
                                    errorBlock);
 
         getBuilder()->SetInsertPoint(errorBlock);
-        auto errorMessage = getBuilder()->CreateGlobalStringPtr(
-            "Error: Array size must be greater than 0\n");
-        getBuilder()->CreateCall(
-            m_module->getFunction("printf"),
-            {getBuilder()->CreateGlobalStringPtr("%s"), errorMessage});
-        getBuilder()->CreateCall(
-            m_module->getFunction("exit"),
-            llvm::ConstantInt::get(llvm::Type::getInt32Ty(*getContext()), -1));
-        getBuilder()->CreateUnreachable();
+        emitRuntimeError("Error: Array size must be greater than 0\n", {});
         // No need to add more instructions here, as exit terminates the program
 
         // Normal execution resumes in the continueBlock
@@ -607,7 +846,29 @@ public:
 
   // Generate code for a return statement.
   void Visit(ReturnStmt &stmt) override {
+    auto it = m_funcInfo->tailRecursiveReturns.find(&stmt);
+    if (it != m_funcInfo->tailRecursiveReturns.end()) {
+      codegenTailRecursion(it->second);
+      return;
+    }
+
     Value *result = m_codegenExp.Codegen(stmt.GetExp());
+
+    // A call to another user function in tail position doesn't need a new
+    // stack frame.
+    const auto *callExp = dynamic_cast<const CallExp *>(&stmt.GetExp());
+    if (callExp && !callExp->getFuncDef()->isBuiltin() &&
+        !m_loop->accumulator)
+      markTailCall(llvm::cast<CallInst>(result));
+
+    EmitReturn(result);
+  }
+
+  // Return the given value from the current function, adding in the
+  // accumulated operands of tail recursive returns if there are any.
+  void EmitReturn(Value *result) {
+    if (m_loop->accumulator)
+      result = accumulate(m_loop->accumulator, result);
     getBuilder()->CreateRet(result);
   }
 
@@ -620,23 +881,23 @@ public:
 
   // Generate code for an "if" statement.
   void Visit(IfStmt &stmt) override {
-    // Generate code for the conditional expression.
-    Value *condition = codegenCondExp(stmt.getCondExp());
-
     // then block
     // optional else block
     // join/merge block
-    BasicBlock *thenBlock =
-        BasicBlock::Create(*getContext(), "then", m_currentFunction);
+    BasicBlock *thenBlock = BasicBlock::Create(*getContext(), "then");
     BasicBlock *elseBlock =
-        stmt.hasElseStmt()
-            ? BasicBlock::Create(*getContext(), "else", m_currentFunction)
-            : nullptr;
-    BasicBlock *joinBlock =
-        BasicBlock::Create(*getContext(), "join", m_currentFunction);
+        stmt.hasElseStmt() ? BasicBlock::Create(*getContext(), "else")
+                           : nullptr;
+    BasicBlock *joinBlock = BasicBlock::Create(*getContext(), "join");
 
-    getBuilder()->CreateCondBr(condition, thenBlock,
+    // Generate code for the conditional expression, which jumps straight to
+    // the branches.  The blocks are placed after the ones of the condition.
+    m_codegenExp.CodegenBranch(stmt.getCondExp(), thenBlock,
                                elseBlock ? elseBlock : joinBlock);
+    m_currentFunction->insert(m_currentFunction->end(), thenBlock);
+    if (elseBlock)
+      m_currentFunction->insert(m_currentFunction->end(), elseBlock);
+    m_currentFunction->insert(m_currentFunction->end(), joinBlock);
 
     // Codegen for then branch
     getBuilder()->SetInsertPoint(thenBlock);
@@ -667,17 +928,15 @@ public:
     getBuilder()->CreateBr(loopBlock);
     getBuilder()->SetInsertPoint(loopBlock);
 
-    // Generate code for the loop condition.
-    Value *condition = codegenCondExp(stmt.GetCondExp());
-
     // Create basic blocks for the loop body and the join point.
-    BasicBlock *bodyBlock =
-        BasicBlock::Create(*getContext(), "body", m_currentFunction);
-    BasicBlock *joinBlock =
-        BasicBlock::Create(*getContext(), "join", m_currentFunction);
+    BasicBlock *bodyBlock = BasicBlock::Create(*getContext(), "body");
+    BasicBlock *joinBlock = BasicBlock::Create(*getContext(), "join");
 
-    // Create a conditional branch.
-    getBuilder()->CreateCondBr(condition, bodyBlock, joinBlock);
+    // Generate code for the loop condition, which jumps to the body or the
+    // join point.
+    m_codegenExp.CodegenBranch(stmt.GetCondExp(), bodyBlock, joinBlock);
+    m_currentFunction->insert(m_currentFunction->end(), bodyBlock);
+    m_currentFunction->insert(m_currentFunction->end(), joinBlock);
 
     // Generate code for the loop body, followed by an unconditional branch to
     // the loop head.
@@ -697,26 +956,33 @@ public:
     // 2. Create basic blocks for the loop header, body, update, and exit.
     BasicBlock *headerBlock =
         BasicBlock::Create(*getContext(), "for.header", m_currentFunction);
-    BasicBlock *bodyBlock =
-        BasicBlock::Create(*getContext(), "for.body", m_currentFunction);
+    BasicBlock *bodyBlock = BasicBlock::Create(*getContext(), "for.body");
     BasicBlock *updateBlock =
-        stmt.HasUpdateStmt()
-            ? BasicBlock::Create(*getContext(), "for.update", m_currentFunction)
-            : nullptr;
-    BasicBlock *exitBlock =
-        BasicBlock::Create(*getContext(), "for.exit", m_currentFunction);
+        stmt.HasUpdateStmt() ? BasicBlock::Create(*getContext(), "for.update")
+                             : nullptr;
+    BasicBlock *exitBlock = BasicBlock::Create(*getContext(), "for.exit");
+
+    // Checks hoisted out of the loop go in front of it.
+    auto checks = m_funcInfo->hoistedChecks.find(&stmt);
+    if (checks != m_funcInfo->hoistedChecks.end()) {
+      for (const HoistedCheck &check : checks->second)
+        m_codegenExp.CheckHoistedArrayIndex(check);
+    }
 
     // Jump to the header block.
     getBuilder()->CreateBr(headerBlock);
     getBuilder()->SetInsertPoint(headerBlock);
 
-    // 3. Codegen for the condition (if any).
-    Value *condition = stmt.HasCondExp()
-                           ? m_codegenExp.Codegen(stmt.GetCondExp())
-                           : GetBool(true);
-
-    // Create conditional branch based on the loop condition.
-    getBuilder()->CreateCondBr(condition, bodyBlock, exitBlock);
+    // 3. Codegen for the condition (if any), which jumps to the body or the
+    // exit block.
+    if (stmt.HasCondExp())
+      m_codegenExp.CodegenBranch(stmt.GetCondExp(), bodyBlock, exitBlock);
+    else
+      getBuilder()->CreateBr(bodyBlock);
+    m_currentFunction->insert(m_currentFunction->end(), bodyBlock);
+    if (updateBlock)
+      m_currentFunction->insert(m_currentFunction->end(), updateBlock);
+    m_currentFunction->insert(m_currentFunction->end(), exitBlock);
 
     // 4. Codegen for the loop body.
     getBuilder()->SetInsertPoint(bodyBlock);
@@ -738,36 +1004,73 @@ private:
   SymbolTable *m_symbols;
   FunctionTable *m_functions;
   Function *m_currentFunction;
+  const FuncInfo *m_funcInfo;
+  TailRecursionLoop *m_loop;
   CodegenExp m_codegenExp;
 
-  // Generate code for the condition expression in an "if" statement or a while
-  // loop.
-  Value *codegenCondExp(const Exp &exp) {
-    Value *condition = m_codegenExp.Codegen(exp);
-    if (exp.getType() == kTypeBool) {
-      return condition;
-
-      // Convert the integer conditional expresison to a boolean (i1) using a
-      // comparison.
-    } else if (exp.getType() == kTypeInt) {
-      return getBuilder()->CreateICmpNE(condition, GetInt(0));
-    } else
-      return getBuilder()->CreateFCmpUNE(
-          condition, llvm::ConstantFP::get(GetFloatType(), 0.0), "tobool");
+  // The accumulated operands are combined in a different order than in the
+  // source, so the accumulator must wrap even if overflow is undefined.
+  Value *accumulate(Value *lhs, Value *rhs) {
+    return m_loop->accumulatorOp == "*" ? getBuilder()->CreateMul(lhs, rhs)
+                                        : getBuilder()->CreateAdd(lhs, rhs);
+  }
+
+  // Replace a tail recursive return with a jump to the loop header, passing
+  // the new arguments (and accumulated value) to its PHI nodes.  The operand
+  // and the arguments are evaluated in source order.
+  void codegenTailRecursion(const TailRecursiveReturn &tailReturn) {
+    Value *operand = nullptr;
+    if (tailReturn.operand && tailReturn.operandFirst)
+      operand = m_codegenExp.Codegen(*tailReturn.operand);
+
+    std::vector<Value *> args;
+    for (const ExpPtr &arg : tailReturn.call->getArgs())
+      args.push_back(m_codegenExp.Codegen(*arg));
+
+    if (tailReturn.operand && !tailReturn.operandFirst)
+      operand = m_codegenExp.Codegen(*tailReturn.operand);
+
+    Value *accumulator = m_loop->accumulator;
+    if (accumulator && operand)
+      accumulator = accumulate(accumulator, operand);
+
+    BasicBlock *block = getBuilder()->GetInsertBlock();
+    for (size_t i = 0; i < args.size(); ++i)
+      m_loop->params[i]->addIncoming(args[i], block);
+    if (m_loop->accumulator)
+      m_loop->accumulator->addIncoming(accumulator, block);
+
+    getBuilder()->CreateBr(m_loop->header);
+  }
+
+  // Mark a call that is immediately returned as a tail call.  If the callee
+  // has the same prototype and calling convention, the tail call is
+  // guaranteed (musttail), even without optimization.
+  void markTailCall(CallInst *call) {
+    Function *callee = call->getCalledFunction();
+    if (callee->getFunctionType() == m_currentFunction->getFunctionType() &&
+        callee->getCallingConv() == m_currentFunction->getCallingConv())
+      call->setTailCallKind(CallInst::TCK_MustTail);
+    else
+      call->setTailCall();
   }
 };
 
 // Function definition code generator.
 class CodegenFunc : public CodegenBase {
 public:
-  CodegenFunc(LLVMContext *context, Module *module, FunctionTable *functions)
-      : CodegenBase(context, module, &m_builder), m_builder(*context),
-        m_functions(functions) {}
+  CodegenFunc(LLVMContext *context, Module *module,
+              const CodegenOptions *options, FunctionTable *functions,
+              const FuncInfoTable *funcInfos)
+      : CodegenBase(context, module, &m_builder, options), m_builder(*context),
+        m_functions(functions), m_funcInfos(funcInfos) {
+    SetFastMathFlags(*options, &m_builder);
+  }
 
   // Generate code for a function definition.
   void Codegen(const FuncDef *funcDef) {
     // Don't generate code for builtin function declarations.
-    if (!funcDef->hasBody())
+    if (funcDef->isBuiltin())
       return;
 
     // Convert parameter types to LLVM types.
@@ -782,18 +1085,31 @@ public:
     llvm::Type *returnType = ConvertType(funcDef->getReturnType());
     FunctionType *funcType =
         FunctionType::get(returnType, paramTypes, false /*isVarArg*/);
-    Function *function = Function::Create(funcType, Function::ExternalLinkage,
-                                          funcDef->getName(), getModule());
-
-    // The main function has external linkage.  Other functions are
-    // "internal", which encourages inlining.
-    function->setLinkage(funcDef->getName() == "main"
+    const std::string &symbol = funcDef->getSymbol();
+    Function *function =
+        Function::Create(funcType, Function::ExternalLinkage,
+                         symbol.empty() ? funcDef->getName() : symbol,
+                         getModule());
+
+    // The main function and the functions that other files call have
+    // external linkage.  Other functions are "internal", which encourages
+    // inlining.
+    function->setLinkage(funcDef->getName() == "main" || !symbol.empty()
                              ? Function::ExternalLinkage
                              : Function::InternalLinkage);
+    AddFunctionAttributes(m_funcInfos->at(funcDef), *m_options, function);
 
     // Update the function table.
     m_functions->insert(FunctionTable::value_type(funcDef, function));
 
+    // A function of another file is only declared.
+    if (funcDef->isImported())
+      return;
+
+    // Create entry block and use it as the builder's insertion point.
+    BasicBlock *block = BasicBlock::Create(*getContext(), "entry", function);
+    getBuilder()->SetInsertPoint(block);
+
     // Construct a symbol table that maps the parameter declarations to the LLVM
     // function parameters.
     SymbolTable symbols;
@@ -803,37 +1119,242 @@ public:
       ++i;
     }
 
-    // Create entry block and use it as the builder's insertion point.
-    BasicBlock *block = BasicBlock::Create(*getContext(), "entry", function);
-    getBuilder()->SetInsertPoint(block);
+    // If the function is tail recursive, the body becomes a loop and the
+    // parameters are replaced by PHI nodes in the loop header.
+    const FuncInfo &info = m_funcInfos->at(funcDef);
+    TailRecursionLoop loop;
+    if (!info.tailRecursiveReturns.empty())
+      createTailRecursionLoop(info, function, &symbols, &loop);
 
     // Generate code for the body of the function.
-    CodegenStmt codegen(getContext(), getModule(), getBuilder(), &symbols,
-                        m_functions, function);
+    CodegenStmt codegen(getContext(), getModule(), getBuilder(), m_options,
+                        &symbols, m_functions, function, &info, &loop);
     codegen.Codegen(funcDef->GetBody());
 
     // Add a return instruction if the user neglected to do so.
     if (!getBuilder()->GetInsertBlock()->getTerminator())
-      getBuilder()->CreateRet(GetInt(0));
+      codegen.EmitReturn(Constant::getNullValue(returnType));
   }
 
 private:
   IRBuilder<> m_builder;
   FunctionTable *m_functions;
+  const FuncInfoTable *m_funcInfos;
+
+  // Create the loop header for a tail recursive function and map the
+  // parameters to PHI nodes, whose first incoming values are the arguments.
+  void createTailRecursionLoop(const FuncInfo &info, Function *function,
+                               SymbolTable *symbols, TailRecursionLoop *loop) {
+    BasicBlock *entry = getBuilder()->GetInsertBlock();
+    loop->header = BasicBlock::Create(*getContext(), "tailrecurse", function);
+    getBuilder()->CreateBr(loop->header);
+    getBuilder()->SetInsertPoint(loop->header);
+
+    for (Argument &arg : function->args()) {
+      PHINode *phi = getBuilder()->CreatePHI(arg.getType(), 2);
+      phi->addIncoming(&arg, entry);
+      loop->params.push_back(phi);
+    }
+    for (auto &symbol : *symbols) {
+      auto *arg = llvm::cast<Argument>(symbol.second);
+      symbol.second = loop->params[arg->getArgNo()];
+    }
+
+    if (!info.accumulatorOp.empty()) {
+      loop->accumulatorOp = info.accumulatorOp;
+      loop->accumulator =
+          getBuilder()->CreatePHI(function->getReturnType(), 2, "accumulator");
+      loop->accumulator->addIncoming(GetInt(info.accumulatorOp == "*" ? 1 : 0),
+                                     entry);
+    }
+  }
 };
 
 } // namespace
 
-std::unique_ptr<Module> Codegen(LLVMContext *context, const Program &program) {
+FuncInfoTable AnalyzeForCodegen(const Program &program,
+                                const CodegenOptions &options) {
+  // The runtime checks may terminate the program.
+  AnalysisOptions analysisOptions;
+  analysisOptions.trapOnOverflow = options.intOverflow == kIntOverflowTrap;
+  analysisOptions.checkArrayBounds = options.boundsCheck != kBoundsCheckOff;
+  analysisOptions.diagnoseArrayBounds =
+      options.boundsCheck == kBoundsCheckDiagnose;
+  return AnalyzeProgram(program, analysisOptions);
+}
+
+void SetFastMathFlags(const CodegenOptions &options, IRBuilderBase *builder) {
+  FastMathFlags flags;
+  flags.setAllowReassoc(options.fpReassociate);
+  flags.setNoNaNs(options.fpNoNaNs);
+  flags.setNoInfs(options.fpNoInfs);
+  flags.setNoSignedZeros(options.fpNoSignedZeros);
+  flags.setAllowReciprocal(options.fpReciprocal);
+  flags.setAllowContract(options.fpContract == kFPContractFast);
+  builder->setFastMathFlags(flags);
+}
+
+void AddFunctionAttributes(const FuncInfo &info, const CodegenOptions &options,
+                           Function *function) {
+  // There are no exceptions in the language.
+  function->setDoesNotThrow();
+  if (!info.isRecursive)
+    function->setDoesNotRecurse();
+  if (!info.mayNotReturn)
+    function->setWillReturn();
+
+  // Parameters are scalars and there are no globals, so a function that
+  // doesn't print can't touch any memory visible to its caller.
+  if (!info.hasSideEffects)
+    function->setDoesNotAccessMemory();
+
+  if (function->hasInternalLinkage())
+    function->setCallingConv(CallingConv::Fast);
+
+  // The backend reads the floating point semantics from these attributes.
+  if (options.fpNoNaNs)
+    function->addFnAttr("no-nans-fp-math", "true");
+  if (options.fpNoInfs)
+    function->addFnAttr("no-infs-fp-math", "true");
+  if (options.fpNoSignedZeros)
+    function->addFnAttr("no-signed-zeros-fp-math", "true");
+  if (options.fpReassociate && options.fpReciprocal && options.fpNoSignedZeros)
+    function->addFnAttr("unsafe-fp-math", "true");
+}
+
+std::unique_ptr<Module> Codegen(LLVMContext *context, const Program &program,
+                                const CodegenOptions &options) {
   // Construct LLVM module.
   std::unique_ptr<Module> module(new Module("module", *context));
 
   // Table that has function definitions and their llvm equivalents
   FunctionTable functions;
 
+  // Facts about each function, which become function attributes and decide
+  // where bounds checks go.
+  FuncInfoTable funcInfos = AnalyzeForCodegen(program, options);
+
   // Generate code for each function, adding LLVM functions to the module.
   for (const FuncDefPtr &funcDef : program.GetFunctions()) {
-    CodegenFunc(context, module.get(), &functions).Codegen(funcDef.get());
+    CodegenFunc(context, module.get(), &options, &functions, &funcInfos)
+        .Codegen(funcDef.get());
   }
   return std::move(module);
-}
\ No newline at end of file
+}
+
+// Translate the floating point options for the backend.
+llvm::TargetOptions GetTargetOptions(const CodegenOptions &options) {
+  llvm::TargetOptions targetOptions;
+  targetOptions.UnsafeFPMath = options.fpReassociate &&
+                               options.fpReciprocal && options.fpNoSignedZeros;
+  targetOptions.NoNaNsFPMath = options.fpNoNaNs;
+  targetOptions.NoInfsFPMath = options.fpNoInfs;
+  targetOptions.NoSignedZerosFPMath = options.fpNoSignedZeros;
+  switch (options.fpContract) {
+  case kFPContractOff:
+    targetOptions.AllowFPOpFusion = llvm::FPOpFusion::Strict;
+    break;
+  case kFPContractOn:
+    targetOptions.AllowFPOpFusion = llvm::FPOpFusion::Standard;
+    break;
+  case kFPContractFast:
+    targetOptions.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+    break;
+  }
+  return targetOptions;
+}
+
+namespace {
+
+bool hasType(llvm::Type *type, ::Type expected) {
+  switch (expected) {
+  case kTypeBool:
+    return type->isIntegerTy(1);
+  case kTypeInt:
+    return type->isIntegerTy(32);
+  case kTypeFloat:
+    return type->isFloatTy();
+  case kTypeUnknown:
+    break;
+  }
+  return false;
+}
+
+} // namespace
+
+// The LLVM names of overloads get a suffix, so they are told apart by their
+// types.
+Function *FindFunction(Module &module, const FuncDef &funcDef) {
+  const std::vector<VarDeclPtr> &params = funcDef.getParams();
+  for (Function &function : module) {
+    StringRef name = function.getName();
+    if (function.isDeclaration() || !name.consume_front(funcDef.getName()) ||
+        !(name.empty() || name.startswith(".")))
+      continue;
+    FunctionType *type = function.getFunctionType();
+    bool matches = hasType(type->getReturnType(), funcDef.getReturnType()) &&
+                   type->getNumParams() == params.size();
+    for (size_t i = 0; matches && i < params.size(); ++i)
+      matches = hasType(type->getParamType(i), params[i]->GetType());
+    if (matches)
+      return &function;
+  }
+  return nullptr;
+}
+
+void DropPureAttributes(Function *function) {
+  function->removeFnAttr(Attribute::Memory);
+  function->removeFnAttr(Attribute::WillReturn);
+  for (User *user : function->users()) {
+    if (auto *call = dyn_cast<CallBase>(user)) {
+      call->removeFnAttr(Attribute::Memory);
+      call->removeFnAttr(Attribute::WillReturn);
+    }
+  }
+}
+
+namespace {
+
+// A guaranteed tail call needs the same calling convention and parameter
+// attributes on both sides, which a function that follows C's no longer
+// shares with the others, so it becomes an ordinary tail call.
+void relaxTailCall(CallInst *call) {
+  if (call->isMustTailCall() &&
+      call->getCalledFunction() != call->getFunction())
+    call->setTailCall();
+}
+
+} // namespace
+
+// Codegen gives internal functions the fast calling convention, which only
+// happens to match C's on some targets.  C passes bool as a byte that is
+// zero or one, which the callee may rely on, so calls inside the module
+// have to extend it as well.
+void UseCCallingConvention(Function *function) {
+  std::vector<unsigned> boolParams;
+  for (Argument &param : function->args()) {
+    if (param.getType()->isIntegerTy(1))
+      boolParams.push_back(param.getArgNo());
+  }
+  bool boolResult = function->getReturnType()->isIntegerTy(1);
+  auto addAttributes = [&](auto *target) {
+    for (unsigned param : boolParams)
+      target->addParamAttr(param, Attribute::ZExt);
+    if (boolResult)
+      target->addRetAttr(Attribute::ZExt);
+  };
+  function->setCallingConv(CallingConv::C);
+  addAttributes(function);
+  for (User *user : function->users()) {
+    auto *call = dyn_cast<CallInst>(user);
+    if (!call)
+      continue;
+    call->setCallingConv(CallingConv::C);
+    addAttributes(call);
+    relaxTailCall(call);
+  }
+  for (Instruction &instruction : instructions(*function)) {
+    if (auto *call = dyn_cast<CallInst>(&instruction))
+      relaxTailCall(call);
+  }
+}
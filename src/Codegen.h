@@ -2,8 +2,73 @@
 
 #include <memory>
 
+class FuncDef;
 class Program;
-namespace llvm { class LLVMContext; class Module; }
+namespace llvm { class Function; class LLVMContext; class Module; class TargetOptions; }
+namespace mir { class Module; }
+
+// Floating point contraction of a*b+c into a fused multiply-add.
+enum FPContract
+{
+    kFPContractOff,   // never fuse
+    kFPContractOn,    // fuse within a single expression (llvm.fmuladd)
+    kFPContractFast   // fuse wherever the backend finds a chance
+};
+
+// Semantics of signed integer overflow in +, - and *.
+enum IntOverflow
+{
+    kIntOverflowUndefined,  // the optimizer may assume it never happens (nsw)
+    kIntOverflowWrap,       // two's complement wrap around
+    kIntOverflowTrap        // checked at runtime, aborting the program
+};
+
+// What happens when an array index is out of bounds.
+enum BoundsCheck
+{
+    kBoundsCheckOff,        // nothing, the access is undefined
+    kBoundsCheckTrap,       // abort the program with a trap instruction
+    kBoundsCheckDiagnose    // print the index and the array, then exit
+};
+
+// Options that change the generated code.
+struct CodegenOptions
+{
+    // Floating point semantics, which are strict IEEE by default.
+    bool       fpReassociate   = false;  // allow reassociation
+    bool       fpNoNaNs        = false;  // assume no NaN operands or results
+    bool       fpNoInfs        = false;  // assume no infinite operands or results
+    bool       fpNoSignedZeros = false;  // ignore the sign of zero
+    bool       fpReciprocal    = false;  // allow x/y to become x*(1/y)
+    FPContract fpContract      = kFPContractOff;
+
+    IntOverflow intOverflow    = kIntOverflowUndefined;
+    BoundsCheck boundsCheck    = kBoundsCheckOff;
+};
 
 // Generate LLVM IR for the given program.
-std::unique_ptr<llvm::Module> Codegen( llvm::LLVMContext* context, const Program& program );
+std::unique_ptr<llvm::Module> Codegen( llvm::LLVMContext* context, const Program& program,
+                                       const CodegenOptions& options = CodegenOptions() );
+
+// Generate LLVM IR for the given program from its MIR (see Mir.h).
+std::unique_ptr<llvm::Module> Codegen( llvm::LLVMContext* context, const Program& program,
+                                       const mir::Module& mirModule,
+                                       const CodegenOptions& options = CodegenOptions() );
+
+// Translate the floating point options for the backend.
+llvm::TargetOptions GetTargetOptions( const CodegenOptions& options );
+
+// Find the function that Codegen generated for the definition, or null.
+llvm::Function* FindFunction( llvm::Module& module, const FuncDef& funcDef );
+
+// Remove the attributes that say that the function doesn't access memory
+// and returns from it and from the calls to it.  Code that is added to a
+// function after Codegen, or put between it and its callers, like profile
+// counters or JIT stubs, has to do this if it breaks them.
+void DropPureAttributes( llvm::Function* function );
+
+// Make a function callable from C: give it and the calls to it the C
+// calling convention, and extend its bool parameters and result to a byte.
+// For the functions that the host of a session calls, or that an object
+// file exports.
+void UseCCallingConvention( llvm::Function* function );
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Analysis.h"
+#include "Codegen.h"
+
+namespace llvm { class Function; class IRBuilderBase; }
+
+// Helpers shared by the code generators for the AST and for MIR.
+
+// Analyze the program, taking into account the runtime checks that the
+// options add.
+FuncInfoTable AnalyzeForCodegen( const Program& program, const CodegenOptions& options );
+
+// Give every floating point operation created by the builder the fast-math
+// flags selected by the options.
+void SetFastMathFlags( const CodegenOptions& options, llvm::IRBuilderBase* builder );
+
+// Translate the facts inferred by the analysis into LLVM attributes.
+// Internal functions can't be called from the outside, so they also get the
+// cheaper "fast" calling convention.
+void AddFunctionAttributes( const FuncInfo& info, const CodegenOptions& options,
+                            llvm::Function* function );
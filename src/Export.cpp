@@ -0,0 +1,140 @@
+#include "Export.h"
+#include "Codegen.h"
+#include "FuncDef.h"
+#include "Program.h"
+
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <cctype>
+#include <ostream>
+#include <sstream>
+
+using namespace llvm;
+
+namespace {
+
+bool isIdentifier(const std::string &name) {
+  return !name.empty() && !std::isdigit(name[0]) &&
+         std::all_of(name.begin(), name.end(), [](char c) {
+           return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+         });
+}
+
+const char *getCType(::Type type) {
+  switch (type) {
+  case kTypeBool:
+    return "bool";
+  case kTypeInt:
+    return "int";
+  case kTypeFloat:
+    return "float";
+  case kTypeUnknown:
+    break;
+  }
+  return "void";
+}
+
+} // namespace
+
+bool ExportFunctions(Module &module, const Program &program,
+                     const std::vector<std::string> &names,
+                     std::vector<const FuncDef *> *exported,
+                     std::ostream &errors) {
+  // The builtins are the functions without a body.  main would clash with
+  // the one of the program that loads the library, so it's only exported by
+  // name.
+  const std::vector<FuncDefPtr> &functions = program.GetFunctions();
+  for (const FuncDefPtr &funcDef : functions) {
+    const std::string &name = funcDef->getName();
+    if (funcDef->hasBody() &&
+        (names.empty() ? name != "main"
+                       : std::find(names.begin(), names.end(), name) !=
+                             names.end()))
+      exported->push_back(funcDef.get());
+  }
+  for (const std::string &name : names) {
+    auto isNamed = [&name](const FuncDef *funcDef) {
+      return funcDef->getName() == name;
+    };
+    if (std::none_of(exported->begin(), exported->end(), isNamed)) {
+      errors << "Error: there is no function " << name << " to export\n";
+      return false;
+    }
+  }
+
+  std::vector<Function *> exportedFunctions;
+  for (const FuncDef *funcDef : *exported) {
+    const std::string &name = funcDef->getName();
+    size_t count = std::count_if(
+        functions.begin(), functions.end(),
+        [&name](const FuncDefPtr &other) { return other->getName() == name; });
+    Function *function = FindFunction(module, *funcDef);
+    if (!isIdentifier(name)) {
+      errors << "Error: operator" << name << " can't be exported to C\n";
+      return false;
+    }
+    if (count > 1) {
+      errors << "Error: " << name
+             << " is overloaded, so it can't be exported to C\n";
+      return false;
+    }
+    if (!function || function->getName() != name) {
+      errors << "Error: " << name
+             << " can't be exported, its symbol is taken by the runtime\n";
+      return false;
+    }
+    exportedFunctions.push_back(function);
+  }
+
+  for (Function &function : module) {
+    if (!function.isDeclaration())
+      function.setLinkage(GlobalValue::InternalLinkage);
+  }
+  for (Function *function : exportedFunctions) {
+    function->setLinkage(GlobalValue::ExternalLinkage);
+    UseCCallingConvention(function);
+  }
+  return true;
+}
+
+std::string GenerateHeader(const std::vector<const FuncDef *> &functions,
+                           const std::string &headerName,
+                           const std::string &sourceName) {
+  std::string guard;
+  for (char c : sys::path::filename(headerName))
+    guard += std::isalnum(static_cast<unsigned char>(c))
+                 ? static_cast<char>(std::toupper(c))
+                 : '_';
+  if (guard.empty() || std::isdigit(static_cast<unsigned char>(guard[0])))
+    guard = "MOJ_" + guard;
+
+  std::ostringstream out;
+  out << "// Generated by moj from " << sys::path::filename(sourceName).str()
+      << ".\n"
+      << "#ifndef " << guard << "\n"
+      << "#define " << guard << "\n\n"
+      << "#include <stdbool.h>\n\n"
+      << "#ifdef __cplusplus\n"
+      << "extern \"C\" {\n"
+      << "#endif\n\n";
+  for (const FuncDef *funcDef : functions) {
+    out << getCType(funcDef->getReturnType()) << ' ' << funcDef->getName()
+        << '(';
+    const std::vector<VarDeclPtr> &params = funcDef->getParams();
+    if (params.empty())
+      out << "void";
+    for (size_t i = 0; i < params.size(); ++i) {
+      if (i > 0)
+        out << ", ";
+      out << getCType(params[i]->GetType()) << ' ' << params[i]->GetName();
+    }
+    out << ");\n";
+  }
+  out << "\n#ifdef __cplusplus\n"
+      << "}\n"
+      << "#endif\n\n"
+      << "#endif\n";
+  return out.str();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class FuncDef;
+class Program;
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+// Functions that an object file or shared library exports (-export,
+// -shared), for C and C++ programs that call them through a generated
+// header.  An exported function keeps its name as its symbol and follows
+// the C calling convention of its types: int is int, float is float and
+// bool is bool from stdbool.h.  All other functions become internal.
+
+// Export the functions of the program with the given names, or all of its
+// functions but main if no names are given, and return them in *exported.  Returns
+// false, with an error message, if there is no function with one of the
+// names, or if one can't be called from C because its name is an operator,
+// it's overloaded or its symbol is taken.
+bool ExportFunctions(llvm::Module &module, const Program &program,
+                     const std::vector<std::string> &names,
+                     std::vector<const FuncDef *> *exported,
+                     std::ostream &errors);
+
+// Generate a C header that declares the functions, with an include guard
+// named after the header's file name.
+std::string GenerateHeader(const std::vector<const FuncDef *> &functions,
+                           const std::string &headerName,
+                           const std::string &sourceName);
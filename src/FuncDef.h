@@ -31,6 +31,20 @@ class FuncDef
 
     bool hasBody() const { return bool(m_body ); }
 
+    // The functions of a program of several files have symbols of their
+    // own (see Import.h), by which the other files call them.  Functions
+    // without one are internal, except main.
+    const std::string& getSymbol() const { return m_symbol; }
+
+    void setSymbol( const std::string& symbol ) { m_symbol = symbol; }
+
+    // A declaration of a function of another file, which has a symbol but no
+    // body.
+    bool isImported() const { return !hasBody() && !m_symbol.empty(); }
+
+    // The builtins are the other functions without a body.
+    bool isBuiltin() const { return !hasBody() && m_symbol.empty(); }
+
     const SeqStmt& GetBody() const
     {
         assert(hasBody() && "Expected function body" );
@@ -42,7 +56,30 @@ class FuncDef
     std::string             m_name;
     std::vector<VarDeclPtr> m_params;
     SeqStmtPtr              m_body;
+    std::string             m_symbol;
 };
 
 using FuncDefPtr = std::unique_ptr<FuncDef>;
 
+// Name a function after its parameter types, e.g. "f(int,float)".  Overloads
+// of a name have different signatures.
+inline std::string GetSignature( const std::string& name, const std::vector<Type>& paramTypes )
+{
+    std::string signature = name + "(";
+    for( size_t i = 0; i < paramTypes.size(); ++i )
+    {
+        if( i > 0 )
+            signature += ",";
+        signature += toString( paramTypes[i] );
+    }
+    return signature + ")";
+}
+
+inline std::string GetSignature( const FuncDef& funcDef )
+{
+    std::vector<Type> paramTypes;
+    for( const VarDeclPtr& param : funcDef.getParams() )
+        paramTypes.push_back( param->GetType() );
+    return GetSignature( funcDef.getName(), paramTypes );
+}
+
@@ -0,0 +1,291 @@
+#include "Import.h"
+#include "Cache.h"
+#include "FuncDef.h"
+#include "Parser.h"
+#include "Program.h"
+#include "TokenStream.h"
+#include "Typechecker.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <cctype>
+#include <map>
+#include <ostream>
+#include <sstream>
+
+namespace {
+
+constexpr const char *kInterfaceMagic = "moj-interface";
+constexpr int kInterfaceVersion = 1;
+
+std::string getSymbol(const std::string &moduleName, const FuncDef &funcDef) {
+  return moduleName + "." + GetSignature(funcDef);
+}
+
+// Operators and main aren't exported.
+bool isExported(const FuncDef &funcDef) {
+  const std::string &name = funcDef.getName();
+  return funcDef.hasBody() && name != "main" &&
+         (std::isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_');
+}
+
+// Report the messages of a file, each prefixed with its path.
+void reportErrors(const std::string &path, const std::string &messages,
+                  std::ostream &errors) {
+  std::istringstream lines(messages);
+  for (std::string line; std::getline(lines, line);)
+    errors << path << ": " << line << '\n';
+}
+
+// Loads the files of a program depth first, so that the imports of a file
+// are loaded before it.
+class ModuleLoader {
+public:
+  ModuleLoader(Cache *cache, std::vector<ModuleFile> *modules,
+               std::ostream &errors)
+      : m_cache(cache), m_modules(modules), m_errors(errors) {}
+
+  // Load a file and its imports, getting its position.  Only modules get
+  // interfaces.
+  bool load(const std::string &path, bool isModule, size_t *position) {
+    llvm::SmallString<128> realPath;
+    if (std::error_code ec = llvm::sys::fs::real_path(path, realPath)) {
+      m_errors << "Error: Could not open " << path << ": " << ec.message()
+               << '\n';
+      return false;
+    }
+    std::string key(realPath);
+    auto loaded = m_positions.find(key);
+    if (loaded != m_positions.end()) {
+      *position = loaded->second;
+      return true;
+    }
+    for (size_t i = 0; i < m_stack.size(); ++i) {
+      if (m_stack[i].first != key)
+        continue;
+      m_errors << "Error: Import cycle: ";
+      for (size_t j = i; j < m_stack.size(); ++j)
+        m_errors << m_stack[j].second << " -> ";
+      m_errors << path << '\n';
+      return false;
+    }
+
+    ModuleFile module;
+    module.path = path;
+    module.name = std::string(llvm::sys::path::stem(path));
+    auto named = m_names.insert({module.name, path});
+    if (!named.second) {
+      m_errors << "Error: Modules " << named.first->second << " and " << path
+               << " have the same name\n";
+      return false;
+    }
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+        llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+      m_errors << "Error: Could not open " << path << ": "
+               << buffer.getError().message() << '\n';
+      return false;
+    }
+    module.source = std::string((*buffer)->getBuffer());
+
+    // The imports are at the start of the file, so reading them doesn't
+    // take parsing the rest.  The interface does, unless it's cached.
+    std::ostringstream messages;
+    TokenStream tokens(module.source.c_str());
+    std::vector<std::string> imports;
+    if (ParseImports(tokens, &imports, messages) != 0) {
+      reportErrors(path, messages.str(), m_errors);
+      return false;
+    }
+    if (isModule && !readInterface(tokens, &module))
+      return false;
+
+    m_stack.emplace_back(key, path);
+    llvm::StringRef directory = llvm::sys::path::parent_path(path);
+    for (const std::string &import : imports) {
+      llvm::SmallString<128> importPath(import);
+      if (llvm::sys::path::is_relative(import)) {
+        importPath = directory;
+        llvm::sys::path::append(importPath, import);
+      }
+      size_t importPosition;
+      if (!load(std::string(importPath), true, &importPosition))
+        return false;
+      module.imports.push_back(importPosition);
+    }
+    m_stack.pop_back();
+
+    *position = m_modules->size();
+    m_positions[key] = *position;
+    m_modules->push_back(std::move(module));
+    return true;
+  }
+
+private:
+  Cache *m_cache;
+  std::vector<ModuleFile> *m_modules;
+  std::ostream &m_errors;
+
+  // The positions of the files that are loaded, by their real paths.
+  std::map<std::string, size_t> m_positions;
+
+  // The files whose imports are being loaded, by their real paths and their
+  // paths, for reporting cycles.
+  std::vector<std::pair<std::string, std::string>> m_stack;
+
+  // The paths of the modules, by their names.
+  std::map<std::string, std::string> m_names;
+
+  // Get the interface of a module from the cache, or by parsing the rest of
+  // its file.
+  bool readInterface(TokenStream &tokens, ModuleFile *module) {
+    std::string cacheName;
+    if (m_cache) {
+      cacheName = Cache::ComputeKey(module->source,
+                                    "interface " + module->name) +
+                  ".mi";
+      if (std::unique_ptr<llvm::MemoryBuffer> interface =
+              m_cache->Lookup(cacheName)) {
+        module->interface = std::string(interface->getBuffer());
+        return true;
+      }
+    }
+    std::ostringstream messages;
+    Program program;
+    if (ParseProgram(tokens, &program, messages) != 0) {
+      reportErrors(module->path, messages.str(), m_errors);
+      return false;
+    }
+    module->interface = GenerateInterface(module->name, program);
+    if (m_cache)
+      m_cache->Store(cacheName, module->interface);
+    return true;
+  }
+};
+
+} // namespace
+
+bool HasImports(const char *source) {
+  TokenStream tokens(source);
+  return *tokens == kTokenImport;
+}
+
+bool LoadModules(const std::string &filename, Cache *cache,
+                 std::vector<ModuleFile> *modules, std::ostream &errors) {
+  size_t position;
+  return ModuleLoader(cache, modules, errors).load(filename, false, &position);
+}
+
+int ParseModule(const ModuleFile &module,
+                const std::vector<ModuleFile> &modules, bool isModule,
+                Program *program, std::ostream &errors) {
+  std::ostringstream messages;
+  std::vector<FuncDefPtr> &functions = program->GetFunctions();
+  std::map<std::string, const ModuleFile *> imported;
+  for (size_t position : module.imports) {
+    const ModuleFile &import = modules[position];
+    size_t numFunctions = functions.size();
+    if (ReadInterface(import.interface, program, messages) != 0) {
+      reportErrors(import.path, messages.str(), errors);
+      return 1;
+    }
+    for (size_t i = numFunctions; i < functions.size(); ++i) {
+      auto it = imported.insert({GetSignature(*functions[i]), &import});
+      if (!it.second) {
+        errors << module.path << ": Error: " << it.first->first
+               << " is imported from both " << it.first->second->path
+               << " and " << import.path << '\n';
+        return 1;
+      }
+    }
+  }
+
+  size_t numFunctions = functions.size();
+  TokenStream tokens(module.source.c_str());
+  std::vector<std::string> imports;
+  int status = ParseImports(tokens, &imports, messages);
+  if (status == 0)
+    status = ParseProgram(tokens, program, messages);
+  if (status != 0) {
+    reportErrors(module.path, messages.str(), errors);
+    return status;
+  }
+  for (size_t i = numFunctions; i < functions.size(); ++i) {
+    FuncDef &funcDef = *functions[i];
+    auto it = imported.find(GetSignature(funcDef));
+    if (it != imported.end()) {
+      errors << module.path << ": Error: " << it->first
+             << " is defined here and imported from " << it->second->path
+             << '\n';
+      return 1;
+    }
+    if (isModule && funcDef.getName() == "main") {
+      errors << module.path << ": Error: Only the file that is compiled can "
+                               "define main, not the modules it imports\n";
+      return 1;
+    }
+    if (isModule && isExported(funcDef))
+      funcDef.setSymbol(getSymbol(module.name, funcDef));
+  }
+
+  status = Typecheck(*program, messages);
+  if (status != 0)
+    reportErrors(module.path, messages.str(), errors);
+  return status;
+}
+
+std::string GenerateInterface(const std::string &moduleName,
+                              const Program &program) {
+  std::ostringstream out;
+  out << kInterfaceMagic << ' ' << kInterfaceVersion << ' ' << moduleName
+      << '\n';
+  for (const FuncDefPtr &funcDef : program.GetFunctions()) {
+    if (!isExported(*funcDef))
+      continue;
+    out << toString(funcDef->getReturnType()) << ' ' << funcDef->getName()
+        << '(';
+    const char *separator = "";
+    for (const VarDeclPtr &param : funcDef->getParams()) {
+      out << separator << toString(param->GetType()) << ' '
+          << param->GetName();
+      separator = ", ";
+    }
+    out << ");\n";
+  }
+  return out.str();
+}
+
+int ReadInterface(const std::string &interface, Program *program,
+                  std::ostream &errors) {
+  std::istringstream in(interface);
+  std::string magic, moduleName;
+  int version = 0;
+  in >> magic >> version >> moduleName;
+  if (magic != kInterfaceMagic || version != kInterfaceVersion ||
+      moduleName.empty()) {
+    errors << "Error: Not a module interface of this version of moj\n";
+    return 1;
+  }
+
+  // The declarations follow the first line.  A module may have none.
+  size_t start = interface.find('\n');
+  if (start == std::string::npos ||
+      interface.find_first_not_of(" \t\r\n", start) == std::string::npos)
+    return 0;
+  std::vector<FuncDefPtr> &functions = program->GetFunctions();
+  size_t numFunctions = functions.size();
+  TokenStream tokens(interface.c_str() + start);
+  int status = ParseProgram(tokens, program, errors);
+  if (status != 0)
+    return status;
+  for (size_t i = numFunctions; i < functions.size(); ++i) {
+    if (functions[i]->hasBody()) {
+      errors << "Error: A module interface can only declare functions\n";
+      return 1;
+    }
+    functions[i]->setSymbol(getSymbol(moduleName, *functions[i]));
+  }
+  return 0;
+}
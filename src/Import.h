@@ -0,0 +1,79 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class Cache;
+class FuncDef;
+class Program;
+
+// Programs of several files.  A file imports the functions of others with
+// imports at its start, whose paths are relative to the file:
+//
+//   import "geometry.in";
+//
+//   int main() { print(area(2.0, 3.0)); return 0; }
+//
+// An imported file is a module, named after its file.  The importer sees
+// all of its functions but main and operators, and none of the modules that
+// it imports in turn.  Imports can't form a cycle, and only the file that
+// is compiled defines main.
+//
+// Each module is compiled on its own, against the interfaces of the modules
+// that it imports: a short text that declares their functions,
+//
+//   moj-interface 1 geometry
+//   float area(float width, float height);
+//
+// so that a module only has to be compiled again when its source or one of
+// those interfaces changes, not when the bodies of the functions that it
+// calls do.  The functions of a module are called by symbols made of its
+// name and their signatures, like "geometry.area(float,float)".  The
+// modules are linked into one before machine code is generated, so calls
+// across modules are inlined like any others.
+
+// A file of a program.
+struct ModuleFile {
+  // The path, relative to the working directory or absolute.
+  std::string path;
+  std::string name;
+  std::string source;
+
+  // The modules that the file imports, by their positions among the files
+  // of the program.
+  std::vector<size_t> imports;
+
+  // The interface of the module, or empty for the file that is compiled.
+  std::string interface;
+};
+
+// Check whether a source starts with imports, so that it has to be built as
+// a program of several files.
+bool HasImports(const char *source);
+
+// Load a file and all the modules that it imports, directly or not, into
+// *modules, each after the ones it imports, so that the file is the last
+// one.  Interfaces are taken from the cache if there is one, without
+// parsing the modules.  Returns false, with an error message, if a file
+// can't be read or parsed, the imports form a cycle or two modules have the
+// same name.
+bool LoadModules(const std::string &filename, Cache *cache,
+                 std::vector<ModuleFile> *modules, std::ostream &errors);
+
+// Parse and typecheck a file against the interfaces of its imports, adding
+// its functions to the program after those of the interfaces.  The
+// functions of a module, unlike those of the file that is compiled, get
+// symbols.  Returns zero for success.
+int ParseModule(const ModuleFile &module,
+                const std::vector<ModuleFile> &modules, bool isModule,
+                Program *program, std::ostream &errors);
+
+// Generate the interface of a module from its functions.
+std::string GenerateInterface(const std::string &moduleName,
+                              const Program &program);
+
+// Add the functions that an interface declares to the program, as imported
+// functions.  Returns zero for success.
+int ReadInterface(const std::string &interface, Program *program,
+                  std::ostream &errors);
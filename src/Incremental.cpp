@@ -0,0 +1,114 @@
+#include "Incremental.h"
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <cassert>
+
+using namespace llvm;
+
+namespace {
+
+// Collect the functions and globals that a function refers to, directly or
+// through constant expressions, in the order they're first used.
+std::vector<GlobalValue *> getReferencedGlobals(Function &function) {
+  std::vector<GlobalValue *> globals;
+  SmallPtrSet<Constant *, 16> visited;
+  SmallVector<Constant *, 16> worklist;
+  for (Instruction &instruction : instructions(function)) {
+    for (Value *operand : instruction.operands()) {
+      if (auto *constant = dyn_cast<Constant>(operand))
+        if (visited.insert(constant).second)
+          worklist.push_back(constant);
+    }
+    while (!worklist.empty()) {
+      Constant *constant = worklist.pop_back_val();
+      if (auto *global = dyn_cast<GlobalValue>(constant)) {
+        globals.push_back(global);
+        continue;
+      }
+      for (Value *operand : constant->operands()) {
+        if (auto *nested = dyn_cast<Constant>(operand))
+          if (visited.insert(nested).second)
+            worklist.push_back(nested);
+      }
+    }
+  }
+  return globals;
+}
+
+// Declare a function, or copy a constant, in the module of another
+// function.
+GlobalValue *copyGlobal(GlobalValue *global, Module *module) {
+  if (auto *function = dyn_cast<Function>(global)) {
+    Function *declaration =
+        Function::Create(function->getFunctionType(), function->getLinkage(),
+                         function->getName(), module);
+    declaration->copyAttributesFrom(function);
+    return declaration;
+  }
+  auto *variable = cast<GlobalVariable>(global);
+  assert(variable->isConstant() && "Only constants can be copied");
+  auto *copy = new GlobalVariable(
+      *module, variable->getValueType(), variable->isConstant(),
+      variable->getLinkage(), nullptr, variable->getName(), nullptr,
+      variable->getThreadLocalMode(), variable->getAddressSpace());
+  copy->copyAttributesFrom(variable);
+  return copy;
+}
+
+} // namespace
+
+std::vector<std::unique_ptr<Module>> SplitByFunction(Module &module) {
+  for (Function &function : module) {
+    if (!function.isDeclaration() && function.hasLocalLinkage())
+      function.setLinkage(GlobalValue::ExternalLinkage);
+  }
+
+  std::vector<std::unique_ptr<Module>> modules;
+  for (Function &function : module) {
+    if (function.isDeclaration())
+      continue;
+    auto functionModule =
+        std::make_unique<Module>(function.getName(), module.getContext());
+    functionModule->setDataLayout(module.getDataLayout());
+    functionModule->setTargetTriple(module.getTargetTriple());
+
+    // The function itself comes first, so that it keeps its name.
+    Function *copy =
+        Function::Create(function.getFunctionType(), function.getLinkage(),
+                         function.getName(), functionModule.get());
+    copy->copyAttributesFrom(&function);
+    ValueToValueMapTy map;
+    map[&function] = copy;
+
+    std::vector<GlobalValue *> globals = getReferencedGlobals(function);
+    for (GlobalValue *global : globals) {
+      if (!map.count(global))
+        map[global] = copyGlobal(global, functionModule.get());
+    }
+    for (GlobalValue *global : globals) {
+      auto *variable = dyn_cast<GlobalVariable>(global);
+      if (variable && variable->hasInitializer())
+        cast<GlobalVariable>(map[global])
+            ->setInitializer(MapValue(variable->getInitializer(), map));
+    }
+
+    auto arg = copy->arg_begin();
+    for (Argument &param : function.args()) {
+      arg->setName(param.getName());
+      map[&param] = &*arg++;
+    }
+    SmallVector<ReturnInst *, 8> returns;
+    CloneFunctionInto(copy, &function, map,
+                      CloneFunctionChangeType::DifferentModule, returns);
+    modules.push_back(std::move(functionModule));
+  }
+  return modules;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+// Incremental compilation for --run (-jit-incremental).  The program is
+// split into one module per function, which the JIT optimizes and compiles
+// on its own, like the lazy JIT does, and the object of each function is
+// kept in the cache under a fingerprint of its module (see JitCache.h).
+// After an edit, only the functions whose IR changed are compiled again,
+// and the JIT links them with the objects of the other ones.
+//
+// The module of a function contains declarations of the functions it calls,
+// with their signatures and attributes, so a function is compiled again
+// when one of those changes as well, e.g. when a function it calls starts
+// to print.
+
+// Split the module into one module per function definition, which gets
+// declarations of the functions it calls and copies of the constants it
+// uses.  All functions get external linkage, so that the modules can be
+// linked together.  The module mustn't have variables, which would be
+// copied as well.
+std::vector<std::unique_ptr<llvm::Module>> SplitByFunction(llvm::Module &module);
@@ -0,0 +1,328 @@
+#include "Bytecode.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// GCC and Clang can jump through a table of label addresses, so that each
+// instruction ends in its own indirect jump to the next one ("threaded
+// code"), which the branch predictor tells apart.  Other compilers get a
+// switch in a loop.
+#if defined(__GNUC__) || defined(__clang__)
+#define MOJ_THREADED_DISPATCH 1
+#endif
+
+namespace bytecode {
+namespace {
+
+[[noreturn]] void trap() {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_trap();
+#else
+  std::abort();
+#endif
+}
+
+// Int arithmetic wraps around, which is one of the outcomes that the
+// generated code may have when overflow is undefined.
+int32_t wrap(int64_t value) { return static_cast<int32_t>(value); }
+
+int32_t checked(int64_t value) {
+  if (value != static_cast<int32_t>(value))
+    trap();
+  return static_cast<int32_t>(value);
+}
+
+class Interpreter {
+public:
+  explicit Interpreter(const Module &module) : m_module(module) {}
+
+  void Run();
+
+private:
+  // The state of a caller while it waits for a call to return.
+  struct Frame {
+    const Function *function;
+    const uint32_t *returnPc;
+    size_t base;
+    size_t heapBase;
+    uint32_t result;
+  };
+
+  const Module &m_module;
+
+  // The register windows of the calls, the arrays, and the callers.
+  std::vector<Slot> m_stack;
+  std::vector<Slot> m_heap;
+  std::vector<Frame> m_frames;
+
+  // Make room for the register window of a call at the given base, and
+  // initialize its constants.
+  Slot *enter(const Function &function, size_t base) {
+    size_t end = base + function.getFrameSize();
+    if (m_stack.size() < end)
+      m_stack.resize(std::max(end, 2 * m_stack.size()));
+    Slot *regs = m_stack.data() + base;
+    for (size_t i = 0; i < function.constants.size(); ++i)
+      regs[function.numRegisters + i] = function.constants[i];
+    return regs;
+  }
+};
+
+void Interpreter::Run() {
+  const Function *function = &m_module.functions.at(m_module.main);
+  size_t base = 0;
+  size_t heapBase = 0;
+  Slot *regs = enter(*function, base);
+  if (function->numParams == 1)
+    regs[0].i = 0;
+  Slot *heap = m_heap.data();
+  const uint32_t *pc = function->code.data();
+
+#define R(n) regs[pc[n]]
+#define ELEMENT(array, index)                                                  \
+  heap[static_cast<uint32_t>(regs[array].i) + int64_t(regs[index].i)]
+
+#ifdef MOJ_THREADED_DISPATCH
+  // In the order of the opcodes.
+  static void *const labels[] = {
+      &&op_kMov, &&op_kAddI, &&op_kSubI, &&op_kMulI, &&op_kDivI, &&op_kRemI,
+      &&op_kNegI, &&op_kAddIChecked, &&op_kSubIChecked, &&op_kMulIChecked,
+      &&op_kNegIChecked, &&op_kAddF, &&op_kSubF, &&op_kMulF, &&op_kDivF,
+      &&op_kNegF, &&op_kEqI, &&op_kNeI, &&op_kLtI, &&op_kLeI, &&op_kGtI,
+      &&op_kGeI, &&op_kEqF, &&op_kNeF, &&op_kLtF, &&op_kLeF, &&op_kGtF,
+      &&op_kGeF, &&op_kNot, &&op_kIntToFloat, &&op_kFloatToInt, &&op_kIntToBool,
+      &&op_kFloatToBool, &&op_kJump, &&op_kJumpIf, &&op_kJumpIfNot,
+      &&op_kJumpEqI, &&op_kJumpNeI, &&op_kJumpLtI, &&op_kJumpLeI, &&op_kJumpGtI,
+      &&op_kJumpGeI, &&op_kNewArray, &&op_kLoad, &&op_kStore, &&op_kCheck,
+      &&op_kCheckDiagnose, &&op_kCall, &&op_kTailCall, &&op_kRet, &&op_kPrintI,
+      &&op_kPrintF, &&op_kPrintB};
+  static_assert(sizeof(labels) / sizeof(labels[0]) == kPrintB + 1,
+                "Every opcode needs a label");
+#define CASE(opcode) op_##opcode:
+#define DISPATCH() goto *labels[*pc]
+  DISPATCH();
+#else
+#define CASE(opcode) case opcode:
+#define DISPATCH() continue
+  for (;;) {
+    switch (static_cast<Opcode>(*pc)) {
+#endif
+
+#define NEXT(operands)                                                         \
+  pc += 1 + (operands);                                                        \
+  DISPATCH()
+#define BINARY(opcode, field, expr)                                            \
+  CASE(opcode) {                                                               \
+    auto lhs = R(2).field;                                                     \
+    auto rhs = R(3).field;                                                     \
+    (void)lhs;                                                                 \
+    (void)rhs;                                                                 \
+    expr;                                                                      \
+    NEXT(3);                                                                   \
+  }
+#define UNARY(opcode, expr)                                                    \
+  CASE(opcode) {                                                               \
+    Slot src = R(2);                                                           \
+    (void)src;                                                                 \
+    expr;                                                                      \
+    NEXT(2);                                                                   \
+  }
+#define JUMP(opcode, op)                                                       \
+  CASE(opcode) {                                                               \
+    if (R(1).i op R(2).i) {                                                    \
+      pc = function->code.data() + pc[3];                                      \
+      DISPATCH();                                                              \
+    }                                                                          \
+    NEXT(3);                                                                   \
+  }
+
+    UNARY(kMov, R(1) = src)
+
+    BINARY(kAddI, i, R(1).i = wrap(int64_t(lhs) + rhs))
+    BINARY(kSubI, i, R(1).i = wrap(int64_t(lhs) - rhs))
+    BINARY(kMulI, i, R(1).i = wrap(int64_t(lhs) * rhs))
+    // Division by zero raises SIGFPE, like the generated code on x86.
+    BINARY(kDivI, i, R(1).i = lhs / rhs)
+    BINARY(kRemI, i, R(1).i = lhs % rhs)
+    UNARY(kNegI, R(1).i = wrap(-int64_t(src.i)))
+
+    BINARY(kAddIChecked, i, R(1).i = checked(int64_t(lhs) + rhs))
+    BINARY(kSubIChecked, i, R(1).i = checked(int64_t(lhs) - rhs))
+    BINARY(kMulIChecked, i, R(1).i = checked(int64_t(lhs) * rhs))
+    UNARY(kNegIChecked, R(1).i = checked(-int64_t(src.i)))
+
+    BINARY(kAddF, f, R(1).f = lhs + rhs)
+    BINARY(kSubF, f, R(1).f = lhs - rhs)
+    BINARY(kMulF, f, R(1).f = lhs * rhs)
+    BINARY(kDivF, f, R(1).f = lhs / rhs)
+    UNARY(kNegF, R(1).f = -src.f)
+
+    BINARY(kEqI, i, R(1).i = lhs == rhs)
+    BINARY(kNeI, i, R(1).i = lhs != rhs)
+    BINARY(kLtI, i, R(1).i = lhs < rhs)
+    BINARY(kLeI, i, R(1).i = lhs <= rhs)
+    BINARY(kGtI, i, R(1).i = lhs > rhs)
+    BINARY(kGeI, i, R(1).i = lhs >= rhs)
+    BINARY(kEqF, f, R(1).i = !(lhs < rhs || lhs > rhs))
+    BINARY(kNeF, f, R(1).i = lhs != rhs)
+    BINARY(kLtF, f, R(1).i = lhs < rhs)
+    BINARY(kLeF, f, R(1).i = !(lhs > rhs))
+    BINARY(kGtF, f, R(1).i = !(lhs <= rhs))
+    BINARY(kGeF, f, R(1).i = !(lhs < rhs))
+
+    UNARY(kNot, R(1).i = !src.i)
+    UNARY(kIntToFloat, R(1).f = static_cast<float>(src.i))
+    UNARY(kFloatToInt, R(1).i = static_cast<int32_t>(src.f))
+    UNARY(kIntToBool, R(1).i = src.i != 0)
+    UNARY(kFloatToBool, R(1).i = src.f != 0)
+
+    CASE(kJump) {
+      pc = function->code.data() + pc[1];
+      DISPATCH();
+    }
+    CASE(kJumpIf) {
+      if (R(1).i) {
+        pc = function->code.data() + pc[2];
+        DISPATCH();
+      }
+      NEXT(2);
+    }
+    CASE(kJumpIfNot) {
+      if (!R(1).i) {
+        pc = function->code.data() + pc[2];
+        DISPATCH();
+      }
+      NEXT(2);
+    }
+    JUMP(kJumpEqI, ==)
+    JUMP(kJumpNeI, !=)
+    JUMP(kJumpLtI, <)
+    JUMP(kJumpLeI, <=)
+    JUMP(kJumpGtI, >)
+    JUMP(kJumpGeI, >=)
+
+    // The elements are zero, though they are undefined in the language.
+    CASE(kNewArray) {
+      int32_t size = R(2).i;
+      if (size <= 0) {
+        std::printf("Error: Array size must be greater than 0\n");
+        std::exit(-1);
+      }
+      R(1).i = static_cast<int32_t>(m_heap.size());
+      regs[pc[1] + 1].i = size;
+      m_heap.resize(m_heap.size() + size);
+      heap = m_heap.data();
+      NEXT(2);
+    }
+    CASE(kLoad) {
+      R(1) = ELEMENT(pc[2], pc[3]);
+      NEXT(3);
+    }
+    CASE(kStore) {
+      ELEMENT(pc[1], pc[2]) = R(3);
+      NEXT(3);
+    }
+    // A negative index is a large unsigned one.
+    CASE(kCheck) {
+      if (static_cast<uint32_t>(R(2).i) >=
+          static_cast<uint32_t>(regs[pc[1] + 1].i))
+        trap();
+      NEXT(2);
+    }
+    CASE(kCheckDiagnose) {
+      int32_t size = regs[pc[1] + 1].i;
+      if (static_cast<uint32_t>(R(2).i) >= static_cast<uint32_t>(size)) {
+        std::printf("Error: Index %d is out of bounds for array %s of size "
+                    "%d\n",
+                    R(2).i, m_module.arrayNames[pc[3]].c_str(), size);
+        std::exit(-1);
+      }
+      NEXT(3);
+    }
+
+    // The window of the callee starts after the caller's.
+    CASE(kCall) {
+      const Function &callee = m_module.functions[pc[2]];
+      m_frames.push_back({function, pc + 4, base, heapBase, pc[1]});
+      uint32_t args = pc[3];
+      size_t calleeBase = base + function->getFrameSize();
+      Slot *calleeRegs = enter(callee, calleeBase);
+      regs = m_stack.data() + base;
+      for (unsigned i = 0; i < callee.numParams; ++i)
+        calleeRegs[i] = regs[args + i];
+
+      function = &callee;
+      base = calleeBase;
+      heapBase = m_heap.size();
+      regs = calleeRegs;
+      pc = callee.code.data();
+      DISPATCH();
+    }
+    // The arguments are temporaries, which come after the parameters, so
+    // they can be moved down in order.
+    CASE(kTailCall) {
+      const Function &callee = m_module.functions[pc[1]];
+      uint32_t args = pc[2];
+      for (unsigned i = 0; i < callee.numParams; ++i)
+        regs[i] = regs[args + i];
+      regs = enter(callee, base);
+      m_heap.resize(heapBase);
+
+      function = &callee;
+      pc = callee.code.data();
+      DISPATCH();
+    }
+    CASE(kRet) {
+      Slot result = R(1);
+      m_heap.resize(heapBase);
+      if (m_frames.empty())
+        return;
+      const Frame &caller = m_frames.back();
+      function = caller.function;
+      pc = caller.returnPc;
+      base = caller.base;
+      heapBase = caller.heapBase;
+      regs = m_stack.data() + base;
+      regs[caller.result] = result;
+      m_frames.pop_back();
+      DISPATCH();
+    }
+
+    CASE(kPrintI) {
+      R(1).i = std::printf("%d\n", R(2).i);
+      NEXT(2);
+    }
+    CASE(kPrintF) {
+      R(1).i = std::printf("%f\n", static_cast<double>(R(2).f));
+      NEXT(2);
+    }
+    CASE(kPrintB) {
+      R(1).i = std::printf("%s\n", R(2).i ? "true" : "false");
+      NEXT(2);
+    }
+
+#ifndef MOJ_THREADED_DISPATCH
+    }
+  }
+#endif
+
+#undef R
+#undef ELEMENT
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef BINARY
+#undef UNARY
+#undef JUMP
+}
+
+} // namespace
+
+int Run(const Module &module) {
+  Interpreter(module).Run();
+  return 0;
+}
+
+} // namespace bytecode
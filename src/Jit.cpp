@@ -0,0 +1,374 @@
+#include "Codegen.h"
+#include "Incremental.h"
+#include "Jit.h"
+#include "JitCache.h"
+#include "Optimize.h"
+#include "Tiering.h"
+
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace {
+
+// Print an error of the JIT, returning true if there was one.
+bool reportError(Error error) {
+  if (!error)
+    return false;
+  errs() << "JIT error: " << toString(std::move(error)) << "\n";
+  return true;
+}
+
+// Optimize each module when the JIT compiles it.
+Error addOptimizer(LLJIT &jit, JITTargetMachineBuilder &machineBuilder,
+                   int optLevel) {
+  // The optimizer gets its own target machine, which the transform keeps
+  // alive for as long as the JIT may compile.
+  Expected<std::unique_ptr<TargetMachine>> targetMachine =
+      machineBuilder.createTargetMachine();
+  if (!targetMachine)
+    return targetMachine.takeError();
+  std::shared_ptr<TargetMachine> optimizerMachine = std::move(*targetMachine);
+  jit.getIRTransformLayer().setTransform(
+      [optimizerMachine, optLevel](ThreadSafeModule module,
+                                   MaterializationResponsibility &)
+          -> Expected<ThreadSafeModule> {
+        module.withModuleDo([&](Module &partition) {
+          Optimize(&partition, optLevel, optimizerMachine.get());
+        });
+        return std::move(module);
+      });
+  return Error::success();
+}
+
+// Create the JIT for the host.  The lazy JIT compiles and optimizes one
+// function at a time, when it's first called.
+Expected<std::unique_ptr<LLJIT>> createJIT(const TargetOptions &targetOptions,
+                                           const JitOptions &options) {
+  Expected<JITTargetMachineBuilder> machineBuilder =
+      CreateMachineBuilder(targetOptions);
+  if (!machineBuilder)
+    return machineBuilder.takeError();
+
+  // The compiler passes the objects it produces to the cache.  The JIT
+  // compiles on this thread, so all modules share one target machine, which
+  // makes compiling the functions one by one much cheaper.
+  if (JitCache *cache = options.cache) {
+    Expected<std::unique_ptr<LLJIT>> jit =
+        LLJITBuilder()
+            .setJITTargetMachineBuilder(*machineBuilder)
+            .setCompileFunctionCreator(
+                [cache](JITTargetMachineBuilder machineBuilder)
+                    -> Expected<std::unique_ptr<IRCompileLayer::IRCompiler>> {
+                  Expected<std::unique_ptr<TargetMachine>> targetMachine =
+                      machineBuilder.createTargetMachine();
+                  if (!targetMachine)
+                    return targetMachine.takeError();
+                  return std::make_unique<TMOwningSimpleCompiler>(
+                      std::move(*targetMachine), cache);
+                })
+            .create();
+    if (jit && options.incremental) {
+      if (Error error = addOptimizer(**jit, *machineBuilder, options.optLevel))
+        return std::move(error);
+    }
+    return jit;
+  }
+  if (options.tiered) {
+    return LLJITBuilder()
+        .setJITTargetMachineBuilder(*machineBuilder)
+        .setCompileFunctionCreator(CreateTieredCompiler)
+        .create();
+  }
+  if (!options.lazy)
+    return LLJITBuilder().setJITTargetMachineBuilder(*machineBuilder).create();
+
+  Expected<std::unique_ptr<LLLazyJIT>> jit =
+      LLLazyJITBuilder().setJITTargetMachineBuilder(*machineBuilder).create();
+  if (!jit)
+    return jit.takeError();
+  (*jit)->setPartitionFunction(CompileOnDemandLayer::compileRequested);
+  if (Error error = addOptimizer(**jit, *machineBuilder, options.optLevel))
+    return std::move(error);
+  return std::unique_ptr<LLJIT>(std::move(*jit));
+}
+
+// Add the functions of the module to the JIT one by one, either as objects
+// from the cache or as modules to compile, whose objects then go to the
+// cache.  The JIT only compiles the functions that main can reach.
+Error addFunctions(LLJIT &jit, std::unique_ptr<LLVMContext> context,
+                   std::unique_ptr<Module> module, JitCache &cache) {
+  // The modules of the functions that are in the cache are destroyed at the
+  // end, before the context.
+  ThreadSafeContext threadSafeContext(std::move(context));
+  std::vector<std::unique_ptr<Module>> functionModules =
+      SplitByFunction(*module);
+  module.reset();
+  for (std::unique_ptr<Module> &functionModule : functionModules) {
+    std::string name = cache.GetFunctionName(*functionModule);
+    if (std::unique_ptr<MemoryBuffer> object = cache.Lookup(name)) {
+      if (Error error = jit.addObjectFile(std::move(object)))
+        return error;
+      continue;
+    }
+    cache.Add(functionModule.get(), std::move(name));
+    if (Error error = jit.addIRModule(
+            ThreadSafeModule(std::move(functionModule), threadSafeContext)))
+      return error;
+  }
+  return Error::success();
+}
+
+// Call main in a child process and wait for it.  Output that is still
+// buffered is written first, so that the child doesn't write it again.
+int runIsolated(void *mainAddress, bool hasParam) {
+  std::fflush(nullptr);
+  outs().flush();
+  errs().flush();
+  pid_t child = fork();
+  if (child < 0) {
+    errs() << "Error: can't start the program: " << std::strerror(errno)
+           << "\n";
+    return 1;
+  }
+  if (child == 0) {
+    if (hasParam)
+      reinterpret_cast<int (*)(int)>(mainAddress)(0);
+    else
+      reinterpret_cast<int (*)()>(mainAddress)();
+    std::fflush(nullptr);
+    _exit(0);
+  }
+  int status;
+  while (waitpid(child, &status, 0) < 0) {
+    if (errno != EINTR)
+      return 1;
+  }
+  if (WIFSIGNALED(status)) {
+    errs() << "Program terminated by signal " << WTERMSIG(status) << "\n";
+    return 1;
+  }
+  return WEXITSTATUS(status);
+}
+
+} // namespace
+
+Expected<JITTargetMachineBuilder>
+CreateMachineBuilder(const TargetOptions &targetOptions) {
+  Expected<JITTargetMachineBuilder> machineBuilder =
+      JITTargetMachineBuilder::detectHost();
+  if (!machineBuilder)
+    return machineBuilder.takeError();
+  machineBuilder->setOptions(targetOptions);
+  machineBuilder->setCodeGenOptLevel(CodeGenOpt::Default);
+  return machineBuilder;
+}
+
+Error AddProcessSymbols(LLJIT &jit) {
+  JITDylib &mainLib = jit.getMainJITDylib();
+  Expected<std::unique_ptr<DynamicLibrarySearchGenerator>> processSymbols =
+      DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          jit.getDataLayout().getGlobalPrefix());
+  if (!processSymbols)
+    return processSymbols.takeError();
+  mainLib.addGenerator(std::move(*processSymbols));
+  int (*atexitFunction)(void (*)()) = &std::atexit;
+  return mainLib.define(
+      absoluteSymbols({{jit.mangleAndIntern("atexit"),
+                        {ExecutorAddr::fromPtr(atexitFunction),
+                         JITSymbolFlags::Exported}}}));
+}
+
+Function *AddCallStub(Function *function, const std::string &codeName,
+                      const std::string &pointerName) {
+  Module *module = function->getParent();
+  std::string name = function->getName().str();
+  function->setName(codeName);
+  Function *stub = Function::Create(function->getFunctionType(),
+                                    GlobalValue::ExternalLinkage, name, module);
+  stub->copyAttributesFrom(function);
+  function->replaceAllUsesWith(stub);
+  // The stub reads the code pointer, so calls to it must not be hoisted or
+  // merged, or a loop would keep calling the old code.
+  DropPureAttributes(stub);
+
+  auto *pointer =
+      new GlobalVariable(*module, function->getType(), false,
+                         GlobalValue::ExternalLinkage, function, pointerName);
+  pointer->setAlignment(module->getDataLayout().getPointerABIAlignment(0));
+
+  IRBuilder<> builder(BasicBlock::Create(module->getContext(), "entry", stub));
+  LoadInst *code = builder.CreateLoad(function->getType(), pointer, "code");
+  code->setAtomic(AtomicOrdering::Acquire);
+  SmallVector<Value *, 8> arguments;
+  for (Argument &argument : stub->args())
+    arguments.push_back(&argument);
+  CallInst *call =
+      builder.CreateCall(function->getFunctionType(), code, arguments);
+  // A guaranteed tail call passes the arguments on with the same attributes,
+  // e.g. bools extended for C.
+  AttributeList attributes = function->getAttributes();
+  SmallVector<AttributeSet, 8> paramAttributes;
+  for (unsigned i = 0; i < function->arg_size(); ++i)
+    paramAttributes.push_back(attributes.getParamAttrs(i));
+  call->setAttributes(AttributeList::get(module->getContext(), AttributeSet(),
+                                         attributes.getRetAttrs(),
+                                         paramAttributes));
+  call->setCallingConv(function->getCallingConv());
+  call->setTailCallKind(CallInst::TCK_MustTail);
+  if (call->getType()->isVoidTy())
+    builder.CreateRetVoid();
+  else
+    builder.CreateRet(call);
+  return stub;
+}
+
+int RunJIT(std::unique_ptr<LLVMContext> context, std::unique_ptr<Module> module,
+           const TargetOptions &targetOptions, const JitOptions &options) {
+  // main is called directly through a function pointer, so its signature has
+  // to be known here.
+  Function *mainFunction = module->getFunction("main");
+  if (!mainFunction || mainFunction->isDeclaration()) {
+    errs() << "Function 'main' not found\n";
+    return 1;
+  }
+  llvm::Type *intType = llvm::Type::getInt32Ty(*context);
+  FunctionType *mainType = mainFunction->getFunctionType();
+  bool hasParam = mainType->getNumParams() == 1;
+  if (mainType->getReturnType() != intType || mainType->getNumParams() > 1 ||
+      (hasParam && mainType->getParamType(0) != intType)) {
+    errs() << "Function 'main' must be 'int main()' or 'int main(int)'\n";
+    return 1;
+  }
+
+  Expected<std::unique_ptr<LLJIT>> jit = createJIT(targetOptions, options);
+  if (!jit) {
+    reportError(jit.takeError());
+    return 1;
+  }
+  JITDylib &mainLib = (*jit)->getMainJITDylib();
+  if (reportError(AddProcessSymbols(**jit)))
+    return 1;
+
+  // A cached module is compiled eagerly, into one object or one object per
+  // function.
+  bool tiered = options.tiered && !options.cache;
+  bool lazy = options.lazy && !tiered && !options.cache;
+
+  // The tiered JIT first compiles the module as tier 0, with stubs and call
+  // counters.
+  std::unique_ptr<Tiering> tiering;
+  if (tiered) {
+    Expected<JITTargetMachineBuilder> machineBuilder =
+        CreateMachineBuilder(targetOptions);
+    if (!machineBuilder) {
+      reportError(machineBuilder.takeError());
+      return 1;
+    }
+    Expected<std::unique_ptr<Tiering>> created =
+        Tiering::Create(jit->get(), module.get(), options,
+                        std::move(*machineBuilder));
+    if (!created) {
+      reportError(created.takeError());
+      return 1;
+    }
+    tiering = std::move(*created);
+  }
+
+  // Internal functions aren't symbols of the JIT, so the lazy JIT would
+  // compile all of them together with the first one that is called.
+  if (lazy) {
+    for (Function &function : *module) {
+      if (!function.isDeclaration() && function.hasLocalLinkage())
+        function.setLinkage(GlobalValue::ExternalLinkage);
+    }
+  }
+
+  if (options.incremental) {
+    if (reportError(addFunctions(**jit, std::move(context), std::move(module),
+                                 *options.cache)))
+      return 1;
+  } else {
+    ThreadSafeModule threadSafeModule(std::move(module), std::move(context));
+    Error added =
+        lazy ? static_cast<LLLazyJIT &>(**jit).addLazyIRModule(
+                   std::move(threadSafeModule))
+             : (*jit)->addIRModule(std::move(threadSafeModule));
+    if (reportError(std::move(added)))
+      return 1;
+  }
+  if (reportError((*jit)->initialize(mainLib)) ||
+      (tiering && reportError(tiering->Start())))
+    return 1;
+
+  Expected<ExecutorAddr> mainAddress = (*jit)->lookup("main");
+  if (!mainAddress) {
+    reportError(mainAddress.takeError());
+    return 1;
+  }
+  if (options.isolate) {
+    int status = runIsolated(mainAddress->toPtr<void *>(), hasParam);
+    if (tiering)
+      tiering->Stop();
+    return status;
+  }
+  if (hasParam)
+    mainAddress->toPtr<int (*)(int)>()(0);
+  else
+    mainAddress->toPtr<int (*)()>()();
+  if (tiering)
+    tiering->Stop();
+
+  // Functions registered with atexit (the profile writer) run after this
+  // returns, so the JIT and its code stay alive until the process exits.
+  jit->release();
+  return 0;
+}
+
+int RunJIT(std::unique_ptr<MemoryBuffer> object,
+           const TargetOptions &targetOptions) {
+  JitOptions options;
+  options.lazy = false;
+  Expected<std::unique_ptr<LLJIT>> jit = createJIT(targetOptions, options);
+  if (!jit) {
+    reportError(jit.takeError());
+    return 1;
+  }
+  if (reportError(AddProcessSymbols(**jit)) ||
+      reportError((*jit)->addObjectFile(std::move(object))) ||
+      reportError((*jit)->initialize((*jit)->getMainJITDylib())))
+    return 1;
+
+  Expected<ExecutorAddr> mainAddress = (*jit)->lookup("main");
+  if (!mainAddress) {
+    reportError(mainAddress.takeError());
+    return 1;
+  }
+  // The object doesn't say whether main has a parameter.  Like the C
+  // runtime, which passes argc and argv to any main, we always pass one,
+  // which an 'int main()' ignores.
+  mainAddress->toPtr<int (*)(int)>()(0);
+  jit->release();
+  return 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <llvm/Support/Error.h>
+
+#include <memory>
+#include <string>
+
+class JitCache;
+
+namespace llvm {
+class Function;
+class LLVMContext;
+class MemoryBuffer;
+class Module;
+class TargetOptions;
+namespace orc {
+class JITTargetMachineBuilder;
+class LLJIT;
+} // namespace orc
+} // namespace llvm
+
+// How --run compiles the program to machine code.
+struct JitOptions {
+  // Compile each function when it is first called, through a stub, instead
+  // of compiling the whole module before main runs.  Each function is then
+  // optimized on its own as well, so calls are never inlined.  This only
+  // pays off if main calls few of the functions: each one that is called
+  // is cut out of the whole module, which gets slow with thousands of them.
+  bool lazy = false;
+
+  // Optimization level (0 - 3) of the functions the lazy JIT compiles.
+  // Otherwise the module has to be optimized before it is passed in.
+  int optLevel = 2;
+
+  // Compile the whole module quickly without optimization, then recompile
+  // the functions that are called often at -O3 in the background (see
+  // Tiering.h).  The module is passed in unoptimized.  Takes precedence over
+  // lazy.
+  bool tiered = false;
+
+  // Number of calls after which the tiered JIT optimizes a function.
+  unsigned tierUpThreshold = 1000;
+
+  // Number of iterations of a loop after which the tiered JIT moves the
+  // running function into optimized code (0 - never).
+  unsigned osrThreshold = 10000;
+
+  // Store the objects of the modules that were added to this cache (see
+  // JitCache.h) when they are compiled.  Unless incremental is set, the
+  // whole module is compiled before main runs, into one object, so lazy and
+  // tiered are ignored, and the module has to be optimized before it is
+  // passed in.
+  JitCache *cache = nullptr;
+
+  // Split the module into one module per function, and load the objects of
+  // the functions that are in the cache instead of compiling them (see
+  // Incremental.h).  The other functions are optimized at optLevel one at a
+  // time, like the lazy JIT does.  Needs a cache.
+  bool incremental = false;
+
+  // Call main in a child process, which shares the compiled code with the
+  // caller, so that the caller survives a program that crashes or exits.
+  // Functions that the program registers with atexit don't run.
+  bool isolate = false;
+};
+
+// Compile the module with ORC and call its main function.  The module keeps
+// its context, which the JIT takes over.  Returns non-zero if
+// the program couldn't be compiled or has no main function, or if its
+// isolated process failed.
+int RunJIT(std::unique_ptr<llvm::LLVMContext> context,
+           std::unique_ptr<llvm::Module> module,
+           const llvm::TargetOptions &targetOptions,
+           const JitOptions &options = JitOptions());
+
+// Load an object that RunJIT stored in a cache and call its main function.
+// Returns non-zero if the object couldn't be linked.
+int RunJIT(std::unique_ptr<llvm::MemoryBuffer> object,
+           const llvm::TargetOptions &targetOptions);
+
+// Describe the host, with the code generation options of an AOT build.
+llvm::Expected<llvm::orc::JITTargetMachineBuilder>
+CreateMachineBuilder(const llvm::TargetOptions &targetOptions);
+
+// Resolve printf, exit and the like in the process, for the main JITDylib
+// of the JIT.  atexit isn't exported by every C library, so the profile
+// writer gets ours.
+llvm::Error AddProcessSymbols(llvm::orc::LLJIT &jit);
+
+// Rename the function to codeName and put a stub under its old name, which
+// every call goes through, including those of the host.  The stub loads the
+// address of the current code from a global with the given name, which
+// starts out pointing to the function, and jumps there with a guaranteed
+// tail call.  Storing another function's address into the global, with
+// release ordering, sends the calls that start after that to it.  The stub
+// and the calls to it lose the attributes that say that they don't access
+// memory and return.
+llvm::Function *AddCallStub(llvm::Function *function,
+                            const std::string &codeName,
+                            const std::string &pointerName);
@@ -0,0 +1,77 @@
+#include "JitCache.h"
+#include "Cache.h"
+
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+JitCache::JitCache(Cache &cache, StringRef flags) : JitCache(flags) {
+  m_cache = &cache;
+}
+
+JitCache::JitCache(StringRef flags) : m_description(("jit " + flags).str()) {
+  // The JIT compiles for the host CPU and uses all of its features.
+  Expected<orc::JITTargetMachineBuilder> host =
+      orc::JITTargetMachineBuilder::detectHost();
+  if (host) {
+    m_description += " " + host->getTargetTriple().str() + " " +
+                     host->getCPU() + " " + host->getFeatures().getString();
+  } else {
+    consumeError(host.takeError());
+  }
+}
+
+std::string JitCache::GetProgramName(StringRef source) const {
+  return Cache::ComputeKey(source, m_description) + ".jit.o";
+}
+
+std::string JitCache::GetFunctionName(const Module &module) const {
+  std::string text;
+  raw_string_ostream out(text);
+  out << module;
+  out.flush();
+  return Cache::ComputeKey(text, m_description) + ".fn.o";
+}
+
+std::unique_ptr<MemoryBuffer> JitCache::Lookup(StringRef name) {
+  if (m_cache)
+    return m_cache->Lookup(name);
+  auto it = m_objects.find(name.str());
+  if (it == m_objects.end())
+    return nullptr;
+  m_used.insert(it->first);
+  return MemoryBuffer::getMemBufferCopy(it->second, name);
+}
+
+void JitCache::Add(const Module *module, std::string name) {
+  m_names[module] = std::move(name);
+}
+
+void JitCache::BeginRun() {
+  if (m_cache)
+    return;
+  for (auto it = m_objects.begin(); it != m_objects.end();) {
+    if (m_used.count(it->first))
+      ++it;
+    else
+      it = m_objects.erase(it);
+  }
+  m_used.clear();
+}
+
+void JitCache::notifyObjectCompiled(const Module *module,
+                                    MemoryBufferRef object) {
+  auto it = m_names.find(module);
+  if (it == m_names.end())
+    return;
+  if (m_cache) {
+    m_cache->Store(it->second, object.getBuffer());
+  } else {
+    m_objects[it->second] = object.getBuffer().str();
+    m_used.insert(it->second);
+  }
+  // Another module may get the same address later.
+  m_names.erase(it);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+class Cache;
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+// Keeps the objects that --run compiles in a Cache: either the object of a
+// whole program, so that running the same program again loads its machine
+// code instead of parsing and compiling it, or the objects of single
+// functions, for incremental compilation (see SplitByFunction in
+// Incremental.h).  Without a Cache, the objects are kept in memory, for
+// --watch, which runs a program again in the same process after each edit.
+//
+// Besides the source or the IR and the code generation flags, the names of
+// the objects include the host CPU and its features, which the JIT
+// compiles for.
+class JitCache : public llvm::ObjectCache {
+public:
+  JitCache(Cache &cache, llvm::StringRef flags);
+  explicit JitCache(llvm::StringRef flags);
+
+  // Get the name of the object of a program, from its source.
+  std::string GetProgramName(llvm::StringRef source) const;
+
+  // Get the name of the object of a function, from the module that contains
+  // only that function.  This is its fingerprint: the IR of the function,
+  // with the declarations of the functions it calls.
+  std::string GetFunctionName(const llvm::Module &module) const;
+
+  // Get the object with the given name, or null if there is none.
+  std::unique_ptr<llvm::MemoryBuffer> Lookup(llvm::StringRef name);
+
+  // Store the object of the given module under the given name once the JIT
+  // has compiled it.  The objects of the modules that the JIT compiles for
+  // itself aren't stored.  The JIT compiles on the thread that adds the
+  // modules, so the table needs no lock.
+  void Add(const llvm::Module *module, std::string name);
+
+  // Start compiling another version of the program.  Without a Cache, the
+  // objects that the last version didn't use are dropped, so that the table
+  // keeps the objects of one version, not those of every edit.
+  void BeginRun();
+
+  void notifyObjectCompiled(const llvm::Module *module,
+                            llvm::MemoryBufferRef object) override;
+
+  // Objects are looked up before the modules are added to the JIT, so it
+  // never finds one.
+  std::unique_ptr<llvm::MemoryBuffer>
+  getObject(const llvm::Module *module) override {
+    return nullptr;
+  }
+
+private:
+  Cache *m_cache = nullptr;
+  std::string m_description;
+  std::map<const llvm::Module *, std::string> m_names;
+
+  // The objects, by name, if there is no Cache, and the names of those that
+  // were looked up or stored since BeginRun.
+  std::map<std::string, std::string> m_objects;
+  std::set<std::string> m_used;
+};
@@ -0,0 +1,51 @@
+#include "Link.h"
+
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string>
+#include <vector>
+
+#ifdef MOJ_HAVE_LLD
+#include <lld/Common/Driver.h>
+
+LLD_HAS_DRIVER(elf)
+#endif
+
+bool LinkExecutable(llvm::StringRef objectFile, llvm::StringRef runtime,
+                    llvm::StringRef outputFile, llvm::raw_ostream &errors) {
+  // No start files and no libraries besides the runtime, whose unused
+  // functions are left out.
+  std::vector<llvm::StringRef> args{
+      "ld", "-static", "--gc-sections", "-o", outputFile, objectFile, runtime};
+
+#ifdef MOJ_HAVE_LLD
+  std::vector<std::string> strings(args.begin(), args.end());
+  std::vector<const char *> argv;
+  for (const std::string &arg : strings)
+    argv.push_back(arg.c_str());
+  argv[0] = "ld.lld";
+  lld::Result result = lld::lldMain(argv, llvm::outs(), errors,
+                                    {{lld::Gnu, &lld::elf::link}});
+  return result.retCode == 0;
+#else
+  llvm::ErrorOr<std::string> linker = llvm::sys::findProgramByName("ld");
+  if (!linker) {
+    errors << "Error: -exe needs a linker (ld) to link " << outputFile
+           << ", or moj built with lld\n";
+    return false;
+  }
+  args[0] = *linker;
+  std::string message;
+  int status = llvm::sys::ExecuteAndWait(*linker, args, std::nullopt, {}, 0, 0,
+                                         &message);
+  if (status != 0) {
+    errors << "Error: Could not link " << outputFile;
+    if (!message.empty())
+      errors << ": " << message;
+    errors << "\n";
+    return false;
+  }
+  return true;
+#endif
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+// Linking of static executables (-exe), which need neither a C compiler
+// nor the C library: an object file of a program is linked with the runtime
+// archive that is built with moj (libmojrt.a, see runtime/mojrt.c), which
+// has the entry point and the C functions that the generated code calls.
+//
+// The linker is lld, in process, if moj is built with it (MOJ_HAVE_LLD),
+// and otherwise the system's ld.
+
+// The name of the runtime archive, which is installed next to moj.
+constexpr const char *kRuntimeName = "libmojrt.a";
+
+// Link the object file with the runtime archive into an executable.
+// Returns false, with the linker's messages, if linking fails.
+bool LinkExecutable(llvm::StringRef objectFile, llvm::StringRef runtime,
+                    llvm::StringRef outputFile, llvm::raw_ostream &errors);
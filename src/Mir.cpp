@@ -0,0 +1,646 @@
+#include "Mir.h"
+#include "FuncDef.h"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <set>
+
+namespace mir {
+
+void Value::replaceAllUsesWith(Value *value) {
+  assert(value != this);
+  // Setting an operand removes the use, so work on a copy.
+  std::vector<Instr *> uses = m_uses;
+  for (Instr *use : uses) {
+    for (size_t i = 0; i < use->getOperands().size(); ++i) {
+      if (use->getOperand(i) == this)
+        use->setOperand(i, value);
+    }
+  }
+}
+
+const char *toString(Opcode opcode) {
+  switch (opcode) {
+  case kAdd:
+    return "add";
+  case kSub:
+    return "sub";
+  case kMul:
+    return "mul";
+  case kDiv:
+    return "div";
+  case kRem:
+    return "rem";
+  case kEq:
+    return "eq";
+  case kNe:
+    return "ne";
+  case kLt:
+    return "lt";
+  case kLe:
+    return "le";
+  case kGt:
+    return "gt";
+  case kGe:
+    return "ge";
+  case kNeg:
+    return "neg";
+  case kNot:
+    return "not";
+  case kConvert:
+    return "convert";
+  case kMulAdd:
+    return "muladd";
+  case kCall:
+    return "call";
+  case kPrint:
+    return "print";
+  case kNewArray:
+    return "newarray";
+  case kCheck:
+    return "check";
+  case kLoad:
+    return "load";
+  case kStore:
+    return "store";
+  case kPhi:
+    return "phi";
+  case kBr:
+    return "br";
+  case kCondBr:
+    return "condbr";
+  case kRet:
+    return "ret";
+  }
+  return "?";
+}
+
+Instr::Instr(Opcode opcode, ::Type type, const std::vector<Value *> &operands,
+             const std::vector<Block *> &blocks)
+    : Value(kInstr, type), m_opcode(opcode), m_operands(operands),
+      m_blocks(blocks) {
+  for (Value *operand : m_operands)
+    operand->m_uses.push_back(this);
+}
+
+Instr::~Instr() {
+  assert(!m_parent && "Instruction must be removed from its block first");
+  dropOperands();
+}
+
+void Instr::removeUse(Value *value) {
+  auto it = std::find(value->m_uses.begin(), value->m_uses.end(), this);
+  assert(it != value->m_uses.end());
+  value->m_uses.erase(it);
+}
+
+void Instr::setOperand(size_t i, Value *value) {
+  removeUse(m_operands.at(i));
+  m_operands[i] = value;
+  value->m_uses.push_back(this);
+}
+
+void Instr::setBlock(size_t i, Block *block) {
+  // The targets of a branch in a block are its successors.
+  if (m_parent && (m_opcode == kBr || m_opcode == kCondBr)) {
+    m_blocks.at(i)->removePred(m_parent);
+    block->m_preds.push_back(m_parent);
+  }
+  m_blocks.at(i) = block;
+}
+
+void Instr::addIncoming(Value *value, Block *block) {
+  assert(m_opcode == kPhi);
+  m_operands.push_back(value);
+  m_blocks.push_back(block);
+  value->m_uses.push_back(this);
+}
+
+void Instr::removeIncoming(size_t i) {
+  assert(m_opcode == kPhi);
+  removeUse(m_operands.at(i));
+  m_operands.erase(m_operands.begin() + i);
+  m_blocks.erase(m_blocks.begin() + i);
+}
+
+Value *Instr::getIncoming(const Block *block) const {
+  for (size_t i = 0; i < m_blocks.size(); ++i) {
+    if (m_blocks[i] == block)
+      return m_operands[i];
+  }
+  return nullptr;
+}
+
+void Instr::dropOperands() {
+  for (Value *operand : m_operands)
+    removeUse(operand);
+  m_operands.clear();
+}
+
+Block::~Block() {
+  // Instructions may use each other, so drop all the operands first.
+  for (InstrPtr &instr : m_instrs)
+    instr->dropOperands();
+  for (InstrPtr &instr : m_instrs)
+    instr->m_parent = nullptr;
+}
+
+Instr *Block::getTerminator() const {
+  if (m_instrs.empty() || !m_instrs.back()->isTerminator())
+    return nullptr;
+  return m_instrs.back().get();
+}
+
+std::vector<Block *> Block::getSuccessors() const {
+  Instr *terminator = getTerminator();
+  if (!terminator)
+    return {};
+  return terminator->getBlocks();
+}
+
+Instr *Block::append(InstrPtr instr) {
+  return insert(m_instrs.size(), std::move(instr));
+}
+
+Instr *Block::insert(size_t pos, InstrPtr instr) {
+  assert(!getTerminator() || pos < m_instrs.size());
+  if (instr->getOpcode() == kPhi) {
+    size_t firstNonPhi = 0;
+    while (firstNonPhi < m_instrs.size() &&
+           m_instrs[firstNonPhi]->getOpcode() == kPhi)
+      ++firstNonPhi;
+    pos = std::min(pos, firstNonPhi);
+  }
+  instr->m_parent = this;
+  if (instr->getOpcode() == kBr || instr->getOpcode() == kCondBr) {
+    for (Block *target : instr->getBlocks())
+      target->m_preds.push_back(this);
+  }
+  Instr *result = instr.get();
+  m_instrs.insert(m_instrs.begin() + pos, std::move(instr));
+  return result;
+}
+
+InstrPtr Block::remove(Instr *instr) {
+  auto it = std::find_if(
+      m_instrs.begin(), m_instrs.end(),
+      [instr](const InstrPtr &other) { return other.get() == instr; });
+  assert(it != m_instrs.end());
+  InstrPtr result = std::move(*it);
+  m_instrs.erase(it);
+  if (instr->getOpcode() == kBr || instr->getOpcode() == kCondBr) {
+    for (Block *target : instr->getBlocks())
+      target->removePred(this);
+  }
+  instr->m_parent = nullptr;
+  return result;
+}
+
+void Block::erase(Instr *instr) {
+  assert(instr->getUses().empty() && "Erasing an instruction that is used");
+  remove(instr);
+}
+
+void Block::removePred(Block *pred) {
+  auto it = std::find(m_preds.begin(), m_preds.end(), pred);
+  assert(it != m_preds.end());
+  m_preds.erase(it);
+}
+
+Function::Function(const FuncDef *funcDef) : m_funcDef(funcDef) {
+  size_t i = 0;
+  for (const VarDeclPtr &param : funcDef->getParams()) {
+    m_params.emplace_back(new Param(param->GetType(), param->GetName(), i));
+    ++i;
+  }
+  createBlock("entry");
+}
+
+Function::~Function() {
+  // Instructions may use values of other blocks, and constants go first.
+  for (const BlockPtr &block : m_blocks) {
+    for (const InstrPtr &instr : block->getInstrs())
+      instr->dropOperands();
+  }
+}
+
+const std::string &Function::getName() const { return m_funcDef->getName(); }
+
+::Type Function::getReturnType() const { return m_funcDef->getReturnType(); }
+
+Block *Function::createBlock(const std::string &name, Block *after) {
+  int number = m_blockNames[name]++;
+  BlockPtr block(
+      new Block(this, number ? name + "." + std::to_string(number) : name));
+  Block *result = block.get();
+  auto pos = m_blocks.end();
+  if (after) {
+    pos = std::find_if(
+        m_blocks.begin(), m_blocks.end(),
+        [after](const BlockPtr &other) { return other.get() == after; });
+    assert(pos != m_blocks.end());
+    ++pos;
+  }
+  m_blocks.insert(pos, std::move(block));
+  return result;
+}
+
+void Function::moveToEnd(Block *block) {
+  auto it = std::find_if(
+      m_blocks.begin(), m_blocks.end(),
+      [block](const BlockPtr &other) { return other.get() == block; });
+  assert(it != m_blocks.end());
+  BlockPtr moved = std::move(*it);
+  m_blocks.erase(it);
+  m_blocks.push_back(std::move(moved));
+}
+
+void Function::eraseBlock(Block *block) {
+  assert(block->getPreds().empty() && block != getEntry());
+  // Removing the terminator updates the predecessors of the successors.
+  if (Instr *terminator = block->getTerminator())
+    block->remove(terminator);
+  auto it = std::find_if(
+      m_blocks.begin(), m_blocks.end(),
+      [block](const BlockPtr &other) { return other.get() == block; });
+  assert(it != m_blocks.end());
+  m_blocks.erase(it);
+}
+
+Constant *Function::getInt(int value) {
+  std::unique_ptr<Constant> &constant = m_constants[{kTypeInt, value}];
+  if (!constant)
+    constant.reset(new Constant(kTypeInt, value));
+  return constant.get();
+}
+
+Constant *Function::getBool(bool value) {
+  std::unique_ptr<Constant> &constant = m_constants[{kTypeBool, value}];
+  if (!constant)
+    constant.reset(new Constant(kTypeBool, value));
+  return constant.get();
+}
+
+Constant *Function::getFloat(float value) {
+  // Floats are keyed by their bits, which tells 0.0 and -0.0 apart.
+  int bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  std::unique_ptr<Constant> &constant = m_constants[{kTypeFloat, bits}];
+  if (!constant)
+    constant.reset(new Constant(value));
+  return constant.get();
+}
+
+Constant *Function::getZero(::Type type) {
+  switch (type) {
+  case kTypeBool:
+    return getBool(false);
+  case kTypeInt:
+    return getInt(0);
+  case kTypeFloat:
+    return getFloat(0);
+  case kTypeUnknown:
+    break;
+  }
+  assert(false && "Invalid type");
+  return nullptr;
+}
+
+Value *Fold(Function *function, Opcode opcode, ::Type type,
+            const std::vector<Value *> &operands, IntOverflow intOverflow) {
+  if (operands.empty())
+    return nullptr;
+  std::vector<const Constant *> constants;
+  for (Value *operand : operands) {
+    const auto *constant = dynamic_cast<const Constant *>(operand);
+    if (!constant || constant->getType() == kTypeFloat)
+      return nullptr;
+    constants.push_back(constant);
+  }
+
+  int64_t lhs = constants[0]->getInt();
+  int64_t rhs = constants.size() > 1 ? constants[1]->getInt() : 0;
+  int64_t result;
+  switch (opcode) {
+  case kAdd:
+    result = lhs + rhs;
+    break;
+  case kSub:
+    result = lhs - rhs;
+    break;
+  case kMul:
+    result = lhs * rhs;
+    break;
+  case kNeg:
+    result = -lhs;
+    break;
+  case kDiv:
+  case kRem:
+    if (rhs == 0 || (lhs == INT_MIN && rhs == -1))
+      return nullptr;
+    result = opcode == kDiv ? lhs / rhs : lhs % rhs;
+    break;
+  case kEq:
+    return function->getBool(lhs == rhs);
+  case kNe:
+    return function->getBool(lhs != rhs);
+  case kLt:
+    return function->getBool(lhs < rhs);
+  case kLe:
+    return function->getBool(lhs <= rhs);
+  case kGt:
+    return function->getBool(lhs > rhs);
+  case kGe:
+    return function->getBool(lhs >= rhs);
+  case kNot:
+    return function->getBool(!lhs);
+  case kConvert:
+    if (type == kTypeBool)
+      return function->getBool(lhs != 0);
+    if (type == kTypeInt)
+      return function->getInt(static_cast<int>(lhs));
+    return function->getFloat(static_cast<float>(lhs));
+  default:
+    return nullptr;
+  }
+
+  if (result < INT_MIN || result > INT_MAX) {
+    if (intOverflow == kIntOverflowTrap)
+      return nullptr;
+    result = static_cast<int32_t>(static_cast<uint32_t>(result));
+  }
+  return function->getInt(static_cast<int>(result));
+}
+
+void RemoveUnreachableBlocks(Function *function) {
+  std::set<Block *> reachable;
+  std::vector<Block *> worklist{function->getEntry()};
+  while (!worklist.empty()) {
+    Block *block = worklist.back();
+    worklist.pop_back();
+    if (reachable.insert(block).second) {
+      for (Block *succ : block->getSuccessors())
+        worklist.push_back(succ);
+    }
+  }
+
+  std::vector<Block *> unreachable;
+  for (const BlockPtr &block : function->getBlocks()) {
+    if (!reachable.count(block.get()))
+      unreachable.push_back(block.get());
+  }
+  if (unreachable.empty())
+    return;
+
+  // Drop the edges out of the unreachable blocks first, including the
+  // incoming values of phis in the reachable ones.
+  for (Block *block : unreachable) {
+    for (Block *succ : block->getSuccessors()) {
+      for (const InstrPtr &instr : succ->getInstrs()) {
+        if (instr->getOpcode() != kPhi)
+          break;
+        for (size_t i = instr->getBlocks().size(); i-- > 0;) {
+          if (instr->getBlocks()[i] == block)
+            instr->removeIncoming(i);
+        }
+      }
+    }
+    if (Instr *terminator = block->getTerminator())
+      block->remove(terminator);
+  }
+  // Values defined in unreachable blocks are only used there.
+  for (Block *block : unreachable) {
+    for (const InstrPtr &instr : block->getInstrs())
+      instr->dropOperands();
+  }
+  for (Block *block : unreachable)
+    function->eraseBlock(block);
+}
+
+bool Verify(const Function &function, std::ostream &errors) {
+  std::set<const Block *> blocks;
+  for (const BlockPtr &block : function.getBlocks())
+    blocks.insert(block.get());
+
+  for (const BlockPtr &block : function.getBlocks()) {
+    const std::string where =
+        "in block " + block->getName() + " of " + function.getName() + ": ";
+    if (!block->getTerminator()) {
+      errors << where << "missing terminator\n";
+      return false;
+    }
+
+    bool seenNonPhi = false;
+    for (const InstrPtr &instr : block->getInstrs()) {
+      if (instr->getParent() != block.get()) {
+        errors << where << "instruction with the wrong parent\n";
+        return false;
+      }
+      if (instr->isTerminator() && instr != block->getInstrs().back()) {
+        errors << where << "terminator in the middle of the block\n";
+        return false;
+      }
+      if (instr->getOpcode() == kPhi) {
+        if (seenNonPhi) {
+          errors << where << "phi after other instructions\n";
+          return false;
+        }
+        // Every predecessor has exactly one incoming value.
+        std::vector<Block *> incoming = instr->getBlocks();
+        std::vector<Block *> preds = block->getPreds();
+        std::sort(incoming.begin(), incoming.end());
+        std::sort(preds.begin(), preds.end());
+        if (incoming != preds) {
+          errors << where << "phi doesn't match the predecessors\n";
+          return false;
+        }
+      } else {
+        seenNonPhi = true;
+      }
+      for (const Value *operand : instr->getOperands()) {
+        const auto *def = dynamic_cast<const Instr *>(operand);
+        if (def && !blocks.count(def->getParent())) {
+          errors << where << "use of a deleted instruction\n";
+          return false;
+        }
+      }
+    }
+
+    for (const Block *succ : block->getSuccessors()) {
+      const std::vector<Block *> &preds = succ->getPreds();
+      if (!blocks.count(succ) ||
+          std::find(preds.begin(), preds.end(), block.get()) == preds.end()) {
+        errors << where << "bad successor\n";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+namespace {
+
+// Prints a function, numbering the values that don't have a source name.
+class FunctionPrinter {
+public:
+  FunctionPrinter(std::ostream &out, const Function &function)
+      : m_out(out), m_function(function) {}
+
+  void Print() {
+    for (const auto &param : m_function.getParams())
+      nameValue(param.get(), param->getName());
+    for (const BlockPtr &block : m_function.getBlocks()) {
+      for (const InstrPtr &instr : block->getInstrs()) {
+        if (instr->getType() != kTypeUnknown)
+          nameValue(instr.get(), instr->getName());
+      }
+    }
+
+    m_out << "func " << toString(m_function.getReturnType()) << " @"
+          << m_function.getName() << "(";
+    for (const auto &param : m_function.getParams()) {
+      m_out << (param->getIndex() ? ", " : "") << toString(param->getType())
+            << " " << m_names.at(param.get());
+    }
+    m_out << ") {\n";
+
+    for (const BlockPtr &block : m_function.getBlocks()) {
+      m_out << block->getName() << ":";
+      if (!block->getPreds().empty()) {
+        m_out << std::string(std::max<int>(1, 24 - block->getName().size()),
+                             ' ')
+              << "; preds:";
+        for (const Block *pred : block->getPreds())
+          m_out << " " << pred->getName();
+      }
+      m_out << "\n";
+      for (const InstrPtr &instr : block->getInstrs())
+        printInstr(*instr);
+    }
+    m_out << "}\n";
+  }
+
+private:
+  std::ostream &m_out;
+  const Function &m_function;
+  std::map<const Value *, std::string> m_names;
+  std::map<std::string, int> m_used;
+  int m_next = 0;
+
+  void nameValue(const Value *value, const std::string &name) {
+    if (name.empty()) {
+      m_names[value] = "%" + std::to_string(m_next++);
+      return;
+    }
+    int number = m_used[name]++;
+    if (number)
+      m_names[value] = "%" + name + "." + std::to_string(number);
+    else
+      m_names[value] = "%" + name;
+  }
+
+  void printValue(const Value *value) {
+    if (const auto *constant = dynamic_cast<const Constant *>(value)) {
+      switch (constant->getType()) {
+      case kTypeBool:
+        m_out << (constant->getBool() ? "true" : "false");
+        break;
+      case kTypeFloat:
+        m_out << constant->getFloat();
+        // Keep floats apart from ints.
+        if (constant->getFloat() == static_cast<int>(constant->getFloat()))
+          m_out << ".0";
+        break;
+      default:
+        m_out << constant->getInt();
+        break;
+      }
+      return;
+    }
+    auto it = m_names.find(value);
+    m_out << (it != m_names.end() ? it->second : "%<deleted>");
+  }
+
+  void printOperands(const Instr &instr, size_t first = 0) {
+    for (size_t i = first; i < instr.getOperands().size(); ++i) {
+      m_out << (i > first ? ", " : " ");
+      printValue(instr.getOperand(i));
+    }
+  }
+
+  void printInstr(const Instr &instr) {
+    m_out << "  ";
+    if (instr.getType() != kTypeUnknown)
+      m_out << m_names.at(&instr) << " = ";
+    m_out << toString(instr.getOpcode());
+
+    switch (instr.getOpcode()) {
+    case kPhi:
+      m_out << " " << toString(instr.getType());
+      for (size_t i = 0; i < instr.getOperands().size(); ++i) {
+        m_out << (i ? ", [" : " [");
+        printValue(instr.getOperand(i));
+        m_out << ", " << instr.getBlocks()[i]->getName() << "]";
+      }
+      break;
+    case kBr:
+    case kCondBr:
+      printOperands(instr);
+      for (size_t i = 0; i < instr.getBlocks().size(); ++i)
+        m_out << (i || !instr.getOperands().empty() ? ", " : " ")
+              << instr.getBlocks()[i]->getName();
+      break;
+    case kCall:
+      m_out << " " << toString(instr.getType()) << " @"
+            << instr.getCallee()->getName() << "(";
+      for (size_t i = 0; i < instr.getOperands().size(); ++i) {
+        m_out << (i ? ", " : "");
+        printValue(instr.getOperand(i));
+      }
+      m_out << ")";
+      break;
+    case kNewArray:
+      m_out << " " << toString(instr.getType());
+      if (instr.getFixedSize())
+        m_out << "[" << instr.getFixedSize() << "]";
+      else
+        printOperands(instr);
+      break;
+    case kCheck:
+    case kStore:
+    case kRet:
+      printOperands(instr);
+      break;
+    case kConvert:
+      m_out << " " << toString(instr.getOperand(0)->getType()) << " to "
+            << toString(instr.getType());
+      printOperands(instr);
+      break;
+    default:
+      // Arithmetic shows the type of its operands, which is also the result
+      // type except for comparisons.
+      m_out << " " << toString(instr.getOperand(0)->getType());
+      printOperands(instr);
+      break;
+    }
+    m_out << "\n";
+  }
+};
+
+} // namespace
+
+void Print(std::ostream &out, const Module &module) {
+  bool first = true;
+  for (const FunctionPtr &function : module.getFunctions()) {
+    if (!first)
+      out << "\n";
+    first = false;
+    FunctionPrinter(out, *function).Print();
+  }
+}
+
+} // namespace mir
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "Codegen.h"
+#include "Type.h"
+
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class FuncDef;
+class Program;
+
+// MIR is a small SSA-based IR between the typechecked AST and LLVM IR.  It
+// keeps facts that the language guarantees but LLVM has to rediscover: local
+// arrays never alias, every name is resolved to its declaration and builtin
+// operators have no side effects.  Scalar variables become SSA values, while
+// arrays are objects that are only accessed through load, store and check
+// instructions.
+namespace mir {
+
+class Block;
+class Function;
+class Instr;
+
+// Base class of everything that can be an operand: constants, parameters and
+// the results of instructions.
+class Value {
+public:
+  enum Kind { kConstant, kParam, kInstr };
+
+  Value(Kind kind, ::Type type) : m_kind(kind), m_type(type) {}
+  virtual ~Value() = default;
+
+  Kind getKind() const { return m_kind; }
+
+  // The type of the value, or the element type of an array.
+  ::Type getType() const { return m_type; }
+
+  // Instructions that use this value, once per operand.
+  const std::vector<Instr *> &getUses() const { return m_uses; }
+
+  // Make every instruction that uses this value use the given one instead.
+  void replaceAllUsesWith(Value *value);
+
+private:
+  friend class Instr;
+
+  Kind m_kind;
+  ::Type m_type;
+  std::vector<Instr *> m_uses;
+};
+
+// An int, float or bool constant.  Constants are unique within a function, so
+// two constants are equal if they are the same object.
+class Constant : public Value {
+public:
+  Constant(::Type type, int value) : Value(kConstant, type), m_int(value) {}
+  explicit Constant(float value)
+      : Value(kConstant, kTypeFloat), m_float(value) {}
+
+  int getInt() const { return m_int; }
+  bool getBool() const { return m_int != 0; }
+  float getFloat() const { return m_float; }
+
+private:
+  int m_int = 0;
+  float m_float = 0;
+};
+
+// A function parameter.  Parameters can't be assigned, so they are SSA values
+// already.
+class Param : public Value {
+public:
+  Param(::Type type, std::string name, size_t index)
+      : Value(kParam, type), m_name(std::move(name)), m_index(index) {}
+
+  const std::string &getName() const { return m_name; }
+  size_t getIndex() const { return m_index; }
+
+private:
+  std::string m_name;
+  size_t m_index;
+};
+
+enum Opcode {
+  // Arithmetic on two ints or two floats (no float remainder).
+  kAdd,
+  kSub,
+  kMul,
+  kDiv,
+  kRem,
+
+  // Comparisons of two ints or two floats, which produce a bool.
+  kEq,
+  kNe,
+  kLt,
+  kLe,
+  kGt,
+  kGe,
+
+  kNeg,     // int or float negation
+  kNot,     // bool negation
+  kConvert, // conversion of an int, float or bool to the instruction type
+  kMulAdd,  // a * b + c on floats, contracted within a source expression
+
+  kCall,  // call of a user-defined function
+  kPrint, // print an int, float or bool, which returns an int
+
+  kNewArray, // local array of the instruction type, with the given size
+  kCheck,    // bounds check of an index into an array
+  kLoad,     // array element at an index
+  kStore,    // store a value into an array element at an index
+
+  kPhi, // operands are parallel to the incoming blocks
+
+  // Terminators, which end every block.
+  kBr,     // jump to the only target
+  kCondBr, // jump to the first target if the bool operand is true
+  kRet
+};
+
+// Get the name of an opcode as printed in the MIR dump.
+const char *toString(Opcode opcode);
+
+// An instruction, which is the value it computes.  Instructions that don't
+// produce a value have an unknown type.
+class Instr : public Value {
+public:
+  Instr(Opcode opcode, ::Type type, const std::vector<Value *> &operands = {},
+        const std::vector<Block *> &blocks = {});
+  ~Instr() override;
+
+  Opcode getOpcode() const { return m_opcode; }
+
+  // The block that holds the instruction (null if it was removed).
+  Block *getParent() const { return m_parent; }
+
+  const std::vector<Value *> &getOperands() const { return m_operands; }
+  Value *getOperand(size_t i) const { return m_operands.at(i); }
+  void setOperand(size_t i, Value *value);
+
+  // The incoming blocks of a phi, or the targets of a branch.
+  const std::vector<Block *> &getBlocks() const { return m_blocks; }
+  void setBlock(size_t i, Block *block);
+
+  // Add or remove an incoming value of a phi.
+  void addIncoming(Value *value, Block *block);
+  void removeIncoming(size_t i);
+
+  // Get the incoming value of a phi for the given block (null if none).
+  Value *getIncoming(const Block *block) const;
+
+  // Stop using the operands, before the instruction is deleted.
+  void dropOperands();
+
+  bool isTerminator() const { return m_opcode >= kBr; }
+  bool isComparison() const { return m_opcode >= kEq && m_opcode <= kGe; }
+
+  // The function called by a call instruction.
+  Function *getCallee() const { return m_callee; }
+  void setCallee(Function *callee) { m_callee = callee; }
+
+  // The source name of an array.
+  const std::string &getName() const { return m_name; }
+  void setName(const std::string &name) { m_name = name; }
+
+  // The number of elements of an array whose size is known at compile time,
+  // or zero if the size is only known at runtime.
+  int getFixedSize() const { return m_fixedSize; }
+  void setFixedSize(int size) { m_fixedSize = size; }
+
+private:
+  friend class Block;
+
+  Opcode m_opcode;
+  Block *m_parent = nullptr;
+  std::vector<Value *> m_operands;
+  std::vector<Block *> m_blocks;
+  Function *m_callee = nullptr;
+  std::string m_name;
+  int m_fixedSize = 0;
+
+  void removeUse(Value *value);
+};
+
+using InstrPtr = std::unique_ptr<Instr>;
+
+// A basic block: phis, then ordinary instructions, then one terminator.
+// Predecessors are kept up to date as terminators are added, retargeted and
+// removed.
+class Block {
+public:
+  Block(Function *parent, std::string name)
+      : m_parent(parent), m_name(std::move(name)) {}
+  ~Block();
+
+  Function *getParent() const { return m_parent; }
+  const std::string &getName() const { return m_name; }
+
+  const std::vector<InstrPtr> &getInstrs() const { return m_instrs; }
+
+  // Get the terminator, or null if the block isn't finished yet.
+  Instr *getTerminator() const;
+
+  std::vector<Block *> getSuccessors() const;
+  const std::vector<Block *> &getPreds() const { return m_preds; }
+
+  // Add an instruction at the end of the block, or in front of the given
+  // position.  Phis always go in front of the other instructions.
+  Instr *append(InstrPtr instr);
+  Instr *insert(size_t pos, InstrPtr instr);
+
+  // Take an instruction out of the block, or delete it.
+  InstrPtr remove(Instr *instr);
+  void erase(Instr *instr);
+
+private:
+  friend class Instr;
+
+  Function *m_parent;
+  std::string m_name;
+  std::vector<InstrPtr> m_instrs;
+  std::vector<Block *> m_preds;
+
+  void removePred(Block *pred);
+};
+
+using BlockPtr = std::unique_ptr<Block>;
+
+// A user-defined function.  The first block is the entry block.
+class Function {
+public:
+  explicit Function(const FuncDef *funcDef);
+  ~Function();
+
+  const FuncDef *getFuncDef() const { return m_funcDef; }
+  const std::string &getName() const;
+  ::Type getReturnType() const;
+
+  const std::vector<std::unique_ptr<Param>> &getParams() const {
+    return m_params;
+  }
+
+  const std::vector<BlockPtr> &getBlocks() const { return m_blocks; }
+  Block *getEntry() const { return m_blocks.front().get(); }
+
+  // Create a block at the end of the function, or after the given one.  The
+  // name gets a number that makes it unique.
+  Block *createBlock(const std::string &name, Block *after = nullptr);
+
+  // Move a block to the end of the function, which keeps the layout close to
+  // the source order.
+  void moveToEnd(Block *block);
+
+  // Delete a block that has no predecessors left.
+  void eraseBlock(Block *block);
+
+  Constant *getInt(int value);
+  Constant *getBool(bool value);
+  Constant *getFloat(float value);
+  Constant *getZero(::Type type);
+
+private:
+  const FuncDef *m_funcDef;
+  std::vector<std::unique_ptr<Param>> m_params;
+  std::vector<BlockPtr> m_blocks;
+  std::map<std::pair<::Type, int>, std::unique_ptr<Constant>> m_constants;
+  std::map<std::string, int> m_blockNames;
+};
+
+using FunctionPtr = std::unique_ptr<Function>;
+
+class Module {
+public:
+  const std::vector<FunctionPtr> &getFunctions() const { return m_functions; }
+  std::vector<FunctionPtr> &getFunctions() { return m_functions; }
+
+private:
+  std::vector<FunctionPtr> m_functions;
+};
+
+using ModulePtr = std::unique_ptr<Module>;
+
+// Compute an operation on int or bool constants the way the generated code
+// would.  Returns null if an operand isn't such a constant, or if the
+// operation may trap at runtime (division by zero, checked overflow).  Float
+// arithmetic isn't folded, because its rounding depends on the fast-math
+// flags.
+Value *Fold(Function *function, Opcode opcode, ::Type type,
+            const std::vector<Value *> &operands, IntOverflow intOverflow);
+
+// Lower the (typechecked) program to MIR, constructing SSA form on the fly.
+// Bounds checks and arithmetic follow the given options.
+ModulePtr LowerProgram(const Program &program, const CodegenOptions &options);
+
+// Delete the blocks that can't be reached from the entry block.
+void RemoveUnreachableBlocks(Function *function);
+
+// Check the structural invariants of a function, printing the first
+// violation.  Returns true if the function is well formed.
+bool Verify(const Function &function, std::ostream &errors);
+
+// Print the module in a readable text form.
+void Print(std::ostream &out, const Module &module);
+
+} // namespace mir
@@ -0,0 +1,465 @@
+#include "Codegen.h"
+#include "CodegenUtil.h"
+#include "FuncDef.h"
+#include "Mir.h"
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <map>
+#include <set>
+
+using namespace llvm;
+
+namespace {
+
+// Generates LLVM IR for the functions of a MIR module.  SSA values map to
+// LLVM values one to one; runtime checks split a MIR block into several LLVM
+// blocks.
+class MirCodegen {
+public:
+  MirCodegen(LLVMContext *context, Module *module,
+             const CodegenOptions *options, const FuncInfoTable *funcInfos)
+      : m_context(context), m_module(module), m_options(options),
+        m_funcInfos(funcInfos), m_builder(*context) {
+    SetFastMathFlags(*options, &m_builder);
+    m_printf = m_module->getOrInsertFunction(
+        "printf", FunctionType::get(m_builder.getInt32Ty(),
+                                    {m_builder.getInt8PtrTy()}, true));
+    m_exit = m_module->getOrInsertFunction(
+        "exit", FunctionType::get(m_builder.getVoidTy(),
+                                  {m_builder.getInt32Ty()}, false));
+  }
+
+  // Create the LLVM function for a MIR function, so calls can refer to it
+  // before its body is generated.
+  void Declare(const mir::Function &function) {
+    std::vector<llvm::Type *> paramTypes;
+    for (const auto &param : function.getParams())
+      paramTypes.push_back(convertType(param->getType()));
+    FunctionType *funcType = FunctionType::get(
+        convertType(function.getReturnType()), paramTypes, false);
+
+    // The main function has external linkage.  Other functions are
+    // "internal", which encourages inlining.
+    Function *llvmFunction = Function::Create(
+        funcType,
+        function.getName() == "main" ? Function::ExternalLinkage
+                                     : Function::InternalLinkage,
+        function.getName(), m_module);
+    AddFunctionAttributes(m_funcInfos->at(function.getFuncDef()), *m_options,
+                          llvmFunction);
+    m_functions[&function] = llvmFunction;
+  }
+
+  void Codegen(const mir::Function &function) {
+    m_function = m_functions.at(&function);
+    m_values.clear();
+    m_blocks.clear();
+    m_blockEnds.clear();
+    m_phis.clear();
+    m_trapBlock = nullptr;
+
+    for (const auto &param : function.getParams())
+      m_values[param.get()] = m_function->getArg(param->getIndex());
+
+    // The LLVM blocks keep the MIR layout, but the instructions are
+    // generated in reverse postorder, which defines every value before its
+    // uses.  Only phis can refer to values that come later.
+    for (const mir::BlockPtr &block : function.getBlocks())
+      m_blocks[block.get()] =
+          BasicBlock::Create(*m_context, block->getName(), m_function);
+    for (const mir::Block *block : reversePostorder(function))
+      codegenBlock(*block);
+
+    for (const mir::Instr *phi : m_phis) {
+      auto *llvmPhi = cast<PHINode>(m_values.at(phi));
+      for (size_t i = 0; i < phi->getOperands().size(); ++i)
+        llvmPhi->addIncoming(getValue(phi->getOperand(i)),
+                             m_blockEnds.at(phi->getBlocks()[i]));
+    }
+  }
+
+private:
+  LLVMContext *m_context;
+  Module *m_module;
+  const CodegenOptions *m_options;
+  const FuncInfoTable *m_funcInfos;
+  IRBuilder<> m_builder;
+  FunctionCallee m_printf;
+  FunctionCallee m_exit;
+  std::map<const mir::Function *, Function *> m_functions;
+
+  // State for the current function.
+  Function *m_function = nullptr;
+  std::map<const mir::Value *, Value *> m_values;
+  std::map<const mir::Block *, BasicBlock *> m_blocks;
+  std::map<const mir::Block *, BasicBlock *> m_blockEnds; // for phis
+  std::vector<const mir::Instr *> m_phis;
+  BasicBlock *m_trapBlock = nullptr;
+
+  static std::vector<const mir::Block *>
+  reversePostorder(const mir::Function &function) {
+    std::vector<const mir::Block *> postorder;
+    std::set<const mir::Block *> visited;
+    std::vector<std::pair<const mir::Block *, size_t>> stack{
+        {function.getEntry(), 0}};
+    visited.insert(function.getEntry());
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      std::vector<mir::Block *> succs = top.first->getSuccessors();
+      if (top.second < succs.size()) {
+        const mir::Block *succ = succs[top.second++];
+        if (visited.insert(succ).second)
+          stack.push_back({succ, 0});
+      } else {
+        postorder.push_back(top.first);
+        stack.pop_back();
+      }
+    }
+    return {postorder.rbegin(), postorder.rend()};
+  }
+
+  llvm::Type *convertType(::Type type) {
+    switch (type) {
+    case kTypeBool:
+      return m_builder.getInt1Ty();
+    case kTypeInt:
+      return m_builder.getInt32Ty();
+    case kTypeFloat:
+      return m_builder.getFloatTy();
+    case kTypeUnknown:
+      break;
+    }
+    assert(false && "Invalid type");
+    return nullptr;
+  }
+
+  Value *getValue(const mir::Value *value) {
+    if (const auto *constant = dynamic_cast<const mir::Constant *>(value)) {
+      if (constant->getType() == kTypeFloat)
+        return ConstantFP::get(m_builder.getFloatTy(), constant->getFloat());
+      return ConstantInt::get(convertType(constant->getType()),
+                              constant->getInt(), true);
+    }
+    return m_values.at(value);
+  }
+
+  void codegenBlock(const mir::Block &block) {
+    m_builder.SetInsertPoint(m_blocks.at(&block));
+    for (const mir::InstrPtr &instr : block.getInstrs()) {
+      if (Value *value = codegenInstr(*instr))
+        m_values[instr.get()] = value;
+    }
+  }
+
+  Value *codegenInstr(const mir::Instr &instr) {
+    std::vector<Value *> operands;
+    if (instr.getOpcode() != mir::kPhi) {
+      for (const mir::Value *operand : instr.getOperands())
+        operands.push_back(getValue(operand));
+    }
+    bool isFloat = !instr.getOperands().empty() &&
+                   instr.getOperand(0)->getType() == kTypeFloat;
+
+    switch (instr.getOpcode()) {
+    case mir::kAdd:
+      return isFloat ? m_builder.CreateFAdd(operands[0], operands[1])
+                     : createIntArith(Instruction::Add, operands[0],
+                                      operands[1]);
+    case mir::kSub:
+      return isFloat ? m_builder.CreateFSub(operands[0], operands[1])
+                     : createIntArith(Instruction::Sub, operands[0],
+                                      operands[1]);
+    case mir::kMul:
+      return isFloat ? m_builder.CreateFMul(operands[0], operands[1])
+                     : createIntArith(Instruction::Mul, operands[0],
+                                      operands[1]);
+    case mir::kDiv:
+      return isFloat ? m_builder.CreateFDiv(operands[0], operands[1])
+                     : m_builder.CreateSDiv(operands[0], operands[1]);
+    case mir::kRem:
+      return isFloat ? m_builder.CreateFRem(operands[0], operands[1])
+                     : m_builder.CreateSRem(operands[0], operands[1]);
+    case mir::kEq:
+    case mir::kNe:
+    case mir::kLt:
+    case mir::kLe:
+    case mir::kGt:
+    case mir::kGe:
+      return m_builder.CreateCmp(getPredicate(instr.getOpcode(), isFloat),
+                                 operands[0], operands[1]);
+    case mir::kNeg:
+      return isFloat ? m_builder.CreateFNeg(operands[0])
+                     : createIntArith(Instruction::Sub,
+                                      m_builder.getInt32(0), operands[0]);
+    case mir::kNot:
+      return m_builder.CreateNot(operands[0]);
+    case mir::kConvert:
+      return convert(operands[0], instr.getOperand(0)->getType(),
+                     instr.getType());
+    case mir::kMulAdd:
+      return m_builder.CreateIntrinsic(Intrinsic::fmuladd,
+                                       {m_builder.getFloatTy()}, operands);
+    case mir::kCall: {
+      // The call site carries the same calling convention and attributes as
+      // the callee.
+      Function *callee = m_functions.at(instr.getCallee());
+      CallInst *call = m_builder.CreateCall(callee, operands);
+      call->setCallingConv(callee->getCallingConv());
+      if (callee->doesNotThrow())
+        call->setDoesNotThrow();
+      if (callee->doesNotAccessMemory())
+        call->setDoesNotAccessMemory();
+      return call;
+    }
+    case mir::kPrint:
+      return createPrint(operands[0], instr.getOperand(0)->getType());
+    case mir::kNewArray:
+      return createArray(instr, operands[0]);
+    case mir::kCheck:
+      createBoundsCheck(*static_cast<const mir::Instr *>(instr.getOperand(0)),
+                        operands[1]);
+      return nullptr;
+    case mir::kLoad:
+      return m_builder.CreateLoad(
+          convertType(instr.getType()),
+          getElementPtr(*static_cast<const mir::Instr *>(instr.getOperand(0)),
+                        operands[1]));
+    case mir::kStore:
+      m_builder.CreateStore(
+          operands[2],
+          getElementPtr(*static_cast<const mir::Instr *>(instr.getOperand(0)),
+                        operands[1]));
+      return nullptr;
+    case mir::kPhi:
+      m_phis.push_back(&instr);
+      return m_builder.CreatePHI(convertType(instr.getType()),
+                                 instr.getOperands().size());
+    case mir::kBr:
+      m_builder.CreateBr(m_blocks.at(instr.getBlocks()[0]));
+      break;
+    case mir::kCondBr:
+      m_builder.CreateCondBr(operands[0], m_blocks.at(instr.getBlocks()[0]),
+                             m_blocks.at(instr.getBlocks()[1]));
+      break;
+    case mir::kRet: {
+      // A call whose result is returned right away doesn't need a new stack
+      // frame.
+      if (auto *call = dyn_cast<CallInst>(operands[0])) {
+        if (call->getNextNode() == nullptr &&
+            call->getParent() == m_builder.GetInsertBlock() &&
+            !call->getCalledFunction()->isDeclaration())
+          call->setTailCall();
+      }
+      m_builder.CreateRet(operands[0]);
+      break;
+    }
+    }
+    // The phis of the successors come from the block that holds the
+    // terminator, which may have been split.
+    m_blockEnds[instr.getParent()] = m_builder.GetInsertBlock();
+    return nullptr;
+  }
+
+  // The predicates match the AST code generator.
+  static CmpInst::Predicate getPredicate(mir::Opcode opcode, bool isFloat) {
+    switch (opcode) {
+    case mir::kEq:
+      return isFloat ? CmpInst::FCMP_UEQ : CmpInst::ICMP_EQ;
+    case mir::kNe:
+      return isFloat ? CmpInst::FCMP_UNE : CmpInst::ICMP_NE;
+    case mir::kLt:
+      return isFloat ? CmpInst::FCMP_OLT : CmpInst::ICMP_SLT;
+    case mir::kLe:
+      return isFloat ? CmpInst::FCMP_ULE : CmpInst::ICMP_SLE;
+    case mir::kGt:
+      return isFloat ? CmpInst::FCMP_UGT : CmpInst::ICMP_SGT;
+    default:
+      assert(opcode == mir::kGe);
+      return isFloat ? CmpInst::FCMP_UGE : CmpInst::ICMP_SGE;
+    }
+  }
+
+  Value *convert(Value *value, ::Type from, ::Type to) {
+    if (to == kTypeFloat)
+      return from == kTypeInt
+                 ? m_builder.CreateSIToFP(value, m_builder.getFloatTy())
+                 : m_builder.CreateUIToFP(value, m_builder.getFloatTy());
+    if (to == kTypeInt)
+      return from == kTypeFloat
+                 ? m_builder.CreateFPToSI(value, m_builder.getInt32Ty())
+                 : m_builder.CreateZExt(value, m_builder.getInt32Ty());
+    assert(to == kTypeBool);
+    return from == kTypeFloat
+               ? m_builder.CreateFCmpUNE(
+                     value, ConstantFP::get(m_builder.getFloatTy(), 0.0))
+               : m_builder.CreateICmpNE(value, m_builder.getInt32(0));
+  }
+
+  Value *createPrint(Value *value, ::Type type) {
+    std::vector<Value *> args;
+    switch (type) {
+    case kTypeFloat:
+      args = {m_builder.CreateGlobalStringPtr("%f\n"),
+              m_builder.CreateFPExt(value, m_builder.getDoubleTy())};
+      break;
+    case kTypeBool:
+      args = {m_builder.CreateGlobalStringPtr("%s\n"),
+              m_builder.CreateSelect(value,
+                                     m_builder.CreateGlobalStringPtr("true"),
+                                     m_builder.CreateGlobalStringPtr("false"))};
+      break;
+    default:
+      args = {m_builder.CreateGlobalStringPtr("%d\n"), value};
+      break;
+    }
+    return m_builder.CreateCall(m_printf, args);
+  }
+
+  // Arrays of a fixed size live in the function's frame.  Others are
+  // allocated where they are declared, once their size is checked.
+  Value *createArray(const mir::Instr &array, Value *size) {
+    llvm::Type *elementType = convertType(array.getType());
+    if (array.getFixedSize()) {
+      BasicBlock &entry = m_function->getEntryBlock();
+      IRBuilder<> entryBuilder(&entry, entry.getFirstInsertionPt());
+      return entryBuilder.CreateAlloca(
+          ArrayType::get(elementType, array.getFixedSize()), nullptr,
+          array.getName());
+    }
+
+    BasicBlock *errorBlock = BasicBlock::Create(*m_context, "error",
+                                                m_function, nextBlock());
+    BasicBlock *continueBlock = BasicBlock::Create(*m_context, "continue",
+                                                   m_function, nextBlock());
+    m_builder.CreateCondBr(
+        m_builder.CreateICmpSGT(size, m_builder.getInt32(0)), continueBlock,
+        errorBlock);
+    m_builder.SetInsertPoint(errorBlock);
+    emitRuntimeError("Error: Array size must be greater than 0\n", {});
+    m_builder.SetInsertPoint(continueBlock);
+    return m_builder.CreateAlloca(elementType, size, array.getName());
+  }
+
+  Value *getArraySize(const mir::Instr &array) {
+    if (array.getFixedSize())
+      return m_builder.getInt32(array.getFixedSize());
+    return getValue(array.getOperand(0));
+  }
+
+  Value *getElementPtr(const mir::Instr &array, Value *index) {
+    auto *alloca = cast<AllocaInst>(m_values.at(&array));
+    if (array.getFixedSize())
+      return m_builder.CreateInBoundsGEP(alloca->getAllocatedType(), alloca,
+                                         {m_builder.getInt32(0), index});
+    return m_builder.CreateInBoundsGEP(alloca->getAllocatedType(), alloca,
+                                       index);
+  }
+
+  // The block after the current one, in front of which blocks split off
+  // from it go.
+  BasicBlock *nextBlock() { return m_builder.GetInsertBlock()->getNextNode(); }
+
+  // A failed check either traps or reports the index and the array, then
+  // exits.  A negative index is a large unsigned one.
+  void createBoundsCheck(const mir::Instr &array, Value *index) {
+    Value *size = getArraySize(array);
+    bool diagnose = m_options->boundsCheck == kBoundsCheckDiagnose;
+    BasicBlock *failBlock =
+        diagnose ? BasicBlock::Create(*m_context, "outofbounds", m_function,
+                                      nextBlock())
+                 : getTrapBlock();
+    BasicBlock *continueBlock = BasicBlock::Create(*m_context, "inbounds",
+                                                   m_function, nextBlock());
+    m_builder.CreateCondBr(
+        m_builder.CreateICmpULT(index, size), continueBlock, failBlock,
+        MDBuilder(*m_context).createBranchWeights((1U << 20) - 1, 1));
+
+    if (diagnose) {
+      m_builder.SetInsertPoint(failBlock);
+      emitRuntimeError("Error: Index %d is out of bounds for array " +
+                           array.getName() + " of size %d\n",
+                       {index, size});
+    }
+    m_builder.SetInsertPoint(continueBlock);
+  }
+
+  // Generate integer addition, subtraction or multiplication with the
+  // overflow semantics selected by the options.
+  Value *createIntArith(Instruction::BinaryOps opcode, Value *lhs,
+                        Value *rhs) {
+    switch (m_options->intOverflow) {
+    case kIntOverflowUndefined:
+      return setNoSignedWrap(m_builder.CreateBinOp(opcode, lhs, rhs));
+    case kIntOverflowWrap:
+      return m_builder.CreateBinOp(opcode, lhs, rhs);
+    case kIntOverflowTrap:
+      break;
+    }
+
+    Intrinsic::ID id = Intrinsic::smul_with_overflow;
+    if (opcode == Instruction::Add)
+      id = Intrinsic::sadd_with_overflow;
+    else if (opcode == Instruction::Sub)
+      id = Intrinsic::ssub_with_overflow;
+    Value *resultAndOverflow = m_builder.CreateBinaryIntrinsic(id, lhs, rhs);
+    BasicBlock *continueBlock = BasicBlock::Create(*m_context, "nooverflow",
+                                                   m_function, nextBlock());
+    m_builder.CreateCondBr(
+        m_builder.CreateExtractValue(resultAndOverflow, 1), getTrapBlock(),
+        continueBlock,
+        MDBuilder(*m_context).createBranchWeights(1, (1U << 20) - 1));
+    m_builder.SetInsertPoint(continueBlock);
+    return m_builder.CreateExtractValue(resultAndOverflow, 0);
+  }
+
+  // Like signed arithmetic in C, which tells the optimizer that e.g. an
+  // induction variable doesn't wrap around.
+  static Value *setNoSignedWrap(Value *value) {
+    if (auto *inst = dyn_cast<BinaryOperator>(value))
+      inst->setHasNoSignedWrap();
+    return value;
+  }
+
+  // Get the block shared by the checks of the current function that trap.
+  BasicBlock *getTrapBlock() {
+    if (!m_trapBlock) {
+      m_trapBlock = BasicBlock::Create(*m_context, "trap", m_function);
+      IRBuilder<> builder(m_trapBlock);
+      builder.CreateIntrinsic(Intrinsic::trap, {}, {});
+      builder.CreateUnreachable();
+    }
+    return m_trapBlock;
+  }
+
+  // Print an error message with printf and exit the program, which ends the
+  // current block.
+  void emitRuntimeError(const std::string &format, ArrayRef<Value *> args) {
+    std::vector<Value *> printfArgs{m_builder.CreateGlobalStringPtr(format)};
+    printfArgs.insert(printfArgs.end(), args.begin(), args.end());
+    m_builder.CreateCall(m_printf, printfArgs);
+    m_builder.CreateCall(m_exit, m_builder.getInt32(-1));
+    m_builder.CreateUnreachable();
+  }
+};
+
+} // namespace
+
+std::unique_ptr<Module> Codegen(LLVMContext *context, const Program &program,
+                                const mir::Module &mirModule,
+                                const CodegenOptions &options) {
+  std::unique_ptr<Module> module(new Module("module", *context));
+
+  // The function attributes come from the same analysis as for the AST.
+  FuncInfoTable funcInfos = AnalyzeForCodegen(program, options);
+
+  MirCodegen codegen(context, module.get(), &options, &funcInfos);
+  for (const mir::FunctionPtr &function : mirModule.getFunctions())
+    codegen.Declare(*function);
+  for (const mir::FunctionPtr &function : mirModule.getFunctions())
+    codegen.Codegen(*function);
+  return module;
+}
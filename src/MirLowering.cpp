@@ -0,0 +1,563 @@
+#include "Exp.h"
+#include "FuncDef.h"
+#include "Mir.h"
+#include "Program.h"
+#include "Stmt.h"
+#include "Visitor.h"
+
+#include <cassert>
+#include <set>
+#include <stdexcept>
+
+namespace mir {
+namespace {
+
+using FunctionTable = std::map<const FuncDef *, Function *>;
+
+// Builds the instructions of a function and constructs SSA form on the fly,
+// following "Simple and Efficient Construction of Static Single Assignment
+// Form" (Braun et al.).  Each block records the current value of the
+// variables assigned in it; reading a variable in a block without one looks
+// through the predecessors, adding phis where they meet.  A block is sealed
+// once all its predecessors are known, and reads in unsealed blocks create
+// placeholder phis that are completed when it is sealed.
+class FuncBuilder {
+public:
+  FuncBuilder(Function *function, const CodegenOptions *options)
+      : m_function(function), m_options(options),
+        m_block(function->getEntry()) {
+    sealBlock(m_block);
+  }
+
+  Function *getFunction() const { return m_function; }
+
+  const CodegenOptions *getOptions() const { return m_options; }
+
+  // The block that instructions are added to, or null after a return, where
+  // the rest of the enclosing statements are unreachable.
+  Block *getBlock() const { return m_block; }
+
+  void setBlock(Block *block) { m_block = block; }
+
+  Block *createBlock(const std::string &name) {
+    return m_function->createBlock(name);
+  }
+
+  Instr *create(Opcode opcode, ::Type type,
+                const std::vector<Value *> &operands,
+                const std::vector<Block *> &blocks = {}) {
+    assert(m_block && !m_block->getTerminator());
+    return m_block->append(
+        InstrPtr(new Instr(opcode, type, operands, blocks)));
+  }
+
+  // Create an arithmetic or comparison instruction, or fold it if the
+  // operands are int or bool constants.
+  Value *createOp(Opcode opcode, ::Type type,
+                  const std::vector<Value *> &operands) {
+    if (Value *folded =
+            Fold(m_function, opcode, type, operands, m_options->intOverflow))
+      return folded;
+    return create(opcode, type, operands);
+  }
+
+  void createBr(Block *target) { create(kBr, kTypeUnknown, {}, {target}); }
+
+  void createCondBr(Value *condition, Block *trueBlock, Block *falseBlock) {
+    if (const auto *constant = dynamic_cast<const Constant *>(condition)) {
+      createBr(constant->getBool() ? trueBlock : falseBlock);
+      return;
+    }
+    create(kCondBr, kTypeUnknown, {condition}, {trueBlock, falseBlock});
+  }
+
+  void createRet(Value *value) {
+    create(kRet, kTypeUnknown, {value});
+    m_block = nullptr;
+  }
+
+  void writeVariable(const VarDecl *var, Value *value) {
+    assert(m_block);
+    m_currentDef[var][m_block] = value;
+  }
+
+  Value *readVariable(const VarDecl *var) {
+    assert(m_block);
+    return readVariable(var, m_block);
+  }
+
+  // All the predecessors of the block are known, so complete its phis.
+  void sealBlock(Block *block) {
+    auto it = m_incompletePhis.find(block);
+    if (it != m_incompletePhis.end()) {
+      for (auto &incomplete : it->second)
+        addPhiOperands(incomplete.first, incomplete.second);
+      m_incompletePhis.erase(it);
+    }
+    m_sealed.insert(block);
+  }
+
+private:
+  Function *m_function;
+  const CodegenOptions *m_options;
+  Block *m_block;
+  std::map<const VarDecl *, std::map<Block *, Value *>> m_currentDef;
+  std::map<Block *, std::map<const VarDecl *, Instr *>> m_incompletePhis;
+  std::set<Block *> m_sealed;
+
+  // Removed phis are kept until the function is done, because a phi can be
+  // found trivial while it is still in a worklist.
+  std::vector<InstrPtr> m_removedPhis;
+
+  Value *readVariable(const VarDecl *var, Block *block) {
+    auto &defs = m_currentDef[var];
+    auto it = defs.find(block);
+    if (it != defs.end())
+      return it->second;
+
+    Value *value;
+    if (!m_sealed.count(block)) {
+      Instr *phi = createPhi(var, block);
+      m_incompletePhis[block][var] = phi;
+      value = phi;
+    } else if (block->getPreds().size() == 1) {
+      value = readVariable(var, block->getPreds().front());
+    } else if (block->getPreds().empty()) {
+      // Unreachable code, or a variable that is read before it's assigned,
+      // which gets an arbitrary value.
+      value = m_function->getZero(var->GetType());
+    } else {
+      // Break cycles through loops with an operandless phi.
+      Instr *phi = createPhi(var, block);
+      defs[block] = phi;
+      value = addPhiOperands(var, phi);
+    }
+    m_currentDef[var][block] = value;
+    return value;
+  }
+
+  Instr *createPhi(const VarDecl *var, Block *block) {
+    return block->insert(0, InstrPtr(new Instr(kPhi, var->GetType())));
+  }
+
+  Value *addPhiOperands(const VarDecl *var, Instr *phi) {
+    Block *block = phi->getParent();
+    // Copy the predecessors, since reading may add phis but not edges.
+    std::vector<Block *> preds = block->getPreds();
+    for (Block *pred : preds)
+      phi->addIncoming(readVariable(var, pred), pred);
+    return tryRemoveTrivialPhi(phi);
+  }
+
+  // A phi whose operands are all the same value (or itself) is replaced by
+  // that value, which may make the phis that use it trivial as well.
+  Value *tryRemoveTrivialPhi(Instr *phi) {
+    Value *same = nullptr;
+    for (Value *operand : phi->getOperands()) {
+      if (operand == same || operand == phi)
+        continue;
+      if (same)
+        return phi;
+      same = operand;
+    }
+    if (!same)
+      same = m_function->getZero(phi->getType());
+
+    std::vector<Instr *> users;
+    for (Instr *use : phi->getUses()) {
+      if (use != phi && use->getOpcode() == kPhi)
+        users.push_back(use);
+    }
+    phi->replaceAllUsesWith(same);
+    for (auto &defs : m_currentDef) {
+      for (auto &def : defs.second) {
+        if (def.second == phi)
+          def.second = same;
+      }
+    }
+    phi->dropOperands();
+    m_removedPhis.push_back(phi->getParent()->remove(phi));
+
+    for (Instr *user : users) {
+      if (user->getParent())
+        tryRemoveTrivialPhi(user);
+    }
+    return same;
+  }
+};
+
+// Lowers expressions to instructions that compute their values.
+class ExpLowering : public ExpVisitor {
+public:
+  ExpLowering(FuncBuilder *builder, const FunctionTable *functions,
+              std::map<const VarDecl *, Instr *> *arrays)
+      : m_builder(builder), m_functions(functions), m_arrays(arrays) {}
+
+  Value *Lower(const Exp &exp) {
+    return reinterpret_cast<Value *>(const_cast<Exp &>(exp).Dispatch(*this));
+  }
+
+  // Lower a condition to branches to the given blocks, short-circuiting
+  // "&&", "||" and "!" straight to the targets.
+  void LowerBranch(const Exp &exp, Block *trueBlock, Block *falseBlock) {
+    const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+    const std::string funcName = callExp ? callExp->getFuncName() : "";
+    if (funcName == "&&" || funcName == "||") {
+      bool isAnd = funcName == "&&";
+      Block *rhsBlock = m_builder->createBlock(isAnd ? "and.rhs" : "or.rhs");
+      LowerBranch(*callExp->getArgs().at(0), isAnd ? rhsBlock : trueBlock,
+                  isAnd ? falseBlock : rhsBlock);
+      m_builder->sealBlock(rhsBlock);
+      m_builder->setBlock(rhsBlock);
+      LowerBranch(*callExp->getArgs().at(1), trueBlock, falseBlock);
+      return;
+    }
+    if (funcName == "!") {
+      LowerBranch(*callExp->getArgs().at(0), falseBlock, trueBlock);
+      return;
+    }
+
+    // Other values are compared against zero.
+    Value *condition = Lower(exp);
+    if (condition->getType() != kTypeBool)
+      condition = m_builder->createOp(
+          kNe, kTypeBool,
+          {condition, m_builder->getFunction()->getZero(condition->getType())});
+    m_builder->createCondBr(condition, trueBlock, falseBlock);
+  }
+
+  // Get the array that a variable refers to.
+  Instr *GetArray(const VarDecl *varDecl) const {
+    auto it = m_arrays->find(varDecl);
+    assert(it != m_arrays->end() && "Array wasn't declared");
+    return it->second;
+  }
+
+  // Check an index into an array if bounds are checked.
+  void CheckIndex(Instr *array, Value *index) {
+    if (m_builder->getOptions()->boundsCheck != kBoundsCheckOff)
+      m_builder->create(kCheck, kTypeUnknown, {array, index});
+  }
+
+  void *Visit(BoolExp &exp) override {
+    return m_builder->getFunction()->getBool(exp.getValue());
+  }
+
+  void *Visit(IntExp &exp) override {
+    return m_builder->getFunction()->getInt(exp.getValue());
+  }
+
+  void *Visit(FloatExp &exp) override {
+    return m_builder->getFunction()->getFloat(exp.getValue());
+  }
+
+  void *Visit(VarExp &exp) override {
+    const VarDecl *varDecl = exp.getVarDecl();
+    assert(varDecl && !varDecl->GetIsArray());
+    if (varDecl->GetKind() == VarDecl::kParam)
+      return getParam(varDecl);
+    return m_builder->readVariable(varDecl);
+  }
+
+  void *Visit(ArrayAccessExp &exp) override {
+    Instr *array = GetArray(exp.getVarDecl());
+    Value *index = Lower(*exp.getIndexExp());
+    CheckIndex(array, index);
+    return m_builder->create(kLoad, array->getType(), {array, index});
+  }
+
+  void *Visit(CallExp &exp) override {
+    const std::string &funcName = exp.getFuncName();
+    if (funcName == "&&" || funcName == "||")
+      return lowerLogicalValue(exp);
+
+    const CodegenOptions *options = m_builder->getOptions();
+    if (options->fpContract == kFPContractOn && exp.getType() == kTypeFloat &&
+        (funcName == "+" || funcName == "-") && exp.getArgs().size() == 2) {
+      if (Value *result = lowerMulAdd(exp))
+        return result;
+    }
+
+    std::vector<Value *> args;
+    for (const ExpPtr &arg : exp.getArgs())
+      args.push_back(Lower(*arg));
+
+    const FuncDef *funcDef = exp.getFuncDef();
+    assert(funcDef);
+    if (funcDef->hasBody()) {
+      Instr *call = m_builder->create(kCall, exp.getType(), args);
+      call->setCallee(m_functions->at(funcDef));
+      return call;
+    }
+    if (funcName == "print")
+      return m_builder->create(kPrint, kTypeInt, args);
+    if (funcName == "int" || funcName == "float" || funcName == "bool")
+      return m_builder->createOp(kConvert, exp.getType(), args);
+    if (funcName == "!")
+      return m_builder->createOp(kNot, kTypeBool, args);
+    if (funcName == "-" && args.size() == 1)
+      return m_builder->createOp(kNeg, exp.getType(), args);
+
+    // Mixed int and float operands are computed as floats.
+    if (args[0]->getType() != args[1]->getType()) {
+      for (Value *&arg : args) {
+        if (arg->getType() == kTypeInt)
+          arg = m_builder->createOp(kConvert, kTypeFloat, {arg});
+      }
+    }
+    static const std::map<std::string, Opcode> binaryOps = {
+        {"+", kAdd}, {"-", kSub}, {"*", kMul}, {"/", kDiv}, {"%", kRem},
+        {"==", kEq}, {"!=", kNe}, {"<", kLt},  {"<=", kLe}, {">", kGt},
+        {">=", kGe}};
+    return m_builder->createOp(binaryOps.at(funcName), exp.getType(), args);
+  }
+
+private:
+  FuncBuilder *m_builder;
+  const FunctionTable *m_functions;
+  std::map<const VarDecl *, Instr *> *m_arrays;
+
+  Value *getParam(const VarDecl *varDecl) {
+    for (const auto &param : m_builder->getFunction()->getParams()) {
+      const FuncDef *funcDef = m_builder->getFunction()->getFuncDef();
+      if (funcDef->getParams()[param->getIndex()].get() == varDecl)
+        return param.get();
+    }
+    assert(false && "Parameter of another function");
+    return nullptr;
+  }
+
+  // Materialize the value of "&&" or "||" as a phi of the blocks that the
+  // condition branches to.
+  Value *lowerLogicalValue(const CallExp &exp) {
+    Function *function = m_builder->getFunction();
+    Block *trueBlock = m_builder->createBlock("bool.true");
+    Block *falseBlock = m_builder->createBlock("bool.false");
+    Block *endBlock = m_builder->createBlock("bool.end");
+
+    LowerBranch(exp, trueBlock, falseBlock);
+    for (Block *block : {trueBlock, falseBlock}) {
+      function->moveToEnd(block);
+      m_builder->sealBlock(block);
+      m_builder->setBlock(block);
+      m_builder->createBr(endBlock);
+    }
+
+    function->moveToEnd(endBlock);
+    m_builder->sealBlock(endBlock);
+    m_builder->setBlock(endBlock);
+    Instr *phi = m_builder->create(kPhi, kTypeBool, {});
+    phi->addIncoming(function->getBool(true), trueBlock);
+    phi->addIncoming(function->getBool(false), falseBlock);
+    return phi;
+  }
+
+  static const CallExp *asFloatMul(const Exp &exp) {
+    const auto *callExp = dynamic_cast<const CallExp *>(&exp);
+    return callExp && callExp->getFuncName() == "*" &&
+                   callExp->getType() == kTypeFloat
+               ? callExp
+               : nullptr;
+  }
+
+  Value *lowerFloat(const Exp &exp) {
+    Value *value = Lower(exp);
+    if (value->getType() != kTypeFloat)
+      value = m_builder->createOp(kConvert, kTypeFloat, {value});
+    return value;
+  }
+
+  // Contract a float addition or subtraction with a multiplication operand,
+  // evaluating the operands in source order.  Returns null if neither
+  // operand is a multiplication.
+  Value *lowerMulAdd(const CallExp &exp) {
+    const Exp &lhs = *exp.getArgs()[0];
+    const Exp &rhs = *exp.getArgs()[1];
+    bool isSub = exp.getFuncName() == "-";
+
+    Value *mulLhs, *mulRhs, *addend;
+    if (const CallExp *mul = asFloatMul(lhs)) {
+      mulLhs = lowerFloat(*mul->getArgs()[0]);
+      mulRhs = lowerFloat(*mul->getArgs()[1]);
+      addend = lowerFloat(rhs);
+      if (isSub)
+        addend = m_builder->create(kNeg, kTypeFloat, {addend});
+    } else if (const CallExp *mul = asFloatMul(rhs)) {
+      addend = lowerFloat(lhs);
+      mulLhs = lowerFloat(*mul->getArgs()[0]);
+      mulRhs = lowerFloat(*mul->getArgs()[1]);
+      if (isSub)
+        mulLhs = m_builder->create(kNeg, kTypeFloat, {mulLhs});
+    } else {
+      return nullptr;
+    }
+    return m_builder->create(kMulAdd, kTypeFloat, {mulLhs, mulRhs, addend});
+  }
+};
+
+// Lowers statements, which may add blocks and switch the current block.
+class StmtLowering : public StmtVisitor {
+public:
+  StmtLowering(FuncBuilder *builder, const FunctionTable *functions)
+      : m_builder(builder), m_exp(builder, functions, &m_arrays) {}
+
+  void Lower(const Stmt &stmt) { const_cast<Stmt &>(stmt).Dispatch(*this); }
+
+  void Visit(CallStmt &stmt) override { m_exp.Lower(stmt.GetCallExp()); }
+
+  void Visit(AssignStmt &stmt) override {
+    Value *value = m_exp.Lower(stmt.GetRvalue());
+    m_builder->writeVariable(stmt.GetVarDecl(), value);
+  }
+
+  void Visit(ArrayAssignStmt &stmt) override {
+    Instr *array = m_exp.GetArray(stmt.GetVarDecl());
+    Value *value = m_exp.Lower(stmt.GetRvalue());
+    Value *index = m_exp.Lower(*stmt.getIndexExp());
+    m_exp.CheckIndex(array, index);
+    m_builder->create(kStore, kTypeUnknown, {array, index, value});
+  }
+
+  void Visit(DeclStmt &stmt) override {
+    const VarDecl *varDecl = stmt.GetVarDecl();
+    if (varDecl->GetIsArray()) {
+      Value *size = m_exp.Lower(varDecl->getVariable().getArraySizeExp());
+      const auto *constant = dynamic_cast<const Constant *>(size);
+      if (constant && constant->getInt() <= 0)
+        throw std::runtime_error("Array size must be > 0");
+      Instr *array = m_builder->create(kNewArray, varDecl->GetType(), {size});
+      array->setName(varDecl->GetName());
+      m_arrays[varDecl] = array;
+      return;
+    }
+
+    // A variable without initializer is zero, though it's undefined in the
+    // language.
+    m_builder->writeVariable(
+        varDecl, stmt.HasInitExp()
+                     ? m_exp.Lower(stmt.GetInitExp())
+                     : m_builder->getFunction()->getZero(varDecl->GetType()));
+  }
+
+  void Visit(ReturnStmt &stmt) override {
+    m_builder->createRet(m_exp.Lower(stmt.GetExp()));
+  }
+
+  // Statements after a return are unreachable, and the language has no
+  // labels to jump to them.
+  void Visit(SeqStmt &seq) override {
+    for (const StmtPtr &stmt : seq.Get()) {
+      if (!m_builder->getBlock())
+        break;
+      Lower(*stmt);
+    }
+  }
+
+  void Visit(IfStmt &stmt) override {
+    Block *thenBlock = m_builder->createBlock("then");
+    Block *elseBlock =
+        stmt.hasElseStmt() ? m_builder->createBlock("else") : nullptr;
+    Block *joinBlock = m_builder->createBlock("join");
+
+    m_exp.LowerBranch(stmt.getCondExp(), thenBlock,
+                      elseBlock ? elseBlock : joinBlock);
+    lowerBranchTarget(thenBlock, stmt.getThenStmt(), joinBlock);
+    if (elseBlock)
+      lowerBranchTarget(elseBlock, stmt.getElseStmt(), joinBlock);
+
+    startBlock(joinBlock);
+  }
+
+  void Visit(WhileStmt &stmt) override {
+    Block *headerBlock = m_builder->createBlock("while.header");
+    m_builder->createBr(headerBlock);
+    m_builder->setBlock(headerBlock);
+
+    Block *bodyBlock = m_builder->createBlock("while.body");
+    Block *exitBlock = m_builder->createBlock("while.exit");
+    m_exp.LowerBranch(stmt.GetCondExp(), bodyBlock, exitBlock);
+
+    // The header is sealed once the back edge is known.
+    lowerBranchTarget(bodyBlock, stmt.GetBodyStmt(), headerBlock);
+    m_builder->sealBlock(headerBlock);
+    startBlock(exitBlock);
+  }
+
+  void Visit(ForStmt &stmt) override {
+    if (stmt.HasInitStmt())
+      Lower(stmt.GetInitStmt());
+
+    Block *headerBlock = m_builder->createBlock("for.header");
+    m_builder->createBr(headerBlock);
+    m_builder->setBlock(headerBlock);
+
+    Block *bodyBlock = m_builder->createBlock("for.body");
+    Block *updateBlock =
+        stmt.HasUpdateStmt() ? m_builder->createBlock("for.update") : nullptr;
+    Block *exitBlock = m_builder->createBlock("for.exit");
+    if (stmt.HasCondExp())
+      m_exp.LowerBranch(stmt.GetCondExp(), bodyBlock, exitBlock);
+    else
+      m_builder->createBr(bodyBlock);
+
+    if (updateBlock) {
+      lowerBranchTarget(bodyBlock, stmt.GetBodyStmt(), updateBlock);
+      lowerBranchTarget(updateBlock, stmt.GetUpdateStmt(), headerBlock);
+    } else {
+      lowerBranchTarget(bodyBlock, stmt.GetBodyStmt(), headerBlock);
+    }
+    m_builder->sealBlock(headerBlock);
+    startBlock(exitBlock);
+  }
+
+private:
+  FuncBuilder *m_builder;
+  std::map<const VarDecl *, Instr *> m_arrays;
+  ExpLowering m_exp;
+
+  // Continue in a block whose predecessors are all known.  The blocks of
+  // statements are placed after the ones of the conditions.
+  void startBlock(Block *block) {
+    m_builder->getFunction()->moveToEnd(block);
+    m_builder->sealBlock(block);
+    m_builder->setBlock(block);
+  }
+
+  // Lower a statement in the block that a condition branches to, then jump
+  // to the given block unless it returned.
+  void lowerBranchTarget(Block *block, const Stmt &stmt, Block *next) {
+    startBlock(block);
+    Lower(stmt);
+    if (m_builder->getBlock())
+      m_builder->createBr(next);
+  }
+};
+
+} // namespace
+
+ModulePtr LowerProgram(const Program &program, const CodegenOptions &options) {
+  ModulePtr module(new Module);
+
+  // Declare every function first, so calls can refer to later ones.
+  FunctionTable functions;
+  for (const FuncDefPtr &funcDef : program.GetFunctions()) {
+    if (!funcDef->hasBody())
+      continue;
+    module->getFunctions().emplace_back(new Function(funcDef.get()));
+    functions[funcDef.get()] = module->getFunctions().back().get();
+  }
+
+  for (const FunctionPtr &function : module->getFunctions()) {
+    FuncBuilder builder(function.get(), &options);
+    StmtLowering lowering(&builder, &functions);
+    lowering.Lower(function->getFuncDef()->GetBody());
+
+    // Add a return instruction if the user neglected to do so.
+    if (builder.getBlock())
+      builder.createRet(function->getZero(function->getReturnType()));
+    RemoveUnreachableBlocks(function.get());
+  }
+  return module;
+}
+
+} // namespace mir
@@ -0,0 +1,760 @@
+#include "MirPasses.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <set>
+#include <tuple>
+
+namespace mir {
+
+void PassManager::Run(Module *module) {
+  for (const FunctionPtr &function : module->getFunctions()) {
+    for (const PassPtr &pass : m_passes) {
+      bool changed = pass->Run(function.get());
+      (void)changed;
+      assert((!changed || Verify(*function, std::cerr)) &&
+             "Pass produced malformed MIR");
+    }
+  }
+}
+
+namespace {
+
+// Immediate dominators, computed with the iterative algorithm of Cooper,
+// Harvey and Kennedy ("A Simple, Fast Dominance Algorithm").  Every block is
+// assumed to be reachable.
+class DominatorTree {
+public:
+  explicit DominatorTree(const Function &function) {
+    std::set<Block *> visited;
+    std::vector<Block *> postorder;
+    visit(function.getEntry(), &visited, &postorder);
+    m_order.assign(postorder.rbegin(), postorder.rend());
+    for (size_t i = 0; i < m_order.size(); ++i)
+      m_number[m_order[i]] = i;
+
+    Block *entry = function.getEntry();
+    m_idom[entry] = entry;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (Block *block : m_order) {
+        if (block == entry)
+          continue;
+        Block *idom = nullptr;
+        for (Block *pred : block->getPreds()) {
+          if (!m_idom.count(pred))
+            continue;
+          idom = idom ? intersect(pred, idom) : pred;
+        }
+        if (m_idom[block] != idom) {
+          m_idom[block] = idom;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  // Blocks in reverse postorder, where every block comes after its
+  // dominators.
+  const std::vector<Block *> &getOrder() const { return m_order; }
+
+  // Get the immediate dominator of a block (null for the entry block).
+  Block *getIdom(const Block *block) const {
+    Block *idom = m_idom.at(const_cast<Block *>(block));
+    return idom == block ? nullptr : idom;
+  }
+
+  // Whether every path from the entry to b goes through a (or a is b).
+  bool dominates(const Block *a, const Block *b) const {
+    for (; b; b = getIdom(b)) {
+      if (a == b)
+        return true;
+    }
+    return false;
+  }
+
+private:
+  std::vector<Block *> m_order;
+  std::map<Block *, size_t> m_number;
+  std::map<Block *, Block *> m_idom;
+
+  static void visit(Block *block, std::set<Block *> *visited,
+                    std::vector<Block *> *postorder) {
+    if (!visited->insert(block).second)
+      return;
+    for (Block *succ : block->getSuccessors())
+      visit(succ, visited, postorder);
+    postorder->push_back(block);
+  }
+
+  Block *intersect(Block *a, Block *b) const {
+    while (a != b) {
+      while (m_number.at(a) > m_number.at(b))
+        a = m_idom.at(a);
+      while (m_number.at(b) > m_number.at(a))
+        b = m_idom.at(b);
+    }
+    return a;
+  }
+};
+
+// A natural loop: the header and the blocks that reach a back edge to it
+// without going through it.
+struct Loop {
+  Block *header = nullptr;
+  std::set<Block *> blocks;
+
+  bool contains(const Block *block) const {
+    return blocks.count(const_cast<Block *>(block)) != 0;
+  }
+
+  // Predecessors of the header inside the loop, which jump back to it.
+  std::vector<Block *> getLatches() const {
+    std::vector<Block *> latches;
+    for (Block *pred : header->getPreds()) {
+      if (contains(pred))
+        latches.push_back(pred);
+    }
+    return latches;
+  }
+
+  // Predecessors of the header outside the loop.
+  std::vector<Block *> getEntries() const {
+    std::vector<Block *> entries;
+    for (Block *pred : header->getPreds()) {
+      if (!contains(pred))
+        entries.push_back(pred);
+    }
+    return entries;
+  }
+
+  // The block that enters the loop and does nothing else, or null.
+  Block *getPreheader() const {
+    std::vector<Block *> entries = getEntries();
+    if (entries.size() != 1 || entries[0]->getSuccessors().size() != 1)
+      return nullptr;
+    return entries[0];
+  }
+};
+
+// Find the natural loops of a function.  Back edges to the same header
+// belong to the same loop.
+std::vector<Loop> FindLoops(const Function &function,
+                            const DominatorTree &domTree) {
+  std::map<Block *, Loop> loops;
+  for (Block *block : domTree.getOrder()) {
+    for (Block *succ : block->getSuccessors()) {
+      if (!domTree.dominates(succ, block))
+        continue;
+      Loop &loop = loops[succ];
+      loop.header = succ;
+      loop.blocks.insert(succ);
+      std::vector<Block *> worklist{block};
+      while (!worklist.empty()) {
+        Block *member = worklist.back();
+        worklist.pop_back();
+        if (loop.blocks.insert(member).second) {
+          for (Block *pred : member->getPreds())
+            worklist.push_back(pred);
+        }
+      }
+    }
+  }
+
+  std::vector<Loop> result;
+  for (Block *block : domTree.getOrder()) {
+    auto it = loops.find(block);
+    if (it != loops.end())
+      result.push_back(it->second);
+  }
+  return result;
+}
+
+// Redirect the edges from the given predecessors of a block to a new block
+// that jumps to it.  Phis in the block get a single incoming value from the
+// new block, merging the values of the redirected edges in a new phi.
+Block *splitPredecessors(Block *block, const std::vector<Block *> &preds,
+                         const std::string &name) {
+  Function *function = block->getParent();
+  Block *split = function->createBlock(name, preds.back());
+  std::set<Block *> predSet(preds.begin(), preds.end());
+
+  for (const InstrPtr &instr : block->getInstrs()) {
+    Instr *phi = instr.get();
+    if (phi->getOpcode() != kPhi)
+      break;
+    InstrPtr merged(new Instr(kPhi, phi->getType()));
+    for (size_t i = phi->getBlocks().size(); i-- > 0;) {
+      if (!predSet.count(phi->getBlocks()[i]))
+        continue;
+      merged->addIncoming(phi->getOperand(i), phi->getBlocks()[i]);
+      phi->removeIncoming(i);
+    }
+
+    Value *value = merged->getOperand(0);
+    bool same = std::all_of(
+        merged->getOperands().begin(), merged->getOperands().end(),
+        [value](const Value *operand) { return operand == value; });
+    if (!same)
+      value = split->append(std::move(merged));
+    phi->addIncoming(value, split);
+  }
+
+  for (Block *pred : predSet) {
+    Instr *terminator = pred->getTerminator();
+    for (size_t i = 0; i < terminator->getBlocks().size(); ++i) {
+      if (terminator->getBlocks()[i] == block)
+        terminator->setBlock(i, split);
+    }
+  }
+  split->append(InstrPtr(new Instr(kBr, kTypeUnknown, {}, {block})));
+  return split;
+}
+
+class LoopCanonicalization : public Pass {
+public:
+  const char *getName() const override { return "loop-canonicalization"; }
+
+  bool Run(Function *function) override {
+    // Each fix changes the control flow, so the loops are found again.
+    bool changed = false;
+    while (canonicalizeOne(function))
+      changed = true;
+    return changed;
+  }
+
+private:
+  static bool canonicalizeOne(Function *function) {
+    DominatorTree domTree(*function);
+    for (const Loop &loop : FindLoops(*function, domTree)) {
+      if (!loop.getPreheader()) {
+        splitPredecessors(loop.header, loop.getEntries(), "preheader");
+        return true;
+      }
+
+      std::vector<Block *> latches = loop.getLatches();
+      if (latches.size() > 1) {
+        splitPredecessors(loop.header, latches, "latch");
+        return true;
+      }
+
+      for (Block *block : loop.blocks) {
+        for (Block *succ : block->getSuccessors()) {
+          if (loop.contains(succ))
+            continue;
+          std::vector<Block *> inside;
+          for (Block *pred : succ->getPreds()) {
+            if (loop.contains(pred))
+              inside.push_back(pred);
+          }
+          if (inside.size() != succ->getPreds().size()) {
+            splitPredecessors(succ, inside, "exit");
+            return true;
+          }
+        }
+      }
+    }
+    return false;
+  }
+};
+
+class ConstantFolding : public Pass {
+public:
+  explicit ConstantFolding(IntOverflow intOverflow)
+      : m_intOverflow(intOverflow) {}
+
+  const char *getName() const override { return "constant-folding"; }
+
+  // Folding makes the users of a value foldable, which may come before it
+  // across a back edge, so this repeats until nothing changes.
+  bool Run(Function *function) override {
+    bool changed = false;
+    while (foldOnce(function))
+      changed = true;
+    if (changed)
+      RemoveUnreachableBlocks(function);
+    return changed;
+  }
+
+private:
+  IntOverflow m_intOverflow;
+
+  bool foldOnce(Function *function) {
+    bool changed = false;
+    for (const BlockPtr &block : function->getBlocks()) {
+      std::vector<Instr *> instrs;
+      for (const InstrPtr &instr : block->getInstrs())
+        instrs.push_back(instr.get());
+
+      for (Instr *instr : instrs) {
+        if (instr->getOpcode() == kCondBr) {
+          if (const auto *condition =
+                  dynamic_cast<const Constant *>(instr->getOperand(0))) {
+            foldBranch(instr, condition->getBool());
+            changed = true;
+          }
+          continue;
+        }
+
+        Value *value =
+            instr->getOpcode() == kPhi
+                ? getSameIncoming(*instr)
+                : Fold(function, instr->getOpcode(), instr->getType(),
+                       instr->getOperands(), m_intOverflow);
+        if (value) {
+          instr->replaceAllUsesWith(value);
+          block->erase(instr);
+          changed = true;
+        }
+      }
+    }
+    return changed;
+  }
+
+  // Get the incoming value of a phi if it's the same for every predecessor
+  // (ignoring the phi itself), or null.
+  static Value *getSameIncoming(const Instr &phi) {
+    Value *same = nullptr;
+    for (Value *operand : phi.getOperands()) {
+      if (operand == &phi || operand == same)
+        continue;
+      if (same)
+        return nullptr;
+      same = operand;
+    }
+    return same;
+  }
+
+  // Replace a branch on a constant with a jump to the target it takes.
+  static void foldBranch(Instr *branch, bool condition) {
+    Block *block = branch->getParent();
+    Block *target = branch->getBlocks()[condition ? 0 : 1];
+    Block *dropped = branch->getBlocks()[condition ? 1 : 0];
+    for (const InstrPtr &phi : dropped->getInstrs()) {
+      if (phi->getOpcode() != kPhi)
+        break;
+      for (size_t i = 0; i < phi->getBlocks().size(); ++i) {
+        if (phi->getBlocks()[i] == block) {
+          phi->removeIncoming(i);
+          break;
+        }
+      }
+    }
+    block->erase(branch);
+    block->append(InstrPtr(new Instr(kBr, kTypeUnknown, {}, {target})));
+  }
+};
+
+class CommonSubexpressionElimination : public Pass {
+public:
+  const char *getName() const override {
+    return "common-subexpression-elimination";
+  }
+
+  bool Run(Function *function) override {
+    DominatorTree domTree(*function);
+    using Key = std::tuple<Opcode, ::Type, std::vector<Value *>>;
+    std::map<Key, std::vector<Instr *>> available;
+    std::vector<Instr *> removed;
+
+    // Blocks are visited after their dominators, and the users of a
+    // replaced instruction see the replacement.
+    for (Block *block : domTree.getOrder()) {
+      for (const InstrPtr &instr : block->getInstrs()) {
+        if (instr->getOpcode() > kMulAdd)
+          continue;
+        std::vector<Instr *> &candidates = available[Key(
+            instr->getOpcode(), instr->getType(), instr->getOperands())];
+        auto same = std::find_if(
+            candidates.begin(), candidates.end(), [&](const Instr *other) {
+              return domTree.dominates(other->getParent(), block);
+            });
+        if (same != candidates.end()) {
+          instr->replaceAllUsesWith(*same);
+          removed.push_back(instr.get());
+        } else {
+          candidates.push_back(instr.get());
+        }
+      }
+    }
+
+    for (Instr *instr : removed)
+      instr->getParent()->erase(instr);
+    return !removed.empty();
+  }
+};
+
+class ArraySizeSpecialization : public Pass {
+public:
+  const char *getName() const override { return "array-size-specialization"; }
+
+  bool Run(Function *function) override {
+    bool changed = false;
+    for (const BlockPtr &block : function->getBlocks()) {
+      for (const InstrPtr &instr : block->getInstrs()) {
+        if (instr->getOpcode() != kNewArray || instr->getFixedSize())
+          continue;
+        // Lowering rejects constant sizes that aren't positive.
+        if (const auto *size =
+                dynamic_cast<const Constant *>(instr->getOperand(0))) {
+          instr->setFixedSize(size->getInt());
+          changed = true;
+        }
+      }
+    }
+    return changed;
+  }
+};
+
+// "base + offset", where a null base stands for zero.
+struct Bound {
+  const Value *base;
+  int64_t offset;
+};
+
+// Finds symbolic bounds of int values at a block, from the conditions of the
+// branches that dominate it, constant offsets and induction variables.
+class RangeAnalysis {
+public:
+  RangeAnalysis(const DominatorTree *domTree, const std::vector<Loop> *loops,
+                IntOverflow intOverflow)
+      : m_domTree(domTree), m_loops(loops),
+        m_noWrap(intOverflow != kIntOverflowWrap) {}
+
+  // Whether an index is known to be in bounds of an array at a block.
+  bool IsInBounds(const Value *index, const Instr *array, const Block *block) {
+    std::vector<Condition> conditions = getConditions(block);
+
+    std::vector<Bound> lower;
+    collect(index, conditions, false, kMaxDepth, &lower);
+    if (std::none_of(lower.begin(), lower.end(), [](const Bound &bound) {
+          return !bound.base && bound.offset >= 0;
+        }))
+      return false;
+
+    // Every array has at least one element.
+    std::vector<Bound> sizes{{nullptr, 1}};
+    collect(array->getOperand(0), conditions, false, kMaxDepth, &sizes);
+    std::vector<Bound> upper;
+    collect(index, conditions, true, kMaxDepth, &upper);
+    for (const Bound &bound : upper) {
+      for (const Bound &size : sizes) {
+        if (bound.base == size.base && bound.offset < size.offset)
+          return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  static constexpr int kMaxDepth = 4;
+
+  // A comparison that holds at the block: "lhs opcode rhs".
+  struct Condition {
+    Opcode opcode;
+    const Value *lhs;
+    const Value *rhs;
+  };
+
+  const DominatorTree *m_domTree;
+  const std::vector<Loop> *m_loops;
+  bool m_noWrap;
+
+  // Collect the int comparisons that hold at a block: a dominator whose only
+  // predecessor branches to it on a condition.
+  std::vector<Condition> getConditions(const Block *block) const {
+    std::vector<Condition> conditions;
+    for (; block; block = m_domTree->getIdom(block)) {
+      if (block->getPreds().size() != 1)
+        continue;
+      const Instr *branch = block->getPreds()[0]->getTerminator();
+      if (branch->getOpcode() != kCondBr ||
+          branch->getBlocks()[0] == branch->getBlocks()[1])
+        continue;
+      const auto *compare = dynamic_cast<const Instr *>(branch->getOperand(0));
+      if (!compare || !compare->isComparison() ||
+          compare->getOperand(0)->getType() != kTypeInt)
+        continue;
+      bool holds = branch->getBlocks()[0] == block;
+      conditions.push_back({holds ? compare->getOpcode()
+                                  : negate(compare->getOpcode()),
+                            compare->getOperand(0), compare->getOperand(1)});
+    }
+    return conditions;
+  }
+
+  static Opcode negate(Opcode opcode) {
+    switch (opcode) {
+    case kEq:
+      return kNe;
+    case kNe:
+      return kEq;
+    case kLt:
+      return kGe;
+    case kLe:
+      return kGt;
+    case kGt:
+      return kLe;
+    case kGe:
+      return kLt;
+    default:
+      assert(false && "Not a comparison");
+      return opcode;
+    }
+  }
+
+  // Collect upper (or lower) bounds of a value, adding "offset" to each.
+  void collect(const Value *value, const std::vector<Condition> &conditions,
+               bool upper, int depth, std::vector<Bound> *bounds,
+               int64_t offset = 0) {
+    if (const auto *constant = dynamic_cast<const Constant *>(value)) {
+      bounds->push_back({nullptr, constant->getInt() + offset});
+      return;
+    }
+    bounds->push_back({value, offset});
+    if (depth == 0)
+      return;
+
+    // x + c and x - c, unless they may wrap around.
+    const auto *instr = dynamic_cast<const Instr *>(value);
+    if (instr && m_noWrap &&
+        (instr->getOpcode() == kAdd || instr->getOpcode() == kSub)) {
+      int64_t sign = instr->getOpcode() == kAdd ? 1 : -1;
+      if (const auto *c = dynamic_cast<const Constant *>(instr->getOperand(1)))
+        collect(instr->getOperand(0), conditions, upper, depth - 1, bounds,
+                offset + sign * c->getInt());
+      else if (const auto *c =
+                   dynamic_cast<const Constant *>(instr->getOperand(0))) {
+        if (sign > 0) {
+          collect(instr->getOperand(1), conditions, upper, depth - 1, bounds,
+                  offset + c->getInt());
+        } else {
+          // c - x is bounded by the opposite bound of x, if it's constant.
+          std::vector<Bound> opposite;
+          collect(instr->getOperand(1), conditions, !upper, depth - 1,
+                  &opposite);
+          for (const Bound &bound : opposite) {
+            if (!bound.base)
+              bounds->push_back({nullptr, offset + c->getInt() - bound.offset});
+          }
+        }
+      }
+    }
+
+    // Comparisons with the value, turned around to have it on the left.
+    for (const Condition &condition : conditions) {
+      Opcode opcode = condition.opcode;
+      const Value *other;
+      if (condition.lhs == value) {
+        other = condition.rhs;
+      } else if (condition.rhs == value) {
+        other = condition.lhs;
+        opcode = opcode == kLt   ? kGt
+                 : opcode == kLe ? kGe
+                 : opcode == kGt ? kLt
+                 : opcode == kGe ? kLe
+                                 : opcode;
+      } else {
+        continue;
+      }
+
+      if (opcode == kEq)
+        collect(other, conditions, upper, depth - 1, bounds, offset);
+      else if (upper && (opcode == kLt || opcode == kLe))
+        collect(other, conditions, upper, depth - 1, bounds,
+                offset - (opcode == kLt));
+      else if (!upper && (opcode == kGt || opcode == kGe))
+        collect(other, conditions, upper, depth - 1, bounds,
+                offset + (opcode == kGt));
+    }
+
+    // An induction variable that only grows is bounded below by its start
+    // value, and one that only shrinks is bounded above by it.
+    if (instr && m_noWrap && instr->getOpcode() == kPhi) {
+      if (const Value *start = getInductionStart(instr, upper))
+        collect(start, conditions, upper, depth - 1, bounds, offset);
+    }
+  }
+
+  // Get the start value of a phi in a loop header that steps by a constant
+  // in the given direction (down for upper bounds) every iteration, or null.
+  const Value *getInductionStart(const Instr *phi, bool down) const {
+    for (const Loop &loop : *m_loops) {
+      if (loop.header != phi->getParent())
+        continue;
+      Block *preheader = loop.getPreheader();
+      std::vector<Block *> latches = loop.getLatches();
+      if (!preheader || latches.size() != 1)
+        return nullptr;
+
+      const auto *step = dynamic_cast<const Instr *>(
+          phi->getIncoming(latches[0]));
+      if (!step || step->getOperand(0) != phi ||
+          (step->getOpcode() != kAdd && step->getOpcode() != kSub))
+        return nullptr;
+      const auto *c = dynamic_cast<const Constant *>(step->getOperand(1));
+      if (!c)
+        return nullptr;
+      int64_t delta = step->getOpcode() == kAdd ? c->getInt() : -c->getInt();
+      if (down ? delta > 0 : delta < 0)
+        return nullptr;
+      return phi->getIncoming(preheader);
+    }
+    return nullptr;
+  }
+};
+
+class BoundsCheckElimination : public Pass {
+public:
+  explicit BoundsCheckElimination(IntOverflow intOverflow)
+      : m_intOverflow(intOverflow) {}
+
+  const char *getName() const override { return "bounds-check-elimination"; }
+
+  bool Run(Function *function) override {
+    DominatorTree domTree(*function);
+    std::vector<Loop> loops = FindLoops(*function, domTree);
+    RangeAnalysis ranges(&domTree, &loops, m_intOverflow);
+
+    // Blocks are visited after their dominators, so a check that repeats
+    // another one sees it among the kept checks.
+    std::vector<Instr *> kept, removed;
+    for (Block *block : domTree.getOrder()) {
+      for (const InstrPtr &instr : block->getInstrs()) {
+        Instr *check = instr.get();
+        if (check->getOpcode() != kCheck)
+          continue;
+        const auto *array = static_cast<const Instr *>(check->getOperand(0));
+        bool redundant = std::any_of(
+            kept.begin(), kept.end(), [&](const Instr *other) {
+              return other->getOperands() == check->getOperands() &&
+                     domTree.dominates(other->getParent(), block);
+            });
+        if (redundant ||
+            ranges.IsInBounds(check->getOperand(1), array, block))
+          removed.push_back(check);
+        else
+          kept.push_back(check);
+      }
+    }
+
+    for (Instr *check : removed)
+      check->getParent()->erase(check);
+    return !removed.empty();
+  }
+
+private:
+  IntOverflow m_intOverflow;
+};
+
+class DeadCodeElimination : public Pass {
+public:
+  explicit DeadCodeElimination(IntOverflow intOverflow)
+      : m_trapOnOverflow(intOverflow == kIntOverflowTrap) {}
+
+  const char *getName() const override { return "dead-code-elimination"; }
+
+  // Mark the instructions that have an effect and everything they use, then
+  // delete the rest, which also removes cycles of unused phis.
+  bool Run(Function *function) override {
+    std::set<const Instr *> live;
+    std::vector<const Instr *> worklist;
+    for (const BlockPtr &block : function->getBlocks()) {
+      for (const InstrPtr &instr : block->getInstrs()) {
+        if (hasEffects(*instr))
+          worklist.push_back(instr.get());
+      }
+    }
+    while (!worklist.empty()) {
+      const Instr *instr = worklist.back();
+      worklist.pop_back();
+      if (!live.insert(instr).second)
+        continue;
+      for (const Value *operand : instr->getOperands()) {
+        if (const auto *def = dynamic_cast<const Instr *>(operand))
+          worklist.push_back(def);
+      }
+    }
+
+    std::vector<Instr *> dead;
+    for (const BlockPtr &block : function->getBlocks()) {
+      for (const InstrPtr &instr : block->getInstrs()) {
+        if (!live.count(instr.get()))
+          dead.push_back(instr.get());
+      }
+    }
+    for (Instr *instr : dead)
+      instr->dropOperands();
+    for (Instr *instr : dead)
+      instr->getParent()->erase(instr);
+    return !dead.empty();
+  }
+
+private:
+  bool m_trapOnOverflow;
+
+  bool hasEffects(const Instr &instr) const {
+    switch (instr.getOpcode()) {
+    case kAdd:
+    case kSub:
+    case kMul:
+    case kNeg:
+      return m_trapOnOverflow && instr.getType() == kTypeInt;
+    case kNewArray:
+      // The runtime size check may terminate the program.
+      return !instr.getFixedSize();
+    case kCall:
+    case kPrint:
+    case kCheck:
+    case kStore:
+    case kBr:
+    case kCondBr:
+    case kRet:
+      return true;
+    default:
+      return false;
+    }
+  }
+};
+
+} // namespace
+
+PassPtr CreateLoopCanonicalizationPass() {
+  return PassPtr(new LoopCanonicalization);
+}
+
+PassPtr CreateConstantFoldingPass(IntOverflow intOverflow) {
+  return PassPtr(new ConstantFolding(intOverflow));
+}
+
+PassPtr CreateCommonSubexpressionEliminationPass() {
+  return PassPtr(new CommonSubexpressionElimination);
+}
+
+PassPtr CreateArraySizeSpecializationPass() {
+  return PassPtr(new ArraySizeSpecialization);
+}
+
+PassPtr CreateBoundsCheckEliminationPass(IntOverflow intOverflow) {
+  return PassPtr(new BoundsCheckElimination(intOverflow));
+}
+
+PassPtr CreateDeadCodeEliminationPass(IntOverflow intOverflow) {
+  return PassPtr(new DeadCodeElimination(intOverflow));
+}
+
+void AddDefaultPasses(PassManager *passManager, const CodegenOptions &options) {
+  passManager->Add(CreateLoopCanonicalizationPass());
+  passManager->Add(CreateConstantFoldingPass(options.intOverflow));
+  passManager->Add(CreateCommonSubexpressionEliminationPass());
+  passManager->Add(CreateArraySizeSpecializationPass());
+  if (options.boundsCheck != kBoundsCheckOff)
+    passManager->Add(CreateBoundsCheckEliminationPass(options.intOverflow));
+  passManager->Add(CreateDeadCodeEliminationPass(options.intOverflow));
+}
+
+} // namespace mir
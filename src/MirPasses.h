@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Codegen.h"
+#include "Mir.h"
+
+#include <memory>
+#include <vector>
+
+namespace mir {
+
+// A transformation of one function at a time.
+class Pass {
+public:
+  virtual ~Pass() = default;
+
+  virtual const char *getName() const = 0;
+
+  // Transform the function, returning whether anything changed.
+  virtual bool Run(Function *function) = 0;
+};
+
+using PassPtr = std::unique_ptr<Pass>;
+
+// Runs a sequence of passes over every function of a module.  Debug builds
+// verify each function after every pass that changed it.
+class PassManager {
+public:
+  void Add(PassPtr pass) { m_passes.push_back(std::move(pass)); }
+
+  void Run(Module *module);
+
+private:
+  std::vector<PassPtr> m_passes;
+};
+
+// Give every loop a preheader (the only block outside the loop that enters
+// it), a single latch (the only block that jumps back to the header) and
+// exit blocks that are only reached from inside the loop.  The other passes
+// rely on this shape.
+PassPtr CreateLoopCanonicalizationPass();
+
+// Fold operations on constants, phis whose incoming values are all the same
+// and branches on constant conditions, deleting the blocks that become
+// unreachable.
+PassPtr CreateConstantFoldingPass(IntOverflow intOverflow);
+
+// Replace an operation by an identical one that dominates it.  Builtin
+// operators have no side effects, so this is safe for all of them.
+PassPtr CreateCommonSubexpressionEliminationPass();
+
+// Give arrays whose size is a compile time constant a fixed size, so they
+// are allocated in the function's frame without a runtime size check.
+PassPtr CreateArraySizeSpecializationPass();
+
+// Remove bounds checks that are proven to hold, from the loop conditions
+// and the other branches that dominate them, or that repeat a check which
+// dominates them.  Bounds don't carry across arithmetic that may wrap.
+PassPtr CreateBoundsCheckEliminationPass(IntOverflow intOverflow);
+
+// Remove instructions whose values are never used, unless they may
+// terminate the program.
+PassPtr CreateDeadCodeEliminationPass(IntOverflow intOverflow);
+
+// Add the passes that run on every program, in order.
+void AddDefaultPasses(PassManager *passManager, const CodegenOptions &options);
+
+} // namespace mir
@@ -0,0 +1,48 @@
+#include "Optimize.h"
+
+#include <llvm/IR/Module.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Target/TargetMachine.h>
+
+void Optimize(llvm::Module *module, int optLevel,
+              llvm::TargetMachine *targetMachine) {
+  llvm::PassBuilder passBuilder(targetMachine);
+
+  llvm::LoopAnalysisManager loopAnalysisManager;
+  llvm::FunctionAnalysisManager functionAnalysisManager;
+  llvm::CGSCCAnalysisManager cGSCCAnalysisManager;
+  llvm::ModuleAnalysisManager moduleAnalysisManager;
+
+  passBuilder.registerModuleAnalyses(moduleAnalysisManager);
+  passBuilder.registerCGSCCAnalyses(cGSCCAnalysisManager);
+  passBuilder.registerFunctionAnalyses(functionAnalysisManager);
+  passBuilder.registerLoopAnalyses(loopAnalysisManager);
+
+  passBuilder.crossRegisterProxies(loopAnalysisManager, functionAnalysisManager,
+                                   cGSCCAnalysisManager, moduleAnalysisManager);
+
+  llvm::ModulePassManager modulePassManager;
+
+  llvm::OptimizationLevel level;
+  switch (optLevel) {
+  case 0:
+    level = llvm::OptimizationLevel::O0;
+    break;
+  case 1:
+    level = llvm::OptimizationLevel::O1;
+    break;
+  case 2:
+    level = llvm::OptimizationLevel::O2;
+    break;
+  case 3:
+    level = llvm::OptimizationLevel::O3;
+    break;
+  default:
+    level = llvm::OptimizationLevel::O2;
+  }
+
+  modulePassManager = passBuilder.buildPerModuleDefaultPipeline(level);
+
+  // Run the optimizations on the module.
+  modulePassManager.run(*module, moduleAnalysisManager);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+namespace llvm {
+class Module;
+class TargetMachine;
+} // namespace llvm
+
+// Optimize the module using the given optimization level (0 -  3).
+void Optimize(llvm::Module *module, int optLevel,
+              llvm::TargetMachine *targetMachine);
@@ -381,16 +381,41 @@ FuncDefPtr parseFuncDef(TokenStream &tokens) {
 
 } // namespace
 
+int ParseImports(TokenStream &tokens, std::vector<std::string> *imports,
+                 std::ostream &errors) {
+  try {
+    while (*tokens == kTokenImport) {
+      ++tokens; // skip "import"
+      Token path(*tokens++);
+      if (path != kTokenStrLit)
+        throw ParseError("Expected the path of the imported file in quotes",
+                         path.getLine(), path.getColumn());
+      skipToken(kTokenSemicolon, tokens);
+      imports->push_back(path.getString());
+    }
+    return 0;
+  } catch (const ParseError &error) {
+    errors << "Parser Error: " << error.what() << std::endl;
+    return -1;
+  }
+}
+
 // Adding function definitions to the program
-int ParseProgram(TokenStream &tokens, Program *program) {
+int ParseProgram(TokenStream &tokens, Program *program, std::ostream &errors) {
   try {
+    if (*tokens == kTokenImport)
+      throw ParseError("Imports are only supported when compiling files",
+                       (*tokens).getLine(), (*tokens).getColumn());
     do {
+      if (*tokens == kTokenImport)
+        throw ParseError("Imports have to come before all functions",
+                         (*tokens).getLine(), (*tokens).getColumn());
       FuncDefPtr function(parseFuncDef(tokens));
       program->GetFunctions().push_back(std::move(function));
     } while (*tokens != kTokenEOF);
     return 0;
   } catch (const ParseError &error) {
-    std::cerr << "Parser Error: " << error.what() << std::endl;
+    errors << "Parser Error: " << error.what() << std::endl;
     return -1;
   }
 }
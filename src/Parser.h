@@ -1,8 +1,22 @@
 #pragma once
 
+#include <iosfwd>
+#include <string>
+#include <vector>
+
 class Program;
 class TokenStream;
 
-int ParseProgram( TokenStream& tokens, Program* program );
+// Parse the imports at the start of a file (import "other.in";), adding
+// their paths to *imports and leaving the tokens at its first function.
+// Returns zero for success; a syntax error is reported to the given stream.
+int ParseImports(TokenStream &tokens, std::vector<std::string> *imports,
+                 std::ostream &errors);
+
+// Parse the tokens into functions of the program.  Returns zero for success;
+// a syntax error is reported to the given stream.  Imports are errors here:
+// they are read by ParseImports, when a program of several files is built
+// (see Import.h).
+int ParseProgram( TokenStream& tokens, Program* program, std::ostream& errors );
 
 
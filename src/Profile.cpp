@@ -0,0 +1,385 @@
+#include "Profile.h"
+#include "Codegen.h"
+
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Module.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+
+using namespace llvm;
+
+namespace {
+
+// The profile starts with a text header that lists the functions, followed
+// by an empty line and the raw 64 bit counters of all functions, in the
+// same order.
+const char *const kProfileMagic = "moj-profile 1\n";
+
+// A function whose counters are in the profile: the first one counts the
+// calls, then there is a pair for each conditional branch, counting how
+// often it went to its first and to its second successor.
+struct FuncLayout {
+  Function *function = nullptr;
+  std::vector<BranchInst *> branches;
+  uint64_t hash = 14695981039346656037ull;
+
+  size_t getNumCounters() const { return 1 + 2 * branches.size(); }
+};
+
+// Find the counted branches of every defined function, and hash the shape
+// of its control flow graph (FNV-1a).
+std::vector<FuncLayout> GetLayouts(Module &module) {
+  std::vector<FuncLayout> layouts;
+  for (Function &function : module) {
+    if (function.isDeclaration())
+      continue;
+    FuncLayout layout;
+    layout.function = &function;
+    auto mix = [&layout](uint64_t value) {
+      layout.hash = (layout.hash ^ value) * 1099511628211ull;
+    };
+
+    std::map<const BasicBlock *, uint64_t> numbers;
+    for (BasicBlock &block : function) {
+      uint64_t number = numbers.size();
+      numbers[&block] = number;
+    }
+    mix(numbers.size());
+    for (BasicBlock &block : function) {
+      Instruction *terminator = block.getTerminator();
+      mix(terminator->getNumSuccessors());
+      for (BasicBlock *succ : successors(&block))
+        mix(numbers[succ]);
+      auto *branch = dyn_cast<BranchInst>(terminator);
+      if (branch && branch->isConditional())
+        layout.branches.push_back(branch);
+    }
+    layouts.push_back(layout);
+  }
+  return layouts;
+}
+
+std::string GetHeader(const std::vector<FuncLayout> &layouts) {
+  std::ostringstream header;
+  header << kProfileMagic;
+  for (const FuncLayout &layout : layouts)
+    header << layout.function->getName().str() << ' ' << layout.hash << ' '
+           << layout.getNumCounters() << '\n';
+  header << '\n';
+  return header.str();
+}
+
+void IncrementCounter(IRBuilder<> *builder, GlobalVariable *counters,
+                      Value *index) {
+  Value *counter = builder->CreateInBoundsGEP(
+      counters->getValueType(), counters, {builder->getInt64(0), index});
+  Value *count = builder->CreateLoad(builder->getInt64Ty(), counter);
+  builder->CreateStore(builder->CreateAdd(count, builder->getInt64(1)),
+                       counter);
+}
+
+// Create the function that writes the counters to the profile.  If the file
+// already holds a profile of the same program, its counts are added first,
+// so that the profile covers all runs.
+Function *CreateProfileWriter(Module *module, GlobalVariable *counters,
+                              const std::string &header,
+                              const std::string &profileFile) {
+  LLVMContext &context = module->getContext();
+  IRBuilder<> builder(context);
+  llvm::Type *voidType = builder.getVoidTy();
+  llvm::Type *ptrType = builder.getInt8PtrTy();
+  llvm::Type *sizeType = module->getDataLayout().getIntPtrType(context);
+
+  FunctionCallee fopen = module->getOrInsertFunction(
+      "fopen", FunctionType::get(ptrType, {ptrType, ptrType}, false));
+  FunctionCallee fread = module->getOrInsertFunction(
+      "fread", FunctionType::get(
+                   sizeType, {ptrType, sizeType, sizeType, ptrType}, false));
+  FunctionCallee fwrite = module->getOrInsertFunction(
+      "fwrite", FunctionType::get(
+                    sizeType, {ptrType, sizeType, sizeType, ptrType}, false));
+  FunctionCallee fclose = module->getOrInsertFunction(
+      "fclose", FunctionType::get(builder.getInt32Ty(), {ptrType}, false));
+  FunctionCallee memcmp = module->getOrInsertFunction(
+      "memcmp", FunctionType::get(builder.getInt32Ty(),
+                                  {ptrType, ptrType, sizeType}, false));
+  FunctionCallee snprintf = module->getOrInsertFunction(
+      "snprintf", FunctionType::get(builder.getInt32Ty(),
+                                    {ptrType, sizeType, ptrType}, true));
+  FunctionCallee getpid = module->getOrInsertFunction(
+      "getpid", FunctionType::get(builder.getInt32Ty(), false));
+  FunctionCallee rename = module->getOrInsertFunction(
+      "rename",
+      FunctionType::get(builder.getInt32Ty(), {ptrType, ptrType}, false));
+  FunctionCallee remove = module->getOrInsertFunction(
+      "remove", FunctionType::get(builder.getInt32Ty(), {ptrType}, false));
+
+  Function *writer = Function::Create(FunctionType::get(voidType, false),
+                                      GlobalValue::InternalLinkage,
+                                      "__moj_profile_write", module);
+  BasicBlock *entry = BasicBlock::Create(context, "entry", writer);
+  BasicBlock *read = BasicBlock::Create(context, "read", writer);
+  BasicBlock *compare = BasicBlock::Create(context, "compare", writer);
+  BasicBlock *readCounters = BasicBlock::Create(context, "counters", writer);
+  BasicBlock *merge = BasicBlock::Create(context, "merge", writer);
+  BasicBlock *close = BasicBlock::Create(context, "close", writer);
+  BasicBlock *write = BasicBlock::Create(context, "write", writer);
+  BasicBlock *output = BasicBlock::Create(context, "output", writer);
+  BasicBlock *replace = BasicBlock::Create(context, "replace", writer);
+  BasicBlock *discard = BasicBlock::Create(context, "discard", writer);
+  BasicBlock *done = BasicBlock::Create(context, "done", writer);
+
+  auto *countersType = cast<ArrayType>(counters->getValueType());
+  uint64_t numCounters = countersType->getNumElements();
+  Constant *headerData =
+      ConstantDataArray::getString(context, header, /*AddNull=*/false);
+  auto *headerGlobal = new GlobalVariable(
+      *module, headerData->getType(), true, GlobalValue::PrivateLinkage,
+      headerData, "__moj_profile_header");
+  Value *headerSize = ConstantInt::get(sizeType, header.size());
+  Value *counterSize = ConstantInt::get(sizeType, 8);
+  Value *counterCount = ConstantInt::get(sizeType, numCounters);
+
+  builder.SetInsertPoint(entry);
+  Value *headerBuffer = builder.CreateAlloca(headerData->getType());
+  Value *oldCounters = builder.CreateAlloca(countersType);
+  // Room for "<profile>.tmp.<pid>".
+  uint64_t temporarySize = profileFile.size() + 32;
+  Value *temporary = builder.CreatePointerCast(
+      builder.CreateAlloca(
+          ArrayType::get(builder.getInt8Ty(), temporarySize)),
+      ptrType);
+  Value *path = builder.CreateGlobalStringPtr(profileFile, "profile.path");
+  Value *in =
+      builder.CreateCall(fopen, {path, builder.CreateGlobalStringPtr("rb")});
+  builder.CreateCondBr(builder.CreateIsNull(in), write, read);
+
+  builder.SetInsertPoint(read);
+  Value *headerRead = builder.CreateCall(
+      fread, {builder.CreatePointerCast(headerBuffer, ptrType),
+              ConstantInt::get(sizeType, 1), headerSize, in});
+  builder.CreateCondBr(builder.CreateICmpEQ(headerRead, headerSize), compare,
+                       close);
+
+  builder.SetInsertPoint(compare);
+  Value *difference = builder.CreateCall(
+      memcmp, {builder.CreatePointerCast(headerBuffer, ptrType),
+               builder.CreatePointerCast(headerGlobal, ptrType), headerSize});
+  builder.CreateCondBr(builder.CreateIsNull(difference), readCounters, close);
+
+  builder.SetInsertPoint(readCounters);
+  Value *countersRead = builder.CreateCall(
+      fread, {builder.CreatePointerCast(oldCounters, ptrType), counterSize,
+              counterCount, in});
+  builder.CreateCondBr(builder.CreateICmpEQ(countersRead, counterCount),
+                       merge, close);
+
+  builder.SetInsertPoint(merge);
+  PHINode *index = builder.CreatePHI(builder.getInt64Ty(), 2, "i");
+  index->addIncoming(builder.getInt64(0), readCounters);
+  Value *oldCounter = builder.CreateInBoundsGEP(
+      countersType, oldCounters, {builder.getInt64(0), index});
+  Value *counter = builder.CreateInBoundsGEP(countersType, counters,
+                                             {builder.getInt64(0), index});
+  builder.CreateStore(
+      builder.CreateAdd(builder.CreateLoad(builder.getInt64Ty(), counter),
+                        builder.CreateLoad(builder.getInt64Ty(), oldCounter)),
+      counter);
+  Value *next = builder.CreateAdd(index, builder.getInt64(1));
+  index->addIncoming(next, merge);
+  builder.CreateCondBr(
+      builder.CreateICmpULT(next, builder.getInt64(numCounters)), merge,
+      close);
+
+  builder.SetInsertPoint(close);
+  builder.CreateCall(fclose, {in});
+  builder.CreateBr(write);
+
+  // The profile is written to a file of this process, which then replaces
+  // it at once, so that a run that is killed or one that exits at the same
+  // time can't leave a truncated or mixed profile behind.
+  builder.SetInsertPoint(write);
+  builder.CreateCall(snprintf,
+                     {temporary, ConstantInt::get(sizeType, temporarySize),
+                      builder.CreateGlobalStringPtr("%s.tmp.%d"), path,
+                      builder.CreateCall(getpid)});
+  Value *out = builder.CreateCall(
+      fopen, {temporary, builder.CreateGlobalStringPtr("wb")});
+  builder.CreateCondBr(builder.CreateIsNull(out), done, output);
+
+  builder.SetInsertPoint(output);
+  Value *headerWritten = builder.CreateCall(
+      fwrite, {builder.CreatePointerCast(headerGlobal, ptrType),
+               ConstantInt::get(sizeType, 1), headerSize, out});
+  Value *countersWritten =
+      builder.CreateCall(fwrite, {builder.CreatePointerCast(counters, ptrType),
+                                  counterSize, counterCount, out});
+  Value *closed = builder.CreateCall(fclose, {out});
+  Value *written = builder.CreateAnd(
+      builder.CreateAnd(builder.CreateICmpEQ(headerWritten, headerSize),
+                        builder.CreateICmpEQ(countersWritten, counterCount)),
+      builder.CreateIsNull(closed));
+  builder.CreateCondBr(written, replace, discard);
+
+  builder.SetInsertPoint(replace);
+  Value *renamed = builder.CreateCall(rename, {temporary, path});
+  builder.CreateCondBr(builder.CreateIsNull(renamed), done, discard);
+
+  builder.SetInsertPoint(discard);
+  builder.CreateCall(remove, {temporary});
+  builder.CreateBr(done);
+
+  builder.SetInsertPoint(done);
+  builder.CreateRetVoid();
+  return writer;
+}
+
+} // namespace
+
+void InstrumentForProfiling(Module *module, const std::string &profileFile) {
+  std::vector<FuncLayout> layouts = GetLayouts(*module);
+  size_t numCounters = 0;
+  for (const FuncLayout &layout : layouts)
+    numCounters += layout.getNumCounters();
+
+  LLVMContext &context = module->getContext();
+  IRBuilder<> builder(context);
+  ArrayType *countersType = ArrayType::get(builder.getInt64Ty(), numCounters);
+  auto *counters = new GlobalVariable(
+      *module, countersType, false, GlobalValue::InternalLinkage,
+      ConstantAggregateZero::get(countersType), "__moj_profile_counters");
+
+  size_t first = 0;
+  for (const FuncLayout &layout : layouts) {
+    // The counters are stores, so calls to the function can't be removed,
+    // hoisted or merged any more.
+    DropPureAttributes(layout.function);
+
+    // Count the calls after the allocas, which have to stay at the start of
+    // the entry block to be promoted to registers.
+    BasicBlock &entry = layout.function->getEntryBlock();
+    BasicBlock::iterator pos = entry.getFirstInsertionPt();
+    while (isa<AllocaInst>(*pos))
+      ++pos;
+    builder.SetInsertPoint(&entry, pos);
+    IncrementCounter(&builder, counters, builder.getInt64(first));
+
+    // Select the counter of the taken successor instead of splitting edges,
+    // which keeps the control flow graph unchanged.
+    for (size_t i = 0; i < layout.branches.size(); ++i) {
+      BranchInst *branch = layout.branches[i];
+      builder.SetInsertPoint(branch);
+      Value *index = builder.CreateSelect(branch->getCondition(),
+                                          builder.getInt64(first + 1 + 2 * i),
+                                          builder.getInt64(first + 2 + 2 * i));
+      IncrementCounter(&builder, counters, index);
+    }
+    first += layout.getNumCounters();
+  }
+
+  // Write the profile when the program exits, also through exit().  The
+  // writer is registered by a constructor, which runs once in AOT builds and
+  // in the JIT alike.
+  Function *writer =
+      CreateProfileWriter(module, counters, GetHeader(layouts), profileFile);
+  FunctionCallee atexit = module->getOrInsertFunction(
+      "atexit",
+      FunctionType::get(builder.getInt32Ty(), {writer->getType()}, false));
+  Function *init = Function::Create(
+      FunctionType::get(builder.getVoidTy(), false),
+      GlobalValue::InternalLinkage, "__moj_profile_init", module);
+  builder.SetInsertPoint(BasicBlock::Create(context, "entry", init));
+  builder.CreateCall(atexit, {writer});
+  builder.CreateRetVoid();
+  appendToGlobalCtors(*module, init, 0);
+}
+
+bool ApplyProfile(Module *module, const std::string &profileFile,
+                  raw_ostream &errors) {
+  std::ifstream in(profileFile, std::ifstream::binary);
+  if (in.fail()) {
+    errors << "Error: Could not open profile " << profileFile << "\n";
+    return false;
+  }
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+
+  // Parse the header into the location of each function's counters.
+  struct Record {
+    uint64_t hash;
+    size_t first;
+    size_t count;
+  };
+  std::map<std::string, Record> records;
+  size_t magicLength = std::strlen(kProfileMagic);
+  size_t headerEnd = data.find("\n\n");
+  size_t numCounters = 0;
+  if (data.compare(0, magicLength, kProfileMagic) == 0 &&
+      headerEnd != std::string::npos) {
+    std::istringstream header(
+        data.substr(magicLength, headerEnd + 1 - magicLength));
+    std::string name;
+    Record record;
+    while (header >> name >> record.hash >> record.count) {
+      record.first = numCounters;
+      records[name] = record;
+      numCounters += record.count;
+    }
+  }
+  size_t countersStart = headerEnd + 2;
+  if (records.empty() ||
+      data.size() != countersStart + numCounters * sizeof(uint64_t)) {
+    errors << "Error: " << profileFile << " is not a valid profile\n";
+    return false;
+  }
+  std::vector<uint64_t> counts(numCounters);
+  std::memcpy(counts.data(), data.data() + countersStart,
+              numCounters * sizeof(uint64_t));
+
+  LLVMContext &context = module->getContext();
+  MDBuilder mdBuilder(context);
+  InstrProfSummaryBuilder summary(ProfileSummaryBuilder::DefaultCutoffs);
+  for (const FuncLayout &layout : GetLayouts(*module)) {
+    std::string name = layout.function->getName().str();
+    auto it = records.find(name);
+    if (it == records.end() || it->second.hash != layout.hash ||
+        it->second.count != layout.getNumCounters()) {
+      errors << "Warning: The profile of function " << name
+             << " doesn't match the program, ignoring it\n";
+      continue;
+    }
+
+    const uint64_t *count = &counts[it->second.first];
+    summary.addRecord(InstrProfRecord(
+        std::vector<uint64_t>(count, count + layout.getNumCounters())));
+    layout.function->setEntryCount(count[0]);
+    for (size_t i = 0; i < layout.branches.size(); ++i) {
+      uint64_t taken = count[1 + 2 * i];
+      uint64_t notTaken = count[2 + 2 * i];
+      if (taken == 0 && notTaken == 0)
+        continue;
+
+      // Branch weights are 32 bit, so large counts are scaled down.
+      uint64_t scale = std::max(taken, notTaken) / UINT32_MAX + 1;
+      MDNode *weights = mdBuilder.createBranchWeights(
+          static_cast<uint32_t>(taken / scale),
+          static_cast<uint32_t>(notTaken / scale));
+      layout.branches[i]->setMetadata(LLVMContext::MD_prof, weights);
+    }
+  }
+  module->setProfileSummary(summary.getSummary()->getMD(context),
+                            ProfileSummary::PSK_Instr);
+  return true;
+}
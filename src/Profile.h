@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+namespace llvm {
+class Module;
+class raw_ostream;
+} // namespace llvm
+
+// Profile-guided optimization without external tools.  An instrumented
+// program counts how often each function is entered and which way each
+// conditional branch goes, and writes the counts to a profile file when it
+// exits, adding them to the counts already in the file.  A later build of
+// the same program reads the profile back as function entry counts, branch
+// weights and a profile summary, which drive inlining, block placement and
+// hot/cold splitting.
+//
+// Both steps work on the unoptimized LLVM IR, so the profile only matches a
+// build with the same source and code generation options.  Each function
+// carries a hash of its control flow graph; functions whose hash doesn't
+// match are compiled without profile data.
+
+// Add counters to every function defined in the module, and code that writes
+// them to the given file at exit.  The module must have its data layout.
+void InstrumentForProfiling(llvm::Module *module,
+                            const std::string &profileFile);
+
+// Attach the counts from a profile written by an instrumented build.
+// Returns false, with an error message, if the file can't be read.
+bool ApplyProfile(llvm::Module *module, const std::string &profileFile,
+                  llvm::raw_ostream &errors);
@@ -0,0 +1,86 @@
+#include "Repl.h"
+#include "Session.h"
+#include "TokenStream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include <unistd.h>
+
+namespace {
+
+// Whether the entry defines functions, i.e. starts with a type and then a
+// function name, rather than a declaration of a variable.
+bool isDefinition(const std::string &entry) {
+  TokenStream tokens(entry.c_str());
+  if (*tokens != INT && *tokens != kTokenFloat && *tokens != kTokenBool)
+    return false;
+  ++tokens;
+  if (*tokens == kTokenOperator)
+    return true;
+  if (*tokens != kTokenId)
+    return false;
+  ++tokens;
+  return *tokens == kTokenLparen;
+}
+
+// Compile and run an entry, reporting its errors to stderr.
+void run(Session &session, CompiledProgram &program, const std::string &entry,
+         unsigned *numStatements) {
+  if (isDefinition(entry)) {
+    session.Extend(program, entry, std::cerr);
+    return;
+  }
+
+  // Statements become a function of their own, which is added to the program
+  // like any other, so that they can call all the functions before it.
+  std::string body = entry.substr(0, entry.find_last_not_of(" \t\r\n") + 1);
+  if (body.back() != ';' && body.back() != '}')
+    body = "print(" + body + ");";
+  std::string name = "__repl" + std::to_string(++*numStatements);
+  if (!session.Extend(program, "int " + name + "() {\n" + body + "\n}",
+                      std::cerr))
+    return;
+  int (*statements)() = program.Lookup<int()>(name);
+  statements();
+  std::fflush(stdout);
+}
+
+} // namespace
+
+int RunRepl(SessionOptions options) {
+  options.reloadable = true;
+  std::unique_ptr<Session> session = Session::Create(options, std::cerr);
+  if (!session)
+    return 1;
+  std::unique_ptr<CompiledProgram> program = session->CreateProgram(std::cerr);
+  if (!program)
+    return 1;
+
+  // Prompts are only shown to a user at a terminal, not when entries come
+  // from a file.
+  bool interactive = isatty(STDIN_FILENO);
+  std::string entry;
+  int depth = 0;
+  unsigned numStatements = 0;
+  for (;;) {
+    if (interactive)
+      std::cout << (entry.empty() ? "> " : "... ") << std::flush;
+    std::string line;
+    if (!std::getline(std::cin, line))
+      break;
+    entry += line + '\n';
+    depth += std::count(line.begin(), line.end(), '{') -
+             std::count(line.begin(), line.end(), '}');
+    if (depth > 0)
+      continue;
+    if (entry.find_first_not_of(" \t\r\n") != std::string::npos)
+      run(*session, *program, entry, &numStatements);
+    entry.clear();
+    depth = 0;
+  }
+  if (interactive)
+    std::cout << '\n';
+  return 0;
+}
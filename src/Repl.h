@@ -0,0 +1,23 @@
+#pragma once
+
+struct SessionOptions;
+
+// The REPL (--repl), for trying out functions without writing a file and
+// compiling it as a whole for each change.  Entries are read from stdin, up
+// to a line that closes all of their braces:
+//
+//   > int square(int x) { return x * x; }
+//   > square(12)
+//   144
+//   > for (int i = 0; i < 3; i = i + 1) print(square(i));
+//
+// Function definitions are added to a program in a reloadable session (see
+// Session.h), which only compiles the new ones and keeps the code of the
+// others.  A definition with the signature of an earlier one replaces it,
+// for it and the functions that call it.  Statements are compiled into a
+// function of their own and run right away, so their variables are gone
+// afterwards.  An expression without a semicolon is printed.
+
+// Run the REPL until the end of stdin.  Errors are reported to stderr, after
+// which the REPL goes on with the next entry.
+int RunRepl(SessionOptions options);
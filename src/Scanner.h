@@ -2,6 +2,7 @@
 #include <cctype>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <utility>
 
 class Scanner {
@@ -103,6 +104,8 @@ public:
     case ';':
       return makeToken(TokenType::kTokenSemicolon, ";", token_line,
                        token_column);
+    case '"':
+      return stringLiteral(token_line, token_column);
 
     default:
       return unknownCharacter(c, token_line, token_column);
@@ -110,7 +113,7 @@ public:
   }
 
 private:
-  std::string source;
+  std::string_view source;
   size_t current;
   int line;
   int column;
@@ -155,7 +158,7 @@ private:
     while (isAlpha(peek()) || isDigit(peek()))
       advance();
 
-    std::string lexeme = source.substr(start, current - start);
+    std::string lexeme(source.substr(start, current - start));
 
     // Keyword check
     if (lexeme == "float")
@@ -181,6 +184,9 @@ private:
                        tokenColumn);
     else if (lexeme == "for")
       return makeToken(TokenType::kTokenFor, lexeme, tokenLine, tokenColumn);
+    else if (lexeme == "import")
+      return makeToken(TokenType::kTokenImport, lexeme, tokenLine,
+                       tokenColumn);
 
     return makeToken(TokenType::kTokenId, lexeme, tokenLine, tokenColumn);
   }
@@ -204,7 +210,7 @@ private:
         advance();
     }
 
-    std::string value = source.substr(start, current - start);
+    std::string value(source.substr(start, current - start));
 
     TokenType type = value.find('.') != std::string::npos
                          ? TokenType::kTokenFPNum
@@ -212,6 +218,18 @@ private:
     return makeToken(type, value, tokenLine, tokenColumn);
   }
 
+  // A string literal ends on the same line; there are no escapes.
+  Token stringLiteral(int tokenLine, int tokenColumn) {
+    size_t start = current;
+    while (!isAtEnd() && peek() != '"' && peek() != '\n')
+      advance();
+    if (peek() != '"')
+      return unknownCharacter('"', tokenLine, tokenColumn);
+    std::string value(source.substr(start, current - start));
+    advance(); // consume '"'
+    return makeToken(TokenType::kTokenStrLit, value, tokenLine, tokenColumn);
+  }
+
   Token makeToken(TokenType type, const std::string &value, int line,
                   int column) {
     if (type == TokenType::kTokenIntNum) {
@@ -220,6 +238,8 @@ private:
       return Token(std::stof(value), line, column);
     } else if (type == TokenType::kTokenId) {
       return Token(value, line, column);
+    } else if (type == TokenType::kTokenStrLit) {
+      return Token(type, value, line, column);
     } else {
       return Token(type, line, column);
     }
@@ -0,0 +1,424 @@
+#include "Server.h"
+#include "ServerProtocol.h"
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+// A request from a client.
+struct Request {
+  // The client's stdin, stdout and stderr.
+  int fds[3] = {-1, -1, -1};
+  std::string directory;
+  std::vector<std::string> arguments;
+  std::vector<std::string> environment;
+};
+
+// Set by SIGINT and SIGTERM in the server.
+volatile sig_atomic_t stopping = 0;
+
+// The process of a worker that waits for the next request or runs it.
+volatile pid_t requestProcess = 0;
+
+// A pipe that SIGCHLD writes to in a worker, so that the worker can wait for
+// the process of a request and for its client at the same time.
+int childExited[2] = {-1, -1};
+
+void stop(int) { stopping = 1; }
+
+// Requests that are still running are killed with their worker.
+void stopWorker(int) {
+  if (requestProcess > 0)
+    kill(requestProcess, SIGKILL);
+  _exit(0);
+}
+
+void blockStop(bool block) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &signals, nullptr);
+}
+
+void notifyChildExited(int) {
+  int savedErrno = errno;
+  char byte = 0;
+  (void)!write(childExited[1], &byte, 1);
+  errno = savedErrno;
+}
+
+// Install a signal handler that doesn't restart the system calls it
+// interrupts.
+void setSignalHandler(int signal, void (*handler)(int)) {
+  struct sigaction action = {};
+  action.sa_handler = handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(signal, &action, nullptr);
+}
+
+void setFlags(int fd, int fdFlags, int statusFlags) {
+  fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | fdFlags);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | statusFlags);
+}
+
+void printError(const char *what, const std::string &path) {
+  llvm::errs() << "Error: " << what << " " << path << ": " << strerror(errno)
+               << "\n";
+}
+
+// Receive up to size bytes, with up to maxFds descriptors, which are made
+// close-on-exec.  Descriptors beyond those are closed.  Returns the number
+// of bytes received, which is 0 at the end of the stream, or -1 on errors.
+ssize_t receiveWithFds(int socket, void *data, size_t size, int *fds,
+                       int maxFds, int *numFds) {
+  union {
+    cmsghdr align;
+    char buffer[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  iovec vector = {data, size};
+  msghdr message = {};
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  ssize_t count;
+  do {
+    count = recvmsg(socket, &message, 0);
+  } while (count < 0 && errno == EINTR);
+  if (count < 0)
+    return -1;
+
+  *numFds = 0;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t numReceived = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < numReceived; ++i) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      if (*numFds < maxFds) {
+        fds[(*numFds)++] = fd;
+        setFlags(fd, FD_CLOEXEC, 0);
+      } else {
+        close(fd);
+      }
+    }
+  }
+  return count;
+}
+
+// Send a descriptor with a byte of data.
+bool sendFd(int socket, int fd) {
+  union {
+    cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  char byte = 0;
+  iovec vector = {&byte, 1};
+  msghdr message = {};
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  ssize_t count;
+  do {
+    count = sendmsg(socket, &message, 0);
+  } while (count < 0 && errno == EINTR);
+  return count == 1;
+}
+
+void closeFds(Request *request) {
+  for (int &fd : request->fds) {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+}
+
+// Receive a request.  Returns false if the client went away or doesn't
+// follow the protocol.
+bool receiveRequest(int connection, Request *request) {
+  RequestHeader header;
+  int numFds;
+  ssize_t count = receiveWithFds(connection, &header, sizeof(header),
+                                 request->fds, 3, &numFds);
+  // The descriptors come with the first part of the header, which may be
+  // all of it.
+  if (count <= 0 ||
+      !ReadAll(connection, reinterpret_cast<char *>(&header) + count,
+               sizeof(header) - count))
+    return false;
+  if (numFds != 3 || header.magic != kRequestMagic || header.size == 0 ||
+      header.size > kMaxRequestSize || header.numArguments == 0)
+    return false;
+  std::string strings(header.size, '\0');
+  if (!ReadAll(connection, &strings[0], strings.size()) ||
+      strings.back() != '\0')
+    return false;
+
+  std::vector<std::string> parts;
+  for (size_t start = 0; start < strings.size();) {
+    size_t end = strings.find('\0', start);
+    parts.emplace_back(strings, start, end - start);
+    start = end + 1;
+  }
+  if (parts.size() !=
+      size_t(1) + header.numArguments + header.numEnvironment)
+    return false;
+  auto arguments = parts.begin() + 1;
+  auto environment = arguments + header.numArguments;
+  request->directory = parts[0];
+  request->arguments.assign(arguments, environment);
+  request->environment.assign(environment, parts.end());
+  return true;
+}
+
+void setEnvironment(const std::vector<std::string> &environment) {
+  std::vector<std::string> names;
+  for (char **variable = environ; *variable; ++variable)
+    names.emplace_back(*variable, strcspn(*variable, "="));
+  for (const std::string &name : names)
+    unsetenv(name.c_str());
+  for (const std::string &variable : environment) {
+    size_t equals = variable.find('=');
+    if (equals != std::string::npos && equals > 0)
+      setenv(variable.substr(0, equals).c_str(), variable.c_str() + equals + 1,
+             1);
+  }
+}
+
+// Wait for the next request in a process forked from the worker, hand its
+// connection to the worker, and make the process look like it was started
+// by the client.  Returns the arguments of the request.
+std::vector<std::string> acceptRequest(int listener, int channel,
+                                       const std::string &path) {
+  close(childExited[0]);
+  close(childExited[1]);
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGPIPE, SIG_DFL);
+  setSignalHandler(SIGTERM, SIG_DFL);
+  blockStop(false);
+
+  int connection;
+  while ((connection = accept(listener, nullptr, nullptr)) < 0) {
+    if (errno != EINTR && errno != ECONNABORTED) {
+      printError("Could not accept a connection on", path);
+      std::exit(1);
+    }
+  }
+  close(listener);
+  // The connection is handed over once the request has been read, after
+  // which it only becomes readable when the client goes away.
+  Request request;
+  bool received = receiveRequest(connection, &request);
+  sendFd(channel, connection);
+  close(channel);
+  close(connection);
+  if (!received)
+    std::exit(1);
+  for (int fd = 0; fd < 3; ++fd)
+    dup2(request.fds[fd], fd);
+  closeFds(&request);
+  setEnvironment(request.environment);
+  if (chdir(request.directory.c_str()) != 0) {
+    printError("Could not change to directory", request.directory);
+    std::exit(1);
+  }
+  return std::move(request.arguments);
+}
+
+// Wait for the process of a request to exit, and kill it if its client goes
+// away first.  Returns the exit status to report to the client.
+int32_t waitForRequest(pid_t pid, int connection) {
+  pollfd fds[2] = {{childExited[0], POLLIN, 0}, {connection, POLLIN, 0}};
+  for (;;) {
+    int status;
+    pid_t exited = waitpid(pid, &status, WNOHANG);
+    if (exited == pid)
+      return WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                 : WEXITSTATUS(status);
+    if (exited < 0 && errno != EINTR)
+      return 1;
+    // SIGCHLD interrupts the wait as well as writing to the pipe.
+    if (poll(fds, 2, -1) < 0)
+      continue;
+    if (fds[0].revents) {
+      char buffer[64];
+      while (read(childExited[0], buffer, sizeof(buffer)) > 0) {
+      }
+    }
+    // The client sends nothing after the request, so the connection only
+    // becomes readable when the client closes it.
+    if (fds[1].revents) {
+      kill(pid, SIGKILL);
+      fds[1].fd = -1;
+    }
+  }
+}
+
+// Run requests one at a time, each in a process forked from the worker,
+// and report their exit status.  The process is forked before its request
+// arrives and accepts the connection itself, so that forking doesn't add
+// to the latency of requests.  Returns only in that process, with the
+// arguments of its request.
+std::vector<std::string> serve(int listener, const std::string &path) {
+  setSignalHandler(SIGINT, SIG_DFL);
+  setSignalHandler(SIGTERM, stopWorker);
+  // The worker outlives clients that go away before their reply.
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe(childExited) != 0) {
+    printError("Could not create a pipe for", path);
+    std::exit(1);
+  }
+  setFlags(childExited[0], FD_CLOEXEC, O_NONBLOCK);
+  setFlags(childExited[1], FD_CLOEXEC, O_NONBLOCK);
+  setSignalHandler(SIGCHLD, notifyChildExited);
+
+  for (;;) {
+    // The process hands the connection that it accepts to the worker.
+    int channel[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel) != 0) {
+      printError("Could not create a socket pair for", path);
+      std::exit(1);
+    }
+    // The worker mustn't stop before it knows the process, which would be
+    // left behind.
+    blockStop(true);
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(channel[0]);
+      return acceptRequest(listener, channel[1], path);
+    }
+    close(channel[1]);
+    if (pid < 0) {
+      printError("Could not fork a request on", path);
+      std::exit(1);
+    }
+    requestProcess = pid;
+    blockStop(false);
+
+    char byte;
+    int connection = -1;
+    int numFds;
+    if (receiveWithFds(channel[0], &byte, 1, &connection, 1, &numFds) <= 0 ||
+        numFds == 0)
+      connection = -1;
+    close(channel[0]);
+    int32_t status = waitForRequest(pid, connection);
+    requestProcess = 0;
+    if (connection >= 0) {
+      WriteAll(connection, reinterpret_cast<const char *>(&status),
+               sizeof(status));
+      close(connection);
+    }
+  }
+}
+
+// Listen on a Unix domain socket at the given path.  A socket that was left
+// by a server that didn't stop cleanly is replaced, but not one that a
+// server still listens on.  Exits on failure.
+int listenOn(const std::string &path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    llvm::errs() << "Error: Socket path is too long: " << path << "\n";
+    std::exit(1);
+  }
+  memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  auto *genericAddress = reinterpret_cast<sockaddr *>(&address);
+
+  struct stat status;
+  if (stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = probe >= 0 &&
+                connect(probe, genericAddress, sizeof(address)) == 0;
+    if (probe >= 0)
+      close(probe);
+    if (live) {
+      llvm::errs() << "Error: A server is already listening on " << path
+                   << "\n";
+      std::exit(1);
+    }
+    unlink(path.c_str());
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 ||
+      bind(listener, genericAddress, sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    printError("Could not listen on", path);
+    std::exit(1);
+  }
+  setFlags(listener, FD_CLOEXEC, 0);
+  return listener;
+}
+
+} // namespace
+
+std::vector<std::string> RunServer(const std::string &path, unsigned workers) {
+  if (workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? cpus : 1;
+  }
+  // The descriptors of a request are moved to 0, 1 and 2, so those mustn't
+  // be taken by anything else.
+  for (int fd = 0; fd < 3; ++fd) {
+    if (fcntl(fd, F_GETFD) < 0)
+      open("/dev/null", O_RDWR);
+  }
+  int listener = listenOn(path);
+  setSignalHandler(SIGINT, stop);
+  setSignalHandler(SIGTERM, stop);
+
+  // Replace workers that exit, which they only do on errors.
+  std::set<pid_t> pool;
+  while (!stopping) {
+    while (pool.size() < workers && !stopping) {
+      pid_t pid = fork();
+      if (pid == 0)
+        return serve(listener, path);
+      if (pid < 0) {
+        printError("Could not fork a worker for", path);
+        stopping = 1;
+        break;
+      }
+      pool.insert(pid);
+    }
+    if (stopping)
+      break;
+    pid_t pid = wait(nullptr);
+    if (pid > 0)
+      pool.erase(pid);
+  }
+
+  for (pid_t pid : pool)
+    kill(pid, SIGTERM);
+  while (wait(nullptr) > 0 || errno == EINTR) {
+  }
+  close(listener);
+  unlink(path.c_str());
+  std::exit(0);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// The compile server (--server), which saves CI jobs that compile many small
+// programs the startup of a process for each: loading LLVM, initializing
+// the targets, parsing the builtins and creating an LLVMContext.  Requests
+// come from mojc, which takes the same arguments as moj (see
+// ServerProtocol.h).
+//
+// The server does that work once and then forks a pool of workers, which
+// run requests from a Unix domain socket, one at a time each.  Every
+// request runs in a copy of its warm worker that nothing else shares, so it
+// may crash, exit or leak memory without affecting the next one.  The
+// worker forks the copy ahead of time, and the copy accepts the next
+// connection itself, takes the client's working directory, environment,
+// stdin, stdout and stderr and then compiles as moj would, with the
+// request's arguments.  The worker waits for its exit status and reports it
+// to the client.  A request is killed when its client goes away.  The
+// server stops on SIGINT or SIGTERM, and kills the requests that are still
+// running.
+
+// Serve requests on the socket at the given path with the given number of
+// workers, or one per CPU if it's zero.  Returns only in the process forked
+// for a request, with its arguments, after switching to the client's
+// working directory, environment and standard streams.  The server itself
+// exits when it stops or can't start.
+std::vector<std::string> RunServer(const std::string &path, unsigned workers);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <unistd.h>
+
+// The protocol between the compile server (see Server.h) and its client,
+// mojc, over a Unix domain socket.  It doesn't depend on LLVM, so that the
+// client stays small and starts quickly.
+//
+// A request starts with a RequestHeader, which carries the client's stdin,
+// stdout and stderr as SCM_RIGHTS ancillary data.  It's followed by `size`
+// bytes of strings, each terminated by a NUL: the working directory, then
+// `numArguments` arguments, starting with the program name, then
+// `numEnvironment` environment variables.  Once the request has finished,
+// the server replies with its exit status as an int32_t and closes the
+// connection.  A status of 128 + N means that the request was killed by
+// signal N, like in a shell.
+
+const uint32_t kRequestMagic = 0x316a6f6d; // "moj1"
+
+// Requests over this size are refused.
+const uint32_t kMaxRequestSize = 16 * 1024 * 1024;
+
+struct RequestHeader {
+  uint32_t magic;
+  uint32_t size;
+  uint32_t numArguments;
+  uint32_t numEnvironment;
+};
+
+// Read exactly size bytes, retrying after signals.  Returns false on errors
+// and at the end of the stream.
+inline bool ReadAll(int fd, char *data, size_t size) {
+  while (size > 0) {
+    ssize_t count = read(fd, data, size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    data += count;
+    size -= count;
+  }
+  return true;
+}
+
+// Write all size bytes, retrying after signals.  Returns false on errors.
+inline bool WriteAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t count = write(fd, data, size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    data += count;
+    size -= count;
+  }
+  return true;
+}
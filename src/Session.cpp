@@ -0,0 +1,439 @@
+#include "Session.h"
+#include "Builtins.h"
+#include "FuncDef.h"
+#include "Jit.h"
+#include "Mir.h"
+#include "MirPasses.h"
+#include "Optimize.h"
+#include "Parser.h"
+#include "TokenStream.h"
+#include "Typechecker.h"
+
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <ostream>
+#include <set>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace {
+
+// Print an error of the JIT, returning true if there was one.
+bool reportError(Error error, std::ostream &errors) {
+  if (!error)
+    return false;
+  errors << "JIT error: " << toString(std::move(error)) << '\n';
+  return true;
+}
+
+} // namespace
+
+std::unique_ptr<Session> Session::Create(const SessionOptions &options,
+                                         std::ostream &diagnostics) {
+  // Registering the targets isn't thread-safe.
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+  });
+
+  std::unique_ptr<Session> session(new Session(options, diagnostics));
+  Expected<JITTargetMachineBuilder> machineBuilder =
+      CreateMachineBuilder(GetTargetOptions(options.codegenOptions));
+  if (!machineBuilder) {
+    reportError(machineBuilder.takeError(), diagnostics);
+    return nullptr;
+  }
+  Expected<std::unique_ptr<TargetMachine>> targetMachine =
+      machineBuilder->createTargetMachine();
+  if (!targetMachine) {
+    reportError(targetMachine.takeError(), diagnostics);
+    return nullptr;
+  }
+  session->m_targetMachine = std::move(*targetMachine);
+  Expected<std::unique_ptr<LLJIT>> jit =
+      LLJITBuilder().setJITTargetMachineBuilder(*machineBuilder).create();
+  if (!jit) {
+    reportError(jit.takeError(), diagnostics);
+    return nullptr;
+  }
+  session->m_jit = std::move(*jit);
+  if (reportError(AddProcessSymbols(*session->m_jit), diagnostics))
+    return nullptr;
+  return session;
+}
+
+Session::Session(const SessionOptions &options, std::ostream &diagnostics)
+    : m_options(options), m_diagnostics(diagnostics), m_program(new Program) {
+  TokenStream tokens(GetBuiltins());
+  int status = ParseProgram(tokens, m_program.get(), m_diagnostics);
+  if (status == 0)
+    status = Typecheck(*m_program, m_diagnostics);
+  assert(status == 0);
+  (void)status;
+}
+
+Session::~Session() = default;
+
+std::unique_ptr<CompiledProgram> Session::Compile(const std::string &source,
+                                                  std::ostream &errors) {
+  // The functions of the program are removed afterwards, so that the next
+  // one starts with the builtins only.  A reloadable program keeps them.
+  std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<FuncDefPtr> &functions = m_program->GetFunctions();
+  size_t numBuiltins = functions.size();
+  std::unique_ptr<CompiledProgram> program =
+      compile(source.c_str(), numBuiltins, errors);
+  if (program && m_options.reloadable)
+    std::move(functions.begin() + numBuiltins, functions.end(),
+              std::back_inserter(program->m_definitions));
+  functions.erase(functions.begin() + numBuiltins, functions.end());
+  return program;
+}
+
+std::unique_ptr<CompiledProgram>
+Session::CreateProgram(std::ostream &errors) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_options.reloadable) {
+    errors << "Error: the session doesn't compile reloadable functions\n";
+    return nullptr;
+  }
+  JITDylib *library = createLibrary(errors);
+  if (!library)
+    return nullptr;
+  return std::unique_ptr<CompiledProgram>(
+      new CompiledProgram(this, library, CompiledProgram::FunctionTable()));
+}
+
+bool Session::Reload(CompiledProgram &program, const std::string &source,
+                     std::ostream &errors) {
+  return update(program, source, false, errors);
+}
+
+bool Session::Extend(CompiledProgram &program, const std::string &source,
+                     std::ostream &errors) {
+  return update(program, source, true, errors);
+}
+
+bool Session::update(CompiledProgram &program, const std::string &source,
+                     bool add, std::ostream &errors) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_options.reloadable) {
+    errors << "Error: the session doesn't compile reloadable functions\n";
+    return false;
+  }
+  Program newProgram;
+  TokenStream tokens(source.c_str());
+  if (ParseProgram(tokens, &newProgram, errors) != 0)
+    return false;
+
+  // Find the function that each definition replaces.  The ones that replace
+  // none go after the functions of the program.
+  std::vector<FuncDefPtr> &definitions = program.m_definitions;
+  std::vector<FuncDefPtr> &newDefinitions = newProgram.GetFunctions();
+  size_t numDefinitions = definitions.size();
+  size_t numAdded = 0;
+  std::vector<size_t> positions;
+  std::set<std::string> signatures;
+  for (const FuncDefPtr &funcDef : newDefinitions) {
+    std::string signature = GetSignature(*funcDef);
+    if (!signatures.insert(signature).second) {
+      errors << "Error: " << signature << " is defined more than once\n";
+      return false;
+    }
+    auto end = definitions.begin() + numDefinitions;
+    auto it = std::find_if(definitions.begin(), end,
+                           [&signature](const FuncDefPtr &definition) {
+                             return GetSignature(*definition) == signature;
+                           });
+    if (it == end && !add) {
+      errors << "Error: the program has no function " << signature << '\n';
+      return false;
+    }
+    if (it == end) {
+      positions.push_back(numDefinitions + numAdded++);
+      continue;
+    }
+    if ((*it)->getReturnType() != funcDef->getReturnType()) {
+      errors << "Error: " << signature << " has to return "
+             << toString((*it)->getReturnType()) << '\n';
+      return false;
+    }
+    positions.push_back(it - definitions.begin());
+  }
+
+  // The new definitions trade places with the old ones, which are put back
+  // if they can't be compiled.
+  definitions.resize(numDefinitions + numAdded);
+  for (size_t i = 0; i < positions.size(); ++i)
+    std::swap(definitions[positions[i]], newDefinitions[i]);
+  std::vector<FuncDefPtr> &functions = m_program->GetFunctions();
+  size_t numBuiltins = functions.size();
+  std::move(definitions.begin(), definitions.end(),
+            std::back_inserter(functions));
+  bool loaded = load(program, positions, numBuiltins, errors);
+  std::move(functions.begin() + numBuiltins, functions.end(),
+            definitions.begin());
+  functions.erase(functions.begin() + numBuiltins, functions.end());
+  if (!loaded) {
+    for (size_t i = 0; i < positions.size(); ++i)
+      std::swap(definitions[positions[i]], newDefinitions[i]);
+    definitions.resize(numDefinitions);
+  }
+  return loaded;
+}
+std::unique_ptr<Module> Session::generate(LLVMContext *context) {
+  const CodegenOptions &codegenOptions = m_options.codegenOptions;
+  std::unique_ptr<Module> module;
+  if (m_options.useMir) {
+    mir::ModulePtr mirModule = mir::LowerProgram(*m_program, codegenOptions);
+    mir::PassManager passManager;
+    mir::AddDefaultPasses(&passManager, codegenOptions);
+    passManager.Run(mirModule.get());
+    module = Codegen(context, *m_program, *mirModule, codegenOptions);
+  } else {
+    module = Codegen(context, *m_program, codegenOptions);
+  }
+  assert(!verifyModule(*module, &errs()));
+  module->setTargetTriple(m_targetMachine->getTargetTriple().str());
+  module->setDataLayout(m_targetMachine->createDataLayout());
+  return module;
+}
+
+std::unique_ptr<CompiledProgram>
+Session::compile(const char *source, size_t numBuiltins,
+                 std::ostream &errors) {
+  TokenStream tokens(source);
+  if (ParseProgram(tokens, m_program.get(), errors) != 0 ||
+      Typecheck(*m_program, errors) != 0)
+    return nullptr;
+
+  auto context = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> module = generate(context.get());
+
+  // The functions of the program keep their symbols, for the host to look
+  // up, instead of being inlined into their callers and removed, and the
+  // host calls them through C function pointers.
+  struct Symbol {
+    std::string signature;
+    ::Type resultType;
+    std::string name;
+  };
+  std::vector<Symbol> symbols;
+  const std::vector<FuncDefPtr> &functions = m_program->GetFunctions();
+  for (size_t i = numBuiltins; i < functions.size(); ++i) {
+    const FuncDef &funcDef = *functions[i];
+    Function *function = FindFunction(*module, funcDef);
+    if (!function)
+      continue;
+    function->setLinkage(GlobalValue::ExternalLinkage);
+    UseCCallingConvention(function);
+    std::string name = function->getName().str();
+    if (m_options.reloadable)
+      AddCallStub(function, name + "$0", name + "$code");
+    symbols.push_back({GetSignature(funcDef), funcDef.getReturnType(), name});
+  }
+
+  Optimize(module.get(), m_options.optLevel, m_targetMachine.get());
+
+  // Each program has a JITDylib of its own.
+  JITDylib *library = createLibrary(errors);
+  if (!library)
+    return nullptr;
+  Error error = m_jit->addIRModule(
+      *library, ThreadSafeModule(std::move(module), std::move(context)));
+  if (!error)
+    error = m_jit->initialize(*library);
+
+  // The first lookup compiles the program, so its errors are reported here,
+  // and Lookup only has to search the table.
+  CompiledProgram::FunctionTable table;
+  for (const Symbol &symbol : symbols) {
+    if (error)
+      break;
+    CompiledProgram::Function &function = table[symbol.signature];
+    function = {symbol.resultType, nullptr, symbol.name, nullptr};
+    error = lookupFunction(*library, symbol.name, &function.address,
+                           &function.code);
+  }
+  if (reportError(std::move(error), errors)) {
+    remove(library);
+    return nullptr;
+  }
+  return std::unique_ptr<CompiledProgram>(
+      new CompiledProgram(this, library, std::move(table)));
+}
+
+bool Session::load(CompiledProgram &program,
+                   const std::vector<size_t> &positions, size_t numBuiltins,
+                   std::ostream &errors) {
+  if (Typecheck(*m_program, errors) != 0)
+    return false;
+  auto context = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> module = generate(context.get());
+
+  // The module keeps the new code only.  The code of a function that is
+  // replaced gets a name of its own, and its calls of the functions of the
+  // program go to their stubs, like all the others.
+  std::string suffix = "$" + std::to_string(++program.m_numReloads);
+  std::vector<std::pair<Function *, std::string>> stubs;
+  std::vector<std::pair<CompiledProgram::Function *, std::string>> code;
+  struct Added {
+    Function *function;
+    std::string signature;
+    CompiledProgram::Function entry;
+  };
+  std::vector<Added> added;
+  const std::vector<FuncDefPtr> &functions = m_program->GetFunctions();
+  for (size_t i = numBuiltins; i < functions.size(); ++i) {
+    const FuncDef &funcDef = *functions[i];
+    Function *function = FindFunction(*module, funcDef);
+    if (!function)
+      continue;
+    UseCCallingConvention(function);
+    bool isNew = std::find(positions.begin(), positions.end(),
+                           i - numBuiltins) != positions.end();
+    std::string signature = GetSignature(funcDef);
+    auto it = program.m_functions.find(signature);
+    if (it == program.m_functions.end()) {
+      // The name of a function that is added is only kept if it's free.
+      added.push_back({function, signature,
+                       {funcDef.getReturnType(), nullptr,
+                        function->getName().str(), nullptr}});
+      function->setName("");
+      continue;
+    }
+    // The stub is called like the function, but it may jump to code that
+    // isn't pure, so calls of it can't be dropped or moved.
+    Function *stub = Function::Create(function->getFunctionType(),
+                                      GlobalValue::ExternalLinkage, "",
+                                      module.get());
+    stub->copyAttributesFrom(function);
+    function->replaceAllUsesWith(stub);
+    DropPureAttributes(stub);
+    stubs.push_back({stub, it->second.symbol});
+    if (!isNew) {
+      function->eraseFromParent();
+      continue;
+    }
+    function->setName(it->second.symbol + suffix);
+    function->setLinkage(GlobalValue::ExternalLinkage);
+    code.push_back({&it->second, function->getName().str()});
+  }
+  for (auto &[stub, symbol] : stubs) {
+    stub->setName(symbol);
+    assert(stub->getName() == symbol);
+  }
+  std::set<std::string> symbols;
+  for (const auto &function : program.m_functions)
+    symbols.insert(function.second.symbol);
+  for (Added &function : added) {
+    std::string &symbol = function.entry.symbol;
+    std::string name = symbol;
+    for (unsigned n = 1; symbols.count(symbol) || module->getNamedValue(symbol);
+         ++n)
+      symbol = name + "." + std::to_string(n);
+    symbols.insert(symbol);
+    function.function->setName(symbol);
+    function.function->setLinkage(GlobalValue::ExternalLinkage);
+    AddCallStub(function.function, symbol + "$0", symbol + "$code");
+  }
+  Optimize(module.get(), m_options.optLevel, m_targetMachine.get());
+
+  // All of the new code is loaded before the first stub jumps to it.
+  Error error = m_jit->addIRModule(
+      *program.m_library,
+      ThreadSafeModule(std::move(module), std::move(context)));
+  std::vector<void *> addresses;
+  for (const auto &function : code) {
+    if (error)
+      break;
+    Expected<ExecutorAddr> address =
+        m_jit->lookup(*program.m_library, function.second);
+    if (!address) {
+      error = address.takeError();
+      break;
+    }
+    addresses.push_back(address->toPtr<void *>());
+  }
+  for (Added &function : added) {
+    if (error)
+      break;
+    error = lookupFunction(*program.m_library, function.entry.symbol,
+                           &function.entry.address, &function.entry.code);
+  }
+  if (reportError(std::move(error), errors))
+    return false;
+  for (size_t i = 0; i < code.size(); ++i)
+    code[i].first->code->store(addresses[i], std::memory_order_release);
+  for (Added &function : added)
+    program.m_functions[function.signature] = function.entry;
+  return true;
+}
+
+Error Session::lookupFunction(JITDylib &library, const std::string &symbol,
+                              void **address, std::atomic<void *> **code) {
+  Expected<ExecutorAddr> stub = m_jit->lookup(library, symbol);
+  if (!stub)
+    return stub.takeError();
+  *address = stub->toPtr<void *>();
+  if (!m_options.reloadable)
+    return Error::success();
+  Expected<ExecutorAddr> pointer = m_jit->lookup(library, symbol + "$code");
+  if (!pointer)
+    return pointer.takeError();
+  *code = pointer->toPtr<std::atomic<void *> *>();
+  return Error::success();
+}
+
+// Create the JITDylib of a program, which finds printf and the like through
+// the main one.
+JITDylib *Session::createLibrary(std::ostream &errors) {
+  Expected<JITDylib &> library = m_jit->getExecutionSession().createJITDylib(
+      "program" + std::to_string(m_numPrograms++));
+  if (!library) {
+    reportError(library.takeError(), errors);
+    return nullptr;
+  }
+  library->addToLinkOrder(m_jit->getMainJITDylib());
+  return &*library;
+}
+
+// Run the destructors of the program, then free its code.
+void Session::remove(JITDylib *library) {
+  reportError(m_jit->deinitialize(*library), m_diagnostics);
+  reportError(m_jit->getExecutionSession().removeJITDylib(*library),
+              m_diagnostics);
+}
+
+CompiledProgram::CompiledProgram(Session *session, JITDylib *library,
+                                 FunctionTable functions)
+    : m_session(session), m_library(library),
+      m_functions(std::move(functions)) {}
+
+CompiledProgram::~CompiledProgram() {
+  std::lock_guard<std::mutex> lock(m_session->m_mutex);
+  m_session->remove(m_library);
+}
+
+void *
+CompiledProgram::lookupAddress(const std::string &name, ::Type resultType,
+                               const std::vector<::Type> &paramTypes) const {
+  auto it = m_functions.find(GetSignature(name, paramTypes));
+  if (it == m_functions.end() || it->second.resultType != resultType)
+    return nullptr;
+  return it->second.address;
+}
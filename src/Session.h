@@ -0,0 +1,241 @@
+#pragma once
+
+#include "Codegen.h"
+#include "Program.h"
+#include "Type.h"
+
+#include <atomic>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class Error;
+class LLVMContext;
+class Module;
+class TargetMachine;
+namespace orc {
+class JITDylib;
+class LLJIT;
+} // namespace orc
+} // namespace llvm
+
+// The compiler as a library (libmoj), for a host program that compiles
+// programs at runtime and calls their functions in its own process, at
+// native speed:
+//
+//   std::unique_ptr<Session> session = Session::Create(SessionOptions(),
+//                                                      std::cerr);
+//   std::unique_ptr<CompiledProgram> program =
+//       session->Compile("int square(int x) { return x * x; }", std::cerr);
+//   int (*square)(int) = program->Lookup<int(int)>("square");
+//   int y = square(7);
+//
+// A session parses the builtins and creates a JIT once, for all the
+// programs it compiles.  Each program is optimized as a whole and loaded
+// into a JITDylib of its own, so programs may define functions with the
+// same names.  Its machine code lives until the CompiledProgram is
+// destroyed, which has to happen before the session is.
+//
+// Sessions share no state, so any number of them may compile programs and
+// run their functions on different threads at the same time.  A session may
+// be used by several threads as well: it compiles one program at a time,
+// and the functions of its programs may be called from any thread.
+//
+// The functions of a program can be replaced while it runs, if the session
+// makes them reloadable:
+//
+//   session->Reload(*program, "int square(int x) { return x * x + 0; }",
+//                   std::cerr);
+//
+// Every call of a reloadable function, from the host or from the program,
+// goes through a stub that jumps to its current code.  Reload compiles the
+// new definitions and repoints the stubs, so the calls that start afterwards
+// run the new code, while the calls in progress finish in the old one.
+// Extend adds functions to a program in the same way, which lets a program
+// grow one function at a time, like in the REPL (see Repl.h).
+
+class CompiledProgram;
+
+// How a session compiles programs.
+struct SessionOptions {
+  // Optimization level (0 - 3).
+  int optLevel = 2;
+
+  // Generate code through MIR (see Mir.h).
+  bool useMir = false;
+
+  CodegenOptions codegenOptions;
+
+  // Give the functions of the programs stubs, so that Reload can replace
+  // them.  Calls between the functions of a program can't be inlined then.
+  bool reloadable = false;
+};
+
+class Session {
+public:
+  // Create a session for the host, or return null, with an error message,
+  // if the JIT can't be created.  Errors that don't belong to a call of
+  // Compile, like those of freeing a program, go to the given stream, which
+  // has to outlive the session.
+  static std::unique_ptr<Session> Create(const SessionOptions &options,
+                                         std::ostream &diagnostics);
+
+  ~Session();
+
+  // Parse, typecheck and compile a program and load it into the JIT.
+  // Returns null if the program has errors, which are reported to the given
+  // stream.
+  std::unique_ptr<CompiledProgram> Compile(const std::string &source,
+                                           std::ostream &errors);
+
+  // Replace functions of a program with the definitions in the source, each
+  // of which has to have the name, parameter types and result type of a
+  // function of the program.  The new definitions may call the functions
+  // that come before the ones they replace, and the functions that aren't
+  // replaced call the new code from now on.  Returns false, leaving the
+  // program as it was, if the session isn't reloadable or the definitions
+  // have errors, which are reported to the given stream.  The old code stays
+  // loaded, for the calls that are still running it, until the program is
+  // destroyed.
+  bool Reload(CompiledProgram &program, const std::string &source,
+              std::ostream &errors);
+
+  // Add the functions in the source to a program, after its other ones.  A
+  // definition with the signature of a function of the program replaces it,
+  // as with Reload.  Lookup mustn't be called on the program at the same
+  // time.
+  bool Extend(CompiledProgram &program, const std::string &source,
+              std::ostream &errors);
+
+  // Create a program without functions, for Extend to add them to.  Returns
+  // null if the session isn't reloadable.
+  std::unique_ptr<CompiledProgram> CreateProgram(std::ostream &errors);
+
+private:
+  friend class CompiledProgram;
+
+  Session(const SessionOptions &options, std::ostream &diagnostics);
+
+  std::unique_ptr<CompiledProgram> compile(const char *source,
+                                           size_t numBuiltins,
+                                           std::ostream &errors);
+
+  // Replace or add functions of a reloadable program.
+  bool update(CompiledProgram &program, const std::string &source, bool add,
+              std::ostream &errors);
+
+  // Compile the new definitions of a program, which are among the functions
+  // after the builtins at the given positions, in place of the ones they
+  // replace.
+  bool load(CompiledProgram &program, const std::vector<size_t> &positions,
+            size_t numBuiltins, std::ostream &errors);
+
+  // Generate the code of the builtins and the functions added to them.
+  std::unique_ptr<llvm::Module> generate(llvm::LLVMContext *context);
+
+  llvm::orc::JITDylib *createLibrary(std::ostream &errors);
+
+  // Look up the stub of a function, or the function itself if the session
+  // isn't reloadable, and the pointer to its code.
+  llvm::Error lookupFunction(llvm::orc::JITDylib &library,
+                             const std::string &symbol, void **address,
+                             std::atomic<void *> **code);
+
+  // Free the code of a program.
+  void remove(llvm::orc::JITDylib *library);
+
+  SessionOptions m_options;
+  std::ostream &m_diagnostics;
+
+  // Guards everything below.  The JIT itself is thread-safe, but the
+  // builtins and the target machine are not.
+  std::mutex m_mutex;
+
+  // The builtins, to which the functions of each program are added while
+  // it's compiled.
+  ProgramPtr m_program;
+
+  std::unique_ptr<llvm::orc::LLJIT> m_jit;
+
+  // Tells the optimizer about the host.
+  std::unique_ptr<llvm::TargetMachine> m_targetMachine;
+
+  // Names the JITDylibs of the programs.
+  unsigned m_numPrograms = 0;
+};
+
+// The C++ types of the parameters and results of the functions that
+// CompiledProgram::Lookup finds.
+template <typename T> struct SessionType;
+template <> struct SessionType<int> {
+  static constexpr Type kType = kTypeInt;
+};
+template <> struct SessionType<float> {
+  static constexpr Type kType = kTypeFloat;
+};
+template <> struct SessionType<bool> {
+  static constexpr Type kType = kTypeBool;
+};
+
+// The machine code of a program that a session compiled.
+class CompiledProgram {
+public:
+  ~CompiledProgram();
+
+  CompiledProgram(const CompiledProgram &) = delete;
+  CompiledProgram &operator=(const CompiledProgram &) = delete;
+
+  // Get the function with the given name and a signature like int(int),
+  // where int, float and bool stand for the types of the language, or null
+  // if the program defines no such function.  The pointer stays valid for
+  // as long as the program.
+  template <typename Signature>
+  Signature *Lookup(const std::string &name) const {
+    return lookup<Signature>(name, static_cast<Signature *>(nullptr));
+  }
+
+private:
+  friend class Session;
+
+  // A function of the program, under its name and parameter types, e.g.
+  // "f(int,float)".
+  struct Function {
+    Type resultType;
+    void *address;
+
+    // For reloadable functions, the symbol of the stub and the pointer to the
+    // code it jumps to.
+    std::string symbol;
+    std::atomic<void *> *code;
+  };
+  using FunctionTable = std::map<std::string, Function>;
+
+  CompiledProgram(Session *session, llvm::orc::JITDylib *library,
+                  FunctionTable functions);
+
+  template <typename Signature, typename Result, typename... Params>
+  Signature *lookup(const std::string &name, Result (*)(Params...)) const {
+    return reinterpret_cast<Signature *>(
+        lookupAddress(name, SessionType<Result>::kType,
+                      {SessionType<Params>::kType...}));
+  }
+
+  void *lookupAddress(const std::string &name, Type resultType,
+                      const std::vector<Type> &paramTypes) const;
+
+  Session *m_session;
+  llvm::orc::JITDylib *m_library;
+  FunctionTable m_functions;
+
+  // The functions of a reloadable program, which the new definitions are
+  // typechecked and compiled with.
+  std::vector<FuncDefPtr> m_definitions;
+
+  // Names the code of the new definitions.
+  unsigned m_numReloads = 0;
+};
@@ -0,0 +1,569 @@
+#include "Tiering.h"
+#include "Codegen.h"
+#include "Optimize.h"
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+
+#include <algorithm>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace {
+
+// Modules of the optimized tier are named with this prefix.
+const char *const kOptimizedTierPrefix = "tier2:";
+
+// The tier 0 and tier 2 code of a function f are called f$0 and f$2, and its
+// stub f jumps through the pointer f$2$code.
+std::string GetTierName(StringRef function, int tier) {
+  return (function + "$" + Twine(tier)).str();
+}
+
+class TieredCompiler : public IRCompileLayer::IRCompiler {
+public:
+  TieredCompiler(const TargetOptions &options,
+                 std::unique_ptr<TargetMachine> quick,
+                 std::unique_ptr<TargetMachine> optimized)
+      : IRCompiler(irManglingOptionsFromTargetOptions(options)),
+        m_quick(std::move(quick)), m_optimized(std::move(optimized)) {}
+
+  // Tier 0 is only compiled before main runs and tier 2 only on the
+  // background thread, so neither target machine is shared by threads.
+  Expected<std::unique_ptr<MemoryBuffer>> operator()(Module &module) override {
+    bool optimized =
+        module.getModuleIdentifier().rfind(kOptimizedTierPrefix, 0) == 0;
+    return SimpleCompiler(optimized ? *m_optimized : *m_quick)(module);
+  }
+
+private:
+  std::unique_ptr<TargetMachine> m_quick;
+  std::unique_ptr<TargetMachine> m_optimized;
+};
+
+// Called by tier 0 code through the symbol __moj_tier_up.
+void TierUpCallback(void *tiering, unsigned index) {
+  static_cast<Tiering *>(tiering)->RequestTierUp(index);
+}
+
+// A loop header where tier 0 code can move to optimized code, with the
+// values that are live whenever the loop starts an iteration.  Both tiers
+// find them in the same unoptimized IR, so they agree on the order.
+struct OsrPoint {
+  BasicBlock *header = nullptr;
+  unsigned blockIndex = 0;
+  std::vector<Value *> liveValues;
+};
+
+// Whether the value fits into a 64 bit slot of an OSR buffer.
+bool IsTransferable(const Value *value) {
+  Type *type = value->getType();
+  if (type->isIntegerTy())
+    return type->getIntegerBitWidth() <= 64;
+  return type->isFloatingPointTy() || type->isPointerTy();
+}
+
+std::vector<OsrPoint> FindOsrPoints(Function &function) {
+  DominatorTree dominators(function);
+  LoopInfo loops(dominators);
+  std::vector<OsrPoint> points;
+  unsigned blockIndex = 0;
+  for (BasicBlock &header : function) {
+    ++blockIndex;
+    if (!loops.isLoopHeader(&header))
+      continue;
+    OsrPoint point;
+    point.header = &header;
+    point.blockIndex = blockIndex - 1;
+
+    SmallPtrSet<BasicBlock *, 32> reachable;
+    SmallVector<BasicBlock *, 32> worklist = {&header};
+    while (!worklist.empty()) {
+      BasicBlock *block = worklist.pop_back_val();
+      if (reachable.insert(block).second)
+        worklist.append(succ_begin(block), succ_end(block));
+    }
+    auto isLive = [&reachable](Value *value) {
+      return any_of(value->users(), [&reachable](User *user) {
+        return reachable.count(cast<Instruction>(user)->getParent()) != 0;
+      });
+    };
+
+    // Values defined in the loop body are dead when it starts over, so
+    // only arguments, the header's phis and the values of the blocks that
+    // dominate it can be live.
+    bool transferable = true;
+    for (Argument &argument : function.args()) {
+      if (isLive(&argument))
+        point.liveValues.push_back(&argument);
+    }
+    for (BasicBlock &block : function) {
+      if (&block != &header && !dominators.dominates(&block, &header))
+        continue;
+      for (Instruction &instruction : block) {
+        if (&block == &header && !isa<PHINode>(instruction))
+          break;
+        if (instruction.getType()->isVoidTy() || !isLive(&instruction))
+          continue;
+        transferable &= IsTransferable(&instruction);
+        point.liveValues.push_back(&instruction);
+      }
+    }
+    if (transferable)
+      points.push_back(std::move(point));
+  }
+  return points;
+}
+
+// Type of the entry at a loop header, which takes the live values in a
+// buffer of 64 bit slots.
+FunctionType *GetOsrEntryType(Function *function) {
+  return FunctionType::get(
+      function->getReturnType(),
+      {PointerType::getUnqual(Type::getInt8Ty(function->getContext()))},
+      false);
+}
+
+// Address of the slot in the OSR buffer that holds a value of the type.
+Value *GetOsrSlot(IRBuilder<> &builder, Value *buffer, unsigned index,
+                  Type *type) {
+  Type *slotType = builder.getInt64Ty();
+  Value *slots =
+      builder.CreatePointerCast(buffer, PointerType::getUnqual(slotType));
+  Value *slot = builder.CreateConstGEP1_32(slotType, slots, index);
+  return builder.CreatePointerCast(slot, PointerType::getUnqual(type));
+}
+
+// Count the calls of the function in a global, and request its tier up when
+// the count reaches the threshold.  The counter is a store, so the function
+// can't keep the attributes that say it doesn't access memory.
+void AddCallCounter(Function *function, unsigned unit, unsigned threshold,
+                    Function *tierUp, Constant *tiering) {
+  DropPureAttributes(function);
+  LLVMContext &context = function->getContext();
+  Type *counterType = Type::getInt32Ty(context);
+  auto *counter = new GlobalVariable(
+      *function->getParent(), counterType, false, GlobalValue::InternalLinkage,
+      ConstantInt::get(counterType, 0), function->getName() + "$calls");
+
+  BasicBlock *entry = &function->getEntryBlock();
+  BasicBlock::iterator position = entry->begin();
+  while (isa<AllocaInst>(*position))
+    ++position;
+  BasicBlock *body = entry->splitBasicBlock(position, "body");
+  BasicBlock *request = BasicBlock::Create(context, "tier_up", function, body);
+  entry->getTerminator()->eraseFromParent();
+
+  IRBuilder<> builder(entry);
+  Value *calls = builder.CreateAdd(builder.CreateLoad(counterType, counter),
+                                   ConstantInt::get(counterType, 1));
+  builder.CreateStore(calls, counter);
+  builder.CreateCondBr(
+      builder.CreateICmpEQ(calls, ConstantInt::get(counterType, threshold)),
+      request, body);
+
+  builder.SetInsertPoint(request);
+  builder.CreateCall(tierUp, {tiering, ConstantInt::get(counterType, unit)});
+  builder.CreateBr(body);
+}
+
+// Count the iterations of the loop in a global, request its OSR entry when
+// the count reaches the threshold, and call the entry once it's ready.  Like
+// the call counter, this takes the function's pure attributes.
+void AddOsrExit(Function *function, const OsrPoint &point,
+                const std::string &pointerName, AllocaInst *buffer,
+                unsigned unit, unsigned threshold, Function *tierUp,
+                Constant *tiering) {
+  DropPureAttributes(function);
+  Module *module = function->getParent();
+  LLVMContext &context = function->getContext();
+  Type *counterType = Type::getInt64Ty(context);
+  auto *counter = new GlobalVariable(
+      *module, counterType, false, GlobalValue::InternalLinkage,
+      ConstantInt::get(counterType, 0), pointerName + "$iterations");
+  FunctionType *entryType = GetOsrEntryType(function);
+  auto *entryPointerType = PointerType::getUnqual(entryType);
+  auto *pointer = new GlobalVariable(
+      *module, entryPointerType, false, GlobalValue::ExternalLinkage,
+      ConstantPointerNull::get(entryPointerType), pointerName);
+  pointer->setAlignment(module->getDataLayout().getPointerABIAlignment(0));
+
+  BasicBlock *header = point.header;
+  BasicBlock *body =
+      header->splitBasicBlock(header->getFirstNonPHI(), "osr.continue");
+  BasicBlock *check = BasicBlock::Create(context, "osr.check", function, body);
+  BasicBlock *request =
+      BasicBlock::Create(context, "osr.request", function, body);
+  BasicBlock *ready = BasicBlock::Create(context, "osr.ready", function, body);
+  BasicBlock *enter = BasicBlock::Create(context, "osr.enter", function, body);
+  header->getTerminator()->eraseFromParent();
+
+  IRBuilder<> builder(header);
+  Value *iterations =
+      builder.CreateAdd(builder.CreateLoad(counterType, counter),
+                        ConstantInt::get(counterType, 1));
+  builder.CreateStore(iterations, counter);
+  Constant *limit = ConstantInt::get(counterType, threshold);
+  builder.CreateCondBr(builder.CreateICmpUGE(iterations, limit), check, body);
+
+  builder.SetInsertPoint(check);
+  builder.CreateCondBr(builder.CreateICmpEQ(iterations, limit), request,
+                       ready);
+  builder.SetInsertPoint(request);
+  builder.CreateCall(tierUp, {tiering, builder.getInt32(unit)});
+  builder.CreateBr(ready);
+
+  builder.SetInsertPoint(ready);
+  LoadInst *code = builder.CreateLoad(entryPointerType, pointer, "code");
+  code->setAtomic(AtomicOrdering::Acquire);
+  builder.CreateCondBr(builder.CreateIsNull(code), body, enter);
+
+  builder.SetInsertPoint(enter);
+  for (size_t i = 0; i < point.liveValues.size(); ++i) {
+    Value *value = point.liveValues[i];
+    builder.CreateStore(value,
+                        GetOsrSlot(builder, buffer, i, value->getType()));
+  }
+  Value *result = builder.CreateCall(
+      entryType, code,
+      {builder.CreatePointerCast(buffer, entryType->getParamType(0))});
+  if (result->getType()->isVoidTy())
+    builder.CreateRetVoid();
+  else
+    builder.CreateRet(result);
+}
+
+// Create a copy of the function that starts at the loop header with the live
+// values from an OSR buffer.
+Function *CreateOsrEntry(Function *function, const OsrPoint &point,
+                         const std::string &name) {
+  LLVMContext &context = function->getContext();
+  Function *entry =
+      Function::Create(GetOsrEntryType(function), GlobalValue::ExternalLinkage,
+                       name, function->getParent());
+  BasicBlock *transfer = BasicBlock::Create(context, "osr.entry", entry);
+  IRBuilder<> builder(transfer);
+
+  ValueToValueMapTy map;
+  for (Argument &argument : function->args())
+    map[&argument] = UndefValue::get(argument.getType());
+  std::vector<std::pair<Instruction *, Value *>> transferred;
+  for (size_t i = 0; i < point.liveValues.size(); ++i) {
+    Value *live = point.liveValues[i];
+    Value *value = builder.CreateLoad(
+        live->getType(),
+        GetOsrSlot(builder, entry->getArg(0), i, live->getType()));
+    // Scalar variables are copied into a frame slot of their own, which the
+    // optimizer can promote to a register.
+    auto *variable = dyn_cast<AllocaInst>(live);
+    if (variable && !variable->isArrayAllocation() &&
+        !variable->getAllocatedType()->isArrayTy()) {
+      Type *type = variable->getAllocatedType();
+      AllocaInst *copy = builder.CreateAlloca(type, nullptr, live->getName());
+      builder.CreateStore(builder.CreateLoad(type, value), copy);
+      value = copy;
+    }
+    if (isa<Argument>(live))
+      map[live] = value;
+    else
+      transferred.emplace_back(cast<Instruction>(live), value);
+  }
+
+  SmallVector<ReturnInst *, 8> returns;
+  CloneFunctionInto(entry, function, map,
+                    CloneFunctionChangeType::LocalChangesOnly, returns);
+  entry->setCallingConv(CallingConv::C);
+  // The entry reads the OSR buffer, whatever the function does.
+  entry->setAttributes(AttributeList::get(
+      context, function->getAttributes().getFnAttrs(),
+      function->getAttributes().getRetAttrs(), {}));
+  entry->removeFnAttr(Attribute::Memory);
+  entry->removeFnAttr(Attribute::WillReturn);
+
+  // The entry jumps to the loop header, so the loop stays reducible; the
+  // header's phis take the values they had in tier 0.  Everything before
+  // the loop is now unreachable, so the transferred values replace the ones
+  // computed there.
+  auto *header = cast<BasicBlock>(map.lookup(point.header));
+  builder.CreateBr(header);
+  for (PHINode &phi : header->phis())
+    phi.addIncoming(UndefValue::get(phi.getType()), transfer);
+  for (auto &[live, value] : transferred) {
+    auto *original = cast<Instruction>(map.lookup(live));
+    if (original->getParent() == header) {
+      cast<PHINode>(original)->setIncomingValueForBlock(transfer, value);
+      continue;
+    }
+    SSAUpdater updater;
+    updater.Initialize(original->getType(), original->getName());
+    updater.AddAvailableValue(original->getParent(), original);
+    updater.AddAvailableValue(transfer, value);
+    for (Use &use : make_early_inc_range(original->uses())) {
+      auto *user = cast<Instruction>(use.getUser());
+      if (user->getParent() != original->getParent() || isa<PHINode>(user))
+        updater.RewriteUse(use);
+    }
+  }
+  EliminateUnreachableBlocks(*entry);
+  return entry;
+}
+
+// Turn a copy of the unoptimized module into one that only defines the
+// given function, linked against the tier 0 code.
+void PrepareOptimizedModule(Module *module, Function *root) {
+  // Keep the bodies of the functions it calls, directly or not, for
+  // inlining.  Calls that aren't inlined go to their stubs.
+  SmallPtrSet<Function *, 16> callees;
+  SmallVector<Function *, 16> worklist = {root};
+  while (!worklist.empty()) {
+    for (Instruction &instruction : instructions(worklist.pop_back_val())) {
+      auto *call = dyn_cast<CallBase>(&instruction);
+      Function *callee = call ? call->getCalledFunction() : nullptr;
+      if (callee && !callee->isDeclaration() && callees.insert(callee).second)
+        worklist.push_back(callee);
+    }
+  }
+  for (Function &other : *module) {
+    if (&other == root || other.isDeclaration())
+      continue;
+    if (callees.count(&other))
+      other.setLinkage(GlobalValue::AvailableExternallyLinkage);
+    else
+      other.deleteBody();
+  }
+
+  // The program's state lives in the tier 0 code; constructors already ran.
+  if (GlobalVariable *constructors =
+          module->getNamedGlobal("llvm.global_ctors"))
+    constructors->eraseFromParent();
+  for (GlobalVariable &global : module->globals()) {
+    if (!global.isConstant() && global.hasInitializer()) {
+      global.setInitializer(nullptr);
+      global.setLinkage(GlobalValue::ExternalLinkage);
+    }
+  }
+}
+
+} // namespace
+
+Expected<std::unique_ptr<IRCompileLayer::IRCompiler>>
+CreateTieredCompiler(JITTargetMachineBuilder machineBuilder) {
+  machineBuilder.setCodeGenOptLevel(CodeGenOpt::None);
+  Expected<std::unique_ptr<TargetMachine>> quick =
+      machineBuilder.createTargetMachine();
+  if (!quick)
+    return quick.takeError();
+  machineBuilder.setCodeGenOptLevel(CodeGenOpt::Aggressive);
+  Expected<std::unique_ptr<TargetMachine>> optimized =
+      machineBuilder.createTargetMachine();
+  if (!optimized)
+    return optimized.takeError();
+  return std::make_unique<TieredCompiler>(machineBuilder.getOptions(),
+                                          std::move(*quick),
+                                          std::move(*optimized));
+}
+
+std::string Tiering::Unit::getName() const {
+  if (loop < 0)
+    return GetTierName(function, 2);
+  return function + "$osr" + std::to_string(loop);
+}
+
+std::string Tiering::Unit::getPointerName() const {
+  return getName() + "$code";
+}
+
+Tiering::Tiering(LLJIT *jit, std::unique_ptr<TargetMachine> optimizer)
+    : m_jit(jit), m_optimizer(std::move(optimizer)),
+      m_context(std::make_unique<LLVMContext>()) {}
+
+Tiering::~Tiering() { Stop(); }
+
+Expected<std::unique_ptr<Tiering>>
+Tiering::Create(LLJIT *jit, Module *module, const JitOptions &options,
+                JITTargetMachineBuilder machineBuilder) {
+  Expected<std::unique_ptr<TargetMachine>> optimizer =
+      machineBuilder.createTargetMachine();
+  if (!optimizer)
+    return optimizer.takeError();
+  std::unique_ptr<Tiering> tiering(new Tiering(jit, std::move(*optimizer)));
+
+  void (*callback)(void *, unsigned) = &TierUpCallback;
+  if (Error error = jit->getMainJITDylib().define(absoluteSymbols(
+          {{jit->mangleAndIntern("__moj_tier_up"),
+            {ExecutorAddr::fromPtr(callback), JITSymbolFlags::Exported}}})))
+    return std::move(error);
+
+  // Optimized code is linked against the tier 0 code, so everything it may
+  // refer to has to be a symbol of the JIT.  Constants are simply copied.
+  for (Function &function : *module) {
+    if (!function.isDeclaration() && function.hasLocalLinkage())
+      function.setLinkage(GlobalValue::ExternalLinkage);
+  }
+  for (GlobalVariable &global : module->globals()) {
+    if (global.isConstant() || !global.hasLocalLinkage())
+      continue;
+    if (!global.hasName())
+      global.setName("global");
+    global.setLinkage(GlobalValue::ExternalLinkage);
+  }
+  raw_svector_ostream bitcode(tiering->m_bitcode);
+  WriteBitcodeToFile(*module, bitcode);
+
+  std::vector<Function *> functions;
+  for (Function &function : *module) {
+    if (!function.isDeclaration() && !function.getName().startswith("__moj_"))
+      functions.push_back(&function);
+  }
+
+  LLVMContext &context = module->getContext();
+  Type *pointerType = PointerType::getUnqual(Type::getInt8Ty(context));
+  Function *tierUp = Function::Create(
+      FunctionType::get(Type::getVoidTy(context),
+                        {pointerType, Type::getInt32Ty(context)}, false),
+      GlobalValue::ExternalLinkage, "__moj_tier_up", module);
+  Constant *self = ConstantExpr::getIntToPtr(
+      ConstantInt::get(Type::getInt64Ty(context),
+                       reinterpret_cast<uintptr_t>(tiering.get())),
+      pointerType);
+  std::vector<Unit> &units = tiering->m_units;
+  for (Function *function : functions) {
+    std::string name = function->getName().str();
+
+    // Loops are instrumented first, while the function still looks like
+    // the copy that its OSR entries are compiled from.
+    std::vector<OsrPoint> points;
+    if (options.osrThreshold > 0)
+      points = FindOsrPoints(*function);
+    if (!points.empty()) {
+      size_t numSlots = 1;
+      for (const OsrPoint &point : points)
+        numSlots = std::max(numSlots, point.liveValues.size());
+      IRBuilder<> builder(&function->getEntryBlock(),
+                          function->getEntryBlock().begin());
+      AllocaInst *buffer = builder.CreateAlloca(
+          ArrayType::get(builder.getInt64Ty(), numSlots), nullptr,
+          "osr.buffer");
+      for (const OsrPoint &point : points) {
+        units.push_back({name, static_cast<int>(point.blockIndex)});
+        AddOsrExit(function, point, units.back().getPointerName(), buffer,
+                   units.size() - 1, options.osrThreshold, tierUp, self);
+      }
+    }
+
+    // main is only entered once, so only its loops move up.
+    if (name != "main") {
+      units.push_back({name});
+      AddCallStub(function, GetTierName(name, 0),
+                  units.back().getPointerName());
+      AddCallCounter(function, units.size() - 1, options.tierUpThreshold,
+                     tierUp, self);
+    }
+  }
+  tiering->m_requested.resize(units.size());
+  return std::move(tiering);
+}
+
+Error Tiering::Start() {
+  static_assert(sizeof(std::atomic<void *>) == sizeof(void *),
+                "tier 0 code loads the code pointers as plain pointers");
+  for (Unit &unit : m_units) {
+    Expected<ExecutorAddr> pointer = m_jit->lookup(unit.getPointerName());
+    if (!pointer)
+      return pointer.takeError();
+    unit.code = pointer->toPtr<std::atomic<void *> *>();
+  }
+  m_thread = std::thread([this] { Run(); });
+  return Error::success();
+}
+
+void Tiering::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_wakeUp.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void Tiering::RequestTierUp(unsigned index) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_requested[index])
+      return;
+    m_requested[index] = true;
+    m_queue.push_back(index);
+  }
+  m_wakeUp.notify_one();
+}
+
+void Tiering::Run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_wakeUp.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+    if (m_stopping)
+      return;
+    unsigned index = m_queue.front();
+    m_queue.pop_front();
+    lock.unlock();
+    // Code that fails to compile keeps running at tier 0.
+    if (Error error = Recompile(index))
+      errs() << "JIT error: " << toString(std::move(error)) << "\n";
+    lock.lock();
+  }
+}
+
+Error Tiering::Recompile(unsigned index) {
+  if (!m_source) {
+    Expected<std::unique_ptr<Module>> source = parseBitcodeFile(
+        MemoryBufferRef(StringRef(m_bitcode.data(), m_bitcode.size()),
+                        "tier2"),
+        *m_context.getContext());
+    if (!source)
+      return source.takeError();
+    m_source = std::move(*source);
+  }
+
+  const Unit &unit = m_units[index];
+  std::unique_ptr<Module> module = CloneModule(*m_source);
+  module->setModuleIdentifier(kOptimizedTierPrefix + unit.getName());
+  Function *function = module->getFunction(unit.function);
+  Function *root = nullptr;
+  if (unit.loop < 0) {
+    root = function;
+    root->setName(unit.getName());
+  } else {
+    for (const OsrPoint &point : FindOsrPoints(*function)) {
+      if (point.blockIndex == static_cast<unsigned>(unit.loop))
+        root = CreateOsrEntry(function, point, unit.getName());
+    }
+  }
+  if (!root)
+    return createStringError(inconvertibleErrorCode(),
+                             "no loop header to enter " + unit.getName());
+  PrepareOptimizedModule(module.get(), root);
+
+  Optimize(module.get(), 3, m_optimizer.get());
+  if (Error error = m_jit->addIRModule(
+          ThreadSafeModule(std::move(module), m_context)))
+    return error;
+  Expected<ExecutorAddr> code = m_jit->lookup(unit.getName());
+  if (!code)
+    return code.takeError();
+  unit.code->store(code->toPtr<void *>(), std::memory_order_release);
+  return Error::success();
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "Jit.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llvm {
+class Module;
+class TargetMachine;
+namespace orc {
+class LLJIT;
+} // namespace orc
+} // namespace llvm
+
+// Tiered compilation for the JIT.  The whole program is first compiled
+// without optimization (tier 0), which is quick, and every function is
+// called through a stub that jumps to its current code.  Tier 0 code counts
+// the calls of each function; when a function reaches the threshold, a
+// background thread recompiles it at -O3 (tier 2) from the unoptimized IR
+// and points its stub at the new code.  The functions it calls may be
+// inlined into the optimized version; the other calls still go through
+// their stubs, so they reach whichever tier is current.
+//
+// A function that spends its time in one long call, like main, gets there
+// by on-stack replacement (OSR) instead.  Tier 0 code also counts the
+// iterations of each loop; past the threshold, the function is recompiled
+// with its loop header as the entry, taking the values that are live there
+// from a buffer.  When that version is ready, the next iteration stores the
+// live values and calls it, and it runs the rest of the function.  Local
+// arrays stay in the tier 0 frame; scalars are copied so that they can live
+// in registers.
+
+// Compiles modules of the optimized tier at -O3 and all others at -O0,
+// which selects FastISel.
+llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>>
+CreateTieredCompiler(llvm::orc::JITTargetMachineBuilder machineBuilder);
+
+class Tiering {
+public:
+  // Prepare the module for tier 0, keeping a copy of its IR to recompile
+  // from.  The JIT has to use the tiered compiler, and the module has to be
+  // added to it before Start.  The optimized tier is tuned for the machine.
+  static llvm::Expected<std::unique_ptr<Tiering>>
+  Create(llvm::orc::LLJIT *jit, llvm::Module *module, const JitOptions &options,
+         llvm::orc::JITTargetMachineBuilder machineBuilder);
+
+  ~Tiering();
+
+  // Find the stubs and start recompiling the functions that get hot.
+  llvm::Error Start();
+
+  // Finish the recompilation in progress and stop the background thread.
+  void Stop();
+
+  // Queue a unit for recompilation, unless it already was.  Called by tier 0
+  // code.
+  void RequestTierUp(unsigned index);
+
+private:
+  // What gets recompiled: a whole function, or its entry at a loop header.
+  struct Unit {
+    std::string function;
+    // Index of the loop header among the blocks of the function, or -1.
+    int loop = -1;
+    // Where tier 0 code finds the optimized code, null until it's ready.
+    std::atomic<void *> *code = nullptr;
+
+    // Name of the optimized code, and of the pointer to it.
+    std::string getName() const;
+    std::string getPointerName() const;
+  };
+
+  Tiering(llvm::orc::LLJIT *jit,
+          std::unique_ptr<llvm::TargetMachine> optimizer);
+
+  void Run();
+
+  llvm::Error Recompile(unsigned index);
+
+  llvm::orc::LLJIT *m_jit;
+  std::unique_ptr<llvm::TargetMachine> m_optimizer;
+
+  // The unoptimized program, as bitcode.  The background thread reads it
+  // into its own context the first time it recompiles a function.
+  llvm::SmallVector<char, 0> m_bitcode;
+  llvm::orc::ThreadSafeContext m_context;
+  std::unique_ptr<llvm::Module> m_source;
+
+  std::vector<Unit> m_units;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wakeUp;
+  std::deque<unsigned> m_queue;
+  std::vector<bool> m_requested;
+  bool m_stopping = false;
+  std::thread m_thread;
+};
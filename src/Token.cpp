@@ -16,6 +16,8 @@ std::string Token::ToString() const {
 
   case kTokenId:
     return getId();
+  case kTokenStrLit:
+    return '"' + getString() + '"';
   case kTokenFloat:
     return "float";
   case kTokenBool:
@@ -38,6 +40,8 @@ std::string Token::ToString() const {
     return "operator";
   case kTokenFor:
     return "for";
+  case kTokenImport:
+    return "import";
   case kTokenPlus:
     return "+";
   case kTokenMinus:
@@ -24,6 +24,7 @@ enum TokenType {
   kTokenWhile,
   kTokenFor,
   kTokenOperator,
+  kTokenImport,
 
   kTokenPlus,
   kTokenMinus,
@@ -69,8 +70,15 @@ public:
 
   Token(TokenType tag, int line, int column)
       : m_type(tag), m_int(0), m_float(0), line(line), column(column) {
-    assert(tag != kTokenIntNum && tag != kTokenId &&
-           "Value required for integer and id tokens");
+    assert(tag != kTokenIntNum && tag != kTokenId && tag != kTokenStrLit &&
+           "Value required for integer, id and string tokens");
+  }
+
+  // A string literal, without its quotes.
+  Token(TokenType tag, std::string text, int line, int column)
+      : m_type(tag), m_int(0), m_float(0), line(line), column(column),
+        m_id(std::move(text)) {
+    assert(tag == kTokenStrLit && "Expected string literal");
   }
 
   TokenType getType() const { return m_type; }
@@ -91,6 +99,11 @@ public:
     return m_id;
   }
 
+  const std::string &getString() const {
+    assert(getType() == kTokenStrLit && "Expected string literal");
+    return m_id;
+  }
+
   std::string ToString() const;
 
   bool operator==(const TokenType &other) const {
@@ -158,6 +171,8 @@ public:
       return "operator";
     case kTokenFor:
       return "for";
+    case kTokenImport:
+      return "import";
     case kTokenPlus:
       return "+";
     case kTokenMinus:
@@ -206,6 +221,8 @@ public:
       return ";";
     case kTokenId:
       return "IDENTIFIER";
+    case kTokenStrLit:
+      return "STRING";
     case kTokenFPNum:
       return "FLOAT";
     case kTokenIntNum:
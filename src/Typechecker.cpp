@@ -343,14 +343,14 @@ void checkFunction(FuncDef *funcDef, FuncTable *funcTable) {
 
 // Typecheck a program, returning zero for success.  If a TypeError exception
 // is caught, an error message is reported and a non-zero value is returned.
-int Typecheck(Program &program) {
+int Typecheck(Program &program, std::ostream &errors) {
   FuncTable funcTable;
 
   for (const FuncDefPtr &funcDef : program.GetFunctions()) {
     try {
       checkFunction(funcDef.get(), &funcTable);
     } catch (const TypeError &e) {
-      std::cerr << "Typechecker Error: " << e.what() << std::endl;
+      errors << "Typechecker Error: " << e.what() << std::endl;
       return -1;
     }
   }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <iosfwd>
+
 class Program;
 
 
@@ -8,6 +10,7 @@ class Program;
 // Defines scoping rules
 // Gives each expression a type
 
-int Typecheck( Program& program );
+// Type errors are reported to the given stream.
+int Typecheck( Program& program, std::ostream& errors );
 
 
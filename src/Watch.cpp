@@ -0,0 +1,69 @@
+#include "Watch.h"
+
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+// Events of a save that come within this time of each other are handled
+// together.
+constexpr int kSettleMilliseconds = 20;
+
+// Read the pending events, returning true if one of them is about the file
+// with the given name.  Blocks until there is an event.
+bool readEvents(int fd, llvm::StringRef name, bool *failed) {
+  alignas(inotify_event) char buffer[4096];
+  ssize_t size = read(fd, buffer, sizeof(buffer));
+  if (size < 0) {
+    *failed = errno != EINTR;
+    return false;
+  }
+  bool matches = false;
+  for (ssize_t offset = 0; offset < size;) {
+    const auto *event =
+        reinterpret_cast<const inotify_event *>(buffer + offset);
+    if (event->len > 0 && name == event->name)
+      matches = true;
+    offset += sizeof(inotify_event) + event->len;
+  }
+  return matches;
+}
+
+} // namespace
+
+int WatchFile(const std::string &path, const std::function<void()> &changed) {
+  std::string directory = llvm::sys::path::parent_path(path).str();
+  if (directory.empty())
+    directory = ".";
+  llvm::StringRef name = llvm::sys::path::filename(path);
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, directory.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    llvm::errs() << "Error: can't watch " << path << ": "
+                 << std::strerror(errno) << "\n";
+    return 1;
+  }
+
+  changed();
+  bool failed = false;
+  while (!failed) {
+    if (!readEvents(fd, name, &failed))
+      continue;
+    // Wait for the rest of the save, e.g. the rename after a write.
+    pollfd pending = {fd, POLLIN, 0};
+    while (!failed && poll(&pending, 1, kSettleMilliseconds) > 0)
+      readEvents(fd, name, &failed);
+    changed();
+  }
+  llvm::errs() << "Error: can't watch " << path << ": " << std::strerror(errno)
+               << "\n";
+  close(fd);
+  return 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+// Call the function once, then again each time the file is saved, until the
+// process is stopped.  Saves are seen with inotify on the directory of the
+// file, so that editors that write a new file and rename it over the old
+// one are noticed as well.  The events of one save are handled together.
+// Returns non-zero, with an error message, if the file can't be watched.
+int WatchFile(const std::string &path, const std::function<void()> &changed);
@@ -0,0 +1,117 @@
+// mojc, the client of the compile server (moj --server, see src/Server.h).
+// It takes the same arguments as moj and runs them on the server whose
+// socket is named by $MOJ_SERVER, with its own working directory,
+// environment, stdin, stdout and stderr, and exits with the status of the
+// request.  It doesn't link LLVM, so that it starts quickly.
+#include "src/ServerProtocol.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+// Send the header with our standard streams.
+bool sendHeader(int connection, const RequestHeader &header) {
+  int fds[3] = {0, 1, 2};
+  union {
+    cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(fds))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  iovec data = {const_cast<RequestHeader *>(&header), sizeof(header)};
+  msghdr message = {};
+  message.msg_iov = &data;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t count;
+  do {
+    count = sendmsg(connection, &message, 0);
+  } while (count < 0 && errno == EINTR);
+  if (count < 0)
+    return false;
+  return WriteAll(connection, reinterpret_cast<const char *>(&header) + count,
+                  sizeof(header) - count);
+}
+
+void addString(std::string *strings, const char *value) {
+  strings->append(value);
+  strings->push_back('\0');
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *path = std::getenv("MOJ_SERVER");
+  if (path == nullptr || *path == '\0') {
+    std::fprintf(stderr, "mojc: Set MOJ_SERVER to the socket of a moj "
+                         "--server\n");
+    return 1;
+  }
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(address.sun_path)) {
+    std::fprintf(stderr, "mojc: Socket path is too long: %s\n", path);
+    return 1;
+  }
+  std::strcpy(address.sun_path, path);
+  int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0 ||
+      connect(connection, reinterpret_cast<sockaddr *>(&address),
+              sizeof(address)) != 0) {
+    std::fprintf(stderr, "mojc: Could not connect to %s: %s\n", path,
+                 std::strerror(errno));
+    return 1;
+  }
+
+  std::string strings;
+  char *directory = getcwd(nullptr, 0);
+  if (directory == nullptr) {
+    std::fprintf(stderr, "mojc: Could not get the working directory: %s\n",
+                 std::strerror(errno));
+    return 1;
+  }
+  addString(&strings, directory);
+  std::free(directory);
+  // The server's errors name moj, which is what runs the request.
+  addString(&strings, "moj");
+  for (int i = 1; i < argc; ++i)
+    addString(&strings, argv[i]);
+  uint32_t numEnvironment = 0;
+  for (char **variable = environ; *variable; ++variable, ++numEnvironment)
+    addString(&strings, *variable);
+
+  RequestHeader header;
+  header.magic = kRequestMagic;
+  header.size = strings.size();
+  header.numArguments = argc;
+  header.numEnvironment = numEnvironment;
+  if (strings.size() > kMaxRequestSize) {
+    std::fprintf(stderr, "mojc: The arguments and environment are too large\n");
+    return 1;
+  }
+  int32_t status;
+  if (!sendHeader(connection, header) ||
+      !WriteAll(connection, strings.data(), strings.size()) ||
+      !ReadAll(connection, reinterpret_cast<char *>(&status),
+               sizeof(status))) {
+    std::fprintf(stderr, "mojc: Lost the connection to %s\n", path);
+    return 1;
+  }
+  return status;
+}
@@ -0,0 +1,162 @@
+// session_stress, a stress test of libmoj's sessions (see src/Session.h).
+// It compiles, calls and frees programs from many threads at once, first
+// with a session per thread and then with one session that all the threads
+// share, and checks the results of the calls.  Some of the programs have
+// errors, which Compile has to report without affecting the other threads.
+//
+//   ./session_stress [<threads> [<programs per thread>]]
+//
+// It exits with status 1 if a result is wrong or an error goes unreported.
+#include "src/Session.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<int> numFailures(0);
+
+void fail(int thread, int index, const std::string &message) {
+  fprintf(stderr, "thread %d, program %d: %s\n", thread, index,
+          message.c_str());
+  ++numFailures;
+}
+
+// A program whose results depend on the given constant, so that each one
+// compiles to different code.
+std::string makeProgram(int constant) {
+  std::string k = std::to_string(constant);
+  return "int square(int x) { return x * x + " + k + "; }\n"
+         "bool above(int x) { return x > " + k + "; }\n"
+         "float scale(float x) { return x * 2.0 + " + k + ".0; }\n"
+         "int sum(int n) {\n"
+         "  int s = 0;\n"
+         "  for (int i = 0; i < n; i = i + 1) {\n"
+         "    s = s + square(i);\n"
+         "  }\n"
+         "  return s;\n"
+         "}\n";
+}
+
+// Compile a program in the session and check its functions.
+void compileAndCall(Session &session, int thread, int index) {
+  int constant = thread * 1000 + index;
+  std::ostringstream errors;
+  std::unique_ptr<CompiledProgram> program =
+      session.Compile(makeProgram(constant), errors);
+  if (!program) {
+    fail(thread, index, "compile failed: " + errors.str());
+    return;
+  }
+
+  int (*square)(int) = program->Lookup<int(int)>("square");
+  bool (*above)(int) = program->Lookup<bool(int)>("above");
+  float (*scale)(float) = program->Lookup<float(float)>("scale");
+  int (*sum)(int) = program->Lookup<int(int)>("sum");
+  if (!square || !above || !scale || !sum) {
+    fail(thread, index, "lookup failed");
+    return;
+  }
+  if (program->Lookup<int(float)>("square"))
+    fail(thread, index, "found square with the wrong signature");
+
+  if (square(7) != 49 + constant)
+    fail(thread, index, "wrong result of square");
+  // Values around the constant, so that both results come up, and the upper
+  // bits of the registers that hold the bools are checked.
+  if (!above(constant + 1) || above(constant) || above(constant - 1))
+    fail(thread, index, "wrong result of above");
+  if (scale(1.5f) != 3.0f + constant)
+    fail(thread, index, "wrong result of scale");
+  int expected = 0;
+  for (int i = 0; i < 10; i++)
+    expected += i * i + constant;
+  if (sum(10) != expected)
+    fail(thread, index, "wrong result of sum");
+}
+
+// Compile a program with a type error, which Compile has to report.
+void compileError(Session &session, int thread, int index) {
+  std::ostringstream errors;
+  std::unique_ptr<CompiledProgram> program =
+      session.Compile("int broken(int x) { return x + undefined; }", errors);
+  if (program)
+    fail(thread, index, "a program with errors compiled");
+  else if (errors.str().empty())
+    fail(thread, index, "no errors reported");
+}
+
+void runThread(Session &session, int thread, int numPrograms) {
+  for (int index = 0; index < numPrograms; index++) {
+    if (index % 4 == 3)
+      compileError(session, thread, index);
+    else
+      compileAndCall(session, thread, index);
+  }
+}
+
+// Run the threads, each with its own session or all with the same one.
+bool run(int numThreads, int numPrograms, bool shared) {
+  SessionOptions options;
+  std::unique_ptr<Session> sharedSession;
+  if (shared) {
+    sharedSession = Session::Create(options, std::cerr);
+    if (!sharedSession)
+      return false;
+  }
+
+  std::vector<std::thread> threads;
+  for (int thread = 0; thread < numThreads; thread++) {
+    threads.emplace_back([&, thread] {
+      if (shared) {
+        runThread(*sharedSession, thread, numPrograms);
+        return;
+      }
+      std::unique_ptr<Session> session = Session::Create(options, std::cerr);
+      if (!session) {
+        fail(thread, -1, "can't create a session");
+        return;
+      }
+      runThread(*session, thread, numPrograms);
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  int numThreads = argc > 1 ? atoi(argv[1]) : 8;
+  int numPrograms = argc > 2 ? atoi(argv[2]) : 16;
+  if (numThreads <= 0 || numPrograms <= 0) {
+    fprintf(stderr, "usage: %s [<threads> [<programs per thread>]]\n",
+            argv[0]);
+    return 2;
+  }
+
+  for (bool shared : {false, true}) {
+    if (!run(numThreads, numPrograms, shared)) {
+      fprintf(stderr, "can't create a session\n");
+      return 1;
+    }
+    printf("%s: %d threads, %d programs each\n",
+           shared ? "shared session" : "separate sessions", numThreads,
+           numPrograms);
+  }
+
+  if (numFailures > 0) {
+    fprintf(stderr, "%d failures\n", numFailures.load());
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}